@@ -21,10 +21,13 @@ struct ifnet;
 struct pl_node;
 struct json_writer;
 struct pl_feature_registration;
+struct npf_cache;
 
 #define PL_NODE_INPUT_MAX 16
 #define PL_NODE_COLL_MAX 128
 #define PL_NODE_STORE_MAX 4
+/* Maximum number of packets processed together in vector mode */
+#define PL_VECTOR_MAX 32
 
 enum pl_mode {
 	/*
@@ -60,6 +63,8 @@ typedef void
 enum validation_flags {
 	NEEDS_EMPTY     = 0x0,
 	NEEDS_SLOWPATH  = 0x1,
+	/* nxt already looked up by a vector-mode prepare hook */
+	NXT_RESOLVED    = 0x2,
 };
 
 struct pl_packet {
@@ -77,6 +82,8 @@ struct pl_packet {
 	uint16_t              npf_flags;
 	uint16_t              l2_proto;
 	int                   max_data_used;
+	/* npf cache of this packet in vector mode */
+	struct npf_cache     *npc;
 	void                 *data[PL_NODE_STORE_MAX];
 } __rte_cache_aligned;
 
@@ -89,6 +96,14 @@ enum pl_node_feat_action {
 typedef unsigned int
 (pl_proc) (struct pl_packet *p);
 
+/*
+ * Optional vector-mode hook, run over a whole vector of packets
+ * before the node's handler is invoked on each of them. Allows work
+ * such as table lookups to be batched across the vector.
+ */
+typedef void
+(pl_vec_prepare) (struct pl_packet **pkts, unsigned int count);
+
 /* node initialization function */
 typedef void
 (pl_init_node) (const struct pl_node *);
@@ -135,6 +150,7 @@ struct pl_node_registration {
 	const char        *name;
 	pl_init_node      *init;
 	pl_proc           *handler;
+	pl_vec_prepare    *vec_prepare;
 	pl_node_feat_change *feat_change;
 	pl_node_feat_iterate *feat_iterate;
 	pl_node_lookup_by_name_fn *lookup_by_name;
@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Classic BPF JIT for x86-64.
+ *
+ * Register use in the generated code:
+ *
+ *	eax  = A
+ *	ecx  = X (so that shifts by X can use cl)
+ *	rdi  = packet
+ *	r10d = buflen (edx is needed for division)
+ *	r11d = wirelen
+ *	r8   = scratch
+ *
+ * The scratch memory store lives in the red zone below rsp, as the
+ * generated function is a leaf.  Out of bounds loads and division by zero
+ * return 0, as in bpf_filter().
+ */
+
+#include <errno.h>
+#include <rte_common.h>
+#include <rte_log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bpf_jit.h"
+#include "compiler.h"
+#include "vplane_log.h"
+
+struct bpf_jit {
+	bpf_jit_fn_t	bj_fn;
+	size_t		bj_map_size;
+};
+
+#ifdef RTE_ARCH_X86_64
+
+/* Largest packet offset handled; keeps offsets within a disp32 */
+#define BPF_JIT_MAX_K	0x7ffffff0u
+
+/* Offset of mem[0] from rsp, within the red zone */
+#define BPF_JIT_MEM(k)	\
+	((uint8_t)(-(int)(BPF_MEMWORDS * 4) + (int)(k) * 4))
+
+/* x86 condition codes, as used with 0x0f 0x80+cc */
+enum bpf_jit_cc {
+	CC_B	= 0x2,
+	CC_AE	= 0x3,
+	CC_E	= 0x4,
+	CC_NE	= 0x5,
+	CC_A	= 0x7,
+};
+
+/* Branch targets that are not BPF instructions */
+#define BPF_JIT_RET0	UINT32_MAX
+
+struct bpf_jit_fixup {
+	uint32_t	f_pos;		/* offset of the rel32 */
+	uint32_t	f_target;	/* BPF instruction, or BPF_JIT_RET0 */
+};
+
+struct bpf_jit_ctx {
+	uint8_t			*c_code;
+	size_t			c_len;
+	size_t			c_cap;
+	uint32_t		*c_map;		/* insn index -> code offset */
+	struct bpf_jit_fixup	*c_fix;
+	uint			c_nfix;
+	uint			c_fix_cap;
+	bool			c_nomem;
+};
+
+static void
+bpf_jit_emit(struct bpf_jit_ctx *ctx, const void *p, size_t len)
+{
+	if (ctx->c_nomem)
+		return;
+
+	if (ctx->c_len + len > ctx->c_cap) {
+		size_t cap = ctx->c_cap ? ctx->c_cap * 2 : 512;
+		uint8_t *code;
+
+		while (cap < ctx->c_len + len)
+			cap *= 2;
+		code = realloc(ctx->c_code, cap);
+		if (!code) {
+			ctx->c_nomem = true;
+			return;
+		}
+		ctx->c_code = code;
+		ctx->c_cap = cap;
+	}
+	memcpy(ctx->c_code + ctx->c_len, p, len);
+	ctx->c_len += len;
+}
+
+#define EMIT(ctx, ...)						\
+	do {							\
+		const uint8_t _b[] = { __VA_ARGS__ };		\
+		bpf_jit_emit(ctx, _b, sizeof(_b));		\
+	} while (0)
+
+static void
+bpf_jit_emit32(struct bpf_jit_ctx *ctx, uint32_t v)
+{
+	bpf_jit_emit(ctx, &v, sizeof(v));
+}
+
+static void
+bpf_jit_rel32(struct bpf_jit_ctx *ctx, uint32_t target)
+{
+	if (ctx->c_nfix == ctx->c_fix_cap) {
+		uint cap = ctx->c_fix_cap ? ctx->c_fix_cap * 2 : 32;
+		struct bpf_jit_fixup *fix;
+
+		fix = realloc(ctx->c_fix, cap * sizeof(*fix));
+		if (!fix) {
+			ctx->c_nomem = true;
+			return;
+		}
+		ctx->c_fix = fix;
+		ctx->c_fix_cap = cap;
+	}
+	ctx->c_fix[ctx->c_nfix].f_pos = ctx->c_len;
+	ctx->c_fix[ctx->c_nfix].f_target = target;
+	ctx->c_nfix++;
+	bpf_jit_emit32(ctx, 0);
+}
+
+/* jmp target */
+static void
+bpf_jit_jmp(struct bpf_jit_ctx *ctx, uint32_t target)
+{
+	EMIT(ctx, 0xe9);
+	bpf_jit_rel32(ctx, target);
+}
+
+/* j<cc> target */
+static void
+bpf_jit_jcc(struct bpf_jit_ctx *ctx, enum bpf_jit_cc cc, uint32_t target)
+{
+	EMIT(ctx, 0x0f, 0x80 + cc);
+	bpf_jit_rel32(ctx, target);
+}
+
+/* Return 0 unless buflen >= end, where end is a constant */
+static void
+bpf_jit_check_abs(struct bpf_jit_ctx *ctx, uint32_t end)
+{
+	EMIT(ctx, 0x41, 0x81, 0xfa);		/* cmp r10d, end */
+	bpf_jit_emit32(ctx, end);
+	bpf_jit_jcc(ctx, CC_B, BPF_JIT_RET0);
+}
+
+/* Return 0 unless buflen >= X + end, computed in 64 bits */
+static void
+bpf_jit_check_ind(struct bpf_jit_ctx *ctx, uint32_t end)
+{
+	EMIT(ctx, 0x4c, 0x8d, 0x81);		/* lea r8, [rcx + end] */
+	bpf_jit_emit32(ctx, end);
+	EMIT(ctx, 0x4d, 0x39, 0xd0);		/* cmp r8, r10 */
+	bpf_jit_jcc(ctx, CC_A, BPF_JIT_RET0);
+}
+
+/* Conditional jump, with jt/jf relative to the next instruction */
+static void
+bpf_jit_cond(struct bpf_jit_ctx *ctx, enum bpf_jit_cc cc, uint32_t next,
+	     const struct bpf_insn *insn)
+{
+	if (insn->jt == insn->jf) {
+		if (insn->jt)
+			bpf_jit_jmp(ctx, next + insn->jt);
+		return;
+	}
+	bpf_jit_jcc(ctx, cc, next + insn->jt);
+	if (insn->jf)
+		bpf_jit_jmp(ctx, next + insn->jf);
+}
+
+static bool
+bpf_jit_uses_mem(const struct bpf_insn *insns, u_int len, uint32_t k)
+{
+	u_int i;
+
+	for (i = 0; i < len; i++)
+		if ((insns[i].code == (BPF_LD | BPF_MEM) ||
+		     insns[i].code == (BPF_LDX | BPF_MEM)) && insns[i].k == k)
+			return true;
+	return false;
+}
+
+static int
+bpf_jit_translate(struct bpf_jit_ctx *ctx, const struct bpf_insn *insns,
+		  u_int len)
+{
+	uint32_t ret0;
+	u_int i;
+
+	ctx->c_map = malloc(len * sizeof(*ctx->c_map));
+	if (!ctx->c_map)
+		return -ENOMEM;
+
+	EMIT(ctx, 0x41, 0x89, 0xd2);		/* mov r10d, edx */
+	EMIT(ctx, 0x41, 0x89, 0xf3);		/* mov r11d, esi */
+	EMIT(ctx, 0x31, 0xc0);			/* xor eax, eax */
+	EMIT(ctx, 0x31, 0xc9);			/* xor ecx, ecx */
+
+	/* Zero the words that are loaded, as bpf_filter() zeroes mem[] */
+	for (i = 0; i < BPF_MEMWORDS; i++) {
+		if (!bpf_jit_uses_mem(insns, len, i))
+			continue;
+		EMIT(ctx, 0xc7, 0x44, 0x24, BPF_JIT_MEM(i));
+		bpf_jit_emit32(ctx, 0);		/* mov [rsp+m], 0 */
+	}
+
+	for (i = 0; i < len; i++) {
+		const struct bpf_insn *insn = &insns[i];
+		uint32_t k = insn->k;
+		uint32_t next = i + 1;
+
+		ctx->c_map[i] = ctx->c_len;
+
+		/* Jumps are forward and within the program */
+		if (BPF_CLASS(insn->code) == BPF_JMP) {
+			uint32_t off = insn->code == (BPF_JMP | BPF_JA) ?
+				k : RTE_MAX(insn->jt, insn->jf);
+
+			if (off >= len - next)
+				return -EINVAL;
+		}
+
+		switch (insn->code) {
+		case BPF_RET | BPF_K:
+			EMIT(ctx, 0xb8);		/* mov eax, k */
+			bpf_jit_emit32(ctx, k);
+			EMIT(ctx, 0xc3);		/* ret */
+			break;
+		case BPF_RET | BPF_A:
+			EMIT(ctx, 0xc3);		/* ret */
+			break;
+
+		case BPF_LD | BPF_W | BPF_ABS:
+			if (k > BPF_JIT_MAX_K)
+				return -ENOTSUP;
+			bpf_jit_check_abs(ctx, k + 4);
+			EMIT(ctx, 0x8b, 0x87);		/* mov eax, [rdi+k] */
+			bpf_jit_emit32(ctx, k);
+			EMIT(ctx, 0x0f, 0xc8);		/* bswap eax */
+			break;
+		case BPF_LD | BPF_H | BPF_ABS:
+			if (k > BPF_JIT_MAX_K)
+				return -ENOTSUP;
+			bpf_jit_check_abs(ctx, k + 2);
+			EMIT(ctx, 0x0f, 0xb7, 0x87);	/* movzx eax, [rdi+k] */
+			bpf_jit_emit32(ctx, k);
+			EMIT(ctx, 0x66, 0xc1, 0xc0, 8);	/* rol ax, 8 */
+			break;
+		case BPF_LD | BPF_B | BPF_ABS:
+			if (k > BPF_JIT_MAX_K)
+				return -ENOTSUP;
+			bpf_jit_check_abs(ctx, k + 1);
+			EMIT(ctx, 0x0f, 0xb6, 0x87);	/* movzx eax, [rdi+k] */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_LD | BPF_W | BPF_IND:
+			if (k > BPF_JIT_MAX_K)
+				return -ENOTSUP;
+			bpf_jit_check_ind(ctx, k + 4);
+			/* mov eax, [rdi+rcx+k] */
+			EMIT(ctx, 0x8b, 0x84, 0x0f);
+			bpf_jit_emit32(ctx, k);
+			EMIT(ctx, 0x0f, 0xc8);		/* bswap eax */
+			break;
+		case BPF_LD | BPF_H | BPF_IND:
+			if (k > BPF_JIT_MAX_K)
+				return -ENOTSUP;
+			bpf_jit_check_ind(ctx, k + 2);
+			/* movzx eax, word [rdi+rcx+k] */
+			EMIT(ctx, 0x0f, 0xb7, 0x84, 0x0f);
+			bpf_jit_emit32(ctx, k);
+			EMIT(ctx, 0x66, 0xc1, 0xc0, 8);	/* rol ax, 8 */
+			break;
+		case BPF_LD | BPF_B | BPF_IND:
+			if (k > BPF_JIT_MAX_K)
+				return -ENOTSUP;
+			bpf_jit_check_ind(ctx, k + 1);
+			/* movzx eax, byte [rdi+rcx+k] */
+			EMIT(ctx, 0x0f, 0xb6, 0x84, 0x0f);
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_LDX | BPF_MSH | BPF_B:
+			if (k > BPF_JIT_MAX_K)
+				return -ENOTSUP;
+			bpf_jit_check_abs(ctx, k + 1);
+			EMIT(ctx, 0x0f, 0xb6, 0x8f);	/* movzx ecx, [rdi+k] */
+			bpf_jit_emit32(ctx, k);
+			EMIT(ctx, 0x83, 0xe1, 0x0f);	/* and ecx, 0xf */
+			EMIT(ctx, 0xc1, 0xe1, 2);	/* shl ecx, 2 */
+			break;
+		case BPF_LD | BPF_W | BPF_LEN:
+			EMIT(ctx, 0x44, 0x89, 0xd8);	/* mov eax, r11d */
+			break;
+		case BPF_LDX | BPF_W | BPF_LEN:
+			EMIT(ctx, 0x44, 0x89, 0xd9);	/* mov ecx, r11d */
+			break;
+		case BPF_LD | BPF_IMM:
+			EMIT(ctx, 0xb8);		/* mov eax, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_LDX | BPF_IMM:
+			EMIT(ctx, 0xb9);		/* mov ecx, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_LD | BPF_MEM:
+			if (k >= BPF_MEMWORDS)
+				return -EINVAL;
+			/* mov eax, [rsp+m] */
+			EMIT(ctx, 0x8b, 0x44, 0x24, BPF_JIT_MEM(k));
+			break;
+		case BPF_LDX | BPF_MEM:
+			if (k >= BPF_MEMWORDS)
+				return -EINVAL;
+			/* mov ecx, [rsp+m] */
+			EMIT(ctx, 0x8b, 0x4c, 0x24, BPF_JIT_MEM(k));
+			break;
+		case BPF_ST:
+			if (k >= BPF_MEMWORDS)
+				return -EINVAL;
+			/* mov [rsp+m], eax */
+			EMIT(ctx, 0x89, 0x44, 0x24, BPF_JIT_MEM(k));
+			break;
+		case BPF_STX:
+			if (k >= BPF_MEMWORDS)
+				return -EINVAL;
+			/* mov [rsp+m], ecx */
+			EMIT(ctx, 0x89, 0x4c, 0x24, BPF_JIT_MEM(k));
+			break;
+
+		case BPF_JMP | BPF_JA:
+			if (k)
+				bpf_jit_jmp(ctx, next + k);
+			break;
+		case BPF_JMP | BPF_JGT | BPF_K:
+			EMIT(ctx, 0x3d);		/* cmp eax, k */
+			bpf_jit_emit32(ctx, k);
+			bpf_jit_cond(ctx, CC_A, next, insn);
+			break;
+		case BPF_JMP | BPF_JGE | BPF_K:
+			EMIT(ctx, 0x3d);		/* cmp eax, k */
+			bpf_jit_emit32(ctx, k);
+			bpf_jit_cond(ctx, CC_AE, next, insn);
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+			EMIT(ctx, 0x3d);		/* cmp eax, k */
+			bpf_jit_emit32(ctx, k);
+			bpf_jit_cond(ctx, CC_E, next, insn);
+			break;
+		case BPF_JMP | BPF_JSET | BPF_K:
+			EMIT(ctx, 0xa9);		/* test eax, k */
+			bpf_jit_emit32(ctx, k);
+			bpf_jit_cond(ctx, CC_NE, next, insn);
+			break;
+		case BPF_JMP | BPF_JGT | BPF_X:
+			EMIT(ctx, 0x39, 0xc8);		/* cmp eax, ecx */
+			bpf_jit_cond(ctx, CC_A, next, insn);
+			break;
+		case BPF_JMP | BPF_JGE | BPF_X:
+			EMIT(ctx, 0x39, 0xc8);		/* cmp eax, ecx */
+			bpf_jit_cond(ctx, CC_AE, next, insn);
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_X:
+			EMIT(ctx, 0x39, 0xc8);		/* cmp eax, ecx */
+			bpf_jit_cond(ctx, CC_E, next, insn);
+			break;
+		case BPF_JMP | BPF_JSET | BPF_X:
+			EMIT(ctx, 0x85, 0xc8);		/* test eax, ecx */
+			bpf_jit_cond(ctx, CC_NE, next, insn);
+			break;
+
+		case BPF_ALU | BPF_ADD | BPF_X:
+			EMIT(ctx, 0x01, 0xc8);		/* add eax, ecx */
+			break;
+		case BPF_ALU | BPF_SUB | BPF_X:
+			EMIT(ctx, 0x29, 0xc8);		/* sub eax, ecx */
+			break;
+		case BPF_ALU | BPF_MUL | BPF_X:
+			EMIT(ctx, 0x0f, 0xaf, 0xc1);	/* imul eax, ecx */
+			break;
+		case BPF_ALU | BPF_DIV | BPF_X:
+		case BPF_ALU | BPF_MOD | BPF_X:
+			EMIT(ctx, 0x85, 0xc9);		/* test ecx, ecx */
+			bpf_jit_jcc(ctx, CC_E, BPF_JIT_RET0);
+			EMIT(ctx, 0x31, 0xd2);		/* xor edx, edx */
+			EMIT(ctx, 0xf7, 0xf1);		/* div ecx */
+			if (BPF_OP(insn->code) == BPF_MOD)
+				EMIT(ctx, 0x89, 0xd0);	/* mov eax, edx */
+			break;
+		case BPF_ALU | BPF_AND | BPF_X:
+			EMIT(ctx, 0x21, 0xc8);		/* and eax, ecx */
+			break;
+		case BPF_ALU | BPF_OR | BPF_X:
+			EMIT(ctx, 0x09, 0xc8);		/* or eax, ecx */
+			break;
+		case BPF_ALU | BPF_XOR | BPF_X:
+			EMIT(ctx, 0x31, 0xc8);		/* xor eax, ecx */
+			break;
+		case BPF_ALU | BPF_LSH | BPF_X:
+			EMIT(ctx, 0xd3, 0xe0);		/* shl eax, cl */
+			break;
+		case BPF_ALU | BPF_RSH | BPF_X:
+			EMIT(ctx, 0xd3, 0xe8);		/* shr eax, cl */
+			break;
+		case BPF_ALU | BPF_ADD | BPF_K:
+			EMIT(ctx, 0x05);		/* add eax, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_ALU | BPF_SUB | BPF_K:
+			EMIT(ctx, 0x2d);		/* sub eax, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_ALU | BPF_MUL | BPF_K:
+			EMIT(ctx, 0x69, 0xc0);		/* imul eax, eax, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_ALU | BPF_DIV | BPF_K:
+		case BPF_ALU | BPF_MOD | BPF_K:
+			if (k == 0)
+				return -EINVAL;
+			EMIT(ctx, 0x31, 0xd2);		/* xor edx, edx */
+			EMIT(ctx, 0x41, 0xb8);		/* mov r8d, k */
+			bpf_jit_emit32(ctx, k);
+			EMIT(ctx, 0x41, 0xf7, 0xf0);	/* div r8d */
+			if (BPF_OP(insn->code) == BPF_MOD)
+				EMIT(ctx, 0x89, 0xd0);	/* mov eax, edx */
+			break;
+		case BPF_ALU | BPF_AND | BPF_K:
+			EMIT(ctx, 0x25);		/* and eax, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_ALU | BPF_OR | BPF_K:
+			EMIT(ctx, 0x0d);		/* or eax, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_ALU | BPF_XOR | BPF_K:
+			EMIT(ctx, 0x35);		/* xor eax, k */
+			bpf_jit_emit32(ctx, k);
+			break;
+		case BPF_ALU | BPF_LSH | BPF_K:
+			/* The count is masked, as it is for A <<= k */
+			EMIT(ctx, 0xc1, 0xe0, k & 31);	/* shl eax, k */
+			break;
+		case BPF_ALU | BPF_RSH | BPF_K:
+			EMIT(ctx, 0xc1, 0xe8, k & 31);	/* shr eax, k */
+			break;
+		case BPF_ALU | BPF_NEG:
+			EMIT(ctx, 0xf7, 0xd8);		/* neg eax */
+			break;
+		case BPF_MISC | BPF_TAX:
+			EMIT(ctx, 0x89, 0xc1);		/* mov ecx, eax */
+			break;
+		case BPF_MISC | BPF_TXA:
+			EMIT(ctx, 0x89, 0xc8);		/* mov eax, ecx */
+			break;
+		default:
+			return -ENOTSUP;
+		}
+
+		if (ctx->c_nomem)
+			return -ENOMEM;
+	}
+
+	/* The program must not run off the end */
+	if (BPF_CLASS(insns[len - 1].code) != BPF_RET)
+		return -EINVAL;
+
+	ret0 = ctx->c_len;
+	EMIT(ctx, 0x31, 0xc0);				/* xor eax, eax */
+	EMIT(ctx, 0xc3);				/* ret */
+	if (ctx->c_nomem)
+		return -ENOMEM;
+
+	for (i = 0; i < ctx->c_nfix; i++) {
+		const struct bpf_jit_fixup *f = &ctx->c_fix[i];
+		uint32_t dst = f->f_target == BPF_JIT_RET0 ?
+			ret0 : ctx->c_map[f->f_target];
+		int32_t rel = (int32_t)dst -
+			(int32_t)(f->f_pos + sizeof(int32_t));
+
+		memcpy(ctx->c_code + f->f_pos, &rel, sizeof(rel));
+	}
+	return 0;
+}
+
+struct bpf_jit *
+bpf_jit_compile(const struct bpf_insn *insns, u_int len)
+{
+	struct bpf_jit_ctx ctx = { 0 };
+	struct bpf_jit *jit = NULL;
+	size_t code_off, map_size;
+	uint8_t *mem;
+	int rc;
+
+	if (!insns || !len)
+		return NULL;
+
+	rc = bpf_jit_translate(&ctx, insns, len);
+	if (rc < 0)
+		goto out;
+
+	code_off = RTE_ALIGN(sizeof(*jit), 64);
+	map_size = RTE_ALIGN(code_off + ctx.c_len,
+			     (size_t)sysconf(_SC_PAGESIZE));
+
+	mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		rc = -errno;
+		goto out;
+	}
+	memcpy(mem + code_off, ctx.c_code, ctx.c_len);
+
+	jit = (struct bpf_jit *)mem;
+	jit->bj_fn = (bpf_jit_fn_t)(uintptr_t)(mem + code_off);
+	jit->bj_map_size = map_size;
+
+	if (mprotect(mem, map_size, PROT_READ | PROT_EXEC) < 0) {
+		rc = -errno;
+		munmap(mem, map_size);
+		jit = NULL;
+	}
+
+out:
+	if (rc < 0 && rc != -ENOTSUP)
+		RTE_LOG(NOTICE, DATAPLANE, "BPF filter not compiled: %s\n",
+			strerror(-rc));
+
+	free(ctx.c_code);
+	free(ctx.c_map);
+	free(ctx.c_fix);
+	return jit;
+}
+
+void
+bpf_jit_free(struct bpf_jit *jit)
+{
+	if (jit)
+		munmap(jit, jit->bj_map_size);
+}
+
+#else /* RTE_ARCH_X86_64 */
+
+struct bpf_jit *
+bpf_jit_compile(const struct bpf_insn *insns __unused, u_int len __unused)
+{
+	return NULL;
+}
+
+void
+bpf_jit_free(struct bpf_jit *jit __unused)
+{
+}
+
+#endif /* RTE_ARCH_X86_64 */
+
+bpf_jit_fn_t
+bpf_jit_func(const struct bpf_jit *jit)
+{
+	return jit->bj_fn;
+}
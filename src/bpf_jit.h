@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef BPF_JIT_H
+#define BPF_JIT_H
+
+#include <pcap/bpf.h>
+#include <sys/types.h>
+
+/*
+ * Classic BPF to native code compiler.
+ *
+ * The generated function has the same arguments and result as
+ * bpf_filter(), less the program.  Programs that use instructions the JIT
+ * does not handle are not compiled, and bpf_filter() should be used.
+ */
+typedef u_int (*bpf_jit_fn_t)(const u_char *p, u_int wirelen, u_int buflen);
+
+struct bpf_jit;
+
+struct bpf_jit *bpf_jit_compile(const struct bpf_insn *insns, u_int len);
+void bpf_jit_free(struct bpf_jit *jit);
+bpf_jit_fn_t bpf_jit_func(const struct bpf_jit *jit);
+
+#endif /* BPF_JIT_H */
@@ -50,6 +50,7 @@
 #define CAPTURE_MAX_PORTS	8
 #define CAP_PKT_BURST		4
 #define CAPTURE_RING_SZ		256
+#define CAPTURE_BURST		32
 #define CAP_MAX_PER_PORT        4 /* max simultaneous captures on a port */
 #define CAPTURE_TIME_RESYNC_USECS (60 * USEC_PER_SEC)
 
@@ -86,6 +87,23 @@ static void capture_time_resync(struct timeval *tod, uint64_t *base,
 		*hz = new_capture_hz;
 }
 
+static void capture_filter_free(struct rcu_head *head)
+{
+	struct capture_filter *cap_filter =
+		caa_container_of(head, struct capture_filter, rcu);
+
+	bpf_jit_free(cap_filter->jit);
+	rte_free(cap_filter->filter.bf_insns);
+	rte_free(cap_filter);
+}
+
+/* Remove a filter, which may still be in use by the forwarding threads */
+static void capture_filter_remove(struct capture_filter *cap_filter)
+{
+	cds_list_del_rcu(&cap_filter->next);
+	call_rcu(&cap_filter->rcu, capture_filter_free);
+}
+
 /*
  * Stop capturing on the given slot, if no more slots capturing
  * then we will exit the main capture loop and clean up.
@@ -101,17 +119,15 @@ static bool capture_stop(struct ifnet *ifp,
 	if (cap_info->capture_mask == 0)
 		return true;
 
-	TAILQ_FOREACH(cap_filter, &cap_info->filters, next) {
+	cds_list_for_each_entry(cap_filter, &cap_info->filters, next) {
 		if (!(cap_filter->mask & slot))
 			continue;
 
-		cap_filter->mask &= ~slot;
+		CMM_STORE_SHARED(cap_filter->mask, cap_filter->mask & ~slot);
 		if (cap_filter->mask)
 			continue;
 
-		TAILQ_REMOVE(&cap_info->filters, cap_filter, next);
-		rte_free(cap_filter->filter.bf_insns);
-		rte_free(cap_filter);
+		capture_filter_remove(cap_filter);
 		break;
 	}
 
@@ -130,38 +146,40 @@ static int cap_filter_install(struct ifnet *ifp, uint8_t slotmask,
 	struct capture_filter *cap_filter;
 	struct bpf_insn *bf_insns;
 
-	TAILQ_FOREACH(cap_filter, &cap_info->filters, next) {
+	cds_list_for_each_entry(cap_filter, &cap_info->filters, next) {
 		if (cap_filter->filter.bf_len == len &&
 		    !memcmp(cap_filter->filter.bf_insns, insn,
 			    sizeof(struct bpf_insn) * len)) {
-			cap_filter->mask |= slotmask;
-			break;
+			CMM_STORE_SHARED(cap_filter->mask,
+					 cap_filter->mask | slotmask);
+			return 0;
 		}
 	}
 
-	if (cap_filter == NULL) {
-		cap_filter = rte_zmalloc_socket("filter", sizeof(*cap_filter),
-						RTE_CACHE_LINE_SIZE,
-						ifp->if_socket);
-		if (cap_filter == NULL)
-			return -1;
+	cap_filter = rte_zmalloc_socket("filter", sizeof(*cap_filter),
+					RTE_CACHE_LINE_SIZE, ifp->if_socket);
+	if (cap_filter == NULL)
+		return -1;
 
-		bf_insns = rte_zmalloc_socket("insns",
-					      sizeof(*bf_insns) * len,
-					      RTE_CACHE_LINE_SIZE,
-					      ifp->if_socket);
-		if (bf_insns == NULL) {
-			rte_free(cap_filter);
-			return -1;
-		}
-		memcpy(bf_insns, insn, sizeof(*bf_insns) * len);
+	bf_insns = rte_zmalloc_socket("insns", sizeof(*bf_insns) * len,
+				      RTE_CACHE_LINE_SIZE, ifp->if_socket);
+	if (bf_insns == NULL) {
+		rte_free(cap_filter);
+		return -1;
+	}
+	memcpy(bf_insns, insn, sizeof(*bf_insns) * len);
 
-		cap_filter->filter.bf_insns = bf_insns;
-		cap_filter->filter.bf_len = len;
-		cap_filter->mask = slotmask;
+	cap_filter->filter.bf_insns = bf_insns;
+	cap_filter->filter.bf_len = len;
+	cap_filter->mask = slotmask;
 
-		TAILQ_INSERT_TAIL(&cap_info->filters, cap_filter, next);
-	}
+	/* bpf_filter() is used if the filter can not be compiled */
+	cap_filter->jit = bpf_jit_compile(bf_insns, len);
+	if (cap_filter->jit)
+		cap_filter->jit_fn = bpf_jit_func(cap_filter->jit);
+
+	/* Visible to the forwarding threads once fully set up */
+	cds_list_add_tail_rcu(&cap_filter->next, &cap_info->filters);
 	return 0;
 }
 
@@ -285,16 +303,13 @@ static int64_t capture_usec_from_tod_base(uint64_t ts, uint64_t base,
 	return ((int64_t)(ts - base) * USEC_PER_SEC) / (int64_t)hz;
 }
 
-/* Read timestamp from packet and convert it to system time of day format */
-static void capture_get_timestamp(struct rte_mbuf *m, struct timeval *tv)
+/* Convert packet timestamp to system time of day format */
+static void capture_get_timestamp(uint64_t ts, struct timeval *tv)
 {
-	uint64_t ts = m->udata64;
 	int64_t us;
 	uint64_t base;
 	uint64_t hz;
 
-	m->udata64 = 0;
-
 	/* protect against resync happening in another thread */
 	rte_spinlock_lock(&capture_time_lock);
 
@@ -331,123 +346,193 @@ static void capture_wakeup(struct capture_info *cap_info)
 			strerror(errno));
 }
 
-/* Make a copy of the packet mbufs */
-static int capture_mbuf_copy(struct rte_mbuf *mbi[], struct rte_mbuf *mbo[],
-			     unsigned int n)
+/*
+ * Written in the headroom of each packet copy by the forwarding thread,
+ * for the capture thread.
+ */
+struct capture_pkt_info {
+	uint64_t ts;		/* timer cycles when captured */
+	uint32_t wirelen;	/* length of the original packet */
+	uint8_t mask;		/* slots that survived filtering */
+};
+
+/*
+ * Make a copy of the part of the packet within the snaplen.  This normally
+ * fits in a single capture mbuf, otherwise the whole packet is copied.
+ */
+static struct rte_mbuf *capture_mbuf_copy(struct rte_mbuf *mi,
+					  unsigned int snaplen)
 {
-	uint64_t ts = rte_get_timer_cycles();
+	unsigned int caplen = RTE_MIN(rte_pktmbuf_pkt_len(mi), snaplen);
 	struct rte_mbuf *m;
-	unsigned int i, j;
+	char *p;
 
-	for (i = 0; i < n; i++) {
-		m = pktmbuf_copy(mbi[i], capture_pool);
-		if (!m)
-			goto nomem;
+	m = pktmbuf_alloc(capture_pool, pktmbuf_get_vrf(mi));
+	if (!m)
+		return NULL;
 
-		m->udata64 = ts;
-		mbo[i] = m;
+	if (caplen > rte_pktmbuf_tailroom(m)) {
+		rte_pktmbuf_free(m);
+		return pktmbuf_copy(mi, capture_pool);
 	}
-	return 0;
-
- nomem:
-	for (j = 0; j < i; j++)
-		rte_pktmbuf_free(mbo[j]);
 
-	return -ENOBUFS;
+	pktmbuf_copy_meta(m, mi);
+	p = rte_pktmbuf_append(m, caplen);
+	memcpy_from_mbuf(p, mi, 0, caplen);
+	return m;
 }
 
-/* Put clone of mbuf's into ring for capture thread */
+/* Put copies of mbuf's into ring for capture thread */
 static int capture_enqueue(struct capture_info *cap_info,
 			   struct rte_mbuf *pkts[], unsigned int n)
 {
-	int ret;
+	if (rte_ring_mp_enqueue_bulk(cap_info->cap_ring,
+				     (void **)pkts, n, NULL) == 0)
+		return -ENOBUFS;
+
+	capture_wakeup(cap_info);
+	return 0;
+}
+
+/*
+ * Run the filters over a burst of packets, giving the slots that each
+ * packet is to be sent to.  Each filter is run over the whole burst in
+ * turn.  Only the first segment of the packet is visible to the filters.
+ */
+static void capture_filter_burst(const struct capture_info *cap_info,
+				 struct rte_mbuf *pkts[],
+				 uint8_t filtered_mask[], unsigned int n)
+{
+	const struct capture_filter *cap_filter;
+	u_int wirelen[n], buflen[n];
+	uint8_t capture_mask = CMM_ACCESS_ONCE(cap_info->capture_mask);
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		filtered_mask[i] = capture_mask;
+		wirelen[i] = rte_pktmbuf_pkt_len(pkts[i]);
+		buflen[i] = RTE_MIN(rte_pktmbuf_data_len(pkts[i]),
+				    cap_info->snaplen);
+	}
+
+	cds_list_for_each_entry_rcu(cap_filter, &cap_info->filters, next) {
+		bpf_jit_fn_t fn = cap_filter->jit_fn;
+		uint8_t mask = CMM_ACCESS_ONCE(cap_filter->mask);
+
+		for (i = 0; i < n; i++) {
+			const u_char *p = rte_pktmbuf_mtod(pkts[i], u_char *);
+			u_int ret;
 
-	ret = rte_ring_mp_enqueue_bulk(cap_info->cap_ring,
-				       (void **)pkts, n, NULL);
-	if (likely(ret > 0))
-		capture_wakeup(cap_info);
+			if (!(filtered_mask[i] & mask))
+				continue;
 
-	return ret;
+			if (fn)
+				ret = fn(p, wirelen[i], buflen[i]);
+			else
+				ret = bpf_filter(cap_filter->filter.bf_insns,
+						 p, wirelen[i], buflen[i]);
+			if (!ret)
+				filtered_mask[i] &= ~mask;
+		}
+	}
 }
 
-/* Put mbuf(s) in capture ring. */
+/*
+ * Put mbuf(s) in capture ring.  The packets are filtered here, so that
+ * only those wanted by a capture are copied, and then only up to the
+ * snaplen.
+ */
 void capture_burst(const struct ifnet *ifp,
 		   struct rte_mbuf *pkts[], unsigned int n)
 {
+	struct capture_info *cap_info = ifp->cap_info;
+	struct capture_pkt_info *info;
+	uint8_t filtered_mask[n];
 	struct rte_mbuf *snap[n];
+	unsigned int i, ns = 0;
+	uint64_t ts;
 
 	/* may be called with no packets on transmit with bonding interfaces */
-	if (n == 0 || capture_mbuf_copy(pkts, snap, n) < 0)
+	if (n == 0 || !cap_info)
 		return;
 
-	if (unlikely(capture_enqueue(ifp->cap_info, snap, n) < 0))
-		pktmbuf_free_bulk(snap, n);
-}
+	capture_filter_burst(cap_info, pkts, filtered_mask, n);
 
-/* Add to zmq msg if within the snaplen and return the remaining space. */
-static int addmsg_if_space(zmsg_t *msg, const void *ptr,
-			   unsigned int len, unsigned int space)
-{
-	unsigned int addlen;
+	ts = rte_get_timer_cycles();
+	for (i = 0; i < n; i++) {
+		if (!filtered_mask[i])
+			continue;
+
+		snap[ns] = capture_mbuf_copy(pkts[i], cap_info->snaplen);
+		if (!snap[ns])
+			break;
+
+		info = (struct capture_pkt_info *)
+			rte_pktmbuf_prepend(snap[ns], sizeof(*info));
+		if (!info) {
+			rte_pktmbuf_free(snap[ns]);
+			break;
+		}
+		info->ts = ts;
+		info->wirelen = rte_pktmbuf_pkt_len(pkts[i]);
+		info->mask = filtered_mask[i];
+		ns++;
+	}
 
-	addlen = len > space ? space : len;
-	zmsg_addmem(msg, ptr, addlen);
-	return space - addlen;
+	if (ns && unlikely(capture_enqueue(cap_info, snap, ns) < 0))
+		pktmbuf_free_bulk(snap, ns);
 }
 
-/* Filter packets and send to captures via zmq */
-static int capture_write(struct rte_mbuf *m, struct ifnet *ifp)
+/*
+ * Build the message for a filtered packet: the slots that survived
+ * filtering, the PCAP header, then the packet data, including any VLAN
+ * header rebuilt from the offload flags, as one frame.
+ */
+zmsg_t *capture_msg(const struct ifnet *ifp, struct rte_mbuf *m)
 {
-	struct capture_info *cap_info = ifp->cap_info;
-	struct capture_filter *cap_filter;
+	const struct capture_info *cap_info = ifp->cap_info;
+	struct capture_pkt_info info;
 	struct pcap_pkthdr pcap;
-	uint8_t filtered_mask = cap_info->capture_mask;
+	unsigned int hlen = 0, off = 0;
+	zframe_t *frame;
 	zmsg_t *msg;
-	unsigned int space = cap_info->snaplen;
+	char *p;
+	bool vlan;
 
-	capture_get_timestamp(m, &pcap.ts);
-	pcap.len = rte_pktmbuf_pkt_len(m);
-	if (pcap.len < cap_info->snaplen)
-		pcap.caplen = pcap.len;
-	else
-		pcap.caplen = cap_info->snaplen;
+	memcpy(&info, rte_pktmbuf_mtod(m, void *), sizeof(info));
+	rte_pktmbuf_adj(m, sizeof(info));
 
-	TAILQ_FOREACH(cap_filter, &cap_info->filters, next) {
-		if (!bpf_filter(cap_filter->filter.bf_insns,
-			       (const u_char *) rte_pktmbuf_mtod(m, char *),
-			       pcap.len, pcap.caplen))
-			filtered_mask &= ~cap_filter->mask;
-	}
+	capture_get_timestamp(info.ts, &pcap.ts);
+	pcap.len = info.wirelen;
+	pcap.caplen = rte_pktmbuf_pkt_len(m);
 
-	if (!filtered_mask)
-		return 0;
+	vlan = (m->ol_flags & (PKT_TX_VLAN_PKT|PKT_RX_VLAN)) &&
+		pcap.caplen >= ETHER_HDR_LEN;
+	if (vlan) {
+		pcap.len += sizeof(struct vlan_hdr);
+		pcap.caplen += sizeof(struct vlan_hdr);
+	}
+	if (pcap.caplen > cap_info->snaplen)
+		pcap.caplen = cap_info->snaplen;
 
 	msg = zmsg_new();
-
 	if (!msg)
-		return -1;
+		return NULL;
 
-	/*
-	 * First send filtered mask, ie. the slots that survived filtering.
-	 */
-	zmsg_addmem(msg, &filtered_mask, sizeof(filtered_mask));
-
-	/* ... then PCAP header */
-	if (m->ol_flags & (PKT_TX_VLAN_PKT|PKT_RX_VLAN)) {
-		pcap.caplen += sizeof(struct vlan_hdr);
-		if (pcap.caplen > cap_info->snaplen)
-			pcap.caplen = cap_info->snaplen;
-		pcap.len += sizeof(struct vlan_hdr);
+	frame = zframe_new(NULL, pcap.caplen);
+	if (!frame) {
+		zmsg_destroy(&msg);
+		return NULL;
 	}
+	p = (char *)zframe_data(frame);
 
-	zmsg_addmem(msg, &pcap, sizeof(pcap));
-
-	/* Special case for VLAN.
+	/*
+	 * Special case for VLAN.
 	 * copy Ethernet header from original packet
-	 * and rebuild real ethernet and vlan header
-	 * in a temporary buffer.
+	 * and rebuild real ethernet and vlan header,
+	 * hiding the original ethernet header.
 	 */
-	if (m->ol_flags & (PKT_TX_VLAN_PKT|PKT_RX_VLAN)) {
+	if (vlan) {
 		const struct ether_hdr *eh
 			= rte_pktmbuf_mtod(m, struct ether_hdr *);
 		struct {
@@ -460,33 +545,34 @@ static int capture_write(struct rte_mbuf *m, struct ifnet *ifp)
 		vhdr.vh.vlan_tci = htons(m->vlan_tci);
 		vhdr.vh.eth_proto = eh->ether_type;
 
-		space = addmsg_if_space(msg, &vhdr, sizeof(vhdr), space);
-		if (!space)
-			goto msg_send;
+		hlen = RTE_MIN(sizeof(vhdr), pcap.caplen);
+		memcpy(p, &vhdr, hlen);
+		off = ETHER_HDR_LEN;
+	}
 
-		/* hide original ethernet header */
-		space = addmsg_if_space(msg,
-					rte_pktmbuf_mtod(m, char *) + ETHER_HDR_LEN,
-					(unsigned int)rte_pktmbuf_data_len(m) - ETHER_HDR_LEN,
-					space);
-		if (!space)
-			goto msg_send;
+	if (pcap.caplen > hlen)
+		memcpy_from_mbuf(p + hlen, m, off, pcap.caplen - hlen);
 
-		m = m->next;
-	}
+	/*
+	 * First send filtered mask, ie. the slots that survived filtering,
+	 * then PCAP header and the data.
+	 */
+	zmsg_addmem(msg, &info.mask, sizeof(info.mask));
+	zmsg_addmem(msg, &pcap, sizeof(pcap));
+	zmsg_append(msg, &frame);
 
-	while (m) {
-		space = addmsg_if_space(msg, rte_pktmbuf_mtod(m, char *),
-					(unsigned int)rte_pktmbuf_data_len(m),
-					space);
-		if (!space)
-			goto msg_send;
+	return msg;
+}
 
-		m = m->next;
-	}
+/* Send a filtered packet to captures via zmq */
+static int capture_write(struct rte_mbuf *m, struct ifnet *ifp)
+{
+	zmsg_t *msg = capture_msg(ifp, m);
 
-msg_send:
-	return zmsg_send_and_destroy(&msg, cap_info->cap_pub);
+	if (!msg)
+		return -1;
+
+	return zmsg_send_and_destroy(&msg, ifp->cap_info->cap_pub);
 }
 
 static void capture_flush(const struct capture_info *cap_info)
@@ -508,15 +594,9 @@ static void capture_cleanup(void *arg)
 	zsock_destroy(&cap_info->cap_pub);
 	zsock_destroy(&cap_info->cap_pcapin);
 
-	for (cap_filter = TAILQ_FIRST(&cap_info->filters);
-	     cap_filter;
-	     cap_filter = next_filter) {
-
-		next_filter = TAILQ_NEXT(cap_filter, next);
-		TAILQ_REMOVE(&cap_info->filters, cap_filter, next);
-		rte_free(cap_filter->filter.bf_insns);
-		rte_free(cap_filter);
-	}
+	cds_list_for_each_entry_safe(cap_filter, next_filter,
+				     &cap_info->filters, next)
+		capture_filter_remove(cap_filter);
 
 	if (ifp->if_type == IFT_ETHER) {
 		if (cap_info->is_promisc)
@@ -530,15 +610,16 @@ static void capture_cleanup(void *arg)
 		ifp->if_name);
 }
 
-/* Max numer of loops processing packets without checking for events */
+/* Max number of packets processed without checking for events */
 #define CAPTURE_MAX_LOOPS 100
 
 /* Main capture loop */
 static void capture_loop(struct ifnet *ifp)
 {
 	struct capture_info *cap_info = ifp->cap_info;
-	struct rte_mbuf *m;
+	struct rte_mbuf *pkts[CAPTURE_BURST];
 	struct timespec now;
+	unsigned int i, n;
 	uint loops;
 	zmq_pollitem_t items[] = {
 		{ .fd = cap_info->cap_wake,
@@ -561,18 +642,22 @@ static void capture_loop(struct ifnet *ifp)
 			return;
 
 		loops = 0;
-		while (rte_ring_sc_dequeue(cap_info->cap_ring,
-					   (void **) &m) == 0) {
-			int ret;
+		while ((n = rte_ring_sc_dequeue_burst(cap_info->cap_ring,
+						      (void **)pkts,
+						      CAPTURE_BURST,
+						      NULL)) != 0) {
+			int ret = 0;
 
-			ret = capture_write(m, ifp);
+			for (i = 0; i < n && ret >= 0; i++)
+				ret = capture_write(pkts[i], ifp);
 
-			rte_pktmbuf_free(m);
+			pktmbuf_free_bulk(pkts, n);
 
 			if (ret < 0)
 				return;
 
-			if (loops++ >= CAPTURE_MAX_LOOPS) {
+			loops += n;
+			if (loops >= CAPTURE_MAX_LOOPS) {
 				capture_wakeup(cap_info);
 				break;
 			}
@@ -707,7 +792,7 @@ static struct capture_info *capture_new(FILE *f, const char *addrstr,
 	}
 
 	clock_gettime(CLOCK_MONOTONIC_COARSE, &cap_info->last_beat);
-	TAILQ_INIT(&cap_info->filters);
+	CDS_INIT_LIST_HEAD(&cap_info->filters);
 
 	/* Publisher to send capture data */
 	cap_info->cap_pub = zsock_new(ZMQ_PUB);
@@ -15,23 +15,28 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <sys/queue.h>
 #include <sys/types.h>
 #include <time.h>
 
+#include "bpf_jit.h"
 #include "if_var.h"
+#include "urcu.h"
 
 struct rte_mbuf;
 
 /*
  * Info used by capture thread.
+ *
+ * The filters are run by the forwarding threads, before packets are
+ * copied, so the list is changed by the capture thread under rcu.
  */
-TAILQ_HEAD(capture_filter_list, capture_filter);
-
 struct capture_filter {
-	TAILQ_ENTRY(capture_filter) next;
+	struct cds_list_head next;
 	struct bpf_program filter; /* BPF filter to apply */
+	bpf_jit_fn_t jit_fn; /* compiled filter, if any */
+	struct bpf_jit *jit;
 	uint8_t mask; /* bitmask of capture slots applying this filter */
+	struct rcu_head rcu;
 };
 
 struct capture_info {
@@ -44,7 +49,7 @@ struct capture_info {
 	int cap_pcapin_port;
 	int offload_mask;
 	uint8_t capture_mask; /* bitmask of current captures */
-	struct capture_filter_list filters;
+	struct cds_list_head filters;
 	struct timespec last_beat;
 	bool is_promisc;
 	unsigned int snaplen;
@@ -80,4 +85,10 @@ void capture_cancel(struct ifnet *ifp);
 void capture_burst(const struct ifnet *ifp, struct rte_mbuf *pkts[], unsigned int n)
 	__attribute__((cold));
 int cmd_capture(FILE *f, int argc, char **argv);
+
+/*
+ * Build the message sent to captures for a packet taken from the capture
+ * ring.  Only used directly by the unit tests.
+ */
+zmsg_t *capture_msg(const struct ifnet *ifp, struct rte_mbuf *m);
 #endif /* CAPTURE_H */
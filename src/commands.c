@@ -870,6 +870,12 @@ static int cmd_ipsec_engine(FILE *f, int argc, char **argv)
 	if (strcmp(argv[0], "probe") == 0)
 		return crypto_engine_probe(f);
 
+	if (strcmp(argv[0], "burst") == 0)
+		return crypto_engine_burst(f, argc > 1 ? argv[1] : NULL);
+
+	if (strcmp(argv[0], "inline") == 0)
+		return crypto_engine_inline(f, argc > 1 ? argv[1] : NULL);
+
 	if (strcmp(argv[0], "set") == 0) {
 		if (argc > 1)
 			rc = crypto_engine_set(f, argv[1]);
@@ -30,6 +30,7 @@
 #include <rte_log.h>
 
 #include "config.h"
+#include "lpm/lpm6.h"
 #include "main.h"
 #include "util.h"
 #include "vplane_debug.h"
@@ -154,6 +155,49 @@ uint32_t config_ctrl_ip_af(void)
 	return config.local_ip.type;
 }
 
+static int parse_pipeline_mode(struct config_param *cfg, const char *value)
+{
+	if (strcmp(value, "vector") == 0)
+		cfg->pipeline_vector_mode = true;
+	else if (strcmp(value, "fused") == 0)
+		cfg->pipeline_vector_mode = false;
+	else {
+		fprintf(stderr, "Invalid pipeline mode: %s\n", value);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int parse_route_shadow_swap(struct config_param *cfg,
+				   const char *value)
+{
+	if (strcmp(value, "true") == 0)
+		cfg->route_shadow_swap = true;
+	else if (strcmp(value, "false") == 0)
+		cfg->route_shadow_swap = false;
+	else {
+		fprintf(stderr, "Invalid route-shadow-swap: %s\n", value);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Applies to all IPv6 route tables, which are created later */
+static int parse_lpm6_algorithm(const char *value)
+{
+	enum lpm6_algo algo;
+
+	if (lpm6_algo_parse(value, &algo) < 0) {
+		fprintf(stderr, "Invalid lpm6 algorithm: %s\n", value);
+		return 0;
+	}
+
+	lpm6_set_default_algo(algo);
+	return 1;
+}
+
 /* Callback from inih library for each name value
  * return 0 = error, 1 = ok
  */
@@ -202,6 +246,12 @@ static int parse_entry(void *user, const char *section,
 			cfg->dp_index = atoi(value);
 		else if (strcmp(name, "uplink-mac") == 0)
 			return ether_aton_r(value, &cfg->uplink_addr) != NULL;
+		else if (strcmp(name, "pipeline-mode") == 0)
+			return parse_pipeline_mode(cfg, value);
+		else if (strcmp(name, "lpm6-algorithm") == 0)
+			return parse_lpm6_algorithm(value);
+		else if (strcmp(name, "route-shadow-swap") == 0)
+			return parse_route_shadow_swap(cfg, value);
 	} else if (strcasecmp(section, "rib") == 0) {
 		if (strcmp(name, "ip") == 0)
 			return parse_ipaddr(&cfg->rib_ip, value);
@@ -65,6 +65,8 @@ struct config_param {
 	struct ether_addr uplink_addr; /* uplink intf perm mac addr */
 	struct ip_addr rib_ip;   /* rib ctrl ip */
 	char *rib_ctrl_url;	 /* rib control url */
+	bool pipeline_vector_mode; /* burst-at-a-time pipeline graph */
+	bool route_shadow_swap;	 /* rebuild table for big route batches */
 };
 
 struct bkplane_pci {
@@ -40,6 +40,7 @@
 #include "pl_commands.h"
 #include "power.h"
 #include "protobuf.h"
+#include "route.h"
 #include "rt_tracker.h"
 #include "session/session_cmds.h"
 #include "urcu.h"
@@ -493,6 +494,7 @@ static const struct msg_handler message_handlers_main[] = {
 	{ 0,	"ptp",		process_config_cmd,      cmd_ptp_cfg },
 	{ 4,	"qos",		process_config_cmd,	 cmd_qos_cfg },
 	{ 0,	"route",	process_netlink_data,	 NULL },
+	{ 0,	"rt-batch-ut",	process_config_cmd,	 cmd_rt_batch_ut },
 	{ 3,    "storm-ctl",    process_config_cmd,      cmd_storm_ctl_cfg },
 	{ 0,	"tablemap",	process_config_cmd,	 cmd_tablemap_cfg },
 	{ 0,	"team",		process_team_cmd,	 NULL },
@@ -38,6 +38,7 @@
 #include "crypto/crypto_policy_cache.h"
 #include "crypto_internal.h"
 #include "crypto_main.h"
+#include "crypto_mb.h"
 #include "crypto_policy.h"
 #include "crypto_sadb.h"
 #include "dp_event.h"
@@ -143,6 +144,70 @@ static const char * const ipsec_counter_names[] = {
 
 unsigned long ipsec_counters[RTE_MAX_LCORE][IPSEC_CNT_MAX] __rte_cache_aligned;
 
+/*
+ * Inline processing
+ *
+ * Normally a forwarding thread queues each burst of packets to the ring
+ * of the pmd for the SA, and the lcore the pmd is attached to processes
+ * them on its next poll.  In inline mode the forwarding thread processes
+ * the burst itself, run to completion, saving the ring hop, the polling
+ * delay and the move of the packets to the cache of another core.
+ *
+ * "pinned" processes a burst inline only if the pmd is attached to the
+ * forwarding lcore, which would otherwise process it later anyway.  "on"
+ * also processes bursts for pmds on other lcores, while the forwarding
+ * lcore has spare capacity, i.e. has spent less than CRYPTO_INLINE_SHARE
+ * percent of the current period doing so.  Once over that budget, or when
+ * the pmd is busy or has a backlog in its ring, bursts are queued.
+ */
+enum crypto_inline_mode {
+	CRYPTO_INLINE_OFF,
+	CRYPTO_INLINE_PINNED,
+	CRYPTO_INLINE_ON,
+	CRYPTO_INLINE_MAX
+};
+
+static const char * const crypto_inline_names[] = {
+	[CRYPTO_INLINE_OFF] = "off",
+	[CRYPTO_INLINE_PINNED] = "pinned",
+	[CRYPTO_INLINE_ON] = "on",
+};
+
+#define CRYPTO_INLINE_PERIOD_MS	1
+#define CRYPTO_INLINE_SHARE	50
+
+static enum crypto_inline_mode crypto_inline_mode;
+static uint64_t crypto_inline_period;
+static uint64_t crypto_inline_budget;
+
+struct crypto_inline_usage {
+	uint64_t period_start;
+	uint64_t cycles;
+};
+
+static RTE_DEFINE_PER_LCORE(struct crypto_inline_usage, crypto_inline_usage);
+
+/*
+ * Histograms of the time from a packet being queued by the forwarding
+ * thread to it being ready to forward, for each of the paths.  Bucket b
+ * counts packets taking from 2^(b-1) up to 2^b TSC cycles.
+ */
+enum crypto_path {
+	CRYPTO_PATH_QUEUED,
+	CRYPTO_PATH_INLINE,
+	CRYPTO_PATH_MAX
+};
+
+static const char * const crypto_path_names[] = {
+	[CRYPTO_PATH_QUEUED] = "queued",
+	[CRYPTO_PATH_INLINE] = "inline",
+};
+
+#define CRYPTO_LATENCY_BUCKETS 32
+
+static uint64_t crypto_latency[RTE_MAX_LCORE][CRYPTO_PATH_MAX]
+	[CRYPTO_LATENCY_BUCKETS] __rte_cache_aligned;
+
 static const char * const xfrm_names[] = {
 	[CRYPTO_ENCRYPT] = "Encrypt",
 	[CRYPTO_DECRYPT] = "Decrypt",
@@ -186,6 +251,7 @@ struct crypto_pkt_ctx {
 	uint8_t family;
 	xfrm_address_t dst; /* Only used for outbound traffic */
 	vrfid_t vrfid;
+	uint64_t enq_tsc; /* When queued, for the latency histograms */
 };
 
 static int crypto_vrf_insert(struct crypto_vrf_ctx *vrf_ctx)
@@ -435,14 +501,16 @@ static struct ifnet *crypto_ctx_to_in_ifp(struct crypto_pkt_ctx *ctx,
 }
 
 /*
- * crypto_process_decrypt_packet()
+ * crypto_decrypt_packet()
  *
- * Decrypt the packet described by the supplied context.
+ * Decrypt the packet described by the supplied context, dealing with
+ * the replay window as the caller says, see enum esp_replay.
  */
-static void crypto_process_decrypt_packet(struct crypto_pkt_ctx *cctx,
-					  struct rte_mbuf *m,
-					  struct sadb_sa *sa,
-					  uint32_t *bytes)
+static void crypto_decrypt_packet(struct crypto_pkt_ctx *cctx,
+				  struct rte_mbuf *m,
+				  struct sadb_sa *sa,
+				  uint32_t *bytes,
+				  enum esp_replay replay)
 {
 	int rc;
 	struct ifnet *vti_ifp = NULL;
@@ -467,9 +535,9 @@ static void crypto_process_decrypt_packet(struct crypto_pkt_ctx *cctx,
 	}
 
 	if (cctx->family == AF_INET)
-		rc = esp_input(m, sa, bytes, &cctx->family);
+		rc = esp_input(m, sa, bytes, &cctx->family, replay);
 	else
-		rc = esp_input6(m, sa, bytes, &cctx->family);
+		rc = esp_input6(m, sa, bytes, &cctx->family, replay);
 
 	if (rc < 0) {
 		IF_INCR_ERROR(vti_ifp ? vti_ifp :
@@ -544,6 +612,14 @@ static void crypto_process_decrypt_packet(struct crypto_pkt_ctx *cctx,
 	}
 }
 
+static void crypto_process_decrypt_packet(struct crypto_pkt_ctx *cctx,
+					  struct rte_mbuf *m,
+					  struct sadb_sa *sa,
+					  uint32_t *bytes)
+{
+	crypto_decrypt_packet(cctx, m, sa, bytes, ESP_REPLAY_SINGLE);
+}
+
 static void crypto_process_encrypt_packet(struct crypto_pkt_ctx *cctx,
 					  struct rte_mbuf *m,
 					  struct sadb_sa *sa,
@@ -778,6 +854,7 @@ static int crypto_enqueue_internal(enum crypto_xfrm xfrm,
 	ctx->nxt_ifp = nxt_ifp;
 	ctx->spi = spi;
 	ctx->vrfid = pktmbuf_get_vrf(m);
+	ctx->enq_tsc = rte_rdtsc();
 
 	/*
 	 * Add to the per thread burst queue.
@@ -799,6 +876,22 @@ free_mbuf_on_error:
 }
 
 
+/*
+ * The packet is encrypted or decrypted in place, so it can't share its
+ * data with another packet, such as a port monitor mirror.  This may
+ * replace the packet with a copy, which can have a different segment
+ * layout, so is done before any checks on the packet.  The packet is
+ * left as it was on failure.
+ */
+static inline int crypto_unshare(struct rte_mbuf **m)
+{
+	if (unlikely(pktmbuf_prepare_for_header_change(m, 0) < 0)) {
+		IPSEC_CNT_INC(DROPPED_NO_MBUF);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 /*
  * Packet must contain crypto headers in first segment
  */
@@ -849,10 +942,16 @@ int crypto_enqueue_inbound_v4(struct rte_mbuf *m,
 					  pktmbuf_l3_len(m));
 	}
 
+	if (crypto_unshare(&m) < 0)
+		return -1;
+
+	/* The caller no longer owns the packet, so free it here */
 	pmd_dev_id = crypto_spi_to_pmd_dev_id(spi);
 	crypto_parse_hdr4(m, &h);
-	if (!crypto_check_hdr_single_seg(m, &h, input_if))
-		return -1;
+	if (!crypto_check_hdr_single_seg(m, &h, input_if)) {
+		rte_pktmbuf_free(m);
+		return 0;
+	}
 
 	if (crypto_enqueue_internal(CRYPTO_DECRYPT, m, AF_INET, AF_INET,
 				    NULL, input_if, NULL, 0,
@@ -894,10 +993,16 @@ int crypto_enqueue_inbound_v6(struct rte_mbuf *m,
 					  pktmbuf_l3_len(m));
 	}
 
+	if (crypto_unshare(&m) < 0)
+		return -1;
+
+	/* The caller no longer owns the packet, so free it here */
 	pmd_dev_id = crypto_spi_to_pmd_dev_id(spi);
 	crypto_parse_hdr6(m, &h);
-	if (!crypto_check_hdr_single_seg(m, &h, input_if))
-		return -1;
+	if (!crypto_check_hdr_single_seg(m, &h, input_if)) {
+		rte_pktmbuf_free(m);
+		return 0;
+	}
 
 	if (crypto_enqueue_internal(CRYPTO_DECRYPT, m, AF_INET6, AF_INET6,
 				    NULL, input_if, NULL, 0,
@@ -930,6 +1035,11 @@ void crypto_enqueue_outbound(struct rte_mbuf *m, uint16_t orig_family,
 		return;
 	}
 
+	if (crypto_unshare(&m) < 0) {
+		rte_pktmbuf_free(m);
+		return;
+	}
+
 	crypto_enqueue_internal(CRYPTO_ENCRYPT, m, orig_family, family, dst,
 				in_ifp, nxt_ifp, reqid,
 				pmd_dev_id, spi, iphdr(m));
@@ -1012,46 +1122,215 @@ sadb_lookup_sa(struct rte_mbuf *m __unused, enum crypto_xfrm xfrm,
 	return sa;
 }
 
-static inline unsigned int
-crypto_pmd_process_packet(struct crypto_pkt_ctx *contexts,
-			  enum crypto_xfrm xfrm)
+static inline struct sadb_sa *
+crypto_pmd_packet_sa(struct crypto_pkt_ctx *ctx, enum crypto_xfrm xfrm)
 {
-	struct rte_mbuf *m;
-	unsigned int packet_size = 0;
-	struct sadb_sa *sa;
+	struct rte_mbuf *m = ctx->mbuf;
 
-	m = contexts->mbuf;
 	if (unlikely(!m)) {
 		CRYPTO_DATA_ERR("Null mbuf\n");
-		contexts->action = CRYPTO_ACT_DROP;
+		ctx->action = CRYPTO_ACT_DROP;
 		IPSEC_CNT_INC(DROPPED_NO_MBUF);
-		return 0;
+		return NULL;
 	}
-	assert(contexts->direction == xfrm);
+	assert(ctx->direction == xfrm);
+
+	return sadb_lookup_sa(m, xfrm, ctx);
+}
+
+static inline unsigned int
+crypto_pmd_process_packet(struct crypto_pkt_ctx *contexts,
+			  enum crypto_xfrm xfrm)
+{
+	unsigned int packet_size = 0;
+	struct sadb_sa *sa;
 
-	sa = sadb_lookup_sa(m, xfrm, contexts);
+	sa = crypto_pmd_packet_sa(contexts, xfrm);
 	if (unlikely(!sa))
 		return 0;
 
-	crypto_cb[xfrm].process(contexts, m, sa, &packet_size);
+	crypto_cb[xfrm].process(contexts, contexts->mbuf, sa, &packet_size);
 	return packet_size;
 }
 
+/*
+ * Decrypt the packets of a burst for one SA.  Their sequence numbers are
+ * checked against the replay window together, and the replay lock is
+ * taken once to advance the window for all of them.  An SA is only used
+ * by the thread that holds its pmd, so the lock is not contended while
+ * it is held over the run.  A packet on its own takes the usual path.
+ */
+static unsigned int
+crypto_decrypt_sa_run(struct sadb_sa *sa, struct crypto_pkt_ctx **run,
+		      const uint32_t seq[], unsigned int count)
+{
+	unsigned int i, total_bytes = 0;
+	uint32_t bytes;
+	uint64_t fail;
+
+	if (count == 1) {
+		bytes = 0;
+		crypto_process_decrypt_packet(run[0], run[0]->mbuf, sa,
+					      &bytes);
+		return bytes;
+	}
+
+	fail = esp_replay_check_burst(sa, seq, count);
+	esp_replay_lock(sa);
+	for (i = 0; i < count; i++) {
+		bytes = 0;
+		crypto_decrypt_packet(run[i], run[i]->mbuf, sa, &bytes,
+				      (fail & (1ull << i)) ?
+				      ESP_REPLAY_FAILED : ESP_REPLAY_LOCKED);
+		total_bytes += bytes;
+	}
+	esp_replay_unlock(sa);
+	return total_bytes;
+}
+
+/*
+ * Decrypt a burst an SA at a time.  The packets for an SA keep their
+ * order, and are forwarded in the order of the burst afterwards.
+ */
+static unsigned int
+crypto_pmd_decrypt_burst(struct crypto_pkt_ctx **contexts,
+			 unsigned int count)
+{
+	struct crypto_pkt_ctx *run[MAX_CRYPTO_PKT_BURST];
+	struct sadb_sa *sas[MAX_CRYPTO_PKT_BURST];
+	uint32_t seq[MAX_CRYPTO_PKT_BURST];
+	unsigned int i, j, n, total_bytes = 0;
+	struct sadb_sa *sa;
+
+	for (i = 0; i < count; i++)
+		sas[i] = crypto_pmd_packet_sa(contexts[i], CRYPTO_DECRYPT);
+
+	for (i = 0; i < count; i++) {
+		sa = sas[i];
+		if (!sa)
+			continue;
+
+		for (j = i, n = 0; j < count; j++) {
+			if (sas[j] != sa)
+				continue;
+			run[n] = contexts[j];
+			seq[n] = esp_replay_seq(contexts[j]->mbuf, sa);
+			sas[j] = NULL;
+			n++;
+		}
+		total_bytes += crypto_decrypt_sa_run(sa, run, seq, n);
+	}
+	return total_bytes;
+}
+
+static void crypto_latency_record(struct crypto_pkt_ctx **contexts,
+				  unsigned int count, enum crypto_path path)
+{
+	uint64_t *hist = crypto_latency[dp_lcore_id()][path];
+	uint64_t cycles, now = rte_rdtsc();
+	unsigned int i, b;
+
+	for (i = 0; i < count; i++) {
+		cycles = now - contexts[i]->enq_tsc;
+		b = cycles ? 64 - __builtin_clzll(cycles) : 0;
+		hist[RTE_MIN(b, CRYPTO_LATENCY_BUCKETS - 1)]++;
+	}
+}
+
+/*
+ * Process the burst queued for the xfrm on the forwarding thread, if
+ * the inline mode and the state of the pmd allow it.  Returns false if
+ * the burst should be queued to the pmd instead.
+ *
+ * Forwarding the packets may queue more, so this must only be called
+ * at the end of a burst, see crypto_send(), and not while a packet is
+ * being queued.
+ */
+bool crypto_inline_burst(struct crypto_pkt_buffer *cpb,
+			 enum crypto_xfrm xfrm)
+{
+	struct crypto_inline_usage *usage = &RTE_PER_LCORE(crypto_inline_usage);
+	enum crypto_inline_mode mode = CMM_LOAD_SHARED(crypto_inline_mode);
+	struct crypto_pkt_ctx *contexts[MAX_CRYPTO_PKT_BURST];
+	unsigned int i, count, total_bytes = 0;
+	struct crypto_pmd *pmd;
+	bool pinned_only;
+	bool pinned;
+	uint64_t start;
+
+	if (likely(mode == CRYPTO_INLINE_OFF))
+		return false;
+
+	/* Not a forwarding thread */
+	if (cpb != RTE_PER_LCORE(crypto_pkt_buffer))
+		return false;
+
+	start = rte_rdtsc();
+	if (start - usage->period_start >= crypto_inline_period) {
+		usage->period_start = start;
+		usage->cycles = 0;
+	}
+
+	pinned_only = (mode == CRYPTO_INLINE_PINNED ||
+		       usage->cycles >= crypto_inline_budget);
+	pmd = crypto_pmd_inline_begin(cpb->pmd_dev_id[xfrm], xfrm,
+				      pinned_only, &pinned);
+	if (!pmd)
+		return false;
+
+	/*
+	 * Take the burst off the queue first, as forwarding the packets
+	 * may queue more.
+	 */
+	count = cpb->local_q_count[xfrm];
+	memcpy(contexts, cpb->local_crypto_q[xfrm],
+	       count * sizeof(contexts[0]));
+	cpb->local_q_count[xfrm] = 0;
+
+	if (xfrm == CRYPTO_DECRYPT)
+		total_bytes = crypto_pmd_decrypt_burst(contexts, count);
+	else
+		for (i = 0; i < count; i++)
+			total_bytes += crypto_pmd_process_packet(contexts[i],
+								 xfrm);
+	crypto_mb_flush();
+
+	crypto_latency_record(contexts, count, CRYPTO_PATH_INLINE);
+
+	/*
+	 * Keep the pmd until the packets are forwarded, so that they
+	 * can't be overtaken by later packets for the same SAs.
+	 */
+	crypto_cb[xfrm].post_process(contexts, count);
+	crypto_pmd_inline_end(pmd, xfrm, count, total_bytes);
+
+	if (!pinned)
+		usage->cycles += rte_rdtsc() - start;
+	return true;
+}
+
 /*
  * PMD walker callback passed together with a PMD listhead, and called
  * back for each xfrm queue within each PMD.
  *
  * Returning false terminates the pmd  walk.
  */
-static bool crypto_pmd_walk_cb(int pmd_dev_id __unused, enum crypto_xfrm xfrm,
+static bool crypto_pmd_walk_cb(int pmd_dev_id, enum crypto_xfrm xfrm,
 			       struct rte_ring *pmd_queue,
 			       uint64_t *bytes,
 			       uint32_t *packets)
 {
 	struct crypto_pkt_ctx *contexts[MAX_CRYPTO_PKT_BURST];
 	unsigned int i, count, total_bytes = 0;
+	struct crypto_pmd *pmd;
 
 	if (!rte_ring_empty(pmd_queue)) {
+		/*
+		 * Held from before the dequeue until the packets are
+		 * forwarded, so that a forwarding thread sees either
+		 * the packets in the ring, or that the pmd is busy.
+		 */
+		pmd = crypto_pmd_lock(pmd_dev_id);
 		count = rte_ring_sc_dequeue_burst(pmd_queue,
 						  (void **)&contexts,
 						  MAX_CRYPTO_PKT_BURST,
@@ -1060,8 +1339,16 @@ static bool crypto_pmd_walk_cb(int pmd_dev_id __unused, enum crypto_xfrm xfrm,
 		for (i = 0; i < CRYPTO_PREFETCH_OFFSET && i < count; i++)
 			rte_prefetch0(contexts[i]);
 
-		/* Process the packets in the burst. */
-		for (i = 0; i + CRYPTO_PREFETCH_OFFSET < count; i++) {
+		/* Decrypt the packets in the burst, an SA at a time. */
+		if (xfrm == CRYPTO_DECRYPT) {
+			total_bytes = crypto_pmd_decrypt_burst(contexts, count);
+			i = count;
+		} else {
+			i = 0;
+		}
+
+		/* Encrypt the packets in the burst. */
+		for (; i + CRYPTO_PREFETCH_OFFSET < count; i++) {
 			rte_prefetch0(contexts[i + CRYPTO_PREFETCH_OFFSET]);
 			rte_prefetch0(
 				contexts[i + CRYPTO_PREFETCH_OFFSET - 1]->mbuf);
@@ -1077,7 +1364,12 @@ static bool crypto_pmd_walk_cb(int pmd_dev_id __unused, enum crypto_xfrm xfrm,
 								 xfrm);
 		}
 
+		/* Finish the packets queued to the burst engine */
+		crypto_mb_flush();
+
+		crypto_latency_record(contexts, count, CRYPTO_PATH_QUEUED);
 		crypto_cb[xfrm].post_process(contexts, count);
+		crypto_pmd_unlock(pmd);
 		*packets = count;
 		*bytes = total_bytes;
 	}
@@ -1301,6 +1593,93 @@ void crypto_show_summary(FILE *f)
 	jsonw_destroy(&wr);
 }
 
+static uint64_t crypto_path_packets(enum crypto_path path)
+{
+	uint64_t packets = 0;
+	unsigned int i, b;
+
+	FOREACH_DP_LCORE(i)
+		for (b = 0; b < CRYPTO_LATENCY_BUCKETS; b++)
+			packets += crypto_latency[i][path][b];
+	return packets;
+}
+
+static void crypto_show_latency(json_writer_t *wr, enum crypto_path path)
+{
+	uint64_t hist[CRYPTO_LATENCY_BUCKETS];
+	uint64_t hz = rte_get_tsc_hz();
+	unsigned int i, b;
+
+	memset(hist, 0, sizeof(hist));
+	FOREACH_DP_LCORE(i)
+		for (b = 0; b < CRYPTO_LATENCY_BUCKETS; b++)
+			hist[b] += crypto_latency[i][path][b];
+
+	jsonw_name(wr, crypto_path_names[path]);
+	jsonw_start_array(wr);
+	for (b = 0; b < CRYPTO_LATENCY_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		jsonw_start_object(wr);
+		jsonw_uint_field(wr, "min_ns",
+				 b ? (1ul << (b - 1)) * 1000000000ul / hz : 0);
+		jsonw_uint_field(wr, "packets", hist[b]);
+		jsonw_end_object(wr);
+	}
+	jsonw_end_array(wr);
+}
+
+/*
+ * Show or set the inline processing mode.  The show includes the latency
+ * histograms for the queued and inline paths.
+ */
+int crypto_engine_inline(FILE *f, const char *str)
+{
+	enum crypto_inline_mode mode;
+	enum crypto_path path;
+	json_writer_t *wr;
+
+	if (str) {
+		for (mode = 0; mode < CRYPTO_INLINE_MAX; mode++)
+			if (strcmp(str, crypto_inline_names[mode]) == 0)
+				break;
+		if (mode == CRYPTO_INLINE_MAX) {
+			fprintf(f, "Invalid inline setting\n");
+			return -1;
+		}
+		crypto_inline_period =
+			rte_get_tsc_hz() / 1000 * CRYPTO_INLINE_PERIOD_MS;
+		crypto_inline_budget =
+			crypto_inline_period * CRYPTO_INLINE_SHARE / 100;
+		CMM_STORE_SHARED(crypto_inline_mode, mode);
+		return 0;
+	}
+
+	wr = jsonw_new(f);
+	if (!wr)
+		return -1;
+
+	jsonw_pretty(wr, true);
+	jsonw_name(wr, "inline");
+	jsonw_start_object(wr);
+	jsonw_string_field(wr, "mode", crypto_inline_names[crypto_inline_mode]);
+	for (path = 0; path < CRYPTO_PATH_MAX; path++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "%s_packets",
+			 crypto_path_names[path]);
+		jsonw_uint_field(wr, name, crypto_path_packets(path));
+	}
+	jsonw_name(wr, "latency");
+	jsonw_start_object(wr);
+	for (path = 0; path < CRYPTO_PATH_MAX; path++)
+		crypto_show_latency(wr, path);
+	jsonw_end_object(wr);
+	jsonw_end_object(wr);
+	jsonw_destroy(&wr);
+	return 0;
+}
+
 /* runs in the context of a crypto thread */
 void crypto_expire_request(uint32_t spi, uint32_t reqid,
 			   uint8_t proto, uint8_t hard)
@@ -86,6 +86,8 @@ void crypto_show_pmd(FILE *f);
 void crypto_sadb_show_spi_mapping(FILE *f, vrfid_t vrfid);
 int crypto_engine_set(FILE *f, const char *str);
 int crypto_engine_probe(FILE *f);
+int crypto_engine_burst(FILE *f, const char *str);
+int crypto_engine_inline(FILE *f, const char *str);
 void crypto_show_cache(FILE *f, const char *str);
 struct cds_lfht *pr_cache_init(void);
 unsigned long hash_xfrm_address(const xfrm_address_t *addr,
@@ -32,6 +32,7 @@
 #include "../in_cksum.h"
 #include "compiler.h"
 #include "crypto_internal.h"
+#include "crypto_mb.h"
 #include "in6.h"
 #include "json_writer.h"
 #include "util.h"
@@ -865,6 +866,49 @@ const struct crypto_session_operations null_hmac_openssl_sops = {
 	.set_iv = openssl_session_set_iv,
 };
 
+/*
+ * Burst engine, for AES-CBC.  The OpenSSL cipher context is still set up,
+ * for decryption and for packets the burst engine does not take.
+ */
+static int burst_session_set_enc_key(struct crypto_session *ctx,
+				     unsigned int length,
+				     const char key[])
+{
+	if (openssl_session_set_enc_key(ctx, length, key))
+		return -1;
+
+	crypto_mb_key_free(ctx->mb_key);
+	ctx->mb_key = crypto_mb_key_create((const uint8_t *)key, length);
+	if (!ctx->mb_key) {
+		ENGINE_ERR("Burst engine key setup failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int burst_session_generate_iv(struct crypto_session *ctx, char iv[])
+{
+	crypto_mb_generate_iv(ctx, (uint8_t *)iv);
+	return 0;
+}
+
+const struct crypto_session_operations burst_openssl_sops = {
+	.decrypt_vops = &default_decrypt_openssl_vops,
+	.encrypt_vops = &default_encrypt_openssl_vops,
+	.set_enc_key = burst_session_set_enc_key,
+	.set_auth_key = openssl_session_set_auth_key,
+	.generate_iv = burst_session_generate_iv,
+};
+
+const struct crypto_session_operations burst_null_hmac_openssl_sops = {
+	.decrypt_vops = &null_hmac_decrypt_openssl_vops,
+	.encrypt_vops = &null_hmac_encrypt_openssl_vops,
+	.set_enc_key = burst_session_set_enc_key,
+	.set_auth_key = openssl_null_hmac_set_auth_key,
+	.generate_iv = burst_session_generate_iv,
+};
+
 static int rfc4106_session_set_enc_key(struct crypto_session *ctx,
 				       unsigned int length,
 				       const char key[])
@@ -940,6 +984,10 @@ crypto_session_create(const struct xfrm_algo *algo_crypt,
 
 		if (strcmp("rfc4106(gcm(aes))", algo_crypt->alg_name) == 0)
 			ctx->s_ops = &rfc4106_openssl_sops;
+		else if (strcmp("cbc(aes)", algo_crypt->alg_name) == 0 &&
+			 crypto_mb_enabled() && crypto_mb_supported())
+			ctx->s_ops = algo_auth ? &burst_openssl_sops :
+				&burst_null_hmac_openssl_sops;
 	}
 
 	if  (algo_auth) {
@@ -967,6 +1015,7 @@ void crypto_session_destroy(struct crypto_session *ctx)
 		HMAC_CTX_free(ctx->hmac_ctx);
 	if (ctx->ctx)
 		EVP_CIPHER_CTX_free(ctx->ctx);
+	crypto_mb_key_free(ctx->mb_key);
 
 	free(ctx);
 }
@@ -1056,8 +1105,6 @@ int cipher_setup_ctx(const struct xfrm_algo *algo_crypt,
 	}
 
 	sa->seq = 0;
-	sa->replay_bitmap = 0;
-	sa->replay_window = sa_info->replay_window;
 
 	sa->flags = sa_info->flags;
 	sa->extra_flags = extra_flags;
@@ -1153,6 +1200,8 @@ void crypto_engine_summary(json_writer_t *wr, const struct sadb_sa *sa)
 
 	jsonw_string_field(wr, "digest", sa->session->md_name ?
 			   sa->session->md_name : "null");
+	jsonw_string_field(wr, "engine", sa->session->mb_key ?
+			   "burst" : "openssl");
 	jsonw_uint_field(wr, "replay_window", sa->replay_window);
 }
 
@@ -20,6 +20,7 @@
 #include <rte_log.h>
 #include <rte_memcpy.h>
 #include <rte_mbuf.h>
+#include <rte_spinlock.h>
 #include <sys/queue.h>
 
 #include "crypto_main.h"
@@ -102,6 +103,8 @@ OPENSSL_init_crypto(uint32_t opts __attribute__ ((__unused__)),
 
 #define CRYPTO_PMD_INVALID_ID -1
 
+struct crypto_mb_key;
+struct crypto_pmd;
 struct crypto_session_operations;
 struct crypto_visitor_operations;
 
@@ -120,6 +123,7 @@ struct crypto_session {
 	uint16_t iv_len;        /* in bytes */
 	EVP_CIPHER_CTX *ctx;
 	HMAC_CTX *hmac_ctx;
+	struct crypto_mb_key *mb_key;	/* burst engine, if used */
 	uint16_t nonce_len;     /* in bytes */
 	char iv[EVP_MAX_IV_LENGTH];
 	/*
@@ -188,9 +192,11 @@ struct sadb_sa {
 	uint32_t seq_drop;
 	int del_pmd_dev_id;
 	/* Cacheline 3 boundary */
-	uint8_t replay_window;
+	uint32_t replay_window;
+	uint32_t replay_mask;
+	rte_spinlock_t replay_lock;
 	uint8_t pending_del;
-	uint64_t replay_bitmap;
+	uint64_t *replay_bmp;
 	struct ip6_hdr ip6_hdr;
 	struct ifnet *feat_attach_ifp;
 	vrfid_t overlay_vrf_id;
@@ -558,6 +564,12 @@ void crypto_remove_sa_from_pmd(int crypto_dev_id, enum crypto_xfrm xfrm,
 			       bool pending);
 int crypto_allocate_pmd(enum crypto_xfrm xfrm);
 struct rte_ring *crypto_pmd_get_q(int dev_id, enum crypto_xfrm xfrm);
+struct crypto_pmd *crypto_pmd_lock(int dev_id);
+void crypto_pmd_unlock(struct crypto_pmd *pmd);
+struct crypto_pmd *crypto_pmd_inline_begin(int dev_id, enum crypto_xfrm xfrm,
+					   bool pinned_only, bool *pinned);
+void crypto_pmd_inline_end(struct crypto_pmd *pmd, enum crypto_xfrm xfrm,
+			   uint32_t packets, uint64_t bytes);
 typedef bool (*crypto_pmd_walker_cb)(int pmd_dev_id, enum crypto_xfrm,
 				     struct rte_ring *,
 				     uint64_t *bytes,
@@ -59,15 +59,26 @@ RTE_DECLARE_PER_LCORE(struct crypto_pkt_buffer *, crypto_pkt_buffer);
 
 int crypto_send_burst(struct crypto_pkt_buffer *cpb,
 		      enum crypto_xfrm xfrm, bool drop);
+bool crypto_inline_burst(struct crypto_pkt_buffer *cpb,
+			 enum crypto_xfrm xfrm);
 
+/*
+ * Send the packets queued on the thread at the end of a burst.  They
+ * are processed inline if the inline mode allows, and anything queued
+ * while forwarding them is sent to the pmd.
+ */
 static inline void crypto_send(struct crypto_pkt_buffer *cpb)
 {
 	uint32_t q;
 	for (q = MIN_CRYPTO_XFRM;
-	     q < MAX_CRYPTO_XFRM; q++)
-		if (cpb->local_q_count[q])
-			(void)crypto_send_burst(cpb, (enum crypto_xfrm)q,
-						false);
+	     q < MAX_CRYPTO_XFRM; q++) {
+		if (!cpb->local_q_count[q])
+			continue;
+		if (crypto_inline_burst(cpb, (enum crypto_xfrm)q) &&
+		    !cpb->local_q_count[q])
+			continue;
+		(void)crypto_send_burst(cpb, (enum crypto_xfrm)q, false);
+	}
 }
 
 void dp_crypto_per_lcore_init(unsigned int lcore_id);
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#include <immintrin.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <rte_common.h>
+#include <rte_cpuflags.h>
+#include <rte_per_lcore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "crypto_internal.h"
+#include "crypto_main.h"
+#include "crypto_mb.h"
+#include "util.h"
+#include "vplane_debug.h"
+#include "vplane_log.h"
+
+#define MB_ERR(args...)				\
+	DP_DEBUG(CRYPTO, ERR, ENGINE, args)
+
+#define MB_BLOCK	16
+#define MB_MAX_ROUNDS	14
+
+/*
+ * Number of packets encrypted at once.  This needs to be enough to cover
+ * the latency of an AES round, so that a round is started on every cycle
+ * the AES unit can accept one.
+ */
+#define MB_LANES	8
+
+struct crypto_mb_key {
+	__m128i		rk[MB_MAX_ROUNDS + 1];
+	unsigned int	rounds;
+	uint64_t	iv_salt;
+	uint64_t	iv_count;
+};
+
+struct crypto_mb_job {
+	struct crypto_session	*session;
+	uint8_t			*auth;
+	uint8_t			*iv;
+	uint8_t			*icv;
+	uint32_t		len;
+};
+
+struct crypto_mb_queue {
+	unsigned int		count;
+	struct crypto_mb_job	jobs[MAX_CRYPTO_PKT_BURST];
+};
+
+static RTE_DEFINE_PER_LCORE(struct crypto_mb_queue, crypto_mb_q);
+
+static bool crypto_mb_enable;
+
+bool crypto_mb_supported(void)
+{
+	return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AES) > 0;
+}
+
+void crypto_mb_set_enabled(bool enable)
+{
+	crypto_mb_enable = enable;
+}
+
+bool crypto_mb_enabled(void)
+{
+	return crypto_mb_enable;
+}
+
+/*
+ * SubWord(w), or SubWord(RotWord(w)), of a key schedule word.  The key
+ * generation assist instruction does both for its second 32-bit word.
+ */
+static __attribute__((target("aes"))) uint32_t
+mb_sub_word(uint32_t w, bool rot)
+{
+	__m128i x = _mm_aeskeygenassist_si128(_mm_set_epi32(0, 0, w, 0), 0);
+
+	return _mm_cvtsi128_si32(rot ? _mm_srli_si128(x, 4) : x);
+}
+
+/* FIPS-197 key expansion, for any of the three key sizes */
+static __attribute__((target("aes"))) void
+mb_expand_key(struct crypto_mb_key *mbk, const uint8_t *key,
+	      unsigned int nk)
+{
+	uint32_t w[4 * (MB_MAX_ROUNDS + 1)];
+	unsigned int i, nw = 4 * (mbk->rounds + 1);
+	uint32_t t, rcon = 1;
+
+	memcpy(w, key, nk * sizeof(uint32_t));
+	for (i = nk; i < nw; i++) {
+		t = w[i - 1];
+		if (i % nk == 0) {
+			t = mb_sub_word(t, true) ^ rcon;
+			rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x11b : 0);
+		} else if (nk > 6 && i % nk == 4) {
+			t = mb_sub_word(t, false);
+		}
+		w[i] = w[i - nk] ^ t;
+	}
+	memcpy(mbk->rk, w, nw * sizeof(uint32_t));
+}
+
+struct crypto_mb_key *crypto_mb_key_create(const uint8_t *key,
+					   unsigned int key_len)
+{
+	struct crypto_mb_key *mbk;
+
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return NULL;
+
+	if (posix_memalign((void **)&mbk, RTE_CACHE_LINE_SIZE, sizeof(*mbk)))
+		return NULL;
+
+	mbk->rounds = key_len / 4 + 6;
+	mb_expand_key(mbk, key, key_len / 4);
+	mbk->iv_count = 0;
+	if (RAND_bytes((unsigned char *)&mbk->iv_salt,
+		       sizeof(mbk->iv_salt)) != 1) {
+		free(mbk);
+		return NULL;
+	}
+	return mbk;
+}
+
+void crypto_mb_key_free(struct crypto_mb_key *mbk)
+{
+	free(mbk);
+}
+
+static __attribute__((target("aes"))) __m128i
+mb_encrypt_block(const struct crypto_mb_key *mbk, __m128i x)
+{
+	unsigned int r;
+
+	x = _mm_xor_si128(x, mbk->rk[0]);
+	for (r = 1; r < mbk->rounds; r++)
+		x = _mm_aesenc_si128(x, mbk->rk[r]);
+	return _mm_aesenclast_si128(x, mbk->rk[mbk->rounds]);
+}
+
+void crypto_mb_generate_iv(struct crypto_session *session, uint8_t *iv)
+{
+	struct crypto_mb_key *mbk = session->mb_key;
+	__m128i x;
+
+	x = _mm_set_epi64x(++mbk->iv_count, mbk->iv_salt);
+	_mm_storeu_si128((__m128i *)iv, mb_encrypt_block(mbk, x));
+}
+
+int crypto_mb_enqueue(struct crypto_session *session, uint8_t *auth,
+		      uint8_t *iv, uint32_t len, uint8_t *icv)
+{
+	struct crypto_mb_queue *q = &RTE_PER_LCORE(crypto_mb_q);
+	struct crypto_mb_job *job;
+
+	if (unlikely(len % MB_BLOCK))
+		return -1;
+
+	if (unlikely(q->count == ARRAY_SIZE(q->jobs)))
+		crypto_mb_flush();
+
+	job = &q->jobs[q->count++];
+	job->session = session;
+	job->auth = auth;
+	job->iv = iv;
+	job->icv = icv;
+	job->len = len;
+	return 0;
+}
+
+/*
+ * Encrypt the given number of blocks in each of nl lanes, with the rounds
+ * of the lanes interleaved.  This is inlined with constant lanes and rounds
+ * so that the loops are unrolled.
+ */
+static ALWAYS_INLINE __attribute__((target("aes"))) void
+mb_cbc_blocks(const __m128i **rk, __m128i **p, __m128i *x,
+	      unsigned int nl, unsigned int rounds, uint32_t blocks)
+{
+	unsigned int l, r;
+
+	while (blocks--) {
+		for (l = 0; l < nl; l++)
+			x[l] = _mm_xor_si128(_mm_xor_si128(
+				x[l], _mm_loadu_si128(p[l])), rk[l][0]);
+		for (r = 1; r < rounds; r++)
+			for (l = 0; l < nl; l++)
+				x[l] = _mm_aesenc_si128(x[l], rk[l][r]);
+		for (l = 0; l < nl; l++) {
+			x[l] = _mm_aesenclast_si128(x[l], rk[l][rounds]);
+			_mm_storeu_si128(p[l]++, x[l]);
+		}
+	}
+}
+
+#define MB_CBC_BLOCKS(rounds)						\
+static __attribute__((target("aes"))) void				\
+mb_cbc_blocks_##rounds(const __m128i **rk, __m128i **p, __m128i *x,	\
+		       unsigned int nl, uint32_t blocks)		\
+{									\
+	if (nl == MB_LANES)						\
+		mb_cbc_blocks(rk, p, x, MB_LANES, rounds, blocks);	\
+	else								\
+		mb_cbc_blocks(rk, p, x, nl, rounds, blocks);		\
+}
+
+MB_CBC_BLOCKS(10)
+MB_CBC_BLOCKS(12)
+MB_CBC_BLOCKS(14)
+
+/*
+ * CBC encrypt the queued jobs using the given number of rounds, MB_LANES
+ * at a time.  Each lane works through one job.  The lanes are run until
+ * the shortest job is done, then finished lanes are refilled with the next
+ * job, or dropped when there are none left.
+ */
+static void
+mb_cbc_encrypt(struct crypto_mb_job *jobs, unsigned int count,
+	       unsigned int rounds)
+{
+	const __m128i *rk[MB_LANES];
+	uint32_t left[MB_LANES];
+	__m128i *p[MB_LANES];
+	__m128i x[MB_LANES];
+	unsigned int next = 0, nl = 0, l, n;
+	struct crypto_mb_key *mbk;
+	uint32_t blocks;
+
+	for (;;) {
+		/* Fill the empty lanes */
+		while (nl < MB_LANES && next < count) {
+			struct crypto_mb_job *job = &jobs[next++];
+
+			mbk = job->session->mb_key;
+			if (mbk->rounds != rounds || job->len == 0)
+				continue;
+			rk[nl] = mbk->rk;
+			p[nl] = (__m128i *)job->iv;
+			x[nl] = _mm_loadu_si128(p[nl]++);
+			left[nl] = job->len / MB_BLOCK;
+			nl++;
+		}
+		if (nl == 0)
+			break;
+
+		blocks = left[0];
+		for (l = 1; l < nl; l++)
+			blocks = RTE_MIN(blocks, left[l]);
+
+		if (rounds == 10)
+			mb_cbc_blocks_10(rk, p, x, nl, blocks);
+		else if (rounds == 12)
+			mb_cbc_blocks_12(rk, p, x, nl, blocks);
+		else
+			mb_cbc_blocks_14(rk, p, x, nl, blocks);
+
+		/* Drop the finished lanes, keeping the others in order */
+		for (l = 0, n = 0; l < nl; l++) {
+			left[l] -= blocks;
+			if (left[l] == 0)
+				continue;
+			rk[n] = rk[l];
+			p[n] = p[l];
+			x[n] = x[l];
+			left[n] = left[l];
+			n++;
+		}
+		nl = n;
+	}
+}
+
+static int mb_hmac(struct crypto_mb_job *job)
+{
+	struct crypto_session *s = job->session;
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len;
+	size_t len;
+
+	if (!s->digest_len)
+		return 0;
+
+	/* ESP header, IV and ciphertext */
+	len = (job->iv - job->auth) + s->iv_len + job->len;
+
+	if (!HMAC_Init_ex(s->hmac_ctx, NULL, 0, NULL, NULL) ||
+	    !HMAC_Update(s->hmac_ctx, job->auth, len) ||
+	    !HMAC_Final(s->hmac_ctx, md, &md_len))
+		return -1;
+
+	memcpy(job->icv, md, s->digest_len);
+	return 0;
+}
+
+void crypto_mb_flush(void)
+{
+	struct crypto_mb_queue *q = &RTE_PER_LCORE(crypto_mb_q);
+	unsigned int i, rounds, mask = 0;
+
+	if (!q->count)
+		return;
+
+	for (i = 0; i < q->count; i++)
+		mask |= 1u << q->jobs[i].session->mb_key->rounds;
+
+	for (rounds = 10; rounds <= MB_MAX_ROUNDS; rounds += 2)
+		if (mask & (1u << rounds))
+			mb_cbc_encrypt(q->jobs, q->count, rounds);
+
+	for (i = 0; i < q->count; i++) {
+		/*
+		 * The action for the packet has already been set, so
+		 * it can not be dropped here.  A zero ICV ensures the
+		 * peer drops it.
+		 */
+		if (unlikely(mb_hmac(&q->jobs[i]) < 0)) {
+			MB_ERR("HMAC failed\n");
+			memset(q->jobs[i].icv, 0,
+			       q->jobs[i].session->digest_len);
+		}
+	}
+
+	q->count = 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef CRYPTO_MB_H
+#define CRYPTO_MB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct crypto_session;
+
+/*
+ * Burst (multi-buffer) crypto engine
+ *
+ * AES-CBC encryption is serial within a packet, as each block depends on
+ * the previous ciphertext block, so a single packet leaves most of the
+ * AES unit idle.  The burst engine instead queues the packets of a burst
+ * and encrypts several at once, one block from each in turn, using AES-NI.
+ * The HMAC is then generated for each packet with OpenSSL.
+ *
+ * Only AES-CBC encryption of single segment packets is queued.  Everything
+ * else, including decryption which OpenSSL already runs in parallel within
+ * a packet, uses the per packet crypto chain.
+ *
+ * The CBC IV of an SA using the burst engine does not depend on the
+ * previous packet.  It is a per SA random salt and counter, encrypted with
+ * the SA key, as in NIST SP 800-38A, Appendix C.
+ */
+struct crypto_mb_key;
+
+/* Can the burst engine be used on this CPU? */
+bool crypto_mb_supported(void);
+
+/* Enable or disable the burst engine for SAs created from now on */
+void crypto_mb_set_enabled(bool enable);
+bool crypto_mb_enabled(void);
+
+/*
+ * Expand an AES key for the burst engine.  key_len is in bytes.  Returns
+ * NULL if the key length is not supported or out of memory.
+ */
+struct crypto_mb_key *crypto_mb_key_create(const uint8_t *key,
+					   unsigned int key_len);
+void crypto_mb_key_free(struct crypto_mb_key *mbk);
+
+/* Write the next IV for the session to iv */
+void crypto_mb_generate_iv(struct crypto_session *session, uint8_t *iv);
+
+/*
+ * Queue a packet for encryption and authentication.
+ *
+ * auth - ESP header, the start of the authenticated data
+ * iv   - IV, immediately followed by the text to be encrypted in place
+ * len  - length of the text, a multiple of the block size
+ * icv  - where the ICV is written
+ *
+ * Returns -1 if the packet can not be queued, and should be processed
+ * by the crypto chain instead.
+ */
+int crypto_mb_enqueue(struct crypto_session *session, uint8_t *auth,
+		      uint8_t *iv, uint32_t len, uint8_t *icv);
+
+/* Process all packets queued by this thread */
+void crypto_mb_flush(void);
+
+#endif /* CRYPTO_MB_H */
@@ -11,9 +11,11 @@
 #include <rte_malloc.h>
 #include <rte_memory.h>
 #include <rte_ring.h>
+#include <rte_spinlock.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <urcu/list.h>
 #include <urcu/uatomic.h>
 
@@ -21,9 +23,11 @@
 #include "crypto.h"
 #include "crypto_internal.h"
 #include "crypto_main.h"
+#include "crypto_mb.h"
 #include "json_writer.h"
 #include "main.h"
 #include "urcu.h"
+#include "util.h"
 #include "vplane_debug.h"
 #include "vplane_log.h"
 
@@ -62,7 +66,14 @@ struct crypto_pmd {
 	 * the other pmd fields are read by the fast path theads
 	 */
 	char *padding[0] __rte_cache_aligned;
+	/*
+	 * Held while packets for the pmd are being processed, either
+	 * by the engine or inline by a forwarding thread, so that the
+	 * SAs of the pmd are only ever used by one thread at a time.
+	 */
+	rte_spinlock_t lock;
 	struct pmd_counters cnt[MAX_CRYPTO_XFRM];
+	struct pmd_counters inline_cnt[MAX_CRYPTO_XFRM];
 	struct rate_stats rates[MAX_CRYPTO_XFRM];
 	unsigned int sa_cnt_per_type[MAX_CRYPTO_XFRM];
 	unsigned int pending_remove[MAX_CRYPTO_XFRM];
@@ -207,6 +218,7 @@ crypto_pmd_find_or_create(enum crypto_xfrm xfrm)
 	}
 
 	CDS_INIT_LIST_HEAD(&pmd->next);
+	rte_spinlock_init(&pmd->lock);
 
 	pmd->q_pair.q[CRYPTO_ENCRYPT] =
 		crypto_create_ring("pmd-en-q", PMD_RING_SIZE,
@@ -307,6 +319,34 @@ int crypto_engine_set(FILE *f, const char *str)
 
 	return crypto_cpu_describe(f, num, tmp_sticky);
 }
+
+/*
+ * Select the burst engine for AES-CBC SAs created from now on.  Existing
+ * SAs keep the engine they were created with.
+ */
+int crypto_engine_burst(FILE *f, const char *str)
+{
+	if (!str) {
+		fprintf(f, "burst engine %s\n",
+			crypto_mb_enabled() ? "on" : "off");
+		return 0;
+	}
+
+	if (strcmp(str, "on") == 0) {
+		if (!crypto_mb_supported()) {
+			fprintf(f, "burst engine needs AES-NI\n");
+			return -1;
+		}
+		crypto_mb_set_enabled(true);
+	} else if (strcmp(str, "off") == 0) {
+		crypto_mb_set_enabled(false);
+	} else {
+		fprintf(f, "Invalid burst engine setting\n");
+		return -1;
+	}
+
+	return 0;
+}
 /*
  * Return a PMD to be used by the caller, either reusing an
  * existing PMD or create a new one. If a new one is created
@@ -445,6 +485,66 @@ struct rte_ring *crypto_pmd_get_q(int dev_id, enum crypto_xfrm xfrm)
 	return pmd->q_pair.q[xfrm];
 }
 
+/*
+ * Lock the pmd for processing its packets.  Returns the pmd, to be
+ * passed to crypto_pmd_unlock(), or NULL if it no longer exists.
+ */
+struct crypto_pmd *crypto_pmd_lock(int dev_id)
+{
+	struct crypto_pmd *pmd;
+	bool err;
+
+	pmd = crypto_dev_id_to_pmd(dev_id, &err);
+	if (pmd)
+		rte_spinlock_lock(&pmd->lock);
+	return pmd;
+}
+
+void crypto_pmd_unlock(struct crypto_pmd *pmd)
+{
+	if (pmd)
+		rte_spinlock_unlock(&pmd->lock);
+}
+
+/*
+ * Take the pmd for processing a burst on the calling thread.  This
+ * fails if the pmd is busy, or if it has packets waiting in its ring
+ * for the xfrm, as processing the burst now would then reorder it with
+ * those packets.  If pinned_only is set it also fails unless the pmd is
+ * attached to the calling lcore.  pinned is set to whether it is.
+ */
+struct crypto_pmd *crypto_pmd_inline_begin(int dev_id, enum crypto_xfrm xfrm,
+					   bool pinned_only, bool *pinned)
+{
+	struct crypto_pmd *pmd;
+	bool err;
+
+	pmd = crypto_dev_id_to_pmd(dev_id, &err);
+	if (!pmd)
+		return NULL;
+
+	*pinned = (pmd->lcore == dp_lcore_id());
+	if (pinned_only && !*pinned)
+		return NULL;
+
+	if (!rte_spinlock_trylock(&pmd->lock))
+		return NULL;
+
+	if (!rte_ring_empty(pmd->q_pair.q[xfrm])) {
+		rte_spinlock_unlock(&pmd->lock);
+		return NULL;
+	}
+	return pmd;
+}
+
+void crypto_pmd_inline_end(struct crypto_pmd *pmd, enum crypto_xfrm xfrm,
+			   uint32_t packets, uint64_t bytes)
+{
+	pmd->inline_cnt[xfrm].packets += packets;
+	pmd->inline_cnt[xfrm].bytes += bytes;
+	rte_spinlock_unlock(&pmd->lock);
+}
+
 /*
  * crypto pmd processing loop.
  */
@@ -505,6 +605,10 @@ crypto_show_pmd_counters(json_writer_t *wr, struct crypto_pmd *pmd)
 		packets = pmd->cnt[q].packets;
 		jsonw_uint_field(wr, "bytes", bytes);
 		jsonw_uint_field(wr, "packets", packets);
+		jsonw_uint_field(wr, "inline_bytes",
+				 pmd->inline_cnt[q].bytes);
+		jsonw_uint_field(wr, "inline_packets",
+				 pmd->inline_cnt[q].packets);
 		bytes = pmd->rates[q].byte_rate;
 		packets = pmd->rates[q].packet_rate;
 		jsonw_uint_field(wr, "bytes_per_sec", bytes);
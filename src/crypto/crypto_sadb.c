@@ -678,6 +678,7 @@ struct sadb_sa *sadb_lookup_inbound(uint32_t spi)
 static void sadb_sa_destroy(struct sadb_sa *sa)
 {
 	cipher_teardown_ctx(sa);
+	esp_replay_free(sa);
 	free(sa);
 }
 
@@ -698,7 +699,7 @@ void crypto_sadb_new_sa(const struct xfrm_usersa_info *sa_info,
 			const struct xfrm_algo_auth *auth_algo,
 			const struct xfrm_encap_tmpl *tmpl,
 			uint32_t mark_val, uint32_t extra_flags,
-			vrfid_t vrf_id)
+			uint32_t replay_window, vrfid_t vrf_id)
 {
 	const struct xfrm_lifetime_cfg *lft = &sa_info->lft;
 	struct sadb_sa *sa, *retiring_sa;
@@ -734,7 +735,7 @@ void crypto_sadb_new_sa(const struct xfrm_usersa_info *sa_info,
 	sa->overlay_vrf_id = vrf_id;
 
 	if (sa_info->family == AF_INET) {
-		if (is_local_ipv4(VRF_DEFAULT_ID, sa_info->id.daddr.a4))
+		if (is_local_ipv4_ctrl(VRF_DEFAULT_ID, sa_info->id.daddr.a4))
 			sa->dir = CRYPTO_DIR_IN;
 		else
 			sa->dir = CRYPTO_DIR_OUT;
@@ -750,6 +751,12 @@ void crypto_sadb_new_sa(const struct xfrm_usersa_info *sa_info,
 
 	CDS_INIT_LIST_HEAD(&sa->peer_links);
 
+	if (esp_replay_init(sa, replay_window) < 0) {
+		SADB_ERR("Failed to allocate SA replay window\n");
+		free(sa);
+		return;
+	}
+
 	if (cipher_setup_ctx(crypto_algo, auth_algo, sa_info, tmpl,
 			     sa, extra_flags))
 		sa->blocked = true;
@@ -28,7 +28,7 @@ void crypto_sadb_new_sa(const struct xfrm_usersa_info *sa_info,
 			const struct xfrm_algo_auth *auth_algo,
 			const struct xfrm_encap_tmpl *tmpl,
 			uint32_t mark_val, uint32_t extra_flags,
-			vrfid_t vrf_id);
+			uint32_t replay_window, vrfid_t vrf_id);
 
 void crypto_sadb_del_sa(const struct xfrm_usersa_info *sa_info, vrfid_t vrfid);
 
@@ -21,11 +21,15 @@
 #include <rte_log.h>
 #include <rte_memcpy.h>
 #include <rte_mbuf.h>
+#include <rte_spinlock.h>
+#include <stdlib.h>
 
 #include "compiler.h"
 #include "crypto/crypto_sadb.h"
 #include "in6.h"
 #include "ip_funcs.h"
+#include "urcu.h"
+#include "util.h"
 #include "vplane_log.h"
 #include "vrf.h"
 
@@ -37,6 +41,7 @@
 #include "../pktmbuf.h"
 #include "crypto.h"
 #include "crypto_internal.h"
+#include "crypto_mb.h"
 #include "esp.h"
 
 struct ifnet;
@@ -188,84 +193,197 @@ uint16_t esp_payload_padded_len(const struct crypto_overhead *overhead,
 }
 
 /*
- * Replay detection is implemented using a sliding window. We remember
- * the highest sequence number so far received. To pass the check, a
- * new packet must either
+ * Replay detection is implemented using a sliding window, as in RFC
+ * 6479.  We remember the highest sequence number so far received. To
+ * pass the check, a new packet must either
  *
  *   have a higher sequence number than the stored number
  *
  *   OR
  *
- *   be within replay_window_size of the stored sequence number
+ *   be within replay_window of the stored sequence number
  *
  *   AND
  *
  *   not have been previously checked and accepted [by
  *   esp_replay_advance]
  *
- * we detect previously received sequence numbers using a bitmask. The
- * MSB of the bitmask corresponds to the stored highest sequence
- * number so far received. Less significant bits correspond to
- * sequence numbers S in the range:
- *
- * highest_received >= S > (highest_received - replay_window_size)
+ * We detect previously received sequence numbers using a ring of 64 bit
+ * buckets.  Sequence number S is bit (S % 64) of bucket (S / 64) modulo
+ * the number of buckets, so bits never move.  There is always at least
+ * one more bucket than is needed to cover the window, so when the window
+ * advances only the buckets it moves into have to be cleared, a bucket
+ * at a time.  Both the check and the advance are O(1) in the window size.
  *
+ * The check is lock free, so it may pass a packet that another thread is
+ * accepting at the same time.  The advance, which is done only after the
+ * ICV has been verified, is under the replay lock of the SA and repeats
+ * the check, so only one of the two is accepted.
  */
-int esp_replay_check(const uint8_t *esp,
-		     const struct sadb_sa *sa)
+#define REPLAY_BUCKET_SHIFT	6
+#define REPLAY_BUCKET_BITS	(1u << REPLAY_BUCKET_SHIFT)
+#define REPLAY_WINDOW_MAX	32768	/* As for Linux xfrm */
+
+int esp_replay_init(struct sadb_sa *sa, uint32_t replay_window)
 {
-	const uint32_t replay_window = sa->replay_window;
-	const uint32_t pkt_seq = ntohl(*(const uint32_t *)(esp+4));
-	uint32_t delta;
+	uint32_t buckets;
 
-	if (unlikely(!pkt_seq))
+	rte_spinlock_init(&sa->replay_lock);
+	sa->replay_bmp = NULL;
+	sa->replay_mask = 0;
+	sa->replay_window = RTE_MIN(replay_window, REPLAY_WINDOW_MAX);
+	if (!sa->replay_window)
+		return 0;
+
+	buckets = rte_align32pow2(RTE_ALIGN_CEIL(sa->replay_window,
+						 REPLAY_BUCKET_BITS) /
+				  REPLAY_BUCKET_BITS + 1);
+	sa->replay_bmp = zmalloc_aligned(buckets * sizeof(uint64_t));
+	if (!sa->replay_bmp)
+		return -ENOMEM;
+	sa->replay_mask = buckets - 1;
+	return 0;
+}
+
+void esp_replay_free(struct sadb_sa *sa)
+{
+	free(sa->replay_bmp);
+	sa->replay_bmp = NULL;
+}
+
+static ALWAYS_INLINE uint64_t *
+esp_replay_bucket(const struct sadb_sa *sa, uint32_t seq)
+{
+	return &sa->replay_bmp[(seq >> REPLAY_BUCKET_SHIFT) & sa->replay_mask];
+}
+
+static ALWAYS_INLINE uint64_t esp_replay_bit(uint32_t seq)
+{
+	return 1ull << (seq & (REPLAY_BUCKET_BITS - 1));
+}
+
+static ALWAYS_INLINE int
+esp_replay_check_seq(const struct sadb_sa *sa, uint32_t top, uint32_t seq)
+{
+	if (unlikely(!seq))
 		return -1; /* Invalid seq in packet. Auditable event? */
 
-	if (likely(pkt_seq > sa->seq))
+	if (likely(seq > top))
 		return 0;
 
-	delta = sa->seq - pkt_seq;
-
-	if (delta >= replay_window)
+	if (top - seq >= sa->replay_window)
 		return -2; /* Wrap or replay. Auditable event? */
 
-	if (sa->replay_bitmap & (1U << delta))
+	if (*esp_replay_bucket(sa, seq) & esp_replay_bit(seq))
 		return -3; /* Replay. Auditable event? */
 
 	return 0;
 }
 
+int esp_replay_check(const uint8_t *esp,
+		     const struct sadb_sa *sa)
+{
+	const uint32_t pkt_seq = ntohl(*(const uint32_t *)(esp+4));
+
+	return esp_replay_check_seq(sa, CMM_LOAD_SHARED(sa->seq), pkt_seq);
+}
+
 /*
- * The most significant bit in the mask represents the right hand edge
- * of the sliding window. As the window moves, the bitmask is shifted
- * left. If a packet is received with a sequence number more than
- * replay_window ahead of the current right hand edge, then the
- * bitmask is cleared, and a single bit set to indicate that we've
- * started afresh.
+ * Check a burst of up to 64 sequence numbers, in host byte order, for
+ * one SA.  Bit i of the result is set if seq[i] fails the check.  The
+ * loop has no data dependent branches.  Duplicates within the burst all
+ * pass, and are caught when the window is advanced.
  */
-void esp_replay_advance(const uint8_t *esp,
-			struct sadb_sa *sa)
+uint64_t esp_replay_check_burst(const struct sadb_sa *sa,
+				const uint32_t seq[], unsigned int count)
 {
-	const uint32_t replay_window = sa->replay_window;
-	uint32_t delta;
+	const uint32_t top = CMM_LOAD_SHARED(sa->seq);
+	uint64_t fail = 0;
+	unsigned int i;
+	bool old, seen;
 
-	if (unlikely(!replay_window))
-		return;
+	if (!sa->replay_window)
+		return 0;
 
-	const uint32_t pkt_seq = ntohl(*(const uint32_t *)(esp+4));
+	for (i = 0; i < RTE_MIN(count, 64u); i++) {
+		old = (top - seq[i] >= sa->replay_window);
+		seen = (*esp_replay_bucket(sa, seq[i]) &
+			esp_replay_bit(seq[i])) != 0;
+		fail |= (uint64_t)((seq[i] == 0) |
+				   ((seq[i] <= top) & (old | seen))) << i;
+	}
+	return fail;
+}
 
-	if (pkt_seq > sa->seq) {
-		delta = pkt_seq - sa->seq;
-		if (delta < replay_window)
-			sa->replay_bitmap =
-				((sa->replay_bitmap) << delta) | 1;
-		else
-			sa->replay_bitmap = 1;
-		sa->seq = pkt_seq;
-	} else {
-		delta = sa->seq - pkt_seq;
-		sa->replay_bitmap |= (1U << delta);
+/*
+ * Accept the sequence number of a packet that has been authenticated.
+ * If it is ahead of the right hand edge of the window, the edge moves
+ * to it, and the buckets between are cleared.  Returns < 0 if it has
+ * been accepted already, or has fallen out of the window, since it
+ * passed the check.
+ */
+static int esp_replay_advance_locked(const uint8_t *esp,
+				     struct sadb_sa *sa)
+{
+	uint32_t top, pkt_seq, b, n, i;
+	uint64_t *bucket;
+
+	if (unlikely(!sa->replay_window))
+		return 0;
+
+	pkt_seq = ntohl(*(const uint32_t *)(esp+4));
+
+	top = sa->seq;
+	if (pkt_seq > top) {
+		b = top >> REPLAY_BUCKET_SHIFT;
+		n = RTE_MIN((pkt_seq >> REPLAY_BUCKET_SHIFT) - b,
+			    sa->replay_mask + 1);
+		for (i = 1; i <= n; i++)
+			sa->replay_bmp[(b + i) & sa->replay_mask] = 0;
+		CMM_STORE_SHARED(sa->seq, pkt_seq);
+	} else if (top - pkt_seq >= sa->replay_window) {
+		return -2;
 	}
+
+	bucket = esp_replay_bucket(sa, pkt_seq);
+	if (*bucket & esp_replay_bit(pkt_seq))
+		return -3;
+	*bucket |= esp_replay_bit(pkt_seq);
+	return 0;
+}
+
+int esp_replay_advance(const uint8_t *esp,
+		       struct sadb_sa *sa)
+{
+	int rc;
+
+	if (unlikely(!sa->replay_window))
+		return 0;
+
+	rte_spinlock_lock(&sa->replay_lock);
+	rc = esp_replay_advance_locked(esp, sa);
+	rte_spinlock_unlock(&sa->replay_lock);
+	return rc;
+}
+
+/* The sequence number, in host byte order, of an inbound packet */
+uint32_t esp_replay_seq(struct rte_mbuf *m, const struct sadb_sa *sa)
+{
+	const uint8_t *esp = pktmbuf_mtol4(m, const uint8_t *);
+
+	if (sa->udp_encap)
+		esp += sizeof(struct udphdr);
+	return ntohl(*(const uint32_t *)(esp+4));
+}
+
+void esp_replay_lock(struct sadb_sa *sa)
+{
+	rte_spinlock_lock(&sa->replay_lock);
+}
+
+void esp_replay_unlock(struct sadb_sa *sa)
+{
+	rte_spinlock_unlock(&sa->replay_lock);
 }
 
 static struct rte_mbuf *esp_get_next_seg(struct rte_mbuf *current,
@@ -552,6 +670,23 @@ static int esp_generate_chain(struct sadb_sa *sa,
 
 	crypto_session_set_direction(sa->session, encrypt);
 
+	/* set ICV and callback */
+	chain.icv_offset = pktmbuf_l2_len(mbuf) + l3_hdr_len +
+		text_total_len;
+
+	if (sa->udp_encap)
+		chain.icv_offset += sizeof(struct udphdr);
+
+	/*
+	 * Queue single segment packets for the burst engine, which
+	 * processes them when the crypto thread finishes the burst.
+	 */
+	if (encrypt && sa->session->mb_key && mbuf->nb_segs == 1 &&
+	    crypto_mb_enqueue(sa->session, esp, iv, text_total_len - esp_len,
+			      rte_pktmbuf_mtod_offset(mbuf, uint8_t *,
+						      chain.icv_offset)) == 0)
+		return 0;
+
 	if (crypto_chain_init(&chain, sa->session))
 		return -1;
 
@@ -561,13 +696,6 @@ static int esp_generate_chain(struct sadb_sa *sa,
 	if (iv_len)
 		chain.v_ops->set_iv(chain.v_ctx, iv_len, iv);
 
-	/* set ICV and callback */
-	chain.icv_offset = pktmbuf_l2_len(mbuf) + l3_hdr_len +
-		text_total_len;
-
-	if (sa->udp_encap)
-		chain.icv_offset += sizeof(struct udphdr);
-
 	if (!encrypt) {
 		chain.icv_callback = icv_len ? check_icv_cb : null_icv_cb;
 		memcpy_from_mbuf(chain.slop_buffer, mbuf, chain.icv_offset,
@@ -696,7 +824,7 @@ static void esp_input_nat_l4cksum_fixup(struct rte_mbuf *m)
 
 static int esp_input_inner(int family, struct rte_mbuf *m, void *l3_hdr,
 			   struct sadb_sa *sa, uint32_t *bytes,
-			   uint8_t *new_family)
+			   uint8_t *new_family, enum esp_replay replay)
 {
 	int rc = 0, head_trim  = 0, tail_trim = 0;
 	unsigned int esp_len, ciphertext_len, udp_len = 0;
@@ -742,8 +870,9 @@ static int esp_input_inner(int family, struct rte_mbuf *m, void *l3_hdr,
 		udp_len = sizeof(struct udphdr);
 	}
 
-	if (unlikely(sa->replay_window &&
-		     esp_replay_check(esp, sa) < 0)) {
+	if (unlikely(replay == ESP_REPLAY_FAILED ||
+		     (replay == ESP_REPLAY_SINGLE && sa->replay_window &&
+		      esp_replay_check(esp, sa) < 0))) {
 		crypto_sadb_seq_drop_inc(sa);
 		ESP_INFO("Replay check failed for SPI 0x%x\n", sa->spi);
 		return -1;
@@ -784,7 +913,13 @@ static int esp_input_inner(int family, struct rte_mbuf *m, void *l3_hdr,
 					0) != 0))
 		return -1;
 
-	esp_replay_advance(esp, sa);
+	if (unlikely((replay == ESP_REPLAY_LOCKED ?
+		      esp_replay_advance_locked(esp, sa) :
+		      esp_replay_advance(esp, sa)) < 0)) {
+		crypto_sadb_seq_drop_inc(sa);
+		ESP_INFO("Replay check failed for SPI 0x%x\n", sa->spi);
+		return -1;
+	}
 
 	rc = buf_tail_trim(m, icv_len, rc);
 	rc = buf_tail_read_char(m, &next_hdr, rc);
@@ -1257,21 +1392,21 @@ int esp_output6(struct rte_mbuf *m, uint8_t orig_family, void *ip6,
 }
 
 int esp_input(struct rte_mbuf *m, struct sadb_sa *sa,
-	      uint32_t *bytes, uint8_t *new_family)
+	      uint32_t *bytes, uint8_t *new_family, enum esp_replay replay)
 {
 	struct iphdr *ip = iphdr(m);
 
 	return esp_input_inner(AF_INET, m, ip, sa,
-			       bytes, new_family);
+			       bytes, new_family, replay);
 }
 
 int esp_input6(struct rte_mbuf *m, struct sadb_sa *sa,
-	       uint32_t *bytes, uint8_t *new_family)
+	       uint32_t *bytes, uint8_t *new_family, enum esp_replay replay)
 {
 	struct ip6_hdr *ip6 = ip6hdr(m);
 
 	return esp_input_inner(AF_INET6, m, ip6, sa,
-			       bytes, new_family);
+			       bytes, new_family, replay);
 }
 
 bool udp_esp_dp_interesting(const struct udphdr *udp,
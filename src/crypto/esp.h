@@ -22,10 +22,22 @@ struct rte_mbuf;
 struct sadb_sa;
 struct udphdr;
 
+/*
+ * How esp_input() deals with the replay window.  The packets of a burst
+ * for one SA are checked together with esp_replay_check_burst(), and
+ * the window is then advanced for each of them under a single take of
+ * the replay lock.
+ */
+enum esp_replay {
+	ESP_REPLAY_SINGLE,	/* check, then advance under the lock */
+	ESP_REPLAY_LOCKED,	/* checked, caller holds the replay lock */
+	ESP_REPLAY_FAILED,	/* failed the burst check */
+};
+
 int esp_input(struct rte_mbuf *m, struct sadb_sa *sa, uint32_t *bytes,
-	      uint8_t *new_family);
+	      uint8_t *new_family, enum esp_replay replay);
 int esp_input6(struct rte_mbuf *m, struct sadb_sa *sa, uint32_t *bytes,
-	       uint8_t *new_family);
+	       uint8_t *new_family, enum esp_replay replay);
 
 
 int esp_output(struct rte_mbuf *m,  uint8_t family, void *l3hdr,
@@ -46,8 +58,15 @@ int esp_output6(struct rte_mbuf *m, uint8_t family, void *l3hdr,
 uint16_t esp_payload_padded_len(const struct crypto_overhead *overhead,
 				uint16_t tot_len);
 
+int esp_replay_init(struct sadb_sa *sa, uint32_t replay_window);
+void esp_replay_free(struct sadb_sa *sa);
 int esp_replay_check(const uint8_t *esp, const struct sadb_sa *sa);
-void esp_replay_advance(const uint8_t *esp, struct sadb_sa *sa);
+uint64_t esp_replay_check_burst(const struct sadb_sa *sa,
+				const uint32_t seq[], unsigned int count);
+int esp_replay_advance(const uint8_t *esp, struct sadb_sa *sa);
+uint32_t esp_replay_seq(struct rte_mbuf *m, const struct sadb_sa *sa);
+void esp_replay_lock(struct sadb_sa *sa);
+void esp_replay_unlock(struct sadb_sa *sa);
 
 /*
  * Returns true if packet requires crypto processing, false otherwise
@@ -42,6 +42,7 @@
 #include "pktmbuf.h"
 #include "route.h"
 #include "route_flags.h"
+#include "urcu.h"
 #include "util.h"
 #include "vplane_log.h"
 
@@ -64,6 +65,7 @@ static const char *ecmp_modes[ECMP_MAX] = {
 	[ECMP_HASH_THRESHOLD]	= "hash-threshold",
 	[ECMP_HRW]		= "hrw",
 	[ECMP_MODULO_N]		= "modulo-n",
+	[ECMP_RESILIENT]	= "resilient",
 };
 
 /* Callback to store route attributes */
@@ -737,6 +739,12 @@ ecmp_lookup_alg(enum ecmp_modes ecmp_alg, uint32_t size, uint32_t key)
 	case ECMP_MODULO_N:
 		return key % size;
 
+	case ECMP_RESILIENT:
+		/* Same as a bucket table with no dead paths */
+		if (size > ECMP_RESILIENT_BUCKETS)
+			return key % size;
+		return (key & (ECMP_RESILIENT_BUCKETS - 1)) % size;
+
 	default:
 		return 0;
 	}
@@ -750,6 +758,58 @@ unsigned int ecmp_lookup(uint32_t size, uint32_t key)
 	return ecmp_lookup_alg(ecmp_mode, size, key);
 }
 
+/*
+ * ECMP nexthop lookup for a group that may carry a resilient hash
+ * bucket table. In resilient mode this is a single indexed load.
+ */
+unsigned int ecmp_lookup_resilient(const uint16_t *buckets, uint32_t size,
+				   uint32_t key)
+{
+	if (ecmp_mode == ECMP_RESILIENT && likely(buckets != NULL))
+		return buckets[key & (ECMP_RESILIENT_BUCKETS - 1)];
+
+	return ecmp_lookup_alg(ecmp_mode, size, key);
+}
+
+/*
+ * Fill the resilient hash bucket table for a group of size paths.
+ *
+ * Every bucket has a home path (bucket % size) which it uses while
+ * that path is alive. Buckets whose home path is dead are dealt out
+ * round-robin to the live paths, so a failure only moves the flows
+ * that were on the dead path, and a recovery moves exactly those flows
+ * back. If all paths are dead the home paths are used and the caller
+ * is expected to notice RTF_DEAD on the selected path.
+ *
+ * Entries are written one at a time while forwarding threads may be
+ * reading them; every value written is a valid path index.
+ */
+void ecmp_resilient_fill(uint16_t *buckets, uint32_t size, const bool *dead)
+{
+	uint16_t live[ECMP_RESILIENT_BUCKETS];
+	unsigned int i, nlive = 0, next = 0;
+
+	if (size > ECMP_RESILIENT_BUCKETS)
+		size = ECMP_RESILIENT_BUCKETS;
+
+	for (i = 0; i < size; i++)
+		if (!dead[i])
+			live[nlive++] = i;
+
+	for (i = 0; i < ECMP_RESILIENT_BUCKETS; i++) {
+		uint16_t path = i % size;
+
+		if (dead[path] && nlive) {
+			path = live[next];
+			if (++next == nlive)
+				next = 0;
+		}
+
+		if (CMM_LOAD_SHARED(buckets[i]) != path)
+			CMM_STORE_SHARED(buckets[i], path);
+	}
+}
+
 static void ecmp_show(json_writer_t *json)
 {
 	jsonw_string_field(json, "mode", ecmp_modes[ecmp_mode]);
@@ -774,13 +834,20 @@ static int ecmp_set_mode(const char *mode)
 
 static int ecmp_set_max_path(int val)
 {
+	if (ecmp_max_path == val)
+		return 0;
+
 	ecmp_max_path = val;
 
+	/* Resilient hash tables are built for the capped path count */
+	nexthop_resilient_refresh();
+	nexthop6_resilient_refresh();
+
 	return 0;
 }
 
 #define ECMP_MODES \
-	"hash-threshold|hrw|modulo-n|disable"
+	"hash-threshold|hrw|modulo-n|resilient|disable"
 
 #define CMD_ECMP_USAGE                     \
 	"Usage: ecmp show\n"               \
@@ -27,9 +27,17 @@ enum ecmp_modes {
 	ECMP_HASH_THRESHOLD,
 	ECMP_HRW,
 	ECMP_MODULO_N,
+	ECMP_RESILIENT,
 	ECMP_MAX
 };
 
+/*
+ * Number of buckets in a resilient hash table. Must be a power of
+ * two; groups with more paths than this have no table and fall back
+ * to modulo-n selection.
+ */
+#define ECMP_RESILIENT_BUCKETS 256
+
 uint32_t ecmp_iphdr_hash(const struct iphdr *ip, uint32_t l4key);
 uint32_t ecmp_ipv4_hash(const struct rte_mbuf *m, unsigned int l3offs);
 uint32_t ecmp_ip6hdr_hash(const struct ip6_hdr *ip6, uint32_t l4_key);
@@ -37,6 +45,9 @@ uint32_t ecmp_ipv6_hash(const struct rte_mbuf *m, unsigned int l3offs);
 uint32_t ecmp_mbuf_hash(const struct rte_mbuf *m, uint16_t ether_type);
 
 unsigned int ecmp_lookup(uint32_t size, uint32_t key);
+unsigned int ecmp_lookup_resilient(const uint16_t *buckets, uint32_t size,
+				   uint32_t key);
+void ecmp_resilient_fill(uint16_t *buckets, uint32_t size, const bool *dead);
 
 struct next_hop *ecmp_create(struct nlattr *mpath, uint32_t *count,
 			     bool *missing_ifp);
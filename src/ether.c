@@ -7,6 +7,8 @@
  */
 
 
+#include <rte_common.h>
+
 #include "ether.h"
 
 #include "dp_event.h"
@@ -54,6 +56,63 @@ ether_input_no_dyn_feats(struct ifnet *ifp, struct rte_mbuf *m)
 	pipeline_fused_no_dyn_feats_ether_in(&pkt);
 }
 
+static ALWAYS_INLINE void
+_ether_input_burst(struct ifnet *ifp, struct rte_mbuf **pkts, uint16_t nb,
+		   bool dyn_feats)
+{
+	struct pl_packet pl_pkts[PL_VECTOR_MAX];
+	struct pl_packet *vec[PL_VECTOR_MAX];
+	npf_cache_t npcs[PL_VECTOR_MAX];
+	unsigned int count;
+	unsigned int i;
+
+	while (nb) {
+		count = RTE_MIN(nb, PL_VECTOR_MAX);
+		for (i = 0; i < count; i++) {
+			pl_pkts[i].mbuf = pkts[i];
+			/* Init to null, to aid compiler optimisation*/
+			pl_pkts[i].nxt.v6 = NULL;
+			pl_pkts[i].in_ifp = ifp;
+			pl_pkts[i].max_data_used = 0;
+			pl_pkts[i].npc = &npcs[i];
+			vec[i] = &pl_pkts[i];
+		}
+
+		if (dyn_feats)
+			pipeline_vector_ether_in(vec, count);
+		else
+			pipeline_vector_no_dyn_feats_ether_in(vec, count);
+		pl_vector_npf_reset();
+
+		pkts += count;
+		nb -= count;
+	}
+}
+
+/*
+ * Ether switching input of a burst of packets in vector mode
+ *
+ * Always consumes the mbufs
+ */
+__attribute__((noinline)) void
+ether_input_burst(struct ifnet *ifp, struct rte_mbuf **pkts, uint16_t nb)
+{
+	_ether_input_burst(ifp, pkts, nb, true);
+}
+
+/*
+ * Ether switching input of a burst of packets in vector mode without
+ * support for dynamic pipeline features
+ *
+ * Always consumes the mbufs
+ */
+__attribute__((noinline)) void
+ether_input_burst_no_dyn_feats(struct ifnet *ifp, struct rte_mbuf **pkts,
+			       uint16_t nb)
+{
+	_ether_input_burst(ifp, pkts, nb, false);
+}
+
 int ether_if_set_l2_address(struct ifnet *ifp, uint32_t l2_addr_len,
 			    void *l2_addr)
 {
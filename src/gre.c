@@ -1381,7 +1381,7 @@ int mgre_ipv4_neigh_change(struct ifnet *ifp,
 	switch (nlh->nlmsg_type) {
 	case RTM_NEWNEIGH:
 	case RTM_DELNEIGH:
-		if (is_local_ipv4(if_vrfid(ifp), tun_addr.s_addr)) {
+		if (is_local_ipv4_ctrl(if_vrfid(ifp), tun_addr.s_addr)) {
 			RTE_LOG(NOTICE, GRE,
 				"local mGRE DST(%s) in NEIGH change msg; skipping\n",
 				inet_ntoa(tun_addr));
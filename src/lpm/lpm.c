@@ -40,18 +40,24 @@
 #include <errno.h>
 #include <rte_branch_prediction.h>
 #include <rte_common.h>
+#include <rte_cycles.h>
 #include <rte_debug.h>
 #include <rte_eal.h>
 #include <rte_eal_memconfig.h>
 #include <rte_errno.h>
 #include <rte_jhash.h>
 #include <rte_log.h>
+#include <rte_prefetch.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <urcu/arch.h>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "compiler.h"
 #include "pd_show.h"
 #include "lpm.h"
@@ -62,6 +68,18 @@
 #define LPM_TBL8_INIT_GROUPS	256	/* power of 2 */
 #define LPM_TBL8_INIT_ENTRIES	(LPM_TBL8_INIT_GROUPS * \
 					 LPM_TBL8_GROUP_NUM_ENTRIES)
+
+/** Deferred updates */
+#define LPM_DIRTY_INIT_RANGES	64
+#define LPM_REBUILD_CHUNK	(1 << 16)	/* tbl24 entries */
+#define LPM_REBUILD_GAP		1024	/* cheaper to rebuild than skip */
+
+/** Range of tbl24 entries [start, end) needing a rebuild */
+struct lpm_range {
+	uint32_t start;
+	uint32_t end;
+};
+
 /** Rule structure. */
 struct lpm_rule {
 	uint32_t ip;	    /**< Rule IP address. */
@@ -84,6 +102,16 @@ struct lpm {
 
 	struct lpm_rule no_route_rule; /* For storing trackers */
 
+	/* Deferred updates, see lpm_update_begin() */
+	bool update_deferred;
+	bool update_all;			/* Rebuild all of tbl24 */
+	uint32_t update_count;			/* Rule changes in batch */
+	uint32_t dirty_count;
+	uint32_t dirty_size;
+	struct lpm_range *dirty;
+	uint64_t update_start;			/* Cycles at start of batch */
+	struct lpm_update_stats update_stats;
+
 	/* LPM Tables. */
 	uint32_t tbl8_num_groups;		/* Number of slots */
 	uint32_t tbl8_rover;			/* Next slot to check */
@@ -113,8 +141,16 @@ enum valid_flag {
 	VALID
 };
 
+/*
+ * Trackers in all tables, so that route changes don't have to look for
+ * trackers to update when there aren't any.
+ */
+static unsigned int lpm_tracker_total;
+
 static void lpm_tracker_update(struct lpm *lpm, struct lpm_rule *old_rule,
 			       uint32_t ip, uint8_t depth);
+static void lpm_update_mark(struct lpm *lpm, uint32_t ip_masked,
+			    uint8_t depth);
 
 /* Macro to enable/disable run-time checks. */
 #if defined(LIBLPM_DEBUG)
@@ -255,6 +291,7 @@ lpm_free(struct lpm *lpm)
 		return;
 
 	assert(lpm->no_route_rule.tracker_count == 0);
+	free(lpm->dirty);
 	free_huge(lpm->tbl8, (lpm->tbl8_num_groups *
 			      LPM_TBL8_GROUP_NUM_ENTRIES *
 			      sizeof(struct lpm_tbl8_entry)));
@@ -714,6 +751,10 @@ lpm_add(struct lpm *lpm, uint32_t ip, uint8_t depth,
 
 	if (!new)
 		return LPM_ALREADY_EXISTS;
+
+	if (lpm->update_deferred)
+		lpm->update_count++;
+
 	/*
 	 * If there's an existing rule for the prefix with a higher
 	 * scope, then don't override it in the LPM.
@@ -726,6 +767,8 @@ lpm_add(struct lpm *lpm, uint32_t ip, uint8_t depth,
 
 	if (depth == 0)
 		add_default_route(lpm, next_hop);
+	else if (lpm->update_deferred)
+		lpm_update_mark(lpm, ip_masked, depth);
 	else if (depth <= MAX_DEPTH_TBL24)
 		add_depth_small(lpm, ip_masked, depth, next_hop);
 	else {
@@ -828,6 +871,8 @@ int lpm_tracker_add(struct lpm *lpm, struct rt_tracker_info *ti_info)
 	else
 		ret = lpm_tracker_add_to_rule(&lpm->no_route_rule, 0, ti_info,
 					      false);
+	if (ret == 0)
+		lpm_tracker_total++;
 	return ret;
 }
 
@@ -837,6 +882,7 @@ void lpm_tracker_delete(struct rt_tracker_info *ti_info)
 
 	RB_REMOVE(lpm_tracker_tree, &rule->tracker_head, ti_info);
 	rule->tracker_count--;
+	lpm_tracker_total--;
 }
 
 static void
@@ -899,6 +945,9 @@ lpm_tracker_update(struct lpm *lpm, struct lpm_rule *old_rule,
 	struct rt_tracker_info *ti_info, *ti_iter = NULL;
 	uint32_t ip_masked;
 
+	if (lpm_tracker_total == 0)
+		return;
+
 	/*
 	 * This should only be set under two conditions:
 	 *
@@ -1288,6 +1337,8 @@ static int rule_replace(struct lpm *lpm, struct lpm_rule *old_rule,
 	 */
 	if (depth == 0)
 		del_default_route(lpm);
+	else if (lpm->update_deferred)
+		lpm_update_mark(lpm, ip_masked, depth);
 	else if (depth <= MAX_DEPTH_TBL24)
 		delete_depth_small(lpm, ip_masked, depth, sub_rule, sub_depth);
 	else
@@ -1341,6 +1392,9 @@ lpm_delete(struct lpm *lpm, uint32_t ip, uint8_t depth,
 
 	*pd_state = rule->pd_state;
 
+	if (lpm->update_deferred)
+		lpm->update_count++;
+
 	/* Replace with next level up rule */
 	rc = rule_replace(lpm, rule, ip, depth, &new_rule);
 
@@ -1371,6 +1425,10 @@ lpm_delete_all(struct lpm *lpm, lpm_walk_func_t func, void *arg)
 		   * sizeof(struct lpm_tbl8_entry));
 	lpm->tbl8_rover = lpm->tbl8_num_groups - 1;
 
+	/* Nothing left that could need rebuilding */
+	lpm->update_all = false;
+	lpm->dirty_count = 0;
+
 	/* Delete all rules form the rules table. */
 	for (depth = 0; depth < LPM_MAX_DEPTH; ++depth) {
 		struct lpm_rules_tree *head = &lpm->rules[depth];
@@ -1386,6 +1444,386 @@ lpm_delete_all(struct lpm *lpm, lpm_walk_func_t func, void *arg)
 	del_default_route(lpm);
 }
 
+/*
+ * Deferred updates.
+ *
+ * While deferred, lpm_add() and lpm_delete() only update the rule
+ * tables and record which range of tbl24 entries the change covers.
+ * lpm_update_commit() then sorts and merges the ranges, including ones
+ * close enough that rebuilding the gap is cheaper than starting a new
+ * range, and rebuilds each tbl24 entry in them (plus its tbl8 group)
+ * once from the rules rather than once per overlapping rule change.
+ *
+ * The rebuild works on chunks of tbl24 at a time, "painting" the rules
+ * covering the chunk into a scratch copy in increasing depth order so
+ * that the longest match wins, and then only storing the entries that
+ * differ. These buffers are only ever used by the master thread.
+ */
+static struct lpm_tbl24_entry rebuild_tbl24[LPM_REBUILD_CHUNK];
+static uint64_t rebuild_ext[LPM_REBUILD_CHUNK / 64];
+static struct lpm_rule *rebuild_next[LPM_MAX_DEPTH];
+
+static void
+lpm_update_mark(struct lpm *lpm, uint32_t ip_masked, uint8_t depth)
+{
+	uint32_t start = ip_masked >> 8;
+	uint32_t end = start + 1;
+	struct lpm_range *range;
+
+	if (depth <= MAX_DEPTH_TBL24)
+		end = start + depth_to_range(depth);
+
+	if (lpm->update_all)
+		return;
+
+	/* Route feeds tend to be ordered, so try and extend the last range */
+	if (lpm->dirty_count) {
+		range = &lpm->dirty[lpm->dirty_count - 1];
+		if (start <= range->end && end >= range->start) {
+			range->start = RTE_MIN(range->start, start);
+			range->end = RTE_MAX(range->end, end);
+			return;
+		}
+	}
+
+	if (lpm->dirty_count == lpm->dirty_size) {
+		uint32_t size = lpm->dirty_size ?
+			lpm->dirty_size * 2 : LPM_DIRTY_INIT_RANGES;
+
+		range = realloc(lpm->dirty, size * sizeof(*range));
+		if (!range) {
+			/* Can still get it right, just more slowly */
+			lpm->update_all = true;
+			return;
+		}
+		lpm->dirty = range;
+		lpm->dirty_size = size;
+	}
+
+	range = &lpm->dirty[lpm->dirty_count++];
+	range->start = start;
+	range->end = end;
+}
+
+static int
+lpm_range_cmp(const void *a, const void *b)
+{
+	const struct lpm_range *r1 = a;
+	const struct lpm_range *r2 = b;
+
+	if (r1->start < r2->start)
+		return -1;
+	return r1->start > r2->start;
+}
+
+/*
+ * Fill in rebuild_tbl24 with the entries for depth <= 24 rules, and
+ * set the bit in rebuild_ext for each /24 that has longer rules.
+ */
+static void
+rebuild_paint_tbl24(struct lpm *lpm, uint32_t start, uint32_t end)
+{
+	struct lpm_rule *r;
+	uint32_t i, first, last;
+	uint8_t depth;
+
+	memset(rebuild_tbl24, 0, (end - start) * sizeof(rebuild_tbl24[0]));
+	memset(rebuild_ext, 0, sizeof(rebuild_ext));
+
+	for (depth = 1; depth <= MAX_DEPTH_TBL24; depth++) {
+		/*
+		 * Rules for the same prefix are in increasing scope
+		 * order, so the highest scope one is painted last.
+		 */
+		first = (start << 8) & lpm_depth_to_mask(depth);
+		for (r = rule_find_next(lpm, first, depth, INT16_MIN);
+		     r && (r->ip >> 8) < end;
+		     r = RB_NEXT(lpm_rules_tree, &lpm->rules[depth], r)) {
+			struct lpm_tbl24_entry entry =
+				TBL24_ENTRY_W_NH_INITIALIZER(depth,
+							     r->next_hop);
+
+			first = RTE_MAX(r->ip >> 8, start);
+			last = RTE_MIN((r->ip >> 8) + depth_to_range(depth),
+				       end);
+			for (i = first; i < last; i++)
+				rebuild_tbl24[i - start] = entry;
+		}
+	}
+
+	/* Also remember where the longer rules start for the tbl8s */
+	for (depth = MAX_DEPTH_TBL24 + 1; depth < LPM_MAX_DEPTH; depth++) {
+		rebuild_next[depth] = rule_find_next(lpm, start << 8, depth,
+						     INT16_MIN);
+		for (r = rebuild_next[depth];
+		     r && (r->ip >> 8) < end;
+		     r = RB_NEXT(lpm_rules_tree, &lpm->rules[depth], r)) {
+			i = (r->ip >> 8) - start;
+			rebuild_ext[i / 64] |= 1ull << (i % 64);
+		}
+	}
+}
+
+/*
+ * Build the tbl8 group for a /24, starting from the tbl24 entry
+ * it would have had without the longer rules. Must be called for
+ * each /24 needing one in increasing order after rebuild_paint_tbl24().
+ */
+static void
+rebuild_tbl8_group(struct lpm *lpm, uint32_t tbl24_index,
+		   struct lpm_tbl24_entry *base,
+		   struct lpm_tbl8_entry *group)
+{
+	struct lpm_tbl8_entry entry = {
+		.valid_group = VALID,
+		.valid = base->valid,
+		.depth = base->valid ? base->depth : 0,
+		.next_hop = base->valid ?
+			lpm_tbl24_get_next_hop_idx(base) : 0,
+	};
+	struct lpm_rule *r;
+	uint32_t i, first, last;
+	uint8_t depth;
+
+	for (i = 0; i < LPM_TBL8_GROUP_NUM_ENTRIES; i++)
+		group[i] = entry;
+
+	for (depth = MAX_DEPTH_TBL24 + 1; depth < LPM_MAX_DEPTH; depth++) {
+		for (r = rebuild_next[depth];
+		     r && (r->ip >> 8) == tbl24_index;
+		     r = RB_NEXT(lpm_rules_tree, &lpm->rules[depth], r)) {
+			entry.valid = VALID;
+			entry.depth = depth;
+			entry.next_hop = r->next_hop;
+
+			first = r->ip & 0xFF;
+			last = first + depth_to_range(depth);
+			for (i = first; i < last; i++)
+				group[i] = entry;
+		}
+		rebuild_next[depth] = r;
+	}
+}
+
+/*
+ * Rebuild tbl24 entries [start, end), which must be no more than
+ * LPM_REBUILD_CHUNK entries, and any tbl8 groups they use.
+ */
+static int
+rebuild_chunk(struct lpm *lpm, uint32_t start, uint32_t end)
+{
+	struct lpm_tbl8_entry group[LPM_TBL8_GROUP_NUM_ENTRIES];
+	struct lpm_tbl8_entry *tbl8;
+	int32_t tbl8_gindex;
+	uint32_t i, j, k;
+	int rc = 0;
+
+	rebuild_paint_tbl24(lpm, start, end);
+
+	for (i = start; i < end; i++) {
+		struct lpm_tbl24_entry new_entry = rebuild_tbl24[i - start];
+		struct lpm_tbl24_entry cur = CMM_ACCESS_ONCE(lpm->tbl24[i]);
+
+		j = i - start;
+		if (rebuild_ext[j / 64] & (1ull << (j % 64))) {
+			rebuild_tbl8_group(lpm, i, &new_entry, group);
+
+			if (cur.valid && cur.ext_entry) {
+				/* Update the existing group in place */
+				tbl8 = lpm->tbl8 + cur.tbl8_gindex *
+					LPM_TBL8_GROUP_NUM_ENTRIES;
+				for (k = 0; k < LPM_TBL8_GROUP_NUM_ENTRIES;
+				     k++)
+					if (memcmp(&tbl8[k], &group[k],
+						   sizeof(group[k])))
+						_CMM_STORE_SHARED(tbl8[k],
+								  group[k]);
+				continue;
+			}
+
+			tbl8_gindex = tbl8_alloc(lpm);
+			if (tbl8_gindex >= 0) {
+				struct lpm_tbl24_entry ext_entry = {
+					.valid = VALID,
+					.ext_entry = 1,
+					.depth = 0,
+					{ .tbl8_gindex = tbl8_gindex, }
+				};
+
+				tbl8 = lpm->tbl8 + tbl8_gindex *
+					LPM_TBL8_GROUP_NUM_ENTRIES;
+				for (k = 0; k < LPM_TBL8_GROUP_NUM_ENTRIES;
+				     k++)
+					_CMM_STORE_SHARED(tbl8[k], group[k]);
+
+				/* Group must be visible before the tbl24 */
+				cmm_smp_wmc();
+				_CMM_STORE_SHARED(lpm->tbl24[i], ext_entry);
+				continue;
+			}
+
+			/* Leave the /24 using its shorter rules */
+			RTE_LOG(ERR, LPM,
+				"LPM tbl8 alloc failed for %u.%u.%u.0/24\n",
+				i >> 16, (i >> 8) & 0xFF, i & 0xFF);
+			rc = tbl8_gindex;
+		}
+
+		if (cur.valid && cur.ext_entry) {
+			_CMM_STORE_SHARED(lpm->tbl24[i], new_entry);
+			tbl8_free(lpm, cur.tbl8_gindex *
+				  LPM_TBL8_GROUP_NUM_ENTRIES);
+		} else if (memcmp(&cur, &new_entry, sizeof(cur)))
+			_CMM_STORE_SHARED(lpm->tbl24[i], new_entry);
+	}
+
+	return rc;
+}
+
+static int
+rebuild_range(struct lpm *lpm, uint32_t start, uint32_t end)
+{
+	uint32_t chunk_end;
+	int rc = 0;
+
+	for (; start < end; start = chunk_end) {
+		chunk_end = RTE_MIN(end, start + LPM_REBUILD_CHUNK);
+		if (rebuild_chunk(lpm, start, chunk_end) < 0)
+			rc = -ENOSPC;
+	}
+
+	return rc;
+}
+
+static void
+lpm_update_finish(struct lpm *lpm, bool shadow)
+{
+	struct lpm_update_stats *stats = &lpm->update_stats;
+	uint64_t usec;
+
+	usec = (rte_get_timer_cycles() - lpm->update_start) * US_PER_S /
+		rte_get_timer_hz();
+
+	stats->batches++;
+	if (shadow)
+		stats->shadow_swaps++;
+	stats->prefixes += lpm->update_count;
+	stats->usec += usec;
+	stats->last_prefixes = lpm->update_count;
+	stats->last_usec = usec;
+
+	lpm->update_deferred = false;
+	lpm->update_all = false;
+	lpm->update_count = 0;
+	lpm->dirty_count = 0;
+}
+
+void
+lpm_update_begin(struct lpm *lpm)
+{
+	if (lpm->update_deferred)
+		return;
+
+	lpm->update_deferred = true;
+	lpm->update_start = rte_get_timer_cycles();
+}
+
+uint32_t
+lpm_update_pending(const struct lpm *lpm)
+{
+	return lpm->update_deferred ? lpm->update_count : 0;
+}
+
+int
+lpm_update_commit(struct lpm *lpm)
+{
+	struct lpm_range *range, *merged;
+	int rc = 0;
+
+	if (!lpm->update_deferred)
+		return 0;
+
+	if (lpm->update_all) {
+		rc = rebuild_range(lpm, 0, LPM_TBL24_NUM_ENTRIES);
+		goto done;
+	}
+
+	if (lpm->dirty_count == 0)
+		goto done;
+
+	qsort(lpm->dirty, lpm->dirty_count, sizeof(*lpm->dirty),
+	      lpm_range_cmp);
+
+	merged = lpm->dirty;
+	for (range = lpm->dirty + 1;
+	     range < lpm->dirty + lpm->dirty_count; range++) {
+		if (range->start <= merged->end + LPM_REBUILD_GAP) {
+			merged->end = RTE_MAX(merged->end, range->end);
+			continue;
+		}
+		if (rebuild_range(lpm, merged->start, merged->end) < 0)
+			rc = -ENOSPC;
+		merged = range;
+	}
+	if (rebuild_range(lpm, merged->start, merged->end) < 0)
+		rc = -ENOSPC;
+
+done:
+	lpm_update_finish(lpm, false);
+	return rc;
+}
+
+struct lpm *
+lpm_update_commit_shadow(struct lpm *lpm)
+{
+	struct rt_tracker_info *ti_info;
+	struct lpm *shadow;
+	uint8_t depth;
+
+	shadow = lpm_create(lpm->id);
+	if (!shadow)
+		return NULL;
+
+	/*
+	 * Hand the rules over rather than copying them, so that the
+	 * pd_state and tracker references to them stay valid.
+	 */
+	for (depth = 0; depth < LPM_MAX_DEPTH; depth++) {
+		shadow->rules[depth] = lpm->rules[depth];
+		RB_INIT(&lpm->rules[depth]);
+	}
+	shadow->rule_count = lpm->rule_count;
+	lpm->rule_count = 0;
+
+	shadow->no_route_rule = lpm->no_route_rule;
+	RB_FOREACH(ti_info, lpm_tracker_tree,
+		   &shadow->no_route_rule.tracker_head)
+		ti_info->rule = &shadow->no_route_rule;
+	memset(&lpm->no_route_rule, 0, sizeof(lpm->no_route_rule));
+	RB_INIT(&lpm->no_route_rule.tracker_head);
+
+	shadow->tbldflt = lpm->tbldflt;
+	shadow->update_stats = lpm->update_stats;
+	shadow->update_start = lpm->update_start;
+	shadow->update_count = lpm->update_count;
+
+	/* Not visible to the forwarding threads yet */
+	if (rebuild_range(shadow, 0, LPM_TBL24_NUM_ENTRIES) < 0)
+		RTE_LOG(ERR, LPM,
+			"LPM shadow table %u incomplete\n", shadow->id);
+
+	lpm->update_deferred = false;
+	lpm->update_count = 0;
+	lpm_update_finish(shadow, true);
+	return shadow;
+}
+
+void
+lpm_update_stats_get(const struct lpm *lpm, struct lpm_update_stats *stats)
+{
+	*stats = lpm->update_stats;
+}
+
 /*
  * Iterate over LPM rules
  */
@@ -1460,6 +1898,27 @@ lpm_lookup_exact(struct lpm *lpm, uint32_t ip, uint8_t depth,
 	return 0;
 }
 
+/*
+ * Lookup using the rules rather than the forwarding tables, which may
+ * be behind while updates are deferred.
+ */
+int
+lpm_lookup_ctrl(struct lpm *lpm, uint32_t ip, uint32_t *next_hop)
+{
+	struct lpm_rule *r;
+	uint8_t depth;
+
+	if (!lpm->update_deferred)
+		return lpm_lookup(lpm, ip, next_hop);
+
+	r = find_previous_rule(lpm, ip, LPM_MAX_DEPTH - 1, &depth);
+	if (!r)
+		return -ENOENT;
+
+	*next_hop = r->next_hop;
+	return 0;
+}
+
 static ALWAYS_INLINE int
 lpm_lookup_default(const struct lpm *lpm, uint32_t *next_hop)
 {
@@ -1515,6 +1974,115 @@ lpm_lookup(const struct lpm *lpm, uint32_t ip, uint32_t *next_hop)
 	return 0; /* Lookup hit. */
 }
 
+/* Number of IPs resolved together by lpm_lookup_bulk() */
+#define LPM_LOOKUP_BULK_CHUNK 32
+
+#ifdef __AVX2__
+static ALWAYS_INLINE void
+lpm_tbl24_load_bulk(const struct lpm *lpm, const uint32_t *ips,
+		    struct lpm_tbl24_entry *tbl24, unsigned int n)
+{
+	unsigned int i;
+
+	/* Gather 8 tbl24 entries at a time */
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i ip = _mm256_loadu_si256((const __m256i *)&ips[i]);
+		__m256i entries = _mm256_i32gather_epi32(
+			(const int *)lpm->tbl24, _mm256_srli_epi32(ip, 8),
+			sizeof(struct lpm_tbl24_entry));
+
+		_mm256_storeu_si256((__m256i *)&tbl24[i], entries);
+	}
+
+	for (; i < n; i++)
+		tbl24[i] = CMM_ACCESS_ONCE(lpm->tbl24[ips[i] >> 8]);
+
+	cmm_barrier();
+}
+#else
+static ALWAYS_INLINE void
+lpm_tbl24_load_bulk(const struct lpm *lpm, const uint32_t *ips,
+		    struct lpm_tbl24_entry *tbl24, unsigned int n)
+{
+	unsigned int i;
+
+	/* None of these loads depend on each other */
+	for (i = 0; i < n; i++)
+		tbl24[i] = CMM_ACCESS_ONCE(lpm->tbl24[ips[i] >> 8]);
+}
+#endif
+
+static ALWAYS_INLINE void
+lpm_lookup_bulk_chunk(const struct lpm *lpm, const uint32_t *ips,
+		      uint32_t *next_hops, unsigned int n)
+{
+	struct lpm_tbl24_entry tbl24[LPM_LOOKUP_BULK_CHUNK];
+	uint32_t tbl8_idx[LPM_LOOKUP_BULK_CHUNK];
+	uint8_t ext[LPM_LOOKUP_BULK_CHUNK];
+	const struct lpm_tbl8_entry *tbl8;
+	unsigned int n_ext = 0;
+	uint32_t dflt_next_hop;
+	unsigned int i;
+
+	if (lpm_lookup_default(lpm, &dflt_next_hop) < 0)
+		dflt_next_hop = LPM_LOOKUP_MISS;
+
+	/* Stage 1: issue all of the tbl24 loads */
+	lpm_tbl24_load_bulk(lpm, ips, tbl24, n);
+
+	/*
+	 * Read the tbl8 pointer only after the tbl24 entries, as the
+	 * table may have been grown to make room for the groups they
+	 * refer to.
+	 */
+	tbl8 = rcu_dereference(lpm->tbl8);
+
+	/* Stage 2: resolve tbl24 hits and prefetch the tbl8 entries */
+	for (i = 0; i < n; i++) {
+		if (unlikely(!tbl24[i].valid)) {
+			next_hops[i] = dflt_next_hop;
+			continue;
+		}
+
+		if (tbl24[i].ext_entry == 0) {
+			next_hops[i] = lpm_tbl24_get_next_hop_idx(&tbl24[i]);
+			continue;
+		}
+
+		tbl8_idx[i] = tbl24[i].tbl8_gindex *
+			LPM_TBL8_GROUP_NUM_ENTRIES + (ips[i] & 0xFF);
+		rte_prefetch0(&tbl8[tbl8_idx[i]]);
+		ext[n_ext++] = i;
+	}
+
+	/* Stage 3: resolve the tbl8 entries */
+	for (i = 0; i < n_ext; i++) {
+		struct lpm_tbl8_entry entry;
+		unsigned int j = ext[i];
+
+		entry = CMM_ACCESS_ONCE(tbl8[tbl8_idx[j]]);
+		if (unlikely(!entry.valid))
+			next_hops[j] = dflt_next_hop;
+		else
+			next_hops[j] = entry.next_hop;
+	}
+}
+
+void
+lpm_lookup_bulk(const struct lpm *lpm, const uint32_t *ips,
+		uint32_t *next_hops, unsigned int n)
+{
+	unsigned int chunk;
+
+	while (n) {
+		chunk = RTE_MIN(n, LPM_LOOKUP_BULK_CHUNK);
+		lpm_lookup_bulk_chunk(lpm, ips, next_hops, chunk);
+		ips += chunk;
+		next_hops += chunk;
+		n -= chunk;
+	}
+}
+
 /*
  * Do a subtree walk of the given rule.
  *
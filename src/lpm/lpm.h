@@ -266,6 +266,80 @@ typedef void (*lpm_walk_func_t)(struct lpm *lpm,
 void
 lpm_delete_all(struct lpm *lpm, lpm_walk_func_t func, void *arg);
 
+/** Convergence statistics for deferred updates of an LPM table. */
+struct lpm_update_stats {
+	uint64_t batches;	/**< Batches committed */
+	uint64_t shadow_swaps;	/**< Batches committed as a new table */
+	uint64_t prefixes;	/**< Rule changes in all batches */
+	uint64_t usec;		/**< Time taken by all batches */
+	uint32_t last_prefixes;	/**< Rule changes in the last batch */
+	uint32_t last_usec;	/**< Time taken by the last batch */
+};
+
+/**
+ * Start deferring forwarding table updates. Until lpm_update_commit()
+ * is called lpm_add() and lpm_delete() only change the rules, and so
+ * lookups by forwarding threads see the table as it was before the
+ * batch. Does nothing if updates are already being deferred.
+ *
+ * Must only be called from the master thread.
+ *
+ * @param lpm
+ *   LPM object handle
+ */
+void
+lpm_update_begin(struct lpm *lpm);
+
+/**
+ * Return the number of rule changes made since lpm_update_begin(),
+ * or 0 if updates are not being deferred.
+ *
+ * @param lpm
+ *   LPM object handle
+ */
+uint32_t
+lpm_update_pending(const struct lpm *lpm);
+
+/**
+ * Apply the deferred changes to the forwarding table in place, writing
+ * each affected tbl24 entry and tbl8 group once.
+ *
+ * @param lpm
+ *   LPM object handle
+ * @return
+ *   0 on success, -ENOSPC if some prefixes longer than /24 could not be
+ *   installed. Their rules remain, but forward using the shorter rules.
+ */
+int
+lpm_update_commit(struct lpm *lpm);
+
+/**
+ * Apply the deferred changes by building a complete new LPM object from
+ * the rules. The rules, and the trackers attached to them, are moved to
+ * the new object, which the caller must publish in place of the old one.
+ * The old object keeps forwarding as it was and must be freed with
+ * lpm_free() once no readers can still be using it.
+ *
+ * @param lpm
+ *   LPM object handle
+ * @return
+ *   New LPM object, or NULL on allocation failure in which case the
+ *   old one is untouched and lpm_update_commit() can be used instead.
+ */
+struct lpm *
+lpm_update_commit_shadow(struct lpm *lpm);
+
+/**
+ * Get the convergence statistics for deferred updates.
+ *
+ * @param lpm
+ *   LPM object handle
+ * @param stats
+ *   Location to store the statistics in
+ */
+void
+lpm_update_stats_get(const struct lpm *lpm, struct lpm_update_stats *stats);
+
 /**
  * Lookup an IP into the LPM table.
  *
@@ -281,6 +355,30 @@ lpm_delete_all(struct lpm *lpm, lpm_walk_func_t func, void *arg);
 int
 lpm_lookup(const struct lpm *lpm, uint32_t ip, uint32_t *next_hop);
 
+/** Next hop value returned by lpm_lookup_bulk() on lookup miss. */
+#define LPM_LOOKUP_MISS UINT32_MAX
+
+/**
+ * Lookup multiple IPs in the LPM table.
+ *
+ * The tbl24 entries for all of the IPs are loaded before any of the
+ * tbl8 entries, so that the memory accesses for different IPs overlap
+ * instead of each lookup stalling on its own dependent loads.
+ *
+ * @param lpm
+ *   LPM object handle
+ * @param ips
+ *   Array of IPs to be looked up in the LPM table
+ * @param next_hops
+ *   Array to store the next hop of the most specific rule found for
+ *   each IP, or LPM_LOOKUP_MISS on lookup miss
+ * @param n
+ *   Number of IPs to be looked up
+ */
+void
+lpm_lookup_bulk(const struct lpm *lpm, const uint32_t *ips,
+		uint32_t *next_hops, unsigned int n);
+
 /**
  * Lookup an IP in the LPM table and return exact match
  *
@@ -299,6 +397,23 @@ int
 lpm_lookup_exact(struct lpm *lpm, uint32_t ip, uint8_t depth,
 		     uint32_t *next_hop);
 
+/**
+ * Lookup an IP in the LPM table from the master thread. Unlike
+ * lpm_lookup() this takes into account changes that have not been
+ * committed to the forwarding table yet.
+ *
+ * @param lpm
+ *   LPM object handle
+ * @param ip
+ *   IP to be looked up in the LPM table
+ * @param next_hop
+ *   Next hop of the most specific rule found for IP (valid on lookup hit only)
+ * @return
+ *   -ENOENT on lookup miss, 0 on lookup hit
+ */
+int
+lpm_lookup_ctrl(struct lpm *lpm, uint32_t ip, uint32_t *next_hop);
+
 /**
  * Iterate over all rules in the LPM table.
  *
@@ -39,6 +39,7 @@
 #include <bsd/sys/tree.h>
 #include <errno.h>
 #include <rte_branch_prediction.h>
+#include <rte_byteorder.h>
 #include <rte_common.h>
 #include <rte_eal.h>
 #include <rte_eal_memconfig.h>
@@ -76,6 +77,24 @@
 
 #define lpm6_tbl8_gindex next_hop
 
+#ifndef LPM6_DEFAULT_ALGO
+#define LPM6_DEFAULT_ALGO LPM6_ALGO_DIR24_8
+#endif
+
+#define PT_DIRECT_BITS	16
+#define PT_DIRECT_ENTRIES	(1 << PT_DIRECT_BITS)
+#define PT_STRIDE	6
+#define PT_FANOUT	(1 << PT_STRIDE)
+#define PT_MAX_LEVELS	((LPM6_MAX_DEPTH - PT_DIRECT_BITS + PT_STRIDE - 1) / \
+			 PT_STRIDE)
+#define PT_NO_ROUTE	UINT32_MAX
+
+/*
+ * Direct table entries are either 0 (no route), a next hop tagged
+ * with the low bit set, or a pointer to the root node of the subtrie.
+ */
+#define PT_DIRECT_LEAF(nh)	(((uintptr_t)(nh) << 1) | 1)
+
 /** Flags for setting an entry as valid/invalid. */
 enum valid_flag {
 	INVALID = 0,
@@ -92,6 +111,22 @@ struct lpm6_tbl_entry {
 	uint32_t valid_group :1;   /**< Group validation flag. */
 };
 
+/*
+ * Poptrie node. Bit n of vector is set if slot n has a child node, in
+ * which case it is children[popcount(vector & bits 0..n) - 1]. Otherwise
+ * the slot is a leaf, and leafvec marks the slots where a new run of
+ * leaves starts, so that the next hop for slot n is
+ * leaves[popcount(leafvec & bits 0..n) - 1].
+ *
+ * Nodes are never modified once reachable from the direct table.
+ */
+struct lpm6_pt_node {
+	uint64_t vector;
+	uint64_t leafvec;
+	struct lpm6_pt_node *children;
+	uint32_t *leaves;
+};
+
 /** Rules tbl entry structure. */
 struct lpm6_rule {
 	uint8_t ip[LPM6_IPV6_ADDR_SIZE]; /**< Rule IP address. */
@@ -107,6 +142,7 @@ struct lpm6_rule {
 struct lpm6 {
 	/* LPM metadata. */
 	uint32_t id;			/**< table id */
+	enum lpm6_algo algo;		/**< forwarding table representation */
 	uint32_t number_tbl8s;           /**< Number of tbl8s to allocate. */
 	uint32_t next_tbl8;              /**< Next tbl8 to be used. */
 	unsigned int rule_count;         /**< num of rules **/
@@ -121,11 +157,24 @@ struct lpm6 {
 	struct lpm6_tbl_entry tbl24[LPM6_TBL24_NUM_ENTRIES]
 			__rte_cache_aligned; /**< LPM tbl24 table. */
 	struct lpm6_tbl_entry *tbl8;	/* Actual table */
+
+	/* Poptrie tables, only allocated for LPM6_ALGO_POPTRIE. */
+	uintptr_t *pt_direct;		/* indexed by first 16 bits */
+	size_t pt_mem;			/* bytes allocated to nodes */
+};
+
+static enum lpm6_algo lpm6_default_algo = LPM6_DEFAULT_ALGO;
+
+static const char * const lpm6_algo_names[] = {
+	[LPM6_ALGO_DIR24_8] = "dir24-8",
+	[LPM6_ALGO_POPTRIE] = "poptrie",
 };
 
 static void
 lpm6_tracker_update(struct lpm6 *lpm, struct lpm6_rule *old_rule,
 		    const uint8_t *ip, uint8_t depth);
+static void
+pt_free_all(struct lpm6 *lpm);
 
 bool
 lpm6_is_empty(const struct lpm6 *lpm)
@@ -139,6 +188,40 @@ lpm6_rule_count(const struct lpm6 *lpm)
 	return lpm->rule_count;
 }
 
+void
+lpm6_set_default_algo(enum lpm6_algo algo)
+{
+	lpm6_default_algo = algo;
+}
+
+int
+lpm6_algo_parse(const char *name, enum lpm6_algo *algo)
+{
+	unsigned int i;
+
+	for (i = 0; i < RTE_DIM(lpm6_algo_names); i++) {
+		if (strcmp(name, lpm6_algo_names[i]) == 0) {
+			*algo = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+const char *
+lpm6_algo_name(enum lpm6_algo algo)
+{
+	if (algo >= RTE_DIM(lpm6_algo_names))
+		return "unknown";
+	return lpm6_algo_names[algo];
+}
+
+enum lpm6_algo
+lpm6_get_algo(const struct lpm6 *lpm)
+{
+	return lpm->algo;
+}
+
 /* Comparison function for red-black tree nodes.
    "If the first argument is smaller than the second, the function
     returns a value smaller than zero.	If they are equal, the function
@@ -216,16 +299,30 @@ lpm6_create(uint32_t tableid)
 		RB_INIT(&lpm->rules[depth]);
 
 	lpm->id = tableid;
-	lpm->number_tbl8s = LPM6_TBL8_INIT_GROUPS;
-	lpm->next_tbl8 = LPM6_TBL8_INIT_GROUPS - 1;
-	lpm->tbl8 = malloc_huge_aligned(LPM6_TBL8_INIT_ENTRIES *
-					sizeof(struct lpm6_tbl_entry));
-
-	if (lpm->tbl8 == NULL) {
-		RTE_LOG(ERR, LPM, "LPM tbl8 group allocation failed\n");
-		free_huge(lpm, sizeof(*lpm));
-		lpm = NULL;
-		goto exit;
+	lpm->algo = lpm6_default_algo;
+
+	if (lpm->algo == LPM6_ALGO_POPTRIE) {
+		/* tbl24 is left untouched so never gets backed by memory */
+		lpm->pt_direct = malloc_huge_aligned(PT_DIRECT_ENTRIES *
+						     sizeof(uintptr_t));
+		if (lpm->pt_direct == NULL) {
+			RTE_LOG(ERR, LPM, "LPM poptrie allocation failed\n");
+			free_huge(lpm, sizeof(*lpm));
+			lpm = NULL;
+			goto exit;
+		}
+	} else {
+		lpm->number_tbl8s = LPM6_TBL8_INIT_GROUPS;
+		lpm->next_tbl8 = LPM6_TBL8_INIT_GROUPS - 1;
+		lpm->tbl8 = malloc_huge_aligned(LPM6_TBL8_INIT_ENTRIES *
+						sizeof(struct lpm6_tbl_entry));
+
+		if (lpm->tbl8 == NULL) {
+			RTE_LOG(ERR, LPM, "LPM tbl8 group allocation failed\n");
+			free_huge(lpm, sizeof(*lpm));
+			lpm = NULL;
+			goto exit;
+		}
 	}
 
 	memset(&lpm->no_route_rule, 0, sizeof(lpm->no_route_rule));
@@ -250,6 +347,10 @@ lpm6_free(struct lpm6 *lpm)
 	if (lpm == NULL)
 		return;
 
+	if (lpm->pt_direct) {
+		pt_free_all(lpm);
+		free_huge(lpm->pt_direct, PT_DIRECT_ENTRIES * sizeof(uintptr_t));
+	}
 	free_huge(lpm->tbl8, (lpm->number_tbl8s *
 			      LPM6_TBL8_GROUP_NUM_ENTRIES *
 			      sizeof(struct lpm6_tbl_entry)));
@@ -447,6 +548,16 @@ lpm6_tbl8_unused_count(const struct lpm6 *lpm)
 	return lpm->number_tbl8s - lpm6_tbl8_used_count(lpm);
 }
 
+size_t
+lpm6_memory_usage(const struct lpm6 *lpm)
+{
+	if (lpm->algo == LPM6_ALGO_POPTRIE)
+		return PT_DIRECT_ENTRIES * sizeof(uintptr_t) + lpm->pt_mem;
+
+	return sizeof(lpm->tbl24) + (size_t)lpm->number_tbl8s *
+		LPM6_TBL8_GROUP_NUM_ENTRIES * sizeof(struct lpm6_tbl_entry);
+}
+
 static int32_t
 tbl8_alloc(struct lpm6 *lpm)
 {
@@ -504,6 +615,25 @@ tbl_entry_get(struct lpm6 *lpm, const struct lpm6_tbl_context *tbl_ctx)
 		&lpm->tbl24[tbl_ctx->tbl_index];
 }
 
+/*
+ * Update default tbl entry. Note: The ext_flag and tbl8_index
+ * need to be updated simultaneously, so assign whole structure
+ * in one go.
+ */
+static void
+tbldflt_set(struct lpm6 *lpm, uint32_t next_hop)
+{
+	struct lpm6_tbl_entry new_tbl_entry = {
+		.next_hop = next_hop,
+		.depth = 0,
+		.valid = VALID,
+		.ext_entry = 0,
+		.valid_group = VALID,
+	};
+
+	_CMM_STORE_SHARED(lpm->tbldflt, new_tbl_entry);
+}
+
 /*
  * Partially adds a new route to the data structure (tbl24+tbl8s).
  * It returns 0 on success, a negative number on failure, or 1 if
@@ -523,20 +653,7 @@ add_step(struct lpm6 *lpm, const struct lpm6_tbl_context *tbl_ctx,
 
 	/* Default route */
 	if (depth == 0) {
-		/*
-		 * Update default tbl entry. Note: The ext_flag and tbl8_index
-		 * need to be updated simultaneously, so assign whole structure
-		 * in one go.
-		 */
-		struct lpm6_tbl_entry new_tbl_entry = {
-			.next_hop = next_hop,
-			.depth = depth,
-			.valid = VALID,
-			.ext_entry = 0,
-			.valid_group = VALID,
-		};
-
-		_CMM_STORE_SHARED(lpm->tbldflt, new_tbl_entry);
+		tbldflt_set(lpm, next_hop);
 		return 0;
 	}
 
@@ -668,6 +785,539 @@ add_step(struct lpm6 *lpm, const struct lpm6_tbl_context *tbl_ctx,
 	return 1;
 }
 
+/*
+ * Add a route to the tbl24/tbl8s.
+ */
+static int
+dir24_8_add(struct lpm6 *lpm, const uint8_t *masked_ip, uint8_t depth,
+	    uint32_t next_hop)
+{
+	struct lpm6_tbl_context tbl_ctx;
+	struct lpm6_tbl_context tbl_ctx_next;
+	int status;
+	int i;
+
+	tbl_ctx.tbl8 = false;
+	tbl_ctx.tbl_index = 0;
+
+	status = add_step(lpm, &tbl_ctx, &tbl_ctx_next, masked_ip,
+			  ADD_FIRST_BYTE, 1, depth, next_hop);
+
+	/*
+	 * Inspect one by one the rest of the bytes until
+	 * the process is completed.
+	 */
+	for (i = ADD_FIRST_BYTE; i < LPM6_IPV6_ADDR_SIZE && status == 1; i++) {
+		tbl_ctx = tbl_ctx_next;
+		status = add_step(lpm, &tbl_ctx, &tbl_ctx_next,
+				  masked_ip, 1, (uint8_t)(i+1), depth,
+				  next_hop);
+	}
+
+	return status;
+}
+
+/*
+ * Poptrie
+ *
+ * An alternative to the tbl24/tbl8s for large tables, following
+ * "Poptrie: A Compressed Trie with Population Count for Fast and
+ * Scalable Software IP Routing Table Lookup" (Asai, Ohara). The first
+ * 16 bits of the address index a direct table, then each 6 bit stride
+ * is a 64-ary node whose children and leaves are packed into arrays
+ * indexed by popcount, with runs of the same leaf stored once. This
+ * keeps the whole table small enough to stay mostly in cache, which
+ * matters more than the number of levels.
+ *
+ * The rules trees are the source of truth. An update rebuilds the
+ * deepest node whose region covers the changed prefix from the rules,
+ * copies the nodes on the path from the direct table down to it, and
+ * then switches to the new path with a single store into the direct
+ * table. Replaced nodes are freed after a grace period. The default
+ * route lives in tbldflt as for the tbl24/tbl8s.
+ */
+
+/* Route in the form used to build nodes */
+struct pt_route {
+	uint64_t hi;
+	uint64_t lo;
+	uint32_t next_hop;
+	uint8_t depth;
+};
+
+/* Nodes unlinked by an update, to be freed after a grace period */
+struct pt_garbage {
+	struct rcu_head rcu;
+	struct lpm6_pt_node subtree;	/* arrays freed recursively */
+	unsigned int count;
+	void *ptrs[PT_MAX_LEVELS + 1];	/* freed as is */
+};
+
+static ALWAYS_INLINE void
+pt_addr(const uint8_t *ip, uint64_t *hi, uint64_t *lo)
+{
+	uint64_t addr[2];
+
+	memcpy(addr, ip, sizeof(addr));
+	*hi = rte_be_to_cpu_64(addr[0]);
+	*lo = rte_be_to_cpu_64(addr[1]);
+}
+
+/* Slot for the stride starting at bit off, zero padded beyond bit 127 */
+static ALWAYS_INLINE unsigned int
+pt_index(uint64_t hi, uint64_t lo, unsigned int off)
+{
+	unsigned __int128 addr = ((unsigned __int128)hi << 64) | lo;
+
+	return (uint64_t)((addr << off) >> (128 - PT_STRIDE));
+}
+
+/* Mask of the slots up to and including idx */
+static ALWAYS_INLINE uint64_t
+pt_mask(unsigned int idx)
+{
+	return ((1ull << idx) << 1) - 1;
+}
+
+static size_t
+pt_subtree_size(const struct lpm6_pt_node *node)
+{
+	unsigned int i, nchildren = __builtin_popcountll(node->vector);
+	size_t sz;
+
+	sz = nchildren * sizeof(*node) +
+		__builtin_popcountll(node->leafvec) * sizeof(uint32_t);
+	for (i = 0; i < nchildren; i++)
+		sz += pt_subtree_size(&node->children[i]);
+
+	return sz;
+}
+
+/* Free the arrays of a node and all below it, but not the node itself */
+static void
+pt_subtree_free(struct lpm6_pt_node *node)
+{
+	unsigned int i;
+
+	/* Copes with a partially built node, see pt_build_node */
+	if (node->children)
+		for (i = 0; i < __builtin_popcountll(node->vector); i++)
+			pt_subtree_free(&node->children[i]);
+	free(node->children);
+	free(node->leaves);
+}
+
+static void
+pt_garbage_free(struct rcu_head *head)
+{
+	struct pt_garbage *garbage =
+		caa_container_of(head, struct pt_garbage, rcu);
+	unsigned int i;
+
+	pt_subtree_free(&garbage->subtree);
+	for (i = 0; i < garbage->count; i++)
+		free(garbage->ptrs[i]);
+	free(garbage);
+}
+
+static void
+pt_free_all(struct lpm6 *lpm)
+{
+	struct lpm6_pt_node *root;
+	uint32_t i;
+
+	for (i = 0; i < PT_DIRECT_ENTRIES; i++) {
+		if (!lpm->pt_direct[i] || (lpm->pt_direct[i] & 1))
+			continue;
+		root = (struct lpm6_pt_node *)lpm->pt_direct[i];
+		pt_subtree_free(root);
+		free(root);
+	}
+	lpm->pt_mem = 0;
+}
+
+/*
+ * Build a node for the region of the given depth from the routes in
+ * it, which must all be longer than the region and in ascending depth
+ * order. Slots not covered by any route get the inherited next hop.
+ */
+static int
+pt_build_node(struct lpm6_pt_node *node, const struct pt_route *routes,
+	      unsigned int count, unsigned int off, uint32_t inherited)
+{
+	unsigned int bucket[PT_FANOUT] = { 0 };
+	unsigned int end[PT_FANOUT];
+	uint32_t leaf[PT_FANOUT];
+	uint32_t leaves[PT_FANOUT];
+	struct pt_route *deeper = NULL;
+	unsigned int i, j, idx, range;
+	unsigned int ndeeper = 0, nleaves = 0;
+	int rc = -ENOMEM;
+
+	memset(node, 0, sizeof(*node));
+	for (i = 0; i < PT_FANOUT; i++)
+		leaf[i] = inherited;
+
+	/* Later (longer) routes override earlier ones */
+	for (i = 0; i < count; i++) {
+		idx = pt_index(routes[i].hi, routes[i].lo, off);
+		if (routes[i].depth > off + PT_STRIDE) {
+			node->vector |= 1ull << idx;
+			bucket[idx]++;
+			ndeeper++;
+			continue;
+		}
+		range = 1 << (off + PT_STRIDE - routes[i].depth);
+		for (j = idx; j < idx + range; j++)
+			leaf[j] = routes[i].next_hop;
+	}
+
+	if (node->vector) {
+		node->children = calloc(__builtin_popcountll(node->vector),
+					sizeof(*node));
+		deeper = malloc(ndeeper * sizeof(*deeper));
+		if (!node->children || !deeper)
+			goto fail;
+
+		/* Split into a bucket per slot, keeping the depth order */
+		for (i = 0, j = 0; i < PT_FANOUT; i++) {
+			end[i] = j;
+			j += bucket[i];
+		}
+		for (i = 0; i < count; i++) {
+			if (routes[i].depth <= off + PT_STRIDE)
+				continue;
+			idx = pt_index(routes[i].hi, routes[i].lo, off);
+			deeper[end[idx]++] = routes[i];
+		}
+
+		for (i = 0, j = 0; i < PT_FANOUT; i++) {
+			if (!bucket[i])
+				continue;
+			rc = pt_build_node(&node->children[j++],
+					   deeper + end[i] - bucket[i],
+					   bucket[i], off + PT_STRIDE, leaf[i]);
+			if (rc < 0)
+				goto fail;
+		}
+		free(deeper);
+		deeper = NULL;
+	}
+
+	for (i = 0; i < PT_FANOUT; i++) {
+		if (node->vector & (1ull << i))
+			continue;
+		if (nleaves && leaves[nleaves - 1] == leaf[i])
+			continue;
+		node->leafvec |= 1ull << i;
+		leaves[nleaves++] = leaf[i];
+	}
+
+	if (nleaves) {
+		node->leaves = malloc(nleaves * sizeof(leaves[0]));
+		if (!node->leaves)
+			goto fail;
+		memcpy(node->leaves, leaves, nleaves * sizeof(leaves[0]));
+	}
+
+	return 0;
+
+fail:
+	free(deeper);
+	pt_subtree_free(node);
+	memset(node, 0, sizeof(*node));
+	return -ENOMEM;
+}
+
+/*
+ * Next hop of the best rule covering ip/depth, not counting the
+ * default route.
+ */
+static uint32_t
+pt_cover_next_hop(struct lpm6 *lpm, const uint8_t *ip, uint8_t depth)
+{
+	uint8_t masked_ip[LPM6_IPV6_ADDR_SIZE];
+	struct lpm6_rule *rule;
+
+	for (; depth > 0; depth--) {
+		if (RB_EMPTY(&lpm->rules[depth]))
+			continue;
+		mask_ip6(masked_ip, ip, depth);
+		rule = rule_find_any(lpm, masked_ip, depth);
+		if (rule)
+			return rule->next_hop;
+	}
+
+	return PT_NO_ROUTE;
+}
+
+/*
+ * Collect the rules more specific than ip/depth, in ascending depth
+ * order. Where a prefix has rules for multiple scopes only the highest
+ * scope one is in use.
+ */
+static int
+pt_collect(struct lpm6 *lpm, const uint8_t *ip, uint8_t depth,
+	   struct pt_route **routes, unsigned int *count)
+{
+	uint8_t masked_ip[LPM6_IPV6_ADDR_SIZE];
+	unsigned int size = 0, n = 0;
+	struct pt_route *tmp, *r = NULL;
+	struct lpm6_rule *rule, *next;
+	unsigned int d;
+
+	for (d = depth + 1; d <= LPM6_MAX_DEPTH; d++) {
+		if (RB_EMPTY(&lpm->rules[d]))
+			continue;
+
+		rule = rule_find_next(lpm, ip, d, INT16_MIN);
+		for (; rule; rule = next) {
+			next = RB_NEXT(lpm6_rules_tree, &lpm->rules[d], rule);
+			mask_ip6(masked_ip, rule->ip, depth);
+			if (memcmp(masked_ip, ip, LPM6_IPV6_ADDR_SIZE))
+				break;
+			if (next && !memcmp(next->ip, rule->ip,
+					    LPM6_IPV6_ADDR_SIZE))
+				continue;
+
+			if (n == size) {
+				size = size ? size * 2 : 64;
+				tmp = realloc(r, size * sizeof(*r));
+				if (!tmp) {
+					free(r);
+					return -ENOMEM;
+				}
+				r = tmp;
+			}
+			pt_addr(rule->ip, &r[n].hi, &r[n].lo);
+			r[n].next_hop = rule->next_hop;
+			r[n].depth = d;
+			n++;
+		}
+	}
+
+	*routes = r;
+	*count = n;
+	return 0;
+}
+
+/*
+ * Rebuild the node at the given level on the path for ip from the
+ * rules and swap it in. path[0] is the root node below the direct table
+ * entry for ip, and level 0 rebuilds the direct table entry itself.
+ *
+ * The cost is that of collecting and building all the routes under the
+ * node, so a level 0 rebuild is O(routes under the /16).  It must not be
+ * done per route when many routes change at once: a batch of updates
+ * should rebuild each region it changed once, at the end of the batch.
+ */
+static int
+pt_rebuild(struct lpm6 *lpm, const uint8_t *ip,
+	   struct lpm6_pt_node * const *path, unsigned int level)
+{
+	unsigned int off = PT_DIRECT_BITS + (level ? level - 1 : 0) * PT_STRIDE;
+	struct lpm6_pt_node *copies[PT_MAX_LEVELS] = { NULL };
+	struct lpm6_pt_node *old, *old_root = NULL, *root = NULL;
+	uint8_t region[LPM6_IPV6_ADDR_SIZE];
+	struct lpm6_pt_node built, node;
+	struct pt_route *routes = NULL;
+	struct pt_garbage *garbage;
+	unsigned int count, nchildren, pos, i;
+	uint32_t inherited, didx;
+	uint64_t hi, lo;
+	uintptr_t entry;
+	int rc;
+
+	mask_ip6(region, ip, off);
+	pt_addr(region, &hi, &lo);
+	didx = hi >> (64 - PT_DIRECT_BITS);
+
+	rc = pt_collect(lpm, region, off, &routes, &count);
+	if (rc < 0)
+		return rc;
+
+	/* Nothing below this node any more, so collapse it into its parent */
+	if (count == 0 && level > 0) {
+		free(routes);
+		return pt_rebuild(lpm, ip, path, level - 1);
+	}
+
+	inherited = pt_cover_next_hop(lpm, region, off);
+
+	garbage = calloc(1, sizeof(*garbage));
+	if (!garbage) {
+		free(routes);
+		return -ENOMEM;
+	}
+
+	memset(&built, 0, sizeof(built));
+	if (count) {
+		rc = pt_build_node(&built, routes, count, off, inherited);
+		free(routes);
+		if (rc < 0) {
+			free(garbage);
+			return rc;
+		}
+	}
+
+	/* Copy the nodes on the path back up to the root */
+	node = built;
+	for (i = level; i > 1; i--) {
+		const struct lpm6_pt_node *parent = path[i - 2];
+		unsigned int poff = PT_DIRECT_BITS + (i - 2) * PT_STRIDE;
+
+		nchildren = __builtin_popcountll(parent->vector);
+		pos = __builtin_popcountll(parent->vector &
+					   pt_mask(pt_index(hi, lo, poff))) - 1;
+
+		copies[i - 2] = malloc(nchildren * sizeof(node));
+		if (!copies[i - 2])
+			goto fail;
+		memcpy(copies[i - 2], parent->children,
+		       nchildren * sizeof(node));
+		copies[i - 2][pos] = node;
+
+		node = *parent;
+		node.children = copies[i - 2];
+		garbage->ptrs[garbage->count++] = parent->children;
+	}
+
+	if (count) {
+		root = malloc(sizeof(*root));
+		if (!root)
+			goto fail;
+		*root = node;
+		entry = (uintptr_t)root;
+	} else if (inherited != PT_NO_ROUTE) {
+		entry = PT_DIRECT_LEAF(inherited);
+	} else {
+		entry = 0;
+	}
+
+	if (lpm->pt_direct[didx] && !(lpm->pt_direct[didx] & 1)) {
+		old_root = (struct lpm6_pt_node *)lpm->pt_direct[didx];
+		garbage->ptrs[garbage->count++] = old_root;
+		lpm->pt_mem -= sizeof(*old_root);
+	}
+	old = level ? path[level - 1] : old_root;
+	if (old) {
+		garbage->subtree = *old;
+		lpm->pt_mem -= pt_subtree_size(old);
+	}
+	if (root)
+		lpm->pt_mem += sizeof(*root);
+	lpm->pt_mem += pt_subtree_size(&built);
+
+	cmm_smp_wmb();
+	CMM_STORE_SHARED(lpm->pt_direct[didx], entry);
+
+	call_rcu(&garbage->rcu, pt_garbage_free);
+	return 0;
+
+fail:
+	for (i = 0; i < PT_MAX_LEVELS; i++)
+		free(copies[i]);
+	pt_subtree_free(&built);
+	free(garbage);
+	return -ENOMEM;
+}
+
+/*
+ * Bring the poptrie in line with the rules after the rules for
+ * ip/depth have changed.
+ */
+static int
+pt_update(struct lpm6 *lpm, const uint8_t *ip, uint8_t depth)
+{
+	struct lpm6_pt_node *path[PT_MAX_LEVELS];
+	uint8_t region[LPM6_IPV6_ADDR_SIZE] = { 0 };
+	struct lpm6_pt_node *node;
+	unsigned int level = 0, off, idx;
+	uint32_t didx, range, i;
+	uint64_t hi, lo;
+	int rc;
+
+	pt_addr(ip, &hi, &lo);
+	didx = hi >> (64 - PT_DIRECT_BITS);
+
+	/* Short prefixes change every direct table entry they cover */
+	if (depth <= PT_DIRECT_BITS) {
+		range = 1 << (PT_DIRECT_BITS - depth);
+		for (i = didx; i < didx + range; i++) {
+			region[0] = i >> 8;
+			region[1] = i & 0xff;
+			rc = pt_rebuild(lpm, region, NULL, 0);
+			if (rc < 0)
+				return rc;
+		}
+		return 0;
+	}
+
+	if (!lpm->pt_direct[didx] || (lpm->pt_direct[didx] & 1))
+		return pt_rebuild(lpm, ip, NULL, 0);
+
+	/*
+	 * Find the deepest node that the prefix falls in. If there is no
+	 * child for the prefix yet then the last node on the path gets one.
+	 */
+	node = (struct lpm6_pt_node *)lpm->pt_direct[didx];
+	path[level++] = node;
+	for (off = PT_DIRECT_BITS; depth > off + PT_STRIDE; off += PT_STRIDE) {
+		idx = pt_index(hi, lo, off);
+		if (!(node->vector & (1ull << idx)))
+			break;
+		node = &node->children[__builtin_popcountll(node->vector &
+							    pt_mask(idx)) - 1];
+		path[level++] = node;
+	}
+
+	return pt_rebuild(lpm, ip, path, level);
+}
+
+static int
+pt_add(struct lpm6 *lpm, const uint8_t *ip, uint8_t depth,
+       uint32_t next_hop)
+{
+	if (depth == 0) {
+		tbldflt_set(lpm, next_hop);
+		return 0;
+	}
+
+	return pt_update(lpm, ip, depth);
+}
+
+static void
+pt_delete_all(struct lpm6 *lpm)
+{
+	struct pt_garbage *garbage;
+	struct lpm6_pt_node *root;
+	uint32_t i;
+
+	for (i = 0; i < PT_DIRECT_ENTRIES; i++) {
+		if (!lpm->pt_direct[i])
+			continue;
+		if (lpm->pt_direct[i] & 1) {
+			CMM_STORE_SHARED(lpm->pt_direct[i], 0);
+			continue;
+		}
+
+		root = (struct lpm6_pt_node *)lpm->pt_direct[i];
+		CMM_STORE_SHARED(lpm->pt_direct[i], 0);
+
+		garbage = calloc(1, sizeof(*garbage));
+		if (!garbage) {
+			synchronize_rcu();
+			pt_subtree_free(root);
+			free(root);
+			continue;
+		}
+		garbage->subtree = *root;
+		garbage->ptrs[garbage->count++] = root;
+		call_rcu(&garbage->rcu, pt_garbage_free);
+	}
+	lpm->pt_mem = 0;
+}
+
 /*
  * Add a route
  */
@@ -679,12 +1329,9 @@ lpm6_add(struct lpm6 *lpm, const uint8_t *ip, uint8_t depth,
 	 struct pd_obj_state_and_flags **old_pd_state)
 {
 	struct lpm6_rule *rule_other_scope;
-	struct lpm6_tbl_context tbl_ctx;
-	struct lpm6_tbl_context tbl_ctx_next;
 	struct lpm6_rule *rule;
 	int status;
 	uint8_t masked_ip[LPM6_IPV6_ADDR_SIZE];
-	int i;
 	bool demoted = false;
 
 	/* Check user arguments. */
@@ -712,33 +1359,16 @@ lpm6_add(struct lpm6 *lpm, const uint8_t *ip, uint8_t depth,
 		return LPM_HIGHER_SCOPE_EXISTS;
 	}
 
-	tbl_ctx.tbl8 = false;
-	tbl_ctx.tbl_index = 0;
-
-	status = add_step(lpm, &tbl_ctx, &tbl_ctx_next, masked_ip,
-			  ADD_FIRST_BYTE, 1, depth, next_hop);
+	if (lpm->algo == LPM6_ALGO_POPTRIE)
+		status = pt_add(lpm, masked_ip, depth, next_hop);
+	else
+		status = dir24_8_add(lpm, masked_ip, depth, next_hop);
 	if (status < 0) {
 		lpm6_delete(lpm, masked_ip, depth, NULL, scope, NULL,
 				NULL, NULL);
 		return status;
 	}
 
-	/*
-	 * Inspect one by one the rest of the bytes until
-	 * the process is completed.
-	 */
-	for (i = ADD_FIRST_BYTE; i < LPM6_IPV6_ADDR_SIZE && status == 1; i++) {
-		tbl_ctx = tbl_ctx_next;
-		status = add_step(lpm, &tbl_ctx, &tbl_ctx_next,
-				  masked_ip, 1, (uint8_t)(i+1), depth,
-				  next_hop);
-		if (status < 0) {
-			lpm6_delete(lpm, masked_ip, depth, NULL, scope,
-					NULL, NULL, NULL);
-			return status;
-		}
-	}
-
 	/* If we are demoting an existing rule then return details */
 	if (rule_other_scope && rule_other_scope->scope < scope) {
 		if (old_next_hop)
@@ -801,6 +1431,42 @@ lookup_step(const struct lpm6 *lpm, const struct lpm6_tbl_entry *tbl,
 	}
 }
 
+static ALWAYS_INLINE int
+pt_lookup(const struct lpm6 *lpm, const uint8_t *ip, uint32_t *next_hop)
+{
+	const struct lpm6_pt_node *node;
+	unsigned int off, idx;
+	uintptr_t entry;
+	uint64_t hi, lo;
+	uint32_t nh;
+
+	pt_addr(ip, &hi, &lo);
+	entry = rcu_dereference(lpm->pt_direct[hi >> (64 - PT_DIRECT_BITS)]);
+	if (entry & 1) {
+		*next_hop = entry >> 1;
+		return 0;
+	}
+	if (!entry)
+		return lookup_tbldflt(&lpm->tbldflt, next_hop);
+
+	node = (const struct lpm6_pt_node *)entry;
+	for (off = PT_DIRECT_BITS; ; off += PT_STRIDE) {
+		idx = pt_index(hi, lo, off);
+		if (!(node->vector & (1ull << idx)))
+			break;
+		node = &node->children[__builtin_popcountll(node->vector &
+							    pt_mask(idx)) - 1];
+	}
+
+	nh = node->leaves[__builtin_popcountll(node->leafvec &
+					       pt_mask(idx)) - 1];
+	if (nh == PT_NO_ROUTE)
+		return lookup_tbldflt(&lpm->tbldflt, next_hop);
+
+	*next_hop = nh;
+	return 0;
+}
+
 /*
  * Prefetch an IP for later lookup
  */
@@ -810,6 +1476,11 @@ lpm6_prefetch(struct lpm6 *lpm, const uint8_t *ip)
 	struct lpm6_tbl_entry *tbl;
 	uint32_t tbl24_index;
 
+	if (lpm->algo == LPM6_ALGO_POPTRIE) {
+		rte_prefetch1(&lpm->pt_direct[(ip[0] << BYTE_SIZE) | ip[1]]);
+		return;
+	}
+
 	tbl24_index = (ip[0] << BYTES2_SIZE) | (ip[1] << BYTE_SIZE) | ip[2];
 
 	/* Calculate pointer to the first entry to be inspected */
@@ -831,6 +1502,9 @@ lpm6_lookup(const struct lpm6 *lpm, const uint8_t *ip,
 	uint8_t first_byte;
 	uint32_t tbl24_index;
 
+	if (lpm->algo == LPM6_ALGO_POPTRIE)
+		return pt_lookup(lpm, ip, next_hop);
+
 	first_byte = LOOKUP_FIRST_BYTE;
 	tbl24_index = (ip[0] << BYTES2_SIZE) | (ip[1] << BYTE_SIZE) | ip[2];
 
@@ -1339,6 +2013,7 @@ static int rule_replace(struct lpm6 *lpm, struct lpm6_rule *old_rule,
 	struct lpm6_rule *sub_rule, *higher_scope_rule;
 	uint8_t sub_depth = 0;
 	bool higher_scope_found = false;
+	int rc;
 
 	mask_ip6(masked_ip, ip, depth);
 
@@ -1368,9 +2043,32 @@ static int rule_replace(struct lpm6 *lpm, struct lpm6_rule *old_rule,
 	    !memcmp(old_rule->ip, higher_scope_rule->ip, LPM6_IPV6_ADDR_SIZE))
 		higher_scope_found = true;
 
-	rule_delete(lpm, old_rule, depth);
-	if (higher_scope_found)
+	if (higher_scope_found) {
+		rule_delete(lpm, old_rule, depth);
 		return LPM_HIGHER_SCOPE_EXISTS;
+	}
+
+	/*
+	 * The poptrie is rebuilt from the rules, so rebuild it with the
+	 * rule taken out of the tree.  If that fails then the rule is
+	 * left in place, matching what is still being forwarded, and the
+	 * delete fails.  A short prefix may have had some direct entries
+	 * rebuilt before the failure, so those are put back.
+	 */
+	if (depth != 0 && lpm->algo == LPM6_ALGO_POPTRIE) {
+		RB_REMOVE(lpm6_rules_tree, &lpm->rules[depth], old_rule);
+		rc = pt_update(lpm, masked_ip, depth);
+		RB_INSERT(lpm6_rules_tree, &lpm->rules[depth], old_rule);
+		if (rc < 0) {
+			if (depth <= PT_DIRECT_BITS &&
+			    pt_update(lpm, masked_ip, depth) < 0)
+				RTE_LOG(ERR, LPM,
+					"LPM6 poptrie restore failed\n");
+			return rc;
+		}
+	}
+
+	rule_delete(lpm, old_rule, depth);
 
 	if (!sub_rule) {
 		sub_rule = find_previous_rule(lpm, ip, depth, &sub_depth);
@@ -1382,7 +2080,7 @@ static int rule_replace(struct lpm6 *lpm, struct lpm6_rule *old_rule,
 	/* Remove from lpm - the rule is already gone from the RB tree */
 	if (depth == 0)
 		memset(&lpm->tbldflt, 0, sizeof(lpm->tbldflt));
-	else
+	else if (lpm->algo != LPM6_ALGO_POPTRIE)
 		delete_rule(lpm, masked_ip, depth, sub_rule, sub_depth);
 
 	return LPM_SUCCESS;
@@ -1453,12 +2151,16 @@ lpm6_delete_all(struct lpm6 *lpm, lpm6_walk_func_t func, void *arg)
 	/* Zero default table entry */
 	memset(&lpm->tbldflt, 0, sizeof(lpm->tbldflt));
 
-	/* Zero tbl24. */
-	memset(lpm->tbl24, 0, sizeof(lpm->tbl24));
+	if (lpm->algo == LPM6_ALGO_POPTRIE) {
+		pt_delete_all(lpm);
+	} else {
+		/* Zero tbl24. */
+		memset(lpm->tbl24, 0, sizeof(lpm->tbl24));
 
-	/* Zero tbl8. */
-	memset(lpm->tbl8, 0, sizeof(lpm->tbl8[0]) *
-			LPM6_TBL8_GROUP_NUM_ENTRIES * lpm->number_tbl8s);
+		/* Zero tbl8. */
+		memset(lpm->tbl8, 0, sizeof(lpm->tbl8[0]) *
+		       LPM6_TBL8_GROUP_NUM_ENTRIES * lpm->number_tbl8s);
+	}
 
 	/* Delete all rules form the rules table. */
 	for (depth = 0; depth <= LPM6_MAX_DEPTH; ++depth) {
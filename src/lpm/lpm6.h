@@ -65,6 +65,12 @@ extern "C" {
 /** LPM structure. */
 struct lpm6;
 
+/** Forwarding table representation used by an LPM6 table. */
+enum lpm6_algo {
+	LPM6_ALGO_DIR24_8,	/**< tbl24 followed by 8 bit tbl8 strides */
+	LPM6_ALGO_POPTRIE,	/**< 16 bit direct table then 64-ary nodes */
+};
+
 /** LPM configuration structure. */
 struct lpm6_config {
 	uint32_t max_rules;      /**< Max number of rules. */
@@ -92,6 +98,38 @@ struct lpm6_walk_arg {
 struct lpm6 *
 lpm6_create(uint32_t id);
 
+/**
+ * Set the algorithm used by LPM tables created after this call.
+ *
+ * Existing tables keep the algorithm they were created with. The
+ * initial default is LPM6_DEFAULT_ALGO, which can be overridden at
+ * build time.
+ *
+ * @param algo
+ *   Algorithm to use for new tables
+ */
+void
+lpm6_set_default_algo(enum lpm6_algo algo);
+
+/**
+ * Parse an algorithm name, as given in the dataplane config.
+ *
+ * @param name
+ *   "dir24-8" or "poptrie"
+ * @param algo
+ *   Location to store the algorithm in
+ * @return
+ *   0 on success, -EINVAL if the name is not recognised
+ */
+int
+lpm6_algo_parse(const char *name, enum lpm6_algo *algo);
+
+const char *
+lpm6_algo_name(enum lpm6_algo algo);
+
+enum lpm6_algo
+lpm6_get_algo(const struct lpm6 *lpm);
+
 /*
  * @param lpm
  *   LPM table to return the ID of.
@@ -274,6 +312,12 @@ lpm6_tbl8_used_count(const struct lpm6 *lpm);
 uint32_t
 lpm6_tbl8_unused_count(const struct lpm6 *lpm);
 
+/*
+ * Bytes allocated to the forwarding tables (not the rules) of an LPM.
+ */
+size_t
+lpm6_memory_usage(const struct lpm6 *lpm);
+
 /*
  * Find the rule that covers the prefix defined by ip and depth.
  *
@@ -120,6 +120,7 @@
 #include "npf/fragment/ipv4_rsmbl.h"
 #include "npf_shim.h"
 #include "pipeline/pl_internal.h"
+#include "pl_common.h"
 #include "pktmbuf.h"
 #include "portmonitor/portmonitor.h"
 #include "power.h"
@@ -142,6 +143,8 @@
 #include "dpdk_eth_if.h"
 
 packet_input_t packet_input_func __hot_data = ether_input_no_dyn_feats;
+packet_burst_input_t packet_burst_input_func __hot_data;
+static bool pipeline_vector_mode;
 
 #define MBUF_OVERHEAD RTE_PKTMBUF_HEADROOM
 #define MIN_MBUF_POOL	4096			/* Minimum number of mbufs */
@@ -171,6 +174,9 @@ static struct rxtx_param *driver_param;
 #define QOS_PKT_BURST 64
 #define TX_PKT_BURST  32
 
+_Static_assert(RX_PKT_BURST <= PL_VECTOR_MAX,
+	       "rx burst does not fit in a pipeline vector");
+
 /* Number of packets queued between top and bottom half.
  * It has to be big enough that an initial burst of packets
  * can be processed by Tx thread which may be sleeping.
@@ -183,14 +189,38 @@ union atomic_stat {
 	uint32_t dword[2];
 };
 
-/* Temporary buffer to aggregate before going into the packet ring */
+/* Number of extra attempts to send packets before dropping them */
+#define PKT_TX_RETRIES	2
+
+/* Packets staged for one output port */
+struct pkt_stage {
+	uint16_t		count;	/* packets in burst */
+	bool			pending; /* port is on pending list */
+	struct rte_mbuf *m_tbl[TX_PKT_BURST];	/* pending packets */
+};
+
+/*
+ * Temporary buffers to aggregate before going to the device or into the
+ * packet ring.  There is one per output port, so that interleaved flows to
+ * different ports still go out in full bursts.  The lcore always uses the
+ * same queue on a port.
+ */
 struct pkt_burst {
-	uint8_t			port;	/* intended port */
 	uint16_t		queue;  /* queue to use for multi-queue tx */
-	uint32_t		count;	/* packets in burst */
-	struct rte_mbuf *m_tbl[TX_PKT_BURST];	/* pending packets */
+	uint16_t		nb_pending;	/* ports with staged packets */
+	portid_t		pending[DATAPLANE_MAX_PORTS];
+	struct pkt_stage	stage[DATAPLANE_MAX_PORTS];
 };
 
+/* Per lcore, per port, transmit burst counts */
+struct pkt_burst_stats {
+	uint64_t		bursts;
+	uint64_t		packets;
+};
+
+static struct pkt_burst_stats
+pkt_burst_stats[RTE_MAX_LCORE][DATAPLANE_MAX_PORTS] __rte_cache_aligned;
+
 RTE_DEFINE_PER_LCORE(unsigned int, _dp_lcore_id) = 0;
 static RTE_DEFINE_PER_LCORE(struct pkt_burst *, pkt_burst);
 
@@ -521,6 +551,45 @@ void pkt_burst_setup(void)
 	pkt_burst_init(lcore_id, lcore_conf[lcore_id]->tx_qid);
 }
 
+/*
+ * Queue packets for QoS into the ring for the scheduler shard of their
+ * subport.  Runs of packets for the same shard go as one burst.  Returns
+ * the number of packets queued, stopping at the first that is not.
+ */
+static uint16_t
+pkt_qos_ring_burst(struct ifnet *ifp, uint16_t port,
+		   struct rte_mbuf **mbufs, uint16_t nb_pkts)
+{
+	struct sched_info *qinfo = qos_handle(ifp);
+	unsigned int nrings = CMM_ACCESS_ONCE(port_config[port].nrings);
+	unsigned int n_shards, rid;
+	uint16_t i, start, n;
+
+	n_shards = qinfo ? qos_sched_shards(qinfo) : 1;
+	if (n_shards == 1 || nrings == 1)
+		return rte_ring_mp_enqueue_burst(port_config[port].pkt_ring[0],
+						 (void **) mbufs, nb_pkts,
+						 NULL);
+
+	for (start = 0; start < nb_pkts; start = i) {
+		rid = qos_sched_shard(qinfo, n_shards, mbufs[start]);
+		for (i = start + 1; i < nb_pkts; i++)
+			if (qos_sched_shard(qinfo, n_shards, mbufs[i]) != rid)
+				break;
+
+		/* Rings have gone away, so go to the first shard */
+		if (unlikely(rid >= nrings))
+			rid = 0;
+
+		n = rte_ring_mp_enqueue_burst(port_config[port].pkt_ring[rid],
+					      (void **) &mbufs[start],
+					      i - start, NULL);
+		if (n < i - start)
+			return start + n;
+	}
+	return nb_pkts;
+}
+
 static ALWAYS_INLINE uint16_t
 pkt_out_burst_cmn(struct ifnet *ifp, bool qos_enabled, uint16_t port,
 		  uint16_t queue, struct rte_mbuf **mbufs, uint16_t nb_pkts)
@@ -529,14 +598,12 @@ pkt_out_burst_cmn(struct ifnet *ifp, bool qos_enabled, uint16_t port,
 
 	if (__use_directpath(port, qos_enabled))
 		n = eth_tx_burst(ifp, queue, mbufs, nb_pkts);
+	else if (qos_enabled)
+		n = pkt_qos_ring_burst(ifp, port, mbufs, nb_pkts);
 	else {
 		uint8_t rid;
 
-		if (qos_enabled)
-			rid = 0;	/* always use ringid 0 for QoS */
-		else
-			rid = queue % CMM_ACCESS_ONCE(
-				port_config[port].nrings);
+		rid = queue % CMM_ACCESS_ONCE(port_config[port].nrings);
 
 		n = rte_ring_mp_enqueue_burst(
 					port_config[port].pkt_ring[rid],
@@ -546,50 +613,100 @@ pkt_out_burst_cmn(struct ifnet *ifp, bool qos_enabled, uint16_t port,
 	return n;
 }
 
+/*
+ * Drop the packets staged for a port that could not be sent, counting
+ * them against the transmit queue or packet ring.
+ */
+static void pkt_stage_drop(struct pkt_burst *pb, portid_t port)
+{
+	struct pkt_stage *ps = &pb->stage[port];
+	struct ifnet *ifp = ifnet_byport(port);
+
+	pktmbuf_free_bulk(ps->m_tbl, ps->count);
+	if (ifp) {
+		if (__use_directpath(port, ifp->qos_software_fwd))
+			if_incr_full_hwq(ifp, ps->count);
+		else
+			if_incr_full_txring(ifp, ps->count);
+	}
+	ps->count = 0;
+}
+
 /* Move packets out of per-cpu burst buffer.
  * If devices is using percoreq mode then go direct to device
  * otherwise queue into packet ring for Tx thread.
+ * Packets not accepted are kept, in order, for the next attempt.
+ * Returns the number of packets still staged.
+ */
+static __hot_func uint16_t
+pkt_stage_burst(struct pkt_burst *pb, portid_t port)
+{
+	struct pkt_stage *ps = &pb->stage[port];
+	struct ifnet *ifp = ifport_table[port];
+	struct pkt_burst_stats *stats;
+	uint16_t n;
+
+	n = pkt_out_burst_cmn(ifp, ifp->qos_software_fwd, port, pb->queue,
+			      ps->m_tbl, ps->count);
+	if (likely(n > 0)) {
+		stats = &pkt_burst_stats[dp_lcore_id()][port];
+		stats->bursts++;
+		stats->packets += n;
+	}
+
+	if (unlikely(n < ps->count)) {
+		/* Shuffle the remaining packets to front of the queue */
+		memmove(ps->m_tbl, ps->m_tbl + n,
+			(ps->count - n) * sizeof(struct rte_mbuf *));
+	}
+	ps->count -= n;
+	return ps->count;
+}
+
+/*
+ * Send the packets staged for a port, retrying up to PKT_TX_RETRIES times
+ * while the device or ring is still taking packets.
+ */
+static __hot_func uint16_t
+pkt_stage_burst_retry(struct pkt_burst *pb, portid_t port)
+{
+	uint16_t left, before;
+	unsigned int retry = 0;
+
+	do {
+		before = pb->stage[port].count;
+		left = pkt_stage_burst(pb, port);
+	} while (left && left < before && retry++ < PKT_TX_RETRIES);
+
+	return left;
+}
+
+/*
+ * Send the packets staged for all ports.  If drain is set any that could
+ * not be sent are dropped, otherwise they are kept for the next flush.
  */
 static __hot_func void
-pkt_ring_burst(struct pkt_burst *pb, bool drain)
+pkt_ring_flush(struct pkt_burst *pb, bool drain)
 {
-	struct ifnet *ifp = ifport_table[pb->port];
-	bool qos_enabled = ifp->qos_software_fwd;
-	uint32_t n;
+	unsigned int i, n = 0;
 
-	n = pkt_out_burst_cmn(ifp, qos_enabled, pb->port, pb->queue,
-			      pb->m_tbl, pb->count);
+	for (i = 0; i < pb->nb_pending; i++) {
+		portid_t port = pb->pending[i];
+		struct pkt_stage *ps = &pb->stage[port];
 
-	if (n < pb->count) {
-		if (n == 0 || drain) {
-			/* The transmit queue is full or some packets could
-			 * not be sent (or placed in tx ring) and we are
-			 * changing ports and need to drain the burst queue.
-			 * Drop the packets (and update counter).
-			 */
-			unsigned int drop = pb->count - n;
-			struct ifnet *ifp = ifnet_byport(pb->port);
-
-			pktmbuf_free_bulk(&pb->m_tbl[n], drop);
-			if (ifp) {
-				if (__use_directpath(pb->port, qos_enabled))
-					if_incr_full_hwq(ifp, drop);
-				else
-					if_incr_full_txring(ifp, drop);
-			}
-			goto out;
+		if (ps->count) {
+			if (!drain)
+				pkt_stage_burst(pb, port);
+			else if (pkt_stage_burst_retry(pb, port))
+				pkt_stage_drop(pb, port);
 		}
 
-		/* If some packets remain, shuffle to front of the queue */
-		unsigned int unsent = pb->count - n;
-		memmove(pb->m_tbl,
-			pb->m_tbl + n,
-			unsent * sizeof(struct rte_mbuf *));
-		pb->count = unsent;
-		return;
+		if (ps->count)
+			pb->pending[n++] = port;
+		else
+			ps->pending = false;
 	}
-out:
-	pb->count = 0;
+	pb->nb_pending = n;
 }
 
 static __hot_func void pkt_ring_drain(void)
@@ -597,8 +714,8 @@ static __hot_func void pkt_ring_drain(void)
 	struct crypto_pkt_buffer *cpb = RTE_PER_LCORE(crypto_pkt_buffer);
 	struct pkt_burst *pb = RTE_PER_LCORE(pkt_burst);
 
-	if (pb->count > 0)
-		pkt_ring_burst(pb, true);
+	if (pb->nb_pending > 0)
+		pkt_ring_flush(pb, true);
 	crypto_send(cpb);
 }
 
@@ -629,23 +746,42 @@ void pkt_ring_output(struct ifnet *ifp, struct rte_mbuf *m)
 	}
 
 	if (likely(pb != NULL)) {
+		struct pkt_stage *ps = &pb->stage[portid];
+
+		if (unlikely(ifp->qos_software_fwd)) {
+			struct sched_info *qinfo = qos_handle(ifp);
+
+			if (qinfo && qinfo->classify_fwd &&
+			    !qos_classify_fwd(ifp, qinfo, &m))
+				return;
+		}
+
 		if (unlikely(ifp->portmonitor) &&
-		    __use_directpath(pb->port,
+		    __use_directpath(portid,
 				     ifp->qos_software_fwd))
 			portmonitor_src_phy_tx_output(ifp, &m, 1);
 
-		/* If changing flows to another port */
-		if (unlikely(portid != pb->port)) {
-			if (pb->count > 0)
-				pkt_ring_burst(pb, true);
-			pb->port = portid;
+		/*
+		 * Backpressure: the last full burst was not all taken,
+		 * so try again before tail dropping.
+		 */
+		if (unlikely(ps->count == TX_PKT_BURST) &&
+		    pkt_stage_burst_retry(pb, portid) == TX_PKT_BURST) {
+			if (__use_directpath(portid, ifp->qos_software_fwd))
+				goto full_hwq;
+			else
+				goto full_txring;
 		}
 
-		pb->m_tbl[pb->count++] = m;
+		ps->m_tbl[ps->count++] = m;
+		if (!ps->pending) {
+			ps->pending = true;
+			pb->pending[pb->nb_pending++] = portid;
+		}
 
 		/* if burst is ready, send now */
-		if (pb->count == TX_PKT_BURST)
-			pkt_ring_burst(pb, false);
+		if (ps->count == TX_PKT_BURST)
+			pkt_stage_burst(pb, portid);
 	} else {
 		if (__use_directpath(portid, ifp->qos_software_fwd)) {
 			if (unlikely(ifp->portmonitor))
@@ -654,10 +790,8 @@ void pkt_ring_output(struct ifnet *ifp, struct rte_mbuf *m)
 			if (!master_eth_tx(ifp, &m, 1))
 				goto full_hwq;
 		} else {
-			/* must be lcore 0 */
-			struct rte_ring *ring = port_config[portid].pkt_ring[0];
-
-			if (rte_ring_mp_enqueue(ring, m) != 0)
+			/* must be lcore 0, use the ring of any QoS shard */
+			if (pkt_qos_ring_burst(ifp, portid, &m, 1) != 1)
 				goto full_txring;
 		}
 	}
@@ -684,8 +818,53 @@ void pkt_burst_flush(void)
 
 	struct pkt_burst *pb = RTE_PER_LCORE(pkt_burst);
 
-	if (pb->count > 0)
-		pkt_ring_burst(pb, true);
+	if (pb->nb_pending > 0)
+		pkt_ring_flush(pb, true);
+}
+
+/* Give the calling thread its own transmit staging buffers */
+void pkt_burst_test_init(uint16_t queue)
+{
+	pkt_burst_init(rte_get_master_lcore(), queue);
+}
+
+void pkt_burst_test_fini(void)
+{
+	struct pkt_burst *pb = RTE_PER_LCORE(pkt_burst);
+
+	if (pb->nb_pending > 0)
+		pkt_ring_flush(pb, true);
+	rte_free(pb);
+	RTE_PER_LCORE(pkt_burst) = NULL;
+}
+
+void pkt_burst_test_output(struct ifnet *ifp, struct rte_mbuf *m)
+{
+	pkt_ring_output(ifp, m);
+}
+
+/* As at the end of an rx burst, or of the forwarding loop if drain */
+void pkt_burst_test_flush(bool drain)
+{
+	struct pkt_burst *pb = RTE_PER_LCORE(pkt_burst);
+
+	if (pb->nb_pending > 0)
+		pkt_ring_flush(pb, drain);
+}
+
+uint16_t pkt_burst_test_staged(portid_t port)
+{
+	return RTE_PER_LCORE(pkt_burst)->stage[port].count;
+}
+
+void pkt_burst_test_stats(portid_t port, uint64_t *bursts,
+			  uint64_t *packets)
+{
+	const struct pkt_burst_stats *stats =
+		&pkt_burst_stats[dp_lcore_id()][port];
+
+	*bursts = stats->bursts;
+	*packets = stats->packets;
 }
 
 static struct rte_mbuf *
@@ -832,8 +1011,27 @@ process_burst(portid_t portid, struct rte_mbuf *pkts[], uint16_t nb)
 {
 	struct ifnet *ifp = ifport_table[portid];
 	packet_input_t input_func = packet_input_func;
+	packet_burst_input_t burst_input_func = packet_burst_input_func;
 	unsigned int i;
 
+	if (burst_input_func) {
+		for (i = 0; i < nb; i++) {
+			rte_prefetch0(pkts[i]->cacheline1);
+			rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+		}
+
+		if (unlikely(ifp->capturing))
+			capture_burst(ifp, pkts, nb);
+
+		if (unlikely(ifp->portmonitor))
+			portmonitor_src_phy_rx_output(ifp, pkts, nb);
+
+		for (i = 0; i < nb; i++)
+			pktmbuf_mdata_clear_all(pkts[i]);
+		burst_input_func(ifp, pkts, nb);
+		return;
+	}
+
 	/* Prefetch first packets */
 	for (i = 0; i < PREFETCH_OFFSET && i < nb; i++) {
 		rte_prefetch0(pkts[i]->cacheline1);
@@ -957,6 +1155,7 @@ static void __hot_func
 poll_receive_queues(struct lcore_conf *conf)
 {
 	struct crypto_pkt_buffer *cpb = RTE_PER_LCORE(crypto_pkt_buffer);
+	struct pkt_burst *pb = RTE_PER_LCORE(pkt_burst);
 	uint16_t high_rxq;
 	unsigned int i;
 
@@ -987,6 +1186,10 @@ poll_receive_queues(struct lcore_conf *conf)
 			rxq->packets += nb;
 			process_burst(portid, rx_pkts, nb);
 			crypto_send(cpb);
+
+			/* Send partial bursts left over from this one */
+			if (pb->nb_pending > 0)
+				pkt_ring_flush(pb, false);
 		}
 	}
 }
@@ -1044,7 +1247,7 @@ static unsigned int pkt_transmit_qos(struct ifnet *ifp,
 	pm_update(&txq->gov, n);
 
 	struct rte_mbuf **tx_pkts = txq->burst + txq->pending;
-	return qos_sched(ifp, qinfo, q_pkts, n, tx_pkts, space);
+	return qos_sched(ifp, qinfo, txq->ringid, q_pkts, n, tx_pkts, space);
 }
 
 /* Fast path, Qos not enabled.
@@ -1097,7 +1300,8 @@ poll_transmit_queues(struct lcore_conf *conf)
 		unsigned int space = TX_PKT_BURST - txq->pending;
 
 		struct sched_info *qinfo = qos_handle(ifp);
-		if (qinfo && txq->ringid == 0) /* QoS only uses ringid 0 */
+		/* QoS shards use the rings with the same index */
+		if (qinfo && txq->ringid < QOS_MAX_SHARDS)
 			added = pkt_transmit_qos(ifp, qinfo, txq, portid,
 						 space);
 		else
@@ -2166,6 +2370,11 @@ int enable_transmit_thread(portid_t portid)
 	if (transmit_thread_running(portid))
 		return 0;
 
+	/* Per core queue devices have extra rings for QoS shards */
+	if (port_conf->percoreq)
+		CMM_STORE_SHARED(port_config[portid].nrings,
+				 port_conf->max_rings);
+
 	ret = assign_port_transmit_queues(portid, &tmpmask);
 	if (ret == 0)
 		start_cpus();
@@ -2190,9 +2399,16 @@ void disable_transmit_thread(portid_t portid)
 
 	synchronize_rcu();
 	pkt_ring_empty(portid);
+	CMM_STORE_SHARED(port_config[portid].nrings, 1);
 	stop_cpus();
 }
 
+/* Number of packet rings, each with a transmit thread, on the port */
+unsigned int port_transmit_rings(portid_t portid)
+{
+	return CMM_ACCESS_ONCE(port_config[portid].nrings);
+}
+
 bool port_uses_queue_state(uint16_t portid)
 {
 	struct port_conf *port_conf = &port_config[portid];
@@ -2968,11 +3184,14 @@ static int port_conf_init_portid(portid_t portid)
 		}
 		port_conf->tx_queues = port_conf->max_rings;
 		port_conf->percoreq = false;
+		port_conf->nrings = port_conf->max_rings;
 	} else {
 		port_conf->percoreq = true;
-		port_conf->max_rings = 1;		/* needed for QoS */
+		/* Only used by QoS, one for each scheduler shard */
+		port_conf->max_rings = RTE_MIN(port_conf->tx_queues,
+					       QOS_MAX_SHARDS);
+		port_conf->nrings = 1;
 	}
-	port_conf->nrings = port_conf->max_rings;
 
 	for (q = 0; q < port_conf->tx_queues; q++)
 		bitmask_set(&port_conf->tx_enabled_queues, q);
@@ -3667,6 +3886,7 @@ main(int argc, char **argv)
 	argv += ret;
 
 	parse_config(config_file);
+	set_pipeline_vector_mode(config.pipeline_vector_mode);
 
 	parse_platform_config(PLATFORM_FILE);
 
@@ -3999,6 +4219,27 @@ void show_per_core(FILE *f)
 			jsonw_end_object(wr);
 		}
 		jsonw_end_array(wr);
+
+		jsonw_name(wr, "tx_burst");
+		jsonw_start_array(wr);
+		for (i = 0; i < DATAPLANE_MAX_PORTS; i++) {
+			const struct pkt_burst_stats *stats =
+				&pkt_burst_stats[id][i];
+			const struct ifnet *ifp = ifnet_byport(i);
+
+			if (!ifp || stats->bursts == 0)
+				continue;
+
+			jsonw_start_object(wr);
+			jsonw_string_field(wr, "interface", ifp->if_name);
+			jsonw_uint_field(wr, "bursts", stats->bursts);
+			jsonw_uint_field(wr, "packets", stats->packets);
+			jsonw_float_field(wr, "average",
+					  (double)stats->packets /
+					  stats->bursts);
+			jsonw_end_object(wr);
+		}
+		jsonw_end_array(wr);
 		jsonw_end_object(wr);
 	}
 	jsonw_end_array(wr);
@@ -4125,6 +4366,24 @@ void set_packet_input_func(packet_input_t input_fn)
 	else
 		/* set to default */
 		packet_input_func = ether_input_no_dyn_feats;
+
+	if (!pipeline_vector_mode)
+		packet_burst_input_func = NULL;
+	else if (packet_input_func == ether_input)
+		packet_burst_input_func = ether_input_burst;
+	else
+		packet_burst_input_func = ether_input_burst_no_dyn_feats;
+}
+
+/*
+ * Select between processing each packet through the fused graph in
+ * turn (the default) and processing each rx burst through the vector
+ * graph. Intended to be chosen once at startup.
+ */
+void set_pipeline_vector_mode(bool enable)
+{
+	pipeline_vector_mode = enable;
+	set_packet_input_func(packet_input_func);
 }
 
 void
@@ -98,6 +98,7 @@ int assign_queues(portid_t portid);
 void unassign_queues(portid_t portid);
 int enable_transmit_thread(portid_t portid);
 void disable_transmit_thread(portid_t portid);
+unsigned int port_transmit_rings(portid_t portid);
 void set_port_queue_state(uint16_t port);
 void reset_port_all_queue_state(uint16_t port);
 bool port_uses_queue_state(uint16_t port);
@@ -181,4 +182,16 @@ void pkt_burst_setup(void);
 void pkt_burst_flush(void);
 void pkt_burst_free(void);
 
+/*
+ * Drive the per port transmit staging of the calling thread as a
+ * forwarding lcore would.  Only used by the unit tests.
+ */
+void pkt_burst_test_init(uint16_t queue);
+void pkt_burst_test_fini(void);
+void pkt_burst_test_output(struct ifnet *ifp, struct rte_mbuf *m);
+void pkt_burst_test_flush(bool drain);
+uint16_t pkt_burst_test_staged(portid_t port);
+void pkt_burst_test_stats(portid_t port, uint64_t *bursts,
+			  uint64_t *packets);
+
 #endif /* MAIN_H */
@@ -93,6 +93,7 @@ struct next_hop_v6_u {
 	uint32_t             nsiblings; /* size of next_hop array */
 	uint32_t             refcount; /* # of LPM entries referring */
 	uint32_t             index;
+	uint16_t             *buckets; /* resilient hash table (ECMP) */
 	struct next_hop_v6   hop0;     /* optimization for non-ECMP */
 	struct cds_lfht_node nh_node;
 	enum pd_obj_state    pd_state;
@@ -812,6 +813,7 @@ void rt6_prefetch(const struct rte_mbuf *m, const struct in6_addr *dst)
 
 ALWAYS_INLINE
 struct next_hop_v6 *nexthop6_select_internal(struct next_hop_v6 *next,
+					     const uint16_t *buckets,
 					     uint32_t size,
 					     uint32_t hash)
 {
@@ -820,7 +822,7 @@ struct next_hop_v6 *nexthop6_select_internal(struct next_hop_v6 *next,
 	if (ecmp_max_path && ecmp_max_path < size)
 		size = ecmp_max_path;
 
-	path = ecmp_lookup(size, hash);
+	path = ecmp_lookup_resilient(buckets, size, hash);
 	if (unlikely(next[path].flags & RTF_DEAD)) {
 		/* retry to find a good path */
 		for (path = 0; path < size; path++) {
@@ -850,7 +852,7 @@ struct next_hop_v6 *nexthop6_select(uint32_t index, const struct rte_mbuf *m,
 	if (likely(size == 1))
 		return next;
 
-	return nexthop6_select_internal(next, size,
+	return nexthop6_select_internal(next, nextu->buckets, size,
 					ecmp_mbuf_hash(m, ether_type));
 }
 
@@ -872,7 +874,8 @@ int nh6_lookup_by_index(uint32_t nhindex, uint32_t hash,
 
 	size = nextu->nsiblings;
 	if (size > 1)
-		next = nexthop6_select_internal(next, size, hash);
+		next = nexthop6_select_internal(next, nextu->buckets, size,
+						hash);
 
 	if (next->flags & RTF_GATEWAY)
 		*nh = next->gateway;
@@ -1230,6 +1233,16 @@ static struct next_hop_v6_u *nexthop6_alloc(int size)
 			free(nextu);
 			return NULL;
 		}
+		if (size <= ECMP_RESILIENT_BUCKETS) {
+			nextu->buckets = calloc(ECMP_RESILIENT_BUCKETS,
+						sizeof(*nextu->buckets));
+			if (unlikely(nextu->buckets == NULL)) {
+				free(nextu->siblings);
+				free(nextu->nh_fal_obj);
+				free(nextu);
+				return NULL;
+			}
+		}
 	}
 	nextu->nsiblings = size;
 	return nextu;
@@ -1245,10 +1258,47 @@ static void __nexthop6_destroy(struct next_hop_v6_u *nextu)
 	if (nextu->siblings != &nextu->hop0)
 		free(nextu->siblings);
 
+	free(nextu->buckets);
 	free(nextu->nh_fal_obj);
 	free(nextu);
 }
 
+/*
+ * (Re)build the resilient hash table of an ECMP nexthop from the
+ * current path state.
+ */
+static void nexthop6_resilient_update(struct next_hop_v6_u *nextu)
+{
+	bool dead[ECMP_RESILIENT_BUCKETS];
+	uint32_t i, size = nextu->nsiblings;
+
+	if (!nextu->buckets)
+		return;
+
+	if (ecmp_max_path && ecmp_max_path < size)
+		size = ecmp_max_path;
+
+	for (i = 0; i < size; i++)
+		dead[i] = nextu->siblings[i].flags & RTF_DEAD;
+
+	ecmp_resilient_fill(nextu->buckets, size, dead);
+}
+
+/* ECMP max-path has changed */
+void nexthop6_resilient_refresh(void)
+{
+	struct next_hop_v6_u *nhu;
+	struct cds_lfht_iter iter;
+	struct cds_lfht_node *node;
+
+	ASSERT_MASTER();
+
+	cds_lfht_for_each(nexthop6_hash, &iter, node) {
+		nhu = caa_container_of(node, struct next_hop_v6_u, nh_node);
+		nexthop6_resilient_update(nhu);
+	}
+}
+
 /* callback from RCU after all other threads are done. */
 static void nexthop6_destroy(struct rcu_head *head)
 {
@@ -1289,6 +1339,7 @@ nexthop6_new(struct next_hop_v6 *nh, size_t size, uint32_t *slot)
 		nextu->hop0 = *nh;
 	} else {
 		memcpy(nextu->siblings, nh, size * sizeof(struct next_hop_v6));
+		nexthop6_resilient_update(nextu);
 	}
 	if (unlikely(nexthop6_hash_insert(nextu, &key))) {
 		__nexthop6_destroy(nextu);
@@ -1632,6 +1683,7 @@ route6_nh_replace(struct next_hop_v6_u *nextu, uint32_t nh_idx,
 	new_nextu->nhg_fal_obj = nextu->nhg_fal_obj;
 	memcpy(new_nextu->nh_fal_obj, nextu->nh_fal_obj,
 	       new_nextu->nsiblings * sizeof(*new_nextu->nh_fal_obj));
+	nexthop6_resilient_update(new_nextu);
 
 	assert(nh6_tbl.entry[nh_idx] == nextu);
 	rcu_xchg_pointer(&nh6_tbl.entry[nh_idx], new_nextu);
@@ -2471,6 +2523,9 @@ static void rt6_if_dead(struct vrf *vrf, uint32_t table_id,
 	if (matches == 0)
 		return;
 
+	/* Move only the flows hashed to the dead paths */
+	nexthop6_resilient_update(nextu);
+
 	/*
 	 * Delete the route as we can't have entries in the routing table
 	 * that use interfaces that have been deleted. We will get another
@@ -2693,6 +2748,13 @@ static int rt6_stats(struct route6_head *rt6_head, json_writer_t *json,
 	jsonw_uint_field(json, "free", lpm6_tbl8_unused_count(lpm));
 	jsonw_end_object(json);
 
+	jsonw_name(json, "lpm");
+	jsonw_start_object(json);
+	jsonw_string_field(json, "algorithm",
+			   lpm6_algo_name(lpm6_get_algo(lpm)));
+	jsonw_uint_field(json, "memory", lpm6_memory_usage(lpm));
+	jsonw_end_object(json);
+
 	return 0;
 }
 
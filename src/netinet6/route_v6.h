@@ -69,6 +69,7 @@ struct next_hop_v6 *nexthop6_create(
 	uint16_t num_labels, label_t *labels);
 void nexthop6_put(uint32_t idx);
 int nexthop6_new(struct next_hop_v6 *nh, size_t size, uint32_t *slot);
+void nexthop6_resilient_refresh(void);
 void rt6_print_nexthop(json_writer_t *json, uint32_t next_hop);
 struct next_hop_v6 *rt6_lookup_fast(struct vrf *vrf,
 				    const struct in6_addr *dst, uint32_t tbl_id,
@@ -1573,9 +1573,11 @@ static void process_xfrm_newsa(struct xfrm_usersa_info *sa_info,
 	struct xfrm_algo_auth *auth_algo;
 	struct xfrm_algo *crypto_algo = NULL;
 	struct xfrm_encap_tmpl *tmpl = NULL;
+	struct xfrm_replay_state_esn *esn;
 	struct xfrm_mark *mark;
 	uint32_t mark_val;
 	uint32_t extra_flags = 0;
+	uint32_t replay_window;
 
 	/*
 	 * VRF. Use topic default if no attribute
@@ -1633,6 +1635,22 @@ static void process_xfrm_newsa(struct xfrm_usersa_info *sa_info,
 		}
 	}
 
+	/*
+	 * Windows larger than the 32 packets of the legacy replay state
+	 * come in the ESN replay state.
+	 */
+	replay_window = sa_info->replay_window;
+	if (attrs[XFRMA_REPLAY_ESN_VAL]) {
+		if (mnl_attr_get_payload_len(attrs[XFRMA_REPLAY_ESN_VAL]) <
+		    sizeof(*esn)) {
+			RTE_LOG(ERR, DATAPLANE,
+				"Could not decode REPLAY_ESN_VAL attr\n");
+			goto scrub;
+		}
+		esn = get_nl_attr_payload(attrs[XFRMA_REPLAY_ESN_VAL]);
+		replay_window = esn->replay_window;
+	}
+
 	/* create on-stack xfrm_algo to create the SA */
 	if (aead_algo) {
 		crypto_algo = alloca(sizeof(struct xfrm_algo) +
@@ -1645,7 +1663,7 @@ static void process_xfrm_newsa(struct xfrm_usersa_info *sa_info,
 	}
 
 	crypto_sadb_new_sa(sa_info, crypto_algo, auth_algo, tmpl,
-			   mark_val, extra_flags, vrf_id);
+			   mark_val, extra_flags, replay_window, vrf_id);
 
  scrub:
 	/*
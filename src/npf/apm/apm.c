@@ -155,6 +155,12 @@ struct cds_list_head *apm_block_get_list_node(struct apm_port_block *pb)
 	return &pb->pb_list_node;
 }
 
+/* Set block start time to now.  Used when a reserved block is handed out */
+void apm_block_reset_start_time(struct apm_port_block *pb)
+{
+	pb->pb_start_time = soft_ticks;
+}
+
 /*
  * Allocate a port from a port block.  Returns 0 if it fails to find an
  * available port.
@@ -148,6 +148,9 @@ uint16_t apm_block_get_nports(struct apm_port_block *pb);
 /* Get pointer to list node */
 struct cds_list_head *apm_block_get_list_node(struct apm_port_block *pb);
 
+/* Set block start time to now */
+void apm_block_reset_start_time(struct apm_port_block *pb);
+
 /* Get port and blocks used counts from a list of port blocks */
 void apm_source_block_list_get_counts(struct cds_list_head *list,
 				      uint *nports, uint *ports_used);
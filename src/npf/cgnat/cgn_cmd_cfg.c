@@ -27,9 +27,16 @@
  * -----------------------------------------------
  *
  * cgn-cfg hairpinning {on | off}
+ *
+ * cgn-cfg logging text
+ * cgn-cfg logging ipfix udp <collector-addr> <port>
+ * cgn-cfg logging ipfix file <path>
+ *
+ * cgn-cfg port-block-cache <size>
  */
 
 #include <errno.h>
+#include <arpa/inet.h>
 #include <netinet/in.h>
 #include <linux/if.h>
 
@@ -45,6 +52,8 @@
 #include "npf/cgnat/cgn.h"
 #include "npf/cgnat/cgn_if.h"
 #include "npf/cgnat/cgn_limits.h"
+#include "npf/cgnat/cgn_log_ipfix.h"
+#include "npf/cgnat/cgn_map.h"
 #include "npf/cgnat/cgn_policy.h"
 #include "npf/cgnat/cgn_sess_state.h"
 #include "npf/cgnat/cgn_session.h"
@@ -483,6 +492,51 @@ usage:
 	return -1;
 }
 
+/*
+ * cgn-cfg logging {text | ipfix {udp <addr> <port> | file <path>}}
+ *
+ * Select text (syslog) or binary (IPFIX) event logging.
+ */
+static int cgn_logging_cfg(FILE *f, int argc, char **argv)
+{
+	struct in_addr addr;
+	int port;
+
+	if (argc < 3)
+		goto usage;
+
+	if (strcmp(argv[2], "text") == 0) {
+		cgn_log_ipfix_stop();
+		return 0;
+	}
+
+	if (strcmp(argv[2], "ipfix") != 0 || argc < 5)
+		goto usage;
+
+	if (strcmp(argv[3], "file") == 0)
+		return cgn_log_ipfix_start_file(argv[4]);
+
+	if (strcmp(argv[3], "udp") != 0 || argc < 6)
+		goto usage;
+
+	if (inet_pton(AF_INET, argv[4], &addr) != 1)
+		goto usage;
+
+	port = cgn_arg_to_int(argv[5]);
+	if (port <= 0 || port > USHRT_MAX)
+		goto usage;
+
+	return cgn_log_ipfix_start_udp(ntohl(addr.s_addr), port);
+
+usage:
+	if (f)
+		fprintf(f, "%s: cgn-cfg logging {text | ipfix "
+			"{udp <addr> <port> | file <path>}}",
+			__func__);
+
+	return -1;
+}
+
 /*
  * cgn-cfg max-sessions <num>
  */
@@ -542,6 +596,34 @@ usage:
 	return -1;
 }
 
+/*
+ * cgn-cfg port-block-cache <size>
+ *
+ * Number of port-blocks each forwarding thread may reserve per nat pool.  0
+ * disables the cache.
+ */
+static int cgn_pb_cache_cfg(FILE *f, int argc, char **argv)
+{
+	int tmp;
+
+	if (argc < 3)
+		goto usage;
+
+	tmp = cgn_arg_to_int(argv[2]);
+	if (tmp < 0 || tmp > CGN_PB_CACHE_MAX)
+		return -1;
+
+	cgn_pb_cache_set_size(tmp);
+
+	return 0;
+usage:
+	if (f)
+		fprintf(f, "%s: cgn-cfg port-block-cache <size>",
+			__func__);
+
+	return -1;
+}
+
 /*
  * Session timeouts
  */
@@ -623,12 +705,18 @@ int cmd_cgn(FILE *f, int argc, char **argv)
 	else if (strcmp(argv[1], "hairpinning") == 0)
 		rc = cgn_hairpinning_cfg(f, argc, argv);
 
+	else if (strcmp(argv[1], "logging") == 0)
+		rc = cgn_logging_cfg(f, argc, argv);
+
 	else if (strcmp(argv[1], "max-sessions") == 0)
 		rc = cgn_max_sessions_cfg(f, argc, argv);
 
 	else if (strcmp(argv[1], "max-dest-per-session") == 0)
 		rc = cgn_max_dest_sessions_cfg(f, argc, argv);
 
+	else if (strcmp(argv[1], "port-block-cache") == 0)
+		rc = cgn_pb_cache_cfg(f, argc, argv);
+
 	else if (strcmp(argv[1], "session-timeouts") == 0)
 		rc = cgn_session_timeouts_cfg(f, argc, argv);
 
@@ -28,6 +28,7 @@
 #include "npf/apm/apm.h"
 #include "npf/cgnat/cgn_errno.h"
 #include "npf/cgnat/cgn_if.h"
+#include "npf/cgnat/cgn_log_ipfix.h"
 #include "npf/cgnat/cgn_policy.h"
 #include "npf/cgnat/cgn_session.h"
 #include "npf/cgnat/cgn_source.h"
@@ -56,6 +57,11 @@ static void cgn_show_summary(FILE *f, int argc __unused, char **argv __unused)
 	jsonw_uint_field(json, "subs_table_used", cgn_source_get_used());
 	jsonw_uint_field(json, "subs_table_max", cgn_source_get_max());
 
+	cgn_session_gc_jsonw(json);
+	cgn_source_gc_jsonw(json);
+
+	cgn_log_ipfix_jsonw(json);
+
 	jsonw_uint_field(json, "apm_table_used", apm_get_used());
 	jsonw_uint_field(json, "apm_table_max", apm_get_max());
 
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/**
+ * @file cgn_gc.c - cgnat incremental garbage collection list
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <rte_cycles.h>
+
+#include "urcu.h"
+#include "util.h"
+
+#include "npf/cgnat/cgn_gc.h"
+
+
+void cgn_gc_entry_init(struct cgn_gc_entry *ge)
+{
+	cds_wfcq_node_init(&ge->ge_node);
+	CDS_INIT_LIST_HEAD(&ge->ge_link);
+}
+
+void cgn_gc_list_init(struct cgn_gc_list *gl, cgn_gc_inspect_cb inspect,
+		      uint32_t interval, uint32_t budget)
+{
+	memset(gl, 0, sizeof(*gl));
+
+	cds_wfcq_init(&gl->gl_head, &gl->gl_tail);
+	CDS_INIT_LIST_HEAD(&gl->gl_list);
+	gl->gl_cursor = NULL;
+	gl->gl_inspect = inspect;
+	gl->gl_interval = interval;
+	gl->gl_budget = budget;
+
+	/* First round starts one interval from now */
+	gl->gl_round_start = rte_get_timer_cycles();
+	gl->gl_last_end = gl->gl_round_start;
+}
+
+/*
+ * Hand an entry to the gc.  May be called from any thread, and only once
+ * per entry.
+ */
+void cgn_gc_list_add(struct cgn_gc_list *gl, struct cgn_gc_entry *ge)
+{
+	cds_wfcq_enqueue(&gl->gl_head, &gl->gl_tail, &ge->ge_node);
+}
+
+/*
+ * Move newly added entries onto the tail of the gc list.  If a round is in
+ * progress then they will be visited by that round.
+ */
+static void cgn_gc_list_drain(struct cgn_gc_list *gl)
+{
+	struct cds_wfcq_node *node;
+	struct cgn_gc_entry *ge;
+
+	while ((node = cds_wfcq_dequeue_blocking(&gl->gl_head,
+						 &gl->gl_tail)) != NULL) {
+		ge = caa_container_of(node, struct cgn_gc_entry, ge_node);
+		cds_list_add_tail(&ge->ge_link, &gl->gl_list);
+		gl->gl_count++;
+	}
+}
+
+static void cgn_gc_round_start(struct cgn_gc_list *gl, uint64_t now)
+{
+	gl->gl_cursor = gl->gl_list.next;
+	gl->gl_round_start = now;
+	gl->gl_round_cycles = 0;
+	gl->gl_round_reclaimed = 0;
+}
+
+static void cgn_gc_round_end(struct cgn_gc_list *gl, uint64_t now)
+{
+	uint64_t hz = rte_get_timer_hz();
+	uint64_t period = now - gl->gl_last_end;
+
+	gl->gl_walk_us = (now - gl->gl_round_start) * USEC_PER_SEC / hz;
+	gl->gl_walk_cpu_us = gl->gl_round_cycles * USEC_PER_SEC / hz;
+	gl->gl_reclaim_rate = period ?
+		gl->gl_round_reclaimed * hz / period : 0;
+
+	gl->gl_last_end = now;
+	gl->gl_cursor = NULL;
+	gl->gl_rounds++;
+}
+
+/*
+ * Inspect entries from the cursor onwards until either the end of the list
+ * is reached or 'budget' work has been done.
+ */
+static void cgn_gc_list_step(struct cgn_gc_list *gl, uint budget)
+{
+	struct cds_list_head *next;
+	struct cgn_gc_entry *ge;
+	uint64_t start, end;
+	bool reclaimed;
+	uint work = 0;
+
+	start = rte_get_timer_cycles();
+
+	while (gl->gl_cursor != &gl->gl_list && work < budget) {
+		next = gl->gl_cursor->next;
+		ge = cds_list_entry(gl->gl_cursor, struct cgn_gc_entry,
+				    ge_link);
+
+		/*
+		 * A reclaimed entry is rcu-freed, so it is safe to unlink it
+		 * after the callback has destroyed it.
+		 */
+		reclaimed = false;
+		work += gl->gl_inspect(ge, &reclaimed);
+
+		if (reclaimed) {
+			cds_list_del(&ge->ge_link);
+			gl->gl_count--;
+			gl->gl_round_reclaimed++;
+			gl->gl_reclaimed++;
+		}
+		gl->gl_cursor = next;
+	}
+
+	end = rte_get_timer_cycles();
+	gl->gl_round_cycles += end - start;
+
+	if (gl->gl_cursor == &gl->gl_list)
+		cgn_gc_round_end(gl, end);
+}
+
+void cgn_gc_list_tick(struct cgn_gc_list *gl)
+{
+	uint64_t now = rte_get_timer_cycles();
+
+	cgn_gc_list_drain(gl);
+
+	if (!gl->gl_cursor) {
+		/* Wait for the interval to elapse before starting a round */
+		if (now - gl->gl_round_start <
+		    gl->gl_interval * rte_get_timer_hz())
+			return;
+
+		cgn_gc_round_start(gl, now);
+	}
+
+	cgn_gc_list_step(gl, gl->gl_budget);
+}
+
+/*
+ * Start a new round and run it to completion.  Any round in progress is
+ * abandoned.  Used by unit-tests and at uninit.
+ */
+void cgn_gc_list_walk_all(struct cgn_gc_list *gl)
+{
+	cgn_gc_list_drain(gl);
+	cgn_gc_round_start(gl, rte_get_timer_cycles());
+	cgn_gc_list_step(gl, UINT_MAX);
+}
+
+bool cgn_gc_list_empty(struct cgn_gc_list *gl)
+{
+	return cds_list_empty(&gl->gl_list) &&
+		cds_wfcq_empty(&gl->gl_head, &gl->gl_tail);
+}
+
+void cgn_gc_list_jsonw(json_writer_t *json, const char *name,
+		       struct cgn_gc_list *gl)
+{
+	jsonw_name(json, name);
+	jsonw_start_object(json);
+
+	jsonw_uint_field(json, "entries", gl->gl_count);
+	jsonw_uint_field(json, "rounds", gl->gl_rounds);
+	jsonw_bool_field(json, "active", gl->gl_cursor != NULL);
+	jsonw_uint_field(json, "walk_us", gl->gl_walk_us);
+	jsonw_uint_field(json, "walk_cpu_us", gl->gl_walk_cpu_us);
+	jsonw_uint_field(json, "reclaimed", gl->gl_reclaimed);
+	jsonw_uint_field(json, "reclaim_rate", gl->gl_reclaim_rate);
+
+	jsonw_end_object(json);
+}
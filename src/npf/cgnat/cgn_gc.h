@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/**
+ * @file cgn_gc.h - cgnat incremental garbage collection list
+ *
+ * Entries (sessions, sources) are handed to the gc list via a wait-free
+ * queue when they are added to their hash table.  The master thread moves
+ * them onto a list which it alone owns, and walks that list in 'rounds'.
+ *
+ * A round is started at most once every gc interval.  Each timer tick
+ * inspects at most a budgeted number of entries, and a cursor records where
+ * the walk is to resume on the next tick.  Entries are only ever removed
+ * from the list by the walk itself, so the cursor always remains valid.
+ */
+
+#ifndef _CGN_GC_H_
+#define _CGN_GC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <urcu/list.h>
+#include <urcu/wfcqueue.h>
+
+#include "json_writer.h"
+
+/* gc timer tick (millisecs) */
+#define CGN_GC_TICK_MS		100
+
+/* Embedded in each entry managed by a gc list */
+struct cgn_gc_entry {
+	struct cds_wfcq_node	ge_node;	/* hand-off queue */
+	struct cds_list_head	ge_link;	/* gc list */
+};
+
+/*
+ * Entry inspection callback.  Returns the amount of work done (number of
+ * entries, including any nested entries, that were examined).  Sets
+ * *reclaimed if the entry was destroyed.
+ */
+typedef uint (*cgn_gc_inspect_cb)(struct cgn_gc_entry *ge, bool *reclaimed);
+
+struct cgn_gc_list {
+	struct cds_wfcq_head	gl_head;
+	struct cds_wfcq_tail	gl_tail;
+	struct cds_list_head	gl_list;
+	struct cds_list_head	*gl_cursor;	/* NULL if no round active */
+	cgn_gc_inspect_cb	gl_inspect;
+	uint32_t		gl_interval;	/* round interval (secs) */
+	uint32_t		gl_budget;	/* max work per tick */
+	uint32_t		gl_count;	/* entries on gl_list */
+
+	/* Current round */
+	uint64_t		gl_round_start;	/* tsc */
+	uint64_t		gl_round_cycles;
+	uint32_t		gl_round_reclaimed;
+
+	/* Metrics from the last complete round */
+	uint64_t		gl_last_end;	/* tsc */
+	uint64_t		gl_walk_us;	/* elapsed time */
+	uint64_t		gl_walk_cpu_us;	/* time spent walking */
+	uint32_t		gl_reclaim_rate; /* per second */
+
+	uint64_t		gl_rounds;
+	uint64_t		gl_reclaimed;
+};
+
+void cgn_gc_list_init(struct cgn_gc_list *gl, cgn_gc_inspect_cb inspect,
+		      uint32_t interval, uint32_t budget);
+void cgn_gc_entry_init(struct cgn_gc_entry *ge);
+
+/* Any thread.  Hand a newly inserted entry to the gc */
+void cgn_gc_list_add(struct cgn_gc_list *gl, struct cgn_gc_entry *ge);
+
+/* Master thread.  Called every CGN_GC_TICK_MS */
+void cgn_gc_list_tick(struct cgn_gc_list *gl);
+
+/* Master thread.  Inspect every entry once, ignoring interval and budget */
+void cgn_gc_list_walk_all(struct cgn_gc_list *gl);
+
+bool cgn_gc_list_empty(struct cgn_gc_list *gl);
+void cgn_gc_list_jsonw(json_writer_t *json, const char *name,
+		       struct cgn_gc_list *gl);
+
+#endif /* _CGN_GC_H_ */
@@ -39,6 +39,12 @@
 /* Number of gc passes before session is deactivated */
 #define CGN_SESS_GC_COUNT	2
 
+/*
+ * Max sessions (plus nested sessions) inspected per gc tick.  A gc pass
+ * over a large table is spread over as many ticks as it needs.
+ */
+#define CGN_SESS_GC_BUDGET	(64 * ONE_THOUSAND)
+
 /*
  * Session hash table (bucket sizes must be powers of 2).
  */
@@ -70,6 +76,9 @@
 /* Number of gc passes before source is deactivated */
 #define CGN_SRC_GC_COUNT	2
 
+/* Max sources inspected per gc tick */
+#define CGN_SRC_GC_BUDGET	(16 * ONE_THOUSAND)
+
 /*
  * Source hash table. (entry per inside address and vrfid)
  */
@@ -20,11 +20,32 @@
 
 #include "npf/cgnat/cgn.h"
 #include "npf/cgnat/cgn_log.h"
+#include "npf/cgnat/cgn_log_ipfix.h"
 #include "npf/cgnat/cgn_source.h"
 #include "npf/cgnat/cgn.h"
 
 #define ADDR_CHARS 16
 
+/*
+ * Post an event record to the binary backend.  Addresses are in host
+ * byte-order.
+ */
+static void cgn_log_post(uint8_t event, uint64_t ticks,
+			 uint32_t int_addr, uint32_t ext_addr,
+			 uint16_t port_start, uint16_t port_end)
+{
+	struct cgn_log_rec rec = {
+		.lr_time = cgn_ticks2timestamp(ticks) / 1000,
+		.lr_int_addr = int_addr,
+		.lr_ext_addr = ext_addr,
+		.lr_ext_port = port_start,
+		.lr_port_end = port_end,
+		.lr_event = event,
+	};
+
+	cgn_log_rec_post(&rec);
+}
+
 /*
  * Log subscriber session start
  */
@@ -32,6 +53,11 @@ void cgn_log_subscriber_start(uint32_t addr)
 {
 	char str1[ADDR_CHARS];
 
+	if (cgn_log_ipfix) {
+		cgn_log_post(CGN_LOG_SUBS_START, soft_ticks, addr, 0, 0, 0);
+		return;
+	}
+
 	RTE_LOG(NOTICE, CGNAT,
 		"SUBSCRIBER_START subs-addr=%s start-time=%lu\n",
 		cgn_addrstr(addr, str1, ADDR_CHARS),
@@ -49,6 +75,11 @@ void cgn_log_subscriber_end(uint32_t addr, uint64_t start_time,
 {
 	char str1[ADDR_CHARS];
 
+	if (cgn_log_ipfix) {
+		cgn_log_post(CGN_LOG_SUBS_END, end_time, addr, 0, 0, 0);
+		return;
+	}
+
 	RTE_LOG(NOTICE, CGNAT,
 		"SUBSCRIBER_END subs-addr=%s start-time=%lu "
 		"end-time=%lu sessions=%lu forw=%lu/%lu back=%lu/%lu\n",
@@ -67,6 +98,11 @@ void cgn_log_subscriber_mbpu_full(uint32_t addr, uint16_t block_count,
 {
 	char str1[ADDR_CHARS];
 
+	if (cgn_log_ipfix) {
+		cgn_log_post(CGN_LOG_MBPU_FULL, soft_ticks, addr, 0, 0, 0);
+		return;
+	}
+
 	RTE_LOG(NOTICE, CGNAT,
 		"MBPU_FULL subs-addr=%s blocks=%u mbpu=%u\n",
 		cgn_addrstr(addr, str1, ADDR_CHARS), block_count, mbpu);
@@ -92,6 +128,11 @@ void cgn_log_public_pb_full(uint32_t addr, uint16_t blocks_used,
 {
 	char str1[ADDR_CHARS];
 
+	if (cgn_log_ipfix) {
+		cgn_log_post(CGN_LOG_PB_FULL, soft_ticks, 0, addr, 0, 0);
+		return;
+	}
+
 	RTE_LOG(NOTICE, CGNAT,
 		"PB_FULL pub-addr=%s blocks=%u/%u\n",
 		cgn_addrstr(addr, str1, ADDR_CHARS), blocks_used, nblocks);
@@ -117,6 +158,12 @@ void cgn_log_pb_alloc(uint32_t pvt_addr, uint32_t pub_addr,
 	char str1[ADDR_CHARS];
 	char str2[ADDR_CHARS];
 
+	if (cgn_log_ipfix) {
+		cgn_log_post(CGN_LOG_PB_ALLOC, start_time, pvt_addr, pub_addr,
+			     port_start, port_end);
+		return;
+	}
+
 	RTE_LOG(NOTICE, CGNAT,
 		"PB_ALLOCATED subs-addr=%s pub-addr=%s "
 		"port=%u-%u start-time=%lu\n",
@@ -132,6 +179,12 @@ void cgn_log_pb_release(uint32_t pvt_addr, uint32_t pub_addr,
 	char str1[ADDR_CHARS];
 	char str2[ADDR_CHARS];
 
+	if (cgn_log_ipfix) {
+		cgn_log_post(CGN_LOG_PB_RELEASE, end_time, pvt_addr, pub_addr,
+			     port_start, port_end);
+		return;
+	}
+
 	RTE_LOG(NOTICE, CGNAT,
 		"PB_RELEASED subs-addr=%s pub-addr=%s port=%u-%u "
 		"start-time=%lu end-time=%lu\n",
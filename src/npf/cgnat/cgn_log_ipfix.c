@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/**
+ * @file cgn_log_ipfix.c - cgnat binary event logging
+ *
+ * Formatting a text log message and writing it to syslog for every session
+ * and port-block event is expensive at cgnat scale.  When the binary
+ * backend is enabled, the event log functions instead copy a fixed size
+ * record (struct cgn_log_rec) into a single-producer, single-consumer ring
+ * owned by the calling lcore.  Threads that are not EAL lcores share one
+ * ring, protected by a spinlock.  Records are dropped (and counted) if a
+ * ring is full.
+ *
+ * An exporter thread polls the rings, and batches the records into IPFIX
+ * (RFC 7011) messages using the NAT event information elements of RFC 8158.
+ * Messages are either sent to a UDP collector or appended to a file.
+ * Templates are sent when the exporter starts, and then periodically.
+ *
+ * Events that have no RFC 8158 natEvent value (periodic session logs and
+ * resource available logs) are always sent to the text logger.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <rte_lcore.h>
+#include <rte_memory.h>
+#include <rte_spinlock.h>
+
+#include "compiler.h"
+#include "urcu.h"
+#include "util.h"
+#include "vplane_log.h"
+
+#include "npf/cgnat/cgn_log_ipfix.h"
+
+/* Records per ring.  Must be a power of 2 */
+#define CGN_LOG_RING_SZ		4096
+#define CGN_LOG_RING_MASK	(CGN_LOG_RING_SZ - 1)
+
+/* Exporter poll interval when all rings are empty */
+#define CGN_LOG_POLL_US		10000
+
+/* Max IPFIX message size.  Fits in one frame on a standard MTU */
+#define CGN_IPFIX_MSG_MAX	1400
+
+/* Template resend interval (secs) */
+#define CGN_IPFIX_TMPL_SECS	60
+
+#define IPFIX_VERSION		10
+#define IPFIX_TEMPLATE_SET_ID	2
+#define IPFIX_MSG_HDR_LEN	16
+#define IPFIX_SET_HDR_LEN	4
+#define IPFIX_OBS_DOMAIN	1
+
+/* Information elements */
+#define IPFIX_IE_PROTO			4
+#define IPFIX_IE_SRC_PORT		7
+#define IPFIX_IE_SRC_ADDR		8
+#define IPFIX_IE_DST_PORT		11
+#define IPFIX_IE_DST_ADDR		12
+#define IPFIX_IE_POST_NAT_SRC_ADDR	225
+#define IPFIX_IE_POST_NAPT_SRC_PORT	227
+#define IPFIX_IE_NAT_EVENT		230
+#define IPFIX_IE_OBS_TIME_MS		323
+#define IPFIX_IE_PORT_RANGE_START	361
+#define IPFIX_IE_PORT_RANGE_END		362
+
+/* RFC 8158 natEvent values */
+#define NAT_EVENT_SESS_CREATE		1
+#define NAT_EVENT_SESS_DELETE		2
+#define NAT_EVENT_PORTS_EXHAUSTED	10
+#define NAT_EVENT_QUOTA_EXCEEDED	11
+#define NAT_EVENT_ADDR_BIND_CREATE	12
+#define NAT_EVENT_ADDR_BIND_DELETE	13
+#define NAT_EVENT_PB_ALLOC		14
+#define NAT_EVENT_PB_DEALLOC		15
+
+enum cgn_ipfix_tmpl {
+	CGN_TMPL_SESS,
+	CGN_TMPL_PB,
+	CGN_TMPL_ADDR,
+	CGN_TMPL_COUNT,
+};
+
+struct cgn_ipfix_ie {
+	uint16_t	id;
+	uint16_t	len;
+};
+
+static const struct cgn_ipfix_ie cgn_ipfix_sess_ies[] = {
+	{ IPFIX_IE_OBS_TIME_MS, 8 },
+	{ IPFIX_IE_NAT_EVENT, 1 },
+	{ IPFIX_IE_PROTO, 1 },
+	{ IPFIX_IE_SRC_ADDR, 4 },
+	{ IPFIX_IE_POST_NAT_SRC_ADDR, 4 },
+	{ IPFIX_IE_DST_ADDR, 4 },
+	{ IPFIX_IE_SRC_PORT, 2 },
+	{ IPFIX_IE_POST_NAPT_SRC_PORT, 2 },
+	{ IPFIX_IE_DST_PORT, 2 },
+};
+
+static const struct cgn_ipfix_ie cgn_ipfix_pb_ies[] = {
+	{ IPFIX_IE_OBS_TIME_MS, 8 },
+	{ IPFIX_IE_NAT_EVENT, 1 },
+	{ IPFIX_IE_SRC_ADDR, 4 },
+	{ IPFIX_IE_POST_NAT_SRC_ADDR, 4 },
+	{ IPFIX_IE_PORT_RANGE_START, 2 },
+	{ IPFIX_IE_PORT_RANGE_END, 2 },
+};
+
+static const struct cgn_ipfix_ie cgn_ipfix_addr_ies[] = {
+	{ IPFIX_IE_OBS_TIME_MS, 8 },
+	{ IPFIX_IE_NAT_EVENT, 1 },
+	{ IPFIX_IE_SRC_ADDR, 4 },
+	{ IPFIX_IE_POST_NAT_SRC_ADDR, 4 },
+};
+
+static const struct cgn_ipfix_tmpl_def {
+	uint16_t			id;
+	uint16_t			nies;
+	uint16_t			rec_len;
+	const struct cgn_ipfix_ie	*ies;
+} cgn_ipfix_tmpls[CGN_TMPL_COUNT] = {
+	[CGN_TMPL_SESS] = {
+		.id = 256, .nies = ARRAY_SIZE(cgn_ipfix_sess_ies),
+		.rec_len = 28, .ies = cgn_ipfix_sess_ies,
+	},
+	[CGN_TMPL_PB] = {
+		.id = 257, .nies = ARRAY_SIZE(cgn_ipfix_pb_ies),
+		.rec_len = 21, .ies = cgn_ipfix_pb_ies,
+	},
+	[CGN_TMPL_ADDR] = {
+		.id = 258, .nies = ARRAY_SIZE(cgn_ipfix_addr_ies),
+		.rec_len = 17, .ies = cgn_ipfix_addr_ies,
+	},
+};
+
+/* Per-lcore record ring */
+struct cgn_log_ring {
+	uint32_t		lg_head;	/* producer index */
+	uint64_t		lg_drops;
+	uint32_t		lg_tail __rte_cache_aligned; /* consumer index */
+	struct cgn_log_rec	lg_recs[CGN_LOG_RING_SZ] __rte_cache_aligned;
+};
+
+struct cgn_log_exporter {
+	pthread_t		ex_thread;
+	bool			ex_running;
+	int			ex_fd;		/* UDP socket, or -1 */
+	FILE			*ex_file;	/* or file */
+	struct sockaddr_in	ex_dst;
+
+	/* One ring per enabled lcore, plus one shared by other threads */
+	struct cgn_log_ring	*ex_rings[RTE_MAX_LCORE + 1];
+	rte_spinlock_t		ex_other_lock;
+
+	/* Message being built */
+	uint8_t			ex_msg[CGN_IPFIX_MSG_MAX];
+	uint			ex_len;
+	uint			ex_set;		/* offset of open data set */
+	int			ex_set_tmpl;	/* -1 if no set open */
+	uint			ex_msg_recs;
+	uint32_t		ex_seq;		/* data records exported */
+	time_t			ex_tmpl_time;
+
+	/* Stats */
+	uint64_t		ex_records;
+	uint64_t		ex_msgs;
+	uint64_t		ex_errors;
+};
+
+bool cgn_log_ipfix;
+
+static struct cgn_log_exporter *cgn_log_exp;
+
+static void cgn_log_ring_put(struct cgn_log_ring *ring,
+			     const struct cgn_log_rec *rec)
+{
+	uint32_t head = ring->lg_head;
+
+	if (unlikely(head - CMM_LOAD_SHARED(ring->lg_tail) >=
+		     CGN_LOG_RING_SZ)) {
+		ring->lg_drops++;
+		return;
+	}
+
+	ring->lg_recs[head & CGN_LOG_RING_MASK] = *rec;
+
+	/* Record must be visible before the index moves */
+	cmm_smp_wmb();
+	CMM_STORE_SHARED(ring->lg_head, head + 1);
+}
+
+/*
+ * Called by the event log functions when the binary backend is enabled
+ */
+void cgn_log_rec_post(const struct cgn_log_rec *rec)
+{
+	struct cgn_log_exporter *exp;
+	unsigned int lcore = rte_lcore_id();
+
+	exp = rcu_dereference(cgn_log_exp);
+	if (!exp)
+		return;
+
+	if (likely(lcore < RTE_MAX_LCORE && exp->ex_rings[lcore])) {
+		cgn_log_ring_put(exp->ex_rings[lcore], rec);
+		return;
+	}
+
+	rte_spinlock_lock(&exp->ex_other_lock);
+	cgn_log_ring_put(exp->ex_rings[RTE_MAX_LCORE], rec);
+	rte_spinlock_unlock(&exp->ex_other_lock);
+}
+
+static inline uint8_t *cgn_ipfix_put8(uint8_t *p, uint8_t val)
+{
+	*p = val;
+	return p + 1;
+}
+
+static inline uint8_t *cgn_ipfix_put16(uint8_t *p, uint16_t val)
+{
+	val = htons(val);
+	memcpy(p, &val, sizeof(val));
+	return p + sizeof(val);
+}
+
+static inline uint8_t *cgn_ipfix_put32(uint8_t *p, uint32_t val)
+{
+	val = htonl(val);
+	memcpy(p, &val, sizeof(val));
+	return p + sizeof(val);
+}
+
+static inline uint8_t *cgn_ipfix_put64(uint8_t *p, uint64_t val)
+{
+	p = cgn_ipfix_put32(p, val >> 32);
+	return cgn_ipfix_put32(p, (uint32_t)val);
+}
+
+static void cgn_ipfix_set_close(struct cgn_log_exporter *exp)
+{
+	if (exp->ex_set_tmpl < 0)
+		return;
+
+	cgn_ipfix_put16(exp->ex_msg + exp->ex_set + 2,
+			exp->ex_len - exp->ex_set);
+	exp->ex_set_tmpl = -1;
+}
+
+static void cgn_ipfix_msg_init(struct cgn_log_exporter *exp)
+{
+	exp->ex_len = IPFIX_MSG_HDR_LEN;
+	exp->ex_set_tmpl = -1;
+	exp->ex_msg_recs = 0;
+}
+
+static void cgn_ipfix_msg_send(struct cgn_log_exporter *exp)
+{
+	uint8_t *p = exp->ex_msg;
+	ssize_t rc;
+
+	cgn_ipfix_set_close(exp);
+
+	if (exp->ex_len == IPFIX_MSG_HDR_LEN)
+		return;
+
+	p = cgn_ipfix_put16(p, IPFIX_VERSION);
+	p = cgn_ipfix_put16(p, exp->ex_len);
+	p = cgn_ipfix_put32(p, (uint32_t)time(NULL));
+	p = cgn_ipfix_put32(p, exp->ex_seq);
+	cgn_ipfix_put32(p, IPFIX_OBS_DOMAIN);
+
+	if (exp->ex_file) {
+		if (fwrite(exp->ex_msg, exp->ex_len, 1, exp->ex_file) != 1)
+			rc = -1;
+		else
+			rc = exp->ex_len;
+	} else
+		rc = sendto(exp->ex_fd, exp->ex_msg, exp->ex_len, 0,
+			    (struct sockaddr *)&exp->ex_dst,
+			    sizeof(exp->ex_dst));
+
+	if (rc < 0)
+		exp->ex_errors++;
+	else
+		exp->ex_msgs++;
+
+	/* Sequence number is the count of data records sent previously */
+	exp->ex_seq += exp->ex_msg_recs;
+	cgn_ipfix_msg_init(exp);
+}
+
+/*
+ * Add a template set containing all templates to the (empty) message
+ */
+static void cgn_ipfix_add_templates(struct cgn_log_exporter *exp)
+{
+	uint8_t *start = exp->ex_msg + exp->ex_len;
+	uint8_t *p = start + IPFIX_SET_HDR_LEN;
+	uint i, j;
+
+	for (i = 0; i < CGN_TMPL_COUNT; i++) {
+		const struct cgn_ipfix_tmpl_def *t = &cgn_ipfix_tmpls[i];
+
+		p = cgn_ipfix_put16(p, t->id);
+		p = cgn_ipfix_put16(p, t->nies);
+		for (j = 0; j < t->nies; j++) {
+			p = cgn_ipfix_put16(p, t->ies[j].id);
+			p = cgn_ipfix_put16(p, t->ies[j].len);
+		}
+	}
+
+	cgn_ipfix_put16(start, IPFIX_TEMPLATE_SET_ID);
+	cgn_ipfix_put16(start + 2, p - start);
+	exp->ex_len += p - start;
+	exp->ex_tmpl_time = time(NULL);
+}
+
+static enum cgn_ipfix_tmpl cgn_log_event2tmpl(uint8_t event, uint8_t *nat_ev)
+{
+	switch (event) {
+	case CGN_LOG_SESS_CREATE:
+		*nat_ev = NAT_EVENT_SESS_CREATE;
+		return CGN_TMPL_SESS;
+	case CGN_LOG_SESS_DELETE:
+		*nat_ev = NAT_EVENT_SESS_DELETE;
+		return CGN_TMPL_SESS;
+	case CGN_LOG_PB_ALLOC:
+		*nat_ev = NAT_EVENT_PB_ALLOC;
+		return CGN_TMPL_PB;
+	case CGN_LOG_PB_RELEASE:
+		*nat_ev = NAT_EVENT_PB_DEALLOC;
+		return CGN_TMPL_PB;
+	case CGN_LOG_SUBS_START:
+		*nat_ev = NAT_EVENT_ADDR_BIND_CREATE;
+		return CGN_TMPL_ADDR;
+	case CGN_LOG_SUBS_END:
+		*nat_ev = NAT_EVENT_ADDR_BIND_DELETE;
+		return CGN_TMPL_ADDR;
+	case CGN_LOG_MBPU_FULL:
+		*nat_ev = NAT_EVENT_QUOTA_EXCEEDED;
+		return CGN_TMPL_ADDR;
+	case CGN_LOG_PB_FULL:
+	default:
+		*nat_ev = NAT_EVENT_PORTS_EXHAUSTED;
+		return CGN_TMPL_ADDR;
+	}
+}
+
+/*
+ * Append one record to the message, starting a new data set or a new
+ * message as required.
+ */
+static void cgn_ipfix_add_rec(struct cgn_log_exporter *exp,
+			      const struct cgn_log_rec *rec)
+{
+	enum cgn_ipfix_tmpl tmpl;
+	uint8_t nat_ev;
+	uint8_t *p;
+
+	tmpl = cgn_log_event2tmpl(rec->lr_event, &nat_ev);
+
+	if (exp->ex_len + IPFIX_SET_HDR_LEN + cgn_ipfix_tmpls[tmpl].rec_len >
+	    CGN_IPFIX_MSG_MAX)
+		cgn_ipfix_msg_send(exp);
+
+	if (exp->ex_set_tmpl != (int)tmpl) {
+		cgn_ipfix_set_close(exp);
+
+		exp->ex_set = exp->ex_len;
+		exp->ex_set_tmpl = tmpl;
+		cgn_ipfix_put16(exp->ex_msg + exp->ex_len,
+				cgn_ipfix_tmpls[tmpl].id);
+		exp->ex_len += IPFIX_SET_HDR_LEN;
+	}
+
+	p = exp->ex_msg + exp->ex_len;
+	p = cgn_ipfix_put64(p, rec->lr_time);
+	p = cgn_ipfix_put8(p, nat_ev);
+
+	switch (tmpl) {
+	case CGN_TMPL_SESS:
+		p = cgn_ipfix_put8(p, rec->lr_proto);
+		p = cgn_ipfix_put32(p, rec->lr_int_addr);
+		p = cgn_ipfix_put32(p, rec->lr_ext_addr);
+		p = cgn_ipfix_put32(p, rec->lr_dst_addr);
+		p = cgn_ipfix_put16(p, rec->lr_int_port);
+		p = cgn_ipfix_put16(p, rec->lr_ext_port);
+		p = cgn_ipfix_put16(p, rec->lr_dst_port);
+		break;
+	case CGN_TMPL_PB:
+		p = cgn_ipfix_put32(p, rec->lr_int_addr);
+		p = cgn_ipfix_put32(p, rec->lr_ext_addr);
+		p = cgn_ipfix_put16(p, rec->lr_ext_port);
+		p = cgn_ipfix_put16(p, rec->lr_port_end);
+		break;
+	case CGN_TMPL_ADDR:
+	default:
+		p = cgn_ipfix_put32(p, rec->lr_int_addr);
+		p = cgn_ipfix_put32(p, rec->lr_ext_addr);
+		break;
+	}
+
+	exp->ex_len = p - exp->ex_msg;
+	exp->ex_msg_recs++;
+	exp->ex_records++;
+}
+
+/*
+ * Move all records currently in the rings into messages.  Returns the
+ * number of records.
+ */
+static uint cgn_log_drain(struct cgn_log_exporter *exp)
+{
+	struct cgn_log_ring *ring;
+	uint32_t head, tail;
+	uint i, count = 0;
+
+	for (i = 0; i <= RTE_MAX_LCORE; i++) {
+		ring = exp->ex_rings[i];
+		if (!ring)
+			continue;
+
+		head = CMM_LOAD_SHARED(ring->lg_head);
+		cmm_smp_rmb();
+
+		for (tail = ring->lg_tail; tail != head; tail++, count++)
+			cgn_ipfix_add_rec(exp,
+				&ring->lg_recs[tail & CGN_LOG_RING_MASK]);
+
+		/* Release the slots back to the producer */
+		cmm_smp_mb();
+		CMM_STORE_SHARED(ring->lg_tail, tail);
+	}
+	return count;
+}
+
+static void *cgn_log_thread(void *arg)
+{
+	struct cgn_log_exporter *exp = arg;
+
+	cgn_ipfix_msg_init(exp);
+	cgn_ipfix_add_templates(exp);
+	cgn_ipfix_msg_send(exp);
+
+	while (CMM_LOAD_SHARED(exp->ex_running)) {
+		if (time(NULL) - exp->ex_tmpl_time >= CGN_IPFIX_TMPL_SECS) {
+			cgn_ipfix_msg_send(exp);
+			cgn_ipfix_add_templates(exp);
+		}
+
+		uint count = cgn_log_drain(exp);
+
+		/* Send any partial message */
+		cgn_ipfix_msg_send(exp);
+		if (exp->ex_file)
+			fflush(exp->ex_file);
+
+		if (count == 0)
+			usleep(CGN_LOG_POLL_US);
+	}
+
+	/* Producers have stopped.  Export anything left */
+	cgn_log_drain(exp);
+	cgn_ipfix_msg_send(exp);
+
+	return NULL;
+}
+
+static void cgn_log_exporter_free(struct cgn_log_exporter *exp)
+{
+	uint i;
+
+	for (i = 0; i <= RTE_MAX_LCORE; i++)
+		free(exp->ex_rings[i]);
+
+	if (exp->ex_fd >= 0)
+		close(exp->ex_fd);
+	if (exp->ex_file)
+		fclose(exp->ex_file);
+	free(exp);
+}
+
+static struct cgn_log_exporter *cgn_log_exporter_alloc(void)
+{
+	struct cgn_log_exporter *exp;
+	uint i;
+
+	exp = zmalloc_aligned(sizeof(*exp));
+	if (!exp)
+		return NULL;
+
+	exp->ex_fd = -1;
+	rte_spinlock_init(&exp->ex_other_lock);
+
+	for (i = 0; i <= RTE_MAX_LCORE; i++) {
+		if (i < RTE_MAX_LCORE && !rte_lcore_is_enabled(i))
+			continue;
+
+		exp->ex_rings[i] = zmalloc_aligned(sizeof(struct cgn_log_ring));
+		if (!exp->ex_rings[i]) {
+			cgn_log_exporter_free(exp);
+			return NULL;
+		}
+	}
+	return exp;
+}
+
+static int cgn_log_exporter_start(struct cgn_log_exporter *exp)
+{
+	exp->ex_running = true;
+
+	if (pthread_create(&exp->ex_thread, NULL, cgn_log_thread, exp) != 0) {
+		RTE_LOG(ERR, CGNAT, "Failed to create log exporter thread\n");
+		cgn_log_exporter_free(exp);
+		return -ENOMEM;
+	}
+	pthread_setname_np(exp->ex_thread, "dataplane/cgnlog");
+
+	rcu_assign_pointer(cgn_log_exp, exp);
+	CMM_STORE_SHARED(cgn_log_ipfix, true);
+
+	return 0;
+}
+
+int cgn_log_ipfix_start_udp(uint32_t addr, uint16_t port)
+{
+	struct cgn_log_exporter *exp;
+
+	cgn_log_ipfix_stop();
+
+	exp = cgn_log_exporter_alloc();
+	if (!exp)
+		return -ENOMEM;
+
+	exp->ex_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (exp->ex_fd < 0) {
+		int rc = -errno;
+
+		RTE_LOG(ERR, CGNAT, "Failed to open log socket: %s\n",
+			strerror(errno));
+		cgn_log_exporter_free(exp);
+		return rc;
+	}
+
+	exp->ex_dst.sin_family = AF_INET;
+	exp->ex_dst.sin_addr.s_addr = htonl(addr);
+	exp->ex_dst.sin_port = htons(port);
+
+	return cgn_log_exporter_start(exp);
+}
+
+int cgn_log_ipfix_start_file(const char *path)
+{
+	struct cgn_log_exporter *exp;
+
+	cgn_log_ipfix_stop();
+
+	exp = cgn_log_exporter_alloc();
+	if (!exp)
+		return -ENOMEM;
+
+	exp->ex_file = fopen(path, "ae");
+	if (!exp->ex_file) {
+		int rc = -errno;
+
+		RTE_LOG(ERR, CGNAT, "Failed to open log file %s: %s\n",
+			path, strerror(errno));
+		cgn_log_exporter_free(exp);
+		return rc;
+	}
+
+	return cgn_log_exporter_start(exp);
+}
+
+/*
+ * Revert to the text logger.  Waits for any producers to finish with the
+ * rings before the exporter is stopped and freed.
+ */
+void cgn_log_ipfix_stop(void)
+{
+	struct cgn_log_exporter *exp = cgn_log_exp;
+
+	if (!exp)
+		return;
+
+	CMM_STORE_SHARED(cgn_log_ipfix, false);
+	rcu_assign_pointer(cgn_log_exp, NULL);
+	synchronize_rcu();
+
+	CMM_STORE_SHARED(exp->ex_running, false);
+	pthread_join(exp->ex_thread, NULL);
+
+	cgn_log_exporter_free(exp);
+}
+
+void cgn_log_ipfix_jsonw(json_writer_t *json)
+{
+	struct cgn_log_exporter *exp = cgn_log_exp;
+	uint64_t drops = 0;
+	uint i;
+
+	jsonw_string_field(json, "log_backend", exp ? "ipfix" : "text");
+	if (!exp)
+		return;
+
+	for (i = 0; i <= RTE_MAX_LCORE; i++)
+		if (exp->ex_rings[i])
+			drops += exp->ex_rings[i]->lg_drops;
+
+	jsonw_uint_field(json, "log_records", exp->ex_records);
+	jsonw_uint_field(json, "log_drops", drops);
+	jsonw_uint_field(json, "log_msgs", exp->ex_msgs);
+	jsonw_uint_field(json, "log_errors", exp->ex_errors);
+}
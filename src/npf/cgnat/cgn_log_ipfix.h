@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/**
+ * @file cgn_log_ipfix.h - cgnat binary event logging
+ */
+
+#ifndef _CGN_LOG_IPFIX_H_
+#define _CGN_LOG_IPFIX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "json_writer.h"
+
+/* Events that may be logged by the binary backend */
+enum cgn_log_event {
+	CGN_LOG_SUBS_START,
+	CGN_LOG_SUBS_END,
+	CGN_LOG_MBPU_FULL,
+	CGN_LOG_PB_FULL,
+	CGN_LOG_PB_ALLOC,
+	CGN_LOG_PB_RELEASE,
+	CGN_LOG_SESS_CREATE,
+	CGN_LOG_SESS_DELETE,
+};
+
+/*
+ * Fixed size event record.  Written by the forwarding threads into a
+ * per-lcore ring, and formatted by the exporter thread.  Addresses and
+ * ports are in host byte-order.
+ */
+struct cgn_log_rec {
+	uint64_t	lr_time;	/* Epoch millisecs */
+	uint32_t	lr_int_addr;	/* subscriber addr */
+	uint32_t	lr_ext_addr;	/* public addr */
+	uint32_t	lr_dst_addr;
+	uint16_t	lr_int_port;
+	uint16_t	lr_ext_port;	/* public port, or port-block start */
+	uint16_t	lr_dst_port;
+	uint16_t	lr_port_end;	/* port-block end */
+	uint8_t		lr_event;	/* enum cgn_log_event */
+	uint8_t		lr_proto;
+	uint8_t		lr_pad[6];
+};
+
+/* True when the binary backend is in use instead of the text logger */
+extern bool cgn_log_ipfix;
+
+void cgn_log_rec_post(const struct cgn_log_rec *rec);
+
+/*
+ * Start the exporter, sending IPFIX messages to a UDP collector (addr and
+ * port in host byte-order) or appending them to a file.
+ */
+int cgn_log_ipfix_start_udp(uint32_t addr, uint16_t port);
+int cgn_log_ipfix_start_file(const char *path);
+void cgn_log_ipfix_stop(void);
+
+void cgn_log_ipfix_jsonw(json_writer_t *json);
+
+#endif /* _CGN_LOG_IPFIX_H_ */
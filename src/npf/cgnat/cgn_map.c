@@ -7,12 +7,37 @@
 /**
  * @file cgn_map.c - Allocation and release of cgnat addresses, port-blocks,
  * and ports.
+ *
+ * Port-block cache
+ * ----------------
+ *
+ * Allocating a port-block requires the public address (apm) lock.  When many
+ * new subscribers arrive at once, all forwarding threads contend for the
+ * same few apm locks.  If enabled ("cgn-cfg port-block-cache <size>"), each
+ * lcore keeps a small cache ("magazine") of empty port-blocks per nat pool.
+ * Magazines are refilled with a batch of blocks, taking each apm lock once
+ * per batch, and a subscribers new port-block is taken from the magazine
+ * without any locking.
+ *
+ * Blocks in a magazine are reserved on their apm, but are not owned by any
+ * subscriber and are not counted in the nat pool block stats until they are
+ * handed out.  Magazines are only ever used by their own lcore, so need no
+ * lock.  Other threads invalidate all magazines by bumping a generation
+ * number, and take them from the lcores to return their blocks straight
+ * away (cgn_pb_cache_flush_all).
+ *
+ * The cache is disabled by default since reserved blocks make the choice of
+ * public address, and the point at which a pool is exhausted, depend on
+ * which lcore a subscriber's first packet arrives on.
  */
 
 #include <errno.h>
 #include <netinet/in.h>
 #include <linux/if.h>
 #include <dpdk/rte_jhash.h>
+#include <rte_lcore.h>
+#include <rte_memory.h>
+#include <rte_spinlock.h>
 
 #include "compiler.h"
 #include "if_var.h"
@@ -179,6 +204,245 @@ error:
 	return NULL;
 }
 
+/*
+ * Reserve up to 'count' port blocks from the given public address, taking
+ * the apm lock once.  Returns the number of blocks reserved.
+ */
+static uint
+cgn_alloc_blocks(struct apm *apm, struct apm_port_block **pbs, uint count)
+{
+	struct apm_port_block *pb;
+	uint16_t block;
+	uint n = 0;
+
+	rte_spinlock_lock(&apm->apm_lock);
+
+	if ((apm->apm_flags & APM_DEAD) != 0)
+		goto end;
+
+	for (block = 0; block < apm->apm_nblocks && n < count; block++) {
+		if (apm->apm_blocks[block])
+			continue;
+
+		pb = apm_block_create(apm, block);
+		if (!pb)
+			break;
+
+		pbs[n++] = pb;
+	}
+
+	if (n == 0 && apm->apm_blocks_used >= apm->apm_nblocks)
+		cgn_alloc_log_pb_full(apm);
+
+end:
+	rte_spinlock_unlock(&apm->apm_lock);
+	return n;
+}
+
+/* Port-block magazines */
+#define CGN_PB_MAGS		4	/* nat pools per lcore */
+
+struct cgn_pb_mag {
+	struct nat_pool		*pm_np;
+	vrfid_t			pm_vrfid;
+	uint32_t		pm_gen;
+	uint64_t		pm_last_use;
+	uint16_t		pm_count;
+	struct apm_port_block	*pm_blocks[CGN_PB_CACHE_MAX];
+};
+
+struct cgn_pb_mag_lcore {
+	struct cgn_pb_mag	ml_mags[CGN_PB_MAGS];
+	uint64_t		ml_clock;
+} __rte_cache_aligned;
+
+/*
+ * Only the lcore sets its pointer, when it is NULL.  Other threads only
+ * swap it for NULL, and then wait for the lcore to finish with the
+ * magazines before using them.
+ */
+static struct cgn_pb_mag_lcore *cgn_pb_mags[RTE_MAX_LCORE];
+
+/* Magazine size.  0 disables the cache */
+uint16_t cgn_pb_cache_size;
+
+/* Magazines with a different generation are stale */
+static rte_atomic32_t cgn_pb_mag_gen;
+
+/*
+ * Return all blocks in a magazine to their apm
+ */
+static void cgn_pb_mag_flush(struct cgn_pb_mag *mag)
+{
+	struct apm_port_block *pb;
+	struct apm *apm;
+
+	while (mag->pm_count > 0) {
+		pb = mag->pm_blocks[--mag->pm_count];
+		apm = apm_block_get_apm(pb);
+
+		rte_spinlock_lock(&apm->apm_lock);
+		apm_block_destroy(pb);
+		rte_spinlock_unlock(&apm->apm_lock);
+	}
+	mag->pm_np = NULL;
+}
+
+/*
+ * Fill a magazine, iterating through the pool addresses from the pool hint
+ */
+static void
+cgn_pb_mag_refill(struct cgn_pb_mag *mag, struct nat_pool *np, uint8_t proto,
+		  vrfid_t vrfid, uint16_t size)
+{
+	uint32_t addr_hint;
+	struct apm *apm;
+	int error;
+	uint n;
+
+	while (mag->pm_count < size) {
+		addr_hint = nat_pool_hint(np, proto);
+		addr_hint = nat_pool_next_addr(np, addr_hint);
+
+		apm = cgn_alloc_addr_rrobin(np, proto, addr_hint, vrfid,
+					    &error);
+		if (!apm)
+			break;
+
+		n = cgn_alloc_blocks(apm, &mag->pm_blocks[mag->pm_count],
+				     size - mag->pm_count);
+		if (n == 0)
+			break;
+
+		mag->pm_count += n;
+	}
+}
+
+/*
+ * Get a port-block from this lcores magazine for the given pool.  If
+ * 'paired_addr' is non-zero then the block must be from that address.
+ * Called with the source locked.
+ */
+static struct apm_port_block *
+cgn_pb_mag_get(struct nat_pool *np, uint8_t proto, vrfid_t vrfid,
+	       uint32_t paired_addr)
+{
+	unsigned int lcore = rte_lcore_id();
+	struct cgn_pb_mag_lcore *ml;
+	struct cgn_pb_mag *mag = NULL, *lru = NULL;
+	struct apm_port_block *pb = NULL;
+	uint16_t size;
+	uint32_t gen;
+	uint i;
+
+	size = CMM_LOAD_SHARED(cgn_pb_cache_size);
+	if (size == 0 || lcore >= RTE_MAX_LCORE)
+		return NULL;
+
+	ml = rcu_dereference(cgn_pb_mags[lcore]);
+	if (!ml) {
+		ml = zmalloc_aligned(sizeof(*ml));
+		if (!ml)
+			return NULL;
+		rcu_assign_pointer(cgn_pb_mags[lcore], ml);
+	}
+
+	gen = rte_atomic32_read(&cgn_pb_mag_gen);
+
+	for (i = 0; i < CGN_PB_MAGS; i++) {
+		struct cgn_pb_mag *m = &ml->ml_mags[i];
+
+		if (m->pm_np && m->pm_gen != gen)
+			cgn_pb_mag_flush(m);
+
+		if (m->pm_np == np && m->pm_vrfid == vrfid)
+			mag = m;
+		else if (!lru || !m->pm_np ||
+			 (lru->pm_np && m->pm_last_use < lru->pm_last_use))
+			lru = m;
+	}
+
+	if (!mag) {
+		mag = lru;
+		cgn_pb_mag_flush(mag);
+		mag->pm_np = np;
+		mag->pm_vrfid = vrfid;
+		mag->pm_gen = gen;
+	}
+	mag->pm_last_use = ++ml->ml_clock;
+
+	if (mag->pm_count == 0)
+		cgn_pb_mag_refill(mag, np, proto, vrfid, size);
+
+	if (mag->pm_count == 0)
+		return NULL;
+
+	pb = mag->pm_blocks[mag->pm_count - 1];
+
+	if (paired_addr && apm_block_get_apm(pb)->apm_addr != paired_addr)
+		return NULL;
+
+	mag->pm_count--;
+
+	apm_block_reset_start_time(pb);
+	nat_pool_incr_block_allocs(np);
+	nat_pool_incr_block_active(np);
+
+	return pb;
+}
+
+/*
+ * Invalidate all magazines.  Called when the cache size changes, or a nat
+ * pool is de-activated.
+ */
+void cgn_pb_cache_invalidate(void)
+{
+	rte_atomic32_inc(&cgn_pb_mag_gen);
+}
+
+/*
+ * Change the magazine size.  Blocks cached at the old size are returned to
+ * their apm straight away, including when the cache is disabled.
+ */
+void cgn_pb_cache_set_size(uint16_t size)
+{
+	if (size > CGN_PB_CACHE_MAX)
+		size = CGN_PB_CACHE_MAX;
+
+	CMM_STORE_SHARED(cgn_pb_cache_size, size);
+	cgn_pb_cache_invalidate();
+	cgn_pb_cache_flush_all();
+}
+
+/*
+ * Return all cached blocks on all lcores to their apm.  Not called from
+ * the forwarding threads, since it waits for them.
+ *
+ * The first grace period ensures no lcore is still refilling at the old
+ * size or generation, so can not attach a magazine after it is taken.  The
+ * second ensures no lcore is still using a magazine that has been taken.
+ */
+void cgn_pb_cache_flush_all(void)
+{
+	struct cgn_pb_mag_lcore *taken[RTE_MAX_LCORE];
+	uint lcore, i;
+
+	synchronize_rcu();
+
+	for (lcore = 0; lcore < RTE_MAX_LCORE; lcore++)
+		taken[lcore] = rcu_xchg_pointer(&cgn_pb_mags[lcore], NULL);
+
+	synchronize_rcu();
+
+	for (lcore = 0; lcore < RTE_MAX_LCORE; lcore++) {
+		if (!taken[lcore])
+			continue;
+		for (i = 0; i < CGN_PB_MAGS; i++)
+			cgn_pb_mag_flush(&taken[lcore]->ml_mags[i]);
+		free(taken[lcore]);
+	}
+}
+
 /*
  * Find a free port in any of the port-blocks already in-use by a subscriber,
  * except the active block (since we will already have checked that).
@@ -203,7 +467,7 @@ cgn_map_get(struct cgn_policy *cp, vrfid_t vrfid, uint8_t proto,
 	    uint32_t oaddr, uint32_t *taddr, uint16_t *tport,
 	    struct cgn_source **srcp)
 {
-	struct apm_port_block *pb;
+	struct apm_port_block *pb, *cpb;
 	struct cgn_source *src;
 	struct nat_pool *np;
 	struct apm *apm;
@@ -262,6 +526,16 @@ cgn_map_get(struct cgn_policy *cp, vrfid_t vrfid, uint8_t proto,
 				src->sr_paired_addr = 0;
 		}
 
+		/* Try this lcores port-block cache first */
+		pb = cgn_pb_mag_get(np, proto, vrfid,
+				    nat_pool_is_ap_paired(np) ?
+				    src->sr_paired_addr : 0);
+		if (pb) {
+			apm = apm_block_get_apm(pb);
+			cgn_source_add_block(src, proto, pb, np);
+			goto alloc_port;
+		}
+
 		addr_hint = src->sr_paired_addr;
 		if (addr_hint == 0) {
 			/*
@@ -299,6 +573,7 @@ cgn_map_get(struct cgn_policy *cp, vrfid_t vrfid, uint8_t proto,
 			goto error;
 	}
 
+alloc_port:
 	/*
 	 * First we try and allocate a port from the active-block, pb.  This
 	 * will be the most likely case.  Allocation within the port-block is
@@ -347,6 +622,15 @@ cgn_map_get(struct cgn_policy *cp, vrfid_t vrfid, uint8_t proto,
 		goto error;
 	}
 
+	/* Try this lcores port-block cache */
+	cpb = cgn_pb_mag_get(np, proto, vrfid,
+			     nat_pool_is_ap_paired(np) ? apm->apm_addr : 0);
+	if (cpb) {
+		pb = cpb;
+		apm = apm_block_get_apm(pb);
+		goto add_block;
+	}
+
 	/*
 	 * Are there any available port-blocks on this public address?
 	 */
@@ -377,6 +661,7 @@ cgn_map_get(struct cgn_policy *cp, vrfid_t vrfid, uint8_t proto,
 	if (!pb)
 		goto error;
 
+add_block:
 	/* Add block to source's block list, and set as active block */
 	cgn_source_add_block(src, proto, pb, np);
 
@@ -24,4 +24,13 @@ cgn_map_get(struct cgn_policy *cp, vrfid_t vrfid, uint8_t proto,
 int cgn_map_put(struct nat_pool *np, vrfid_t vrfid, int dir, uint8_t proto,
 		uint32_t oaddr, uint32_t taddr, uint16_t tport);
 
+/* Per-lcore port-block cache.  Max blocks per lcore per nat pool */
+#define CGN_PB_CACHE_MAX	32
+
+extern uint16_t cgn_pb_cache_size;
+
+void cgn_pb_cache_set_size(uint16_t size);
+void cgn_pb_cache_invalidate(void);
+void cgn_pb_cache_flush_all(void);
+
 #endif
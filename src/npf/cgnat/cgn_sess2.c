@@ -27,6 +27,7 @@
 #include "npf/cgnat/cgn_errno.h"
 #include "npf/cgnat/cgn_limits.h"
 #include "npf/cgnat/cgn_log.h"
+#include "npf/cgnat/cgn_log_ipfix.h"
 #include "npf/cgnat/cgn_mbuf.h"
 #include "npf/cgnat/cgn_sess2.h"
 #include "npf/cgnat/cgn_sess_state.h"
@@ -232,6 +233,28 @@ cgn_log_sess_common(struct cgn_sess2 *s2, char *log_str, uint log_str_sz)
 	return len;
 }
 
+/*
+ * Post a session event record to the binary backend
+ */
+static void cgn_log_sess_post(struct cgn_sess2 *s2, uint8_t event,
+			      uint64_t ticks)
+{
+	struct cgn_session *cse = s2->s2_cse;
+	struct cgn_log_rec rec = {
+		.lr_time = cgn_ticks2timestamp(ticks) / 1000,
+		.lr_int_addr = ntohl(cgn_session_forw_addr(cse)),
+		.lr_ext_addr = ntohl(cgn_session_back_addr(cse)),
+		.lr_dst_addr = ntohl(s2->s2_addr),
+		.lr_int_port = ntohs(cgn_session_forw_id(cse)),
+		.lr_ext_port = ntohs(cgn_session_back_id(cse)),
+		.lr_dst_port = ntohs(s2->s2_port),
+		.lr_event = event,
+		.lr_proto = s2->s2_ipproto,
+	};
+
+	cgn_log_rec_post(&rec);
+}
+
 /*
  * SESSION_CREATE
  */
@@ -240,6 +263,11 @@ static void cgn_log_sess_start(struct cgn_sess2 *s2)
 #define LOG_STR_SZ 400
 	char log_str[LOG_STR_SZ];
 
+	if (cgn_log_ipfix) {
+		cgn_log_sess_post(s2, CGN_LOG_SESS_CREATE, s2->s2_start_time);
+		return;
+	}
+
 	cgn_log_sess_common(s2, log_str, sizeof(log_str));
 	RTE_LOG(NOTICE, CGNAT, "SESSION_CREATE %s\n", log_str);
 }
@@ -282,6 +310,11 @@ static void cgn_log_sess_end(struct cgn_sess2 *s2, uint64_t end_time)
 	char log_str[LOG_STR_SZ];
 	uint len;
 
+	if (cgn_log_ipfix) {
+		cgn_log_sess_post(s2, CGN_LOG_SESS_DELETE, end_time);
+		return;
+	}
+
 	len = cgn_log_sess_common(s2, log_str, sizeof(log_str));
 
 	len += snprintf(log_str + len, sizeof(log_str) - len,
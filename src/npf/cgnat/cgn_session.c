@@ -48,6 +48,7 @@
 #include "npf/apm/apm.h"
 #include "npf/cgnat/cgn_cmd_cfg.h"
 #include "npf/cgnat/cgn_errno.h"
+#include "npf/cgnat/cgn_gc.h"
 #include "npf/cgnat/cgn_limits.h"
 #include "npf/cgnat/cgn_log.h"
 #include "npf/cgnat/cgn_map.h"
@@ -124,7 +125,9 @@ struct cgn_session {
 	/* timeout for a map instantiated session */
 	uint32_t		cs_map_timeout;
 
-	uint8_t			cs_pad3[42];	/* pad to cacheline boundary */
+	struct cgn_gc_entry	cs_gc;		/* 24 bytes */
+
+	uint8_t			cs_pad3[18];	/* pad to cacheline boundary */
 	/* --- cacheline 4 boundary (256 bytes) --- */
 };
 
@@ -135,6 +138,9 @@ struct cds_lfht *cgn_sess_ht[CGN_DIR_SZ];
 /* GC Timer */
 struct rte_timer cgn_gc_timer;
 
+/* GC list of all activated sessions */
+static struct cgn_gc_list cgn_sess_gc;
+
 /* cs_id resource */
 static rte_atomic32_t cgn_id_resource;
 
@@ -370,6 +376,8 @@ static struct cgn_session *cgn_session_create(int *error)
 	assert(cse == sentry2session(&cse->cs_forw_entry, CGN_DIR_FORW));
 	assert(cse == sentry2session(&cse->cs_back_entry, CGN_DIR_BACK));
 
+	cgn_gc_entry_init(&cse->cs_gc);
+
 	return cse;
 }
 
@@ -698,6 +706,9 @@ int cgn_session_activate(struct cgn_session *cse,
 		goto end;
 	}
 
+	/* Session is now owned by the garbage collector */
+	cgn_gc_list_add(&cgn_sess_gc, &cse->cs_gc);
+
 	/* Add a nested 2-tuple session? */
 	if (cse->cs_sess2_ht && cpk->cpk_keepalive) {
 		rc = cgn_sess2_establish_and_activate(cse, cpk, dir);
@@ -2335,9 +2346,10 @@ static inline bool cgn_session_expired(struct cgn_session *cse)
  */
 
 /*
- * GC worker routine, Reclaim expired/timed-out sessions
+ * GC worker routine, Reclaim expired/timed-out sessions.  Returns true if
+ * the session was destroyed.
  */
-static inline void
+static inline bool
 cgn_session_gc_inspect(struct cgn_session *cse)
 {
 
@@ -2380,47 +2392,50 @@ cgn_session_gc_inspect(struct cgn_session *cse)
 
 		/* Only progress with gc when no nested sessions remain */
 		if ((unexpd + expd) > 0)
-			return;
+			return false;
 	} else
 		cgn_session_stats_periodic(cse);
 
 	/* Is session expired? */
 	if (!cgn_session_expired(cse))
-		return;
+		return false;
 
 	/* Wait until all references on the session have been removed */
 	if (rte_atomic16_read(&cse->cs_refcnt))
-		return;
+		return false;
 
 	if (cse->cs_gc_pass++ < CGN_SESS_GC_COUNT)
-		return;
+		return false;
 
 	/* Remove sentrys' from table */
 	cgn_session_deactivate(cse);
 
 	/* Release map and policy, schedule rcu-free */
 	cgn_session_destroy(cse, true);
+
+	return true;
 }
 
 /*
- * Session table garbage collect walk
+ * GC list callback.  The work done includes any nested sessions.
  */
-static void cgn_session_gc_walk(void)
+static uint
+cgn_session_gc_cb(struct cgn_gc_entry *ge, bool *reclaimed)
 {
-	struct cds_lfht_iter iter;
-	struct cgn_sentry *ce;
-	struct cgn_session *cse;
+	struct cgn_session *cse = caa_container_of(ge, struct cgn_session,
+						   cs_gc);
+	uint work = 1;
 
-	if (!cgn_sess_ht[CGN_DIR_FORW])
-		return;
+	if (cse->cs_sess2_ht)
+		work += rte_atomic16_read(&cse->cs_sess2_used);
 
-	/* Walk the forwards-flow session table */
-	cds_lfht_for_each_entry(cgn_sess_ht[CGN_DIR_FORW], &iter, ce, ce_node) {
+	*reclaimed = cgn_session_gc_inspect(cse);
 
-		cse = caa_container_of(ce, struct cgn_session, cs_forw_entry);
-		cgn_session_gc_inspect(cse);
-	}
+	return work;
+}
 
+static void cgn_session_table_full_check(void)
+{
 	/* Is table still full? */
 	if (cgn_session_table_full &&
 	    rte_atomic32_read(&cgn_sessions_used) < cgn_sessions_max) {
@@ -2434,13 +2449,26 @@ static void cgn_session_gc_walk(void)
 }
 
 /*
- * garbage collector timer callback
+ * Inspect every session once.  Used by unit-tests and at uninit.
+ */
+static void cgn_session_gc_walk(void)
+{
+	if (!cgn_sess_ht[CGN_DIR_FORW])
+		return;
+
+	cgn_gc_list_walk_all(&cgn_sess_gc);
+	cgn_session_table_full_check();
+}
+
+/*
+ * garbage collector timer callback.  Each tick inspects a bounded number of
+ * sessions, resuming from where the previous tick stopped.
  */
 static void
 cgn_session_gc(struct rte_timer *timer __rte_unused, void *arg __rte_unused)
 {
-	/* Walk the session table. */
-	cgn_session_gc_walk();
+	cgn_gc_list_tick(&cgn_sess_gc);
+	cgn_session_table_full_check();
 
 	/* Restart timer if dataplane still running. */
 	if (running)
@@ -2478,7 +2506,7 @@ void cgn_session_gc_pass(void)
 static void cgn_session_start_timer(void)
 {
 	rte_timer_reset(&cgn_gc_timer,
-			CGN_SESS_GC_INTERVAL * rte_get_timer_hz(),
+			(rte_get_timer_hz() * CGN_GC_TICK_MS) / 1000,
 			SINGLE, rte_get_master_lcore(), cgn_session_gc, NULL);
 }
 
@@ -2507,6 +2535,9 @@ void cgn_session_init(void)
 			     CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
 			     NULL);
 
+	cgn_gc_list_init(&cgn_sess_gc, cgn_session_gc_cb,
+			 CGN_SESS_GC_INTERVAL, CGN_SESS_GC_BUDGET);
+
 	rte_timer_init(&cgn_gc_timer);
 	cgn_session_start_timer();
 }
@@ -2534,6 +2565,7 @@ void cgn_session_uninit(void)
 
 	assert(cgn_session_table_nodes(cgn_sess_ht[CGN_DIR_FORW]) == 0);
 	assert(cgn_session_table_nodes(cgn_sess_ht[CGN_DIR_BACK]) == 0);
+	assert(cgn_gc_list_empty(&cgn_sess_gc));
 
 	/* Destroy the session hash tables */
 	dp_ht_destroy_deferred(cgn_sess_ht[CGN_DIR_FORW]);
@@ -2542,3 +2574,11 @@ void cgn_session_uninit(void)
 	dp_ht_destroy_deferred(cgn_sess_ht[CGN_DIR_BACK]);
 	cgn_sess_ht[CGN_DIR_BACK] = NULL;
 }
+
+/*
+ * GC metrics, for the cgnat summary
+ */
+void cgn_session_gc_jsonw(json_writer_t *json)
+{
+	cgn_gc_list_jsonw(json, "sess_gc", &cgn_sess_gc);
+}
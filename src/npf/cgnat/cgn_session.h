@@ -7,6 +7,7 @@
 #ifndef _CGN_SESSION_H_
 #define _CGN_SESSION_H_
 
+#include "json_writer.h"
 #include "util.h"
 
 struct cgn_session;
@@ -106,6 +107,7 @@ int cgn_session_walk(cgn_sesswalk_cb cb, void *data);
 
 /* Used by unit-tests only to initiate a gc pass */
 void cgn_session_gc_pass(void);
+void cgn_session_gc_jsonw(json_writer_t *json);
 void cgn_sess_list_show(void);
 
 void cgn_session_cleanup(void);
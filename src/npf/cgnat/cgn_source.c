@@ -39,6 +39,9 @@
 /* source GC Timer */
 static struct rte_timer cgn_src_timer;
 
+/* GC list of all sources in the hash table */
+static struct cgn_gc_list cgn_src_gc;
+
 /* source hash table */
 static struct cds_lfht *cgn_src_ht;
 
@@ -266,6 +269,8 @@ cgn_source_create(struct cgn_policy *cp, uint32_t addr, vrfid_t vrfid,
 	for (proto = NAT_PROTO_FIRST; proto < NAT_PROTO_COUNT; proto++)
 		src->sr_active_block[proto] = NULL;
 
+	cgn_gc_entry_init(&src->sr_gc);
+
 	return src;
 }
 
@@ -442,6 +447,9 @@ cgn_source_insert(struct cgn_source **srcp)
 		return 0;
 	}
 
+	/* Source is now owned by the garbage collector */
+	cgn_gc_list_add(&cgn_src_gc, &src->sr_gc);
+
 	if (!src->sr_policy || src->sr_policy->cp_log_subs)
 		cgn_log_subscriber_start(src->sr_addr);
 
@@ -941,10 +949,13 @@ cgn_source_stats_periodic(struct cgn_source *src)
 }
 
 /*
- * Garbage collector per-entry inspection function
+ * Garbage collector per-entry inspection function.  Returns true if the
+ * source was destroyed.
  */
-static void cgn_source_gc_inspect(struct cgn_source *src)
+static bool cgn_source_gc_inspect(struct cgn_source *src)
 {
+	bool destroyed = false;
+
 	assert(!rte_spinlock_is_locked(&src->sr_lock));
 	rte_spinlock_lock(&src->sr_lock);
 
@@ -980,22 +991,24 @@ static void cgn_source_gc_inspect(struct cgn_source *src)
 	}
 
 	cgn_source_destroy(src);
+	destroyed = true;
 
 unlock:
 	rte_spinlock_unlock(&src->sr_lock);
+	return destroyed;
 }
 
-static void cgn_source_gc_walk(void)
+static uint cgn_source_gc_cb(struct cgn_gc_entry *ge, bool *reclaimed)
 {
-	struct cds_lfht_iter iter;
-	struct cgn_source *src;
+	struct cgn_source *src = caa_container_of(ge, struct cgn_source,
+						  sr_gc);
 
-	if (!cgn_src_ht)
-		return;
-
-	cds_lfht_for_each_entry(cgn_src_ht, &iter, src, sr_node)
-		cgn_source_gc_inspect(src);
+	*reclaimed = cgn_source_gc_inspect(src);
+	return 1;
+}
 
+static void cgn_source_table_full_check(void)
+{
 	/* Is table still full? */
 	if (cgn_src_table_full &&
 	    rte_atomic32_read(&cgn_src_used) < cgn_src_max) {
@@ -1007,15 +1020,31 @@ static void cgn_source_gc_walk(void)
 	}
 }
 
+/*
+ * Inspect every source once.  Used by unit-tests and at uninit.
+ */
+static void cgn_source_gc_walk(void)
+{
+	if (!cgn_src_ht)
+		return;
+
+	cgn_gc_list_walk_all(&cgn_src_gc);
+	cgn_source_table_full_check();
+}
+
+/*
+ * Each tick inspects a bounded number of sources, resuming from where the
+ * previous tick stopped.
+ */
 static void cgn_source_gc(struct rte_timer *timer __unused, void *arg __unused)
 {
-	/* Walk the source table */
-	cgn_source_gc_walk();
+	cgn_gc_list_tick(&cgn_src_gc);
+	cgn_source_table_full_check();
 
 	/* Restart timer if dataplane still running */
 	if (running)
 		rte_timer_reset(&cgn_src_timer,
-				CGN_SRC_GC_INTERVAL * rte_get_timer_hz(),
+				(rte_get_timer_hz() * CGN_GC_TICK_MS) / 1000,
 				SINGLE, rte_get_master_lcore(), cgn_source_gc,
 				NULL);
 }
@@ -1041,9 +1070,12 @@ void cgn_source_init(void)
 				  CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
 				  NULL);
 
+	cgn_gc_list_init(&cgn_src_gc, cgn_source_gc_cb,
+			 CGN_SRC_GC_INTERVAL, CGN_SRC_GC_BUDGET);
+
 	rte_timer_init(&cgn_src_timer);
 	rte_timer_reset(&cgn_src_timer,
-			(CGN_SRC_GC_INTERVAL + 5) * rte_get_timer_hz(),
+			(rte_get_timer_hz() * CGN_GC_TICK_MS) / 1000,
 			SINGLE, rte_get_master_lcore(), cgn_source_gc,
 			NULL);
 }
@@ -1064,3 +1096,11 @@ void cgn_source_uninit(void)
 	dp_ht_destroy_deferred(cgn_src_ht);
 	cgn_src_ht = NULL;
 }
+
+/*
+ * GC metrics, for the cgnat summary
+ */
+void cgn_source_gc_jsonw(json_writer_t *json)
+{
+	cgn_gc_list_jsonw(json, "subs_gc", &cgn_src_gc);
+}
@@ -8,11 +8,13 @@
 #define _CGN_SOURCE_H_
 
 #include <urcu/list.h>
+#include "json_writer.h"
 #include "util.h"
 
 #include "npf/nat/nat_proto.h"
 #include "npf/cgnat/cgn_limits.h"
 #include "npf/cgnat/cgn.h"
+#include "npf/cgnat/cgn_gc.h"
 
 struct nat_pool;
 struct cgn_source;
@@ -84,6 +86,8 @@ struct cgn_source {
 	uint64_t		sr_map_reqs;
 	uint64_t		sr_map_fails;
 	rte_atomic32_t		sr_map_active;
+
+	struct cgn_gc_entry	sr_gc;
 };
 
 /* source entry removal bits. */
@@ -119,6 +123,7 @@ void cgn_source_update_stats(struct cgn_source *src,
 /* Get subscriber hash table used and max counts */
 int32_t cgn_source_get_used(void);
 int32_t cgn_source_get_max(void);
+void cgn_source_gc_jsonw(json_writer_t *json);
 
 void cgn_source_show(FILE *f, int argc, char **argv);
 void cgn_source_list(FILE *f, int argc, char **argv);
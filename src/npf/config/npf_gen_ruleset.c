@@ -16,6 +16,7 @@
 
 #include "if_var.h"
 #include "npf/npf.h"
+#include "npf/npf_dtree.h"
 #include "npf/config/npf_attach_point.h"
 #include "npf/config/npf_gen_ruleset.h"
 #include "npf/config/npf_rule_group.h"
@@ -49,6 +50,7 @@ struct create_ruleset_info {
 	const struct npf_rlgrp_key *rgk;
 	uint num_rules_in_group;
 	unsigned int ruleset_type_flags;
+	bool use_dtree;
 };
 
 static bool
@@ -111,8 +113,11 @@ npf_cfg_create_ruleset_group_cb(const struct npf_attpt_group *rsg, void *ctx)
 	if (info->num_rules_in_group == 0)
 		/* no rules in the group or does no exist, so discard it */
 		npf_free_group(rg);
-	else
+	else {
 		npf_grouper_optimize(rg);
+		if (info->use_dtree)
+			npf_grouper_build_dtree(rg);
+	}
 
 	info->num_rules_in_group = 0;
 	info->dp_rule_group = NULL;
@@ -133,7 +138,8 @@ npf_cfg_create_ruleset(npf_ruleset_t **new_dp_ruleset,
 		.dp_rule_group = NULL,
 		.num_rules_in_group = 0,
 		.new_dp_ruleset = new_dp_ruleset,
-		.ruleset_type_flags = ruleset_type_flags
+		.ruleset_type_flags = ruleset_type_flags,
+		.use_dtree = npf_dtree_attpt_enabled(attach_type, attach_point)
 	};
 
 	if (attach_type >= NPF_ATTACH_TYPE_COUNT ||
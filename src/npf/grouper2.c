@@ -7,6 +7,8 @@
  */
 
 #include <rte_branch_prediction.h>
+#include <rte_common.h>
+#include <rte_cpuflags.h>
 #include <rte_log.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -15,6 +17,10 @@
 #include <string.h>
 #include <util.h>
 
+#ifdef RTE_ARCH_X86
+#include <immintrin.h>
+#endif
+
 #include "npf/grouper2.h"
 #include "npf/npf_ruleset.h"
 #include "vplane_log.h"
@@ -63,6 +69,15 @@
  *    rule (i.e. subrule).  This includes:
  *
  *    a. Port ranges (but only when the range specifies more than one port)
+ *
+ * SIMD evaluation:
+ *
+ * The bit patterns for consecutive 64-rule chunks are contiguous, so where
+ * the cpu supports it we AND 256 (AVX2) or 512 (AVX-512) rule bits at a time
+ * instead of one 64-bit chunk.  The level is detected at runtime when the
+ * first grouper is created.  A vector is only used when the bit patterns are
+ * allocated to at least that width, so loads never run past the end of a
+ * pattern.
  */
 
 
@@ -93,6 +108,11 @@ static const uint32_t g_size_alloc[] = {
 
 typedef bool (*g2_fp_eval_rule)(const uint8_t *, uint32_t, const void *);
 
+/* SIMD level supported by the cpu, and the level in use */
+static enum g2_simd g2_simd_max;
+static enum g2_simd g2_simd;
+static bool g2_simd_detected;
+
 /*
  * Grouper config
  *
@@ -218,6 +238,39 @@ g2_alloc_match_table(g2_config_t *conf, uint table)
 }
 
 
+static void g2_simd_detect(void)
+{
+	g2_simd_max = G2_SIMD_NONE;
+#ifdef RTE_ARCH_X86
+	if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0)
+		g2_simd_max = G2_SIMD_AVX2;
+	if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX512F) > 0)
+		g2_simd_max = G2_SIMD_AVX512;
+#endif
+	g2_simd = g2_simd_max;
+	g2_simd_detected = true;
+}
+
+enum g2_simd g2_simd_get(void)
+{
+	if (!g2_simd_detected)
+		g2_simd_detect();
+	return g2_simd;
+}
+
+/*
+ * Select the SIMD level used for evaluation.  Limited to what the cpu
+ * supports.  Returns the level selected.
+ */
+enum g2_simd g2_simd_set(enum g2_simd level)
+{
+	if (!g2_simd_detected)
+		g2_simd_detect();
+
+	g2_simd = RTE_MIN(level, g2_simd_max);
+	return g2_simd;
+}
+
 /*
  * Grouper initialization.
  *
@@ -240,6 +293,9 @@ g2_config_t *g2_init(uint num_tables)
 	if (num_tables < 1)
 		return NULL;
 
+	if (!g2_simd_detected)
+		g2_simd_detect();
+
 	/*
 	 * Alloc conf structure and table pointer array
 	 */
@@ -585,6 +641,247 @@ g2_optimize(g2_config_t **confp)
 	}
 }
 
+/*
+ * Number of 64-bit words of rule bits to evaluate at a time
+ */
+static inline uint
+g2_eval_width(const g2_config_t *conf)
+{
+	uint words = g_size_alloc[conf->_rs_size_idx] / STRIDE_BITS;
+
+	if (conf->_num_chunks < 2)
+		return 1;
+
+	if (g2_simd >= G2_SIMD_AVX512 && words >= 8)
+		return 8;
+
+	if (g2_simd >= G2_SIMD_AVX2 && words >= 4)
+		return 4;
+
+	return 1;
+}
+
+/*
+ * Verify each candidate in one 64-rule chunk, in rule order.  Returns the
+ * first matching rule.  Sets *end if the candidates run past the last rule.
+ */
+static inline void *
+g2_chunk_match(const g2_config_t *conf, uint64_t rule_match, uint32_t j,
+	       const void *data, process_callback proc, bool *end)
+{
+	while (rule_match) {
+		uint32_t loc;
+		uint32_t idx_match;
+
+		loc = ffsl(rule_match);
+		idx_match = loc + (j * STRIDE_BITS);
+
+		if (unlikely(idx_match > conf->_num_rules)) {
+			*end = true;
+			return NULL;
+		}
+
+		void *r = conf->_md[idx_match - 1];
+
+		if (proc(data, r))
+			return r;
+
+		rule_match ^= (1ull << (loc - 1ull));
+	}
+	return NULL;
+}
+
+/*
+ * AND the bit patterns for each packet byte, for the 'width' words of rules
+ * starting at chunk j.  Returns false as soon as no candidates remain.
+ */
+static inline bool
+g2_and_scalar(const g2_config_t *conf, const uint8_t *packet, uint32_t j,
+	      uint64_t *words)
+{
+	uint64_t rule_match = UINT64_MAX;
+	uint i;
+
+	for (i = 0; i < conf->_num_tables && rule_match; i++)
+		rule_match &= conf->_match_table[i][packet[i]][j];
+
+	words[0] = rule_match;
+	return rule_match != 0;
+}
+
+#ifdef RTE_ARCH_X86
+static inline __attribute__((target("avx2"))) bool
+g2_and_avx2(const g2_config_t *conf, const uint8_t *packet, uint32_t j,
+	    uint64_t *words)
+{
+	__m256i m;
+	uint i;
+
+	m = _mm256_loadu_si256(
+		(const __m256i *)&conf->_match_table[0][packet[0]][j]);
+
+	for (i = 1; i < conf->_num_tables; i++) {
+		if (_mm256_testz_si256(m, m))
+			return false;
+		m = _mm256_and_si256(m, _mm256_loadu_si256(
+			(const __m256i *)&conf->_match_table[i][packet[i]][j]));
+	}
+
+	if (_mm256_testz_si256(m, m))
+		return false;
+
+	_mm256_storeu_si256((__m256i *)words, m);
+	return true;
+}
+
+static inline __attribute__((target("avx512f"))) bool
+g2_and_avx512(const g2_config_t *conf, const uint8_t *packet, uint32_t j,
+	      uint64_t *words)
+{
+	__m512i m;
+	uint i;
+
+	m = _mm512_loadu_si512(&conf->_match_table[0][packet[0]][j]);
+
+	for (i = 1; i < conf->_num_tables; i++) {
+		if (_mm512_test_epi64_mask(m, m) == 0)
+			return false;
+		m = _mm512_and_si512(m, _mm512_loadu_si512(
+			&conf->_match_table[i][packet[i]][j]));
+	}
+
+	if (_mm512_test_epi64_mask(m, m) == 0)
+		return false;
+
+	_mm512_storeu_si512(words, m);
+	return true;
+}
+#endif
+
+/*
+ * Generate the single packet and burst evaluation functions for one width.
+ * The AND function is called directly so that it is inlined with the
+ * correct target attribute.
+ */
+#define G2_EVAL_FUNCS(_isa, _width, _attr)				\
+static _attr void *							\
+g2_eval_##_isa(const g2_config_t *conf, const uint8_t *packet,		\
+	       const void *data, process_callback proc)			\
+{									\
+	uint64_t words[_width];						\
+	bool end = false;						\
+	uint32_t j;							\
+	uint w;								\
+	void *r;							\
+									\
+	for (j = 0; j < conf->_num_chunks; j += _width) {		\
+		if (!g2_and_##_isa(conf, packet, j, words))		\
+			continue;					\
+		for (w = 0; w < _width; w++) {				\
+			r = g2_chunk_match(conf, words[w], j + w,	\
+					   data, proc, &end);		\
+			if (r || end)					\
+				return r;				\
+		}							\
+	}								\
+	return NULL;							\
+}									\
+									\
+static _attr void							\
+g2_burst_##_isa(const g2_config_t *conf, uint n,			\
+		const uint8_t *const packets[],				\
+		const void *const data[], process_callback proc,	\
+		void *rules[])						\
+{									\
+	uint64_t pending, todo;						\
+	uint64_t words[_width];						\
+	uint32_t j;							\
+	uint k, w;							\
+									\
+	pending = n < 64 ? (1ull << n) - 1 : UINT64_MAX;		\
+	for (k = 0; k < n; k++)						\
+		rules[k] = NULL;					\
+									\
+	for (j = 0; j < conf->_num_chunks && pending; j += _width) {	\
+		todo = pending;						\
+		while (todo) {						\
+			k = __builtin_ctzll(todo);			\
+			todo &= todo - 1;				\
+									\
+			if (!g2_and_##_isa(conf, packets[k], j, words))	\
+				continue;				\
+									\
+			for (w = 0; w < _width; w++) {			\
+				bool end = false;			\
+				void *r;				\
+									\
+				r = g2_chunk_match(conf, words[w],	\
+						   j + w, data[k],	\
+						   proc, &end);		\
+				if (r || end) {				\
+					rules[k] = r;			\
+					pending &= ~(1ull << k);	\
+					break;				\
+				}					\
+			}						\
+		}							\
+	}								\
+}
+
+G2_EVAL_FUNCS(scalar, 1, )
+#ifdef RTE_ARCH_X86
+G2_EVAL_FUNCS(avx2, 4, __attribute__((target("avx2"))))
+G2_EVAL_FUNCS(avx512, 8, __attribute__((target("avx512f"))))
+#endif
+
+static void *
+g2_eval_simd(const g2_config_t *conf, uint width, const uint8_t *packet,
+	     const void *data, process_callback proc)
+{
+#ifdef RTE_ARCH_X86
+	if (width == 8)
+		return g2_eval_avx512(conf, packet, data, proc);
+	if (width == 4)
+		return g2_eval_avx2(conf, packet, data, proc);
+#endif
+	return g2_eval_scalar(conf, packet, data, proc);
+}
+
+/*
+ * Evaluate a packet with a caller supplied rule verification callback.
+ */
+void *g2_eval(const g2_config_t *conf, const uint8_t *packet,
+	      const void *data, process_callback proc)
+{
+	return g2_eval_simd(conf, g2_eval_width(conf), packet, data, proc);
+}
+
+/*
+ * Evaluate a burst of up to G2_BURST_MAX packets against the same grouper.
+ * Each chunk of bit patterns is visited once for all the packets still
+ * without a match.  rules[k] is set to the first rule matched by packet k,
+ * or NULL.
+ */
+void g2_eval_burst(const g2_config_t *conf, uint n,
+		   const uint8_t *const packets[], const void *const data[],
+		   process_callback proc, void *rules[])
+{
+	if (n > G2_BURST_MAX)
+		n = G2_BURST_MAX;
+
+#ifdef RTE_ARCH_X86
+	switch (g2_eval_width(conf)) {
+	case 8:
+		g2_burst_avx512(conf, n, packets, data, proc, rules);
+		return;
+	case 4:
+		g2_burst_avx2(conf, n, packets, data, proc, rules);
+		return;
+	}
+#endif
+	g2_burst_scalar(conf, n, packets, data, proc, rules);
+}
+
 /*
  * g2_eval4()
  * conf:     ptr to configuration structure
@@ -596,8 +893,13 @@ inline
 void *g2_eval4(const g2_config_t *conf, const uint8_t *packet,
 	       const void *data)
 {
+	uint width = g2_eval_width(conf);
 	uint32_t j;
 
+	if (width > 1)
+		return g2_eval_simd(conf, width, packet, data,
+				    npf_rule_proc);
+
 	/*
 	 * for each chunk of rules, i.e. 64 at a time
 	 */
@@ -649,8 +951,13 @@ void *g2_eval4(const g2_config_t *conf, const uint8_t *packet,
 void *g2_eval6(const g2_config_t *conf, const uint8_t *packet,
 	       const void *data)
 {
+	uint width = g2_eval_width(conf);
 	uint32_t j;
 
+	if (width > 1)
+		return g2_eval_simd(conf, width, packet, data,
+				    npf_rule_proc);
+
 	/*
 	 * for each chunk of rules, i.e. 64 at a time
 	 */
@@ -18,7 +18,17 @@
 
 typedef struct g2_config g2_config_t;
 typedef void *g2_handle_t;
-typedef	bool (*process_callback)(void *, void *);
+typedef	bool (*process_callback)(const void *, const void *);
+
+/* Max packets per g2_eval_burst call */
+#define G2_BURST_MAX	64
+
+/* SIMD instruction set used to evaluate the bit patterns */
+enum g2_simd {
+	G2_SIMD_NONE,
+	G2_SIMD_AVX2,
+	G2_SIMD_AVX512,
+};
 
 g2_config_t *g2_init(uint num_tables);
 bool g2_create_rule(g2_config_t *conf, rule_no_t rule_no, void *match_data);
@@ -29,6 +39,14 @@ void *g2_eval4(const g2_config_t *conf, const uint8_t *packet,
 	       const void *data);
 void *g2_eval6(const g2_config_t *conf, const uint8_t *packet,
 	       const void *data);
+void *g2_eval(const g2_config_t *conf, const uint8_t *packet,
+	      const void *data, process_callback proc);
+void g2_eval_burst(const g2_config_t *conf, uint n,
+		   const uint8_t *const packets[], const void *const data[],
+		   process_callback proc, void *rules[]);
 void g2_destroy(g2_config_t **confp);
 
+enum g2_simd g2_simd_get(void);
+enum g2_simd g2_simd_set(enum g2_simd level);
+
 #endif /* GROUPER2_H */
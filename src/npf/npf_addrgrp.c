@@ -10,7 +10,9 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <rte_branch_prediction.h>
+#include <rte_lcore.h>
 #include <rte_rwlock.h>
+#include <rte_timer.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +26,7 @@
 #include "npf_addrgrp.h"
 #include "npf_cidr_util.h"
 #include "npf_ptree.h"
+#include "npf_rangetbl.h"
 #include "npf_tblset.h"
 #include "urcu.h"
 #include "util.h"
@@ -72,6 +75,14 @@ struct ptree_table;
  *
  * Changes to an address-groups ptree are protected by a read-write lock.
  *
+ * The ptree is the authoritative, editable, copy of the address-group.  For
+ * the forwarding threads it is compiled to a range table (npf_rangetbl.c),
+ * which is published via rcu and looked up without taking the lock.  Any
+ * change to the ptree unpublishes the range table, and the forwarding
+ * threads use the ptree until a timer rebuilds the range table once the
+ * changes have stopped.  This means that loading a large address-group
+ * compiles it once, rather than once per entry.
+ *
  *
  * g_addrgrp_table[]
  *      |
@@ -208,8 +219,13 @@ struct npf_addrgrp {
 	bool                ag_any[AG_MAX];  /* 0.0.0.0/0 or ::/0 */
 	zlist_t            *ag_list[AG_MAX];
 	struct ptree_table *ag_tree[AG_MAX];
+	struct rangetbl    *ag_rtbl[AG_MAX];
+	struct rte_timer    ag_rtbl_timer;
 };
 
+/* Delay after the last change before the range tables are rebuilt */
+#define AG_RTBL_DELAY_MS 100
+
 #define AG_KLEN_IPv4 4
 #define AG_KLEN_IPv6 16
 
@@ -282,6 +298,7 @@ npf_addrgrp_lookup(enum npf_addrgrp_af af, struct npf_addrgrp *ag,
 		   npf_addr_t *addr)
 {
 	struct ptree_node *pn;
+	struct rangetbl *rt;
 
 	if (unlikely(!ag))
 		return -EINVAL;
@@ -292,6 +309,10 @@ npf_addrgrp_lookup(enum npf_addrgrp_af af, struct npf_addrgrp *ag,
 	if (ag->ag_any[af])
 		return 0;
 
+	rt = rcu_dereference(ag->ag_rtbl[af]);
+	if (likely(rt != NULL))
+		return rangetbl_lookup(rt, addr->s6_addr) ? 0 : -ENOENT;
+
 	rte_rwlock_read_lock(&ag->ag_lock);
 
 	pn = ptree_shortest_match(ag->ag_tree[af], addr->s6_addr);
@@ -304,6 +325,7 @@ npf_addrgrp_lookup(enum npf_addrgrp_af af, struct npf_addrgrp *ag,
 int npf_addrgrp_lookup_v4(struct npf_addrgrp *ag, uint32_t addr)
 {
 	struct ptree_node *pn;
+	struct rangetbl *rt;
 
 	if (unlikely(!ag))
 		return -EINVAL;
@@ -312,6 +334,10 @@ int npf_addrgrp_lookup_v4(struct npf_addrgrp *ag, uint32_t addr)
 	if (ag->ag_any[AG_IPv4])
 		return 0;
 
+	rt = rcu_dereference(ag->ag_rtbl[AG_IPv4]);
+	if (likely(rt != NULL))
+		return rangetbl_lookup_v4(rt, addr) ? 0 : -ENOENT;
+
 	rte_rwlock_read_lock(&ag->ag_lock);
 
 	pn = ptree_shortest_match(ag->ag_tree[AG_IPv4], (uint8_t *)&addr);
@@ -324,6 +350,7 @@ int npf_addrgrp_lookup_v4(struct npf_addrgrp *ag, uint32_t addr)
 int npf_addrgrp_lookup_v6(struct npf_addrgrp *ag, uint8_t *addr)
 {
 	struct ptree_node *pn;
+	struct rangetbl *rt;
 
 	if (unlikely(!ag))
 		return -EINVAL;
@@ -332,6 +359,10 @@ int npf_addrgrp_lookup_v6(struct npf_addrgrp *ag, uint8_t *addr)
 	if (ag->ag_any[AG_IPv6])
 		return 0;
 
+	rt = rcu_dereference(ag->ag_rtbl[AG_IPv6]);
+	if (likely(rt != NULL))
+		return rangetbl_lookup_v6(rt, addr) ? 0 : -ENOENT;
+
 	rte_rwlock_read_lock(&ag->ag_lock);
 
 	pn = ptree_shortest_match(ag->ag_tree[AG_IPv6], addr);
@@ -341,6 +372,64 @@ int npf_addrgrp_lookup_v6(struct npf_addrgrp *ag, uint8_t *addr)
 	return (pn != NULL) ? 0 : -ENOENT;
 }
 
+/*
+ * Publish a range table for each address family that does not have one.
+ * Called on the master thread, as are all changes to the ptrees.
+ */
+void npf_addrgrp_rtbl_build(struct npf_addrgrp *ag)
+{
+	struct rangetbl *rt;
+	uint af;
+
+	for (af = AG_IPv4; af < AG_MAX; af++) {
+		if (ag->ag_rtbl[af] ||
+		    ptree_get_table_leaf_count(ag->ag_tree[af]) == 0)
+			continue;
+
+		rt = rangetbl_build(ag->ag_tree[af]);
+		if (rt)
+			rcu_assign_pointer(ag->ag_rtbl[af], rt);
+	}
+}
+
+static void
+npf_addrgrp_rtbl_timer_cb(struct rte_timer *timer __unused, void *arg)
+{
+	npf_addrgrp_rtbl_build(arg);
+}
+
+static void
+npf_addrgrp_rtbl_unpublish(struct npf_addrgrp *ag, enum npf_addrgrp_af af)
+{
+	struct rangetbl *rt = ag->ag_rtbl[af];
+
+	if (rt) {
+		rcu_assign_pointer(ag->ag_rtbl[af], NULL);
+		rangetbl_free_rcu(rt);
+	}
+}
+
+static void npf_addrgrp_rtbl_free(struct npf_addrgrp *ag)
+{
+	npf_addrgrp_rtbl_unpublish(ag, AG_IPv4);
+	npf_addrgrp_rtbl_unpublish(ag, AG_IPv6);
+}
+
+/*
+ * The ptree for an address family has changed.  Stop using its range
+ * table, and (re)start the timer to build a new one.
+ */
+static void
+npf_addrgrp_tree_changed(struct npf_addrgrp *ag, enum npf_addrgrp_af af)
+{
+	npf_addrgrp_rtbl_unpublish(ag, af);
+
+	rte_timer_reset(&ag->ag_rtbl_timer,
+			AG_RTBL_DELAY_MS * rte_get_timer_hz() / 1000,
+			SINGLE, rte_get_master_lcore(),
+			npf_addrgrp_rtbl_timer_cb, ag);
+}
+
 /*
  * Create an address-group tableset
  */
@@ -524,6 +613,7 @@ struct npf_addrgrp *npf_addrgrp_create(const char *name)
 
 	/* Initialize address-group data */
 	rte_rwlock_init(&ag->ag_lock);
+	rte_timer_init(&ag->ag_rtbl_timer);
 
 	/* Create mgmgt list */
 	ag->ag_list[AG_IPv4] = zlist_new();
@@ -583,8 +673,12 @@ npf_addrgrp_data_destroy(struct npf_addrgrp *ag)
 
 	assert(ptree_get_table_leaf_count(ag->ag_tree[AG_IPv6]) == 0);
 
+	rte_timer_stop(&ag->ag_rtbl_timer);
+
 	rte_rwlock_write_lock(&ag->ag_lock);
 
+	npf_addrgrp_rtbl_free(ag);
+
 	if (ag->ag_tree[AG_IPv4])
 		ptree_table_destroy(ag->ag_tree[AG_IPv4]);
 
@@ -710,6 +804,8 @@ npf_addrgrp_prefix_mask_insert(struct npf_addrgrp_entry *ae, uint8_t mask)
 		ptree_insert(ag->ag_tree[ae->ae_af], ap_prefix(ae),
 			     ag_ptree_mask(ae->ae_af, ae->ap_mask[0]));
 
+		npf_addrgrp_tree_changed(ag, ae->ae_af);
+
 		rte_rwlock_write_unlock(&ag->ag_lock);
 	}
 	return 0;
@@ -757,6 +853,8 @@ npf_addrgrp_prefix_mask_remove(struct npf_addrgrp_entry *ae, uint8_t mask)
 		ptree_insert(ag->ag_tree[ae->ae_af], ap_prefix(ae),
 			     ag_ptree_mask(ae->ae_af, ae->ap_mask[1]));
 
+		npf_addrgrp_tree_changed(ag, ae->ae_af);
+
 		rte_rwlock_write_unlock(&ag->ag_lock);
 	}
 
@@ -1027,6 +1125,8 @@ static void npf_addrgrp_entry_free(void *item)
 		if (rc == 0)
 			ae->ae_ptree = 0;
 
+		npf_addrgrp_tree_changed(ag, ae->ae_af);
+
 		rte_rwlock_write_unlock(&ag->ag_lock);
 	}
 
@@ -1261,6 +1361,8 @@ int npf_addrgrp_prefix_insert(const char *name, npf_addr_t *addr,
 	if (rc == 0)
 		ae->ae_ptree = 1;
 
+	npf_addrgrp_tree_changed(ag, af);
+
 	rte_rwlock_write_unlock(&ag->ag_lock);
 
 	assert(rc == 0);
@@ -1339,6 +1441,8 @@ npf_addrgrp_range_pfx_list_ptree_insert(struct npf_addrgrp *ag,
 			ap->ae_ptree = 1;
 	}
 
+	npf_addrgrp_tree_changed(ag, ae->ae_af);
+
 	rte_rwlock_write_unlock(&ag->ag_lock);
 }
 
@@ -1495,6 +1599,7 @@ npf_addrgrp_range_update(struct npf_addrgrp *ag,
 				tmp->ae_ptree = 1;
 		}
 	}
+	npf_addrgrp_tree_changed(ag, af);
 
 	/* Swap lists */
 	ae->ar_list = cur_list;
@@ -47,8 +47,8 @@ enum npf_addrgrp_af {
 /**
  * @brief Lookup an address in an address-group.
  *
- * Called from forwarding thread, so access to underlying ptree is protected
- * with read-write lock.
+ * Called from forwarding thread.  The address-group's range table is used
+ * if there is one, else the ptree, protected with a read-write lock.
  *
  * @param af   Address-group address family.  AG_IPv4 or AG_IPv6.
  * @param ag   Address-group handle
@@ -63,8 +63,8 @@ int npf_addrgrp_lookup(enum npf_addrgrp_af af, struct npf_addrgrp *ag,
 /**
  * @brief Lookup an IPv4 address in an address-group.
  *
- * Called from forwarding thread, so access to underlying ptree is protected
- * with read-write lock.
+ * Called from forwarding thread.  The address-group's range table is used
+ * if there is one, else the ptree, protected with a read-write lock.
  *
  * @param ag   Address-group handle
  * @param addr IPv4 address to lookup
@@ -77,8 +77,8 @@ int npf_addrgrp_lookup_v4(struct npf_addrgrp *ag, uint32_t addr);
 /**
  * @brief Lookup an IPv6 address in an address-group.
  *
- * Called from forwarding thread, so access to underlying ptree is protected
- * with read-write lock.
+ * Called from forwarding thread.  The address-group's range table is used
+ * if there is one, else the ptree, protected with a read-write lock.
  *
  * @param ag   Address-group handle
  * @param addr IPv6 address to lookup
@@ -88,6 +88,14 @@ int npf_addrgrp_lookup_v4(struct npf_addrgrp *ag, uint32_t addr);
  */
 int npf_addrgrp_lookup_v6(struct npf_addrgrp *ag, uint8_t *addr);
 
+/**
+ * @brief Build the range tables of an address-group
+ *
+ * Range tables are normally built by a timer shortly after the last change
+ * to an address-group.  This builds them immediately.
+ */
+void npf_addrgrp_rtbl_build(struct npf_addrgrp *ag);
+
 /**
  * @brief Get name from address group handle
  */
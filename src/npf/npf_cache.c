@@ -57,6 +57,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "compiler.h"
 #include "in_cksum.h"
 #include "netinet6/in6.h"
 #include "npf/npf.h"
@@ -768,6 +769,143 @@ static inline bool npf_fetch_icmp(npf_cache_t *npc, struct rte_mbuf *nbuf,
 	return true;
 }
 
+/*
+ * Minimum L4 header that npf_cache_all_fast() copies for each protocol, or
+ * 0 if the protocol is left to the general parse.
+ */
+static inline u_int npf_cache_fast_l4len(uint8_t proto, bool v4)
+{
+	switch (proto) {
+	case IPPROTO_TCP:
+		return sizeof(struct tcphdr);
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+		return sizeof(struct udphdr);
+	case IPPROTO_ICMP:
+		return v4 ? ICMP_MINLEN : 0;
+	case IPPROTO_ICMPV6:
+		return v4 ? 0 : ICMP_MINLEN;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Single pass parse of the common case.  That is an unfragmented IPv4
+ * packet, or an IPv6 packet without extension headers, carrying TCP, UDP,
+ * UDP-Lite or ICMP with all headers in the first segment.
+ *
+ * There is one bounds check for the L3 and L4 headers, and the grouper is
+ * filled in as they are cached.  The result is the same as the general
+ * parse.  Returns false, having cached nothing, for any other packet.
+ *
+ * This only speeds up the npf parse.  CGNAT (cgn_cache_all) and session
+ * lookup (se_parse_ids) still read the headers for themselves.
+ */
+static ALWAYS_INLINE bool
+npf_cache_all_fast(npf_cache_t *npc, struct rte_mbuf *nbuf, const char *n_ptr,
+		   uint16_t eth_proto)
+{
+	const char *eod = rte_pktmbuf_mtod(nbuf, char *) +
+		rte_pktmbuf_data_len(nbuf);
+	char *gpr = npc->npc_grouper;
+	u_int hlen, l4len;
+	uint8_t proto;
+
+	if (likely(eth_proto == htons(ETHER_TYPE_IPv4))) {
+		const struct ip *ip = (const struct ip *)n_ptr;
+
+		if (unlikely(n_ptr + sizeof(struct ip) > eod))
+			return false;
+
+		hlen = ip->ip_hl << 2;
+		proto = ip->ip_p;
+		l4len = npf_cache_fast_l4len(proto, true);
+
+		if (unlikely(ip->ip_v != IPVERSION ||
+			     hlen < sizeof(struct ip) || l4len == 0 ||
+			     (ip->ip_off & ~htons(IP_DF | IP_RF)) ||
+			     n_ptr + hlen + l4len > eod))
+			return false;
+
+		memcpy(&npc->npc_ip.v4, ip, sizeof(struct ip));
+		memcpy(&npc->npc_l4, n_ptr + hlen, l4len);
+
+		npc->npc_alen = sizeof(struct in_addr);
+		npc->npc_srcdst = (npf_srcdst_t *)&npc->npc_ip.v4.ip_src;
+		npc->npc_info |= NPC_IP4;
+		npc->npc_hlen = hlen;
+		npc->npc_next_proto = proto;
+
+		/* Source and destination are adjacent in both */
+		gpr[NPC_GPR_PROTO_OFF_v4] = proto;
+		memcpy(gpr + NPC_GPR_SADDR_OFF_v4, &npc->npc_ip.v4.ip_src,
+		       NPC_GPR_SADDR_LEN_v4 + NPC_GPR_DADDR_LEN_v4);
+
+		if (proto == IPPROTO_ICMP) {
+			const struct icmp *ic = &npc->npc_l4.icmp;
+
+			npf_decode_icmp4(npc);
+			npc->npc_info |= NPC_ICMP;
+			gpr[NPC_GPR_ICMPTYPE_OFF_v4] = ic->icmp_type;
+			gpr[NPC_GPR_ICMPCODE_OFF_v4] = ic->icmp_code;
+		} else {
+			npc->npc_info |= NPC_L4PORTS;
+			memcpy(gpr + NPC_GPR_SPORT_OFF_v4, &npc->npc_l4.ports,
+			       NPC_GPR_SPORT_LEN_v4 + NPC_GPR_DPORT_LEN_v4);
+		}
+	} else if (eth_proto == htons(ETHER_TYPE_IPv6)) {
+		const struct ip6_hdr *ip6 = (const struct ip6_hdr *)n_ptr;
+
+		hlen = sizeof(struct ip6_hdr);
+		if (unlikely(n_ptr + hlen > eod))
+			return false;
+
+		proto = ip6->ip6_nxt;
+		l4len = npf_cache_fast_l4len(proto, false);
+
+		if (unlikely((ip6->ip6_vfc & IPV6_VERSION_MASK) !=
+			     IPV6_VERSION || l4len == 0 ||
+			     n_ptr + hlen + l4len > eod))
+			return false;
+
+		memcpy(&npc->npc_ip.v6, ip6, sizeof(struct ip6_hdr));
+		memcpy(&npc->npc_l4, n_ptr + hlen, l4len);
+
+		if (pktmbuf_l3_len(nbuf) == 0)
+			pktmbuf_l3_len(nbuf) = hlen;
+
+		npc->last_unfrg_hlen = hlen;
+		npc->last_unfrg_hofs = 0;
+		npc->npc_alen = sizeof(struct in6_addr);
+		npc->npc_srcdst = (npf_srcdst_t *)&npc->npc_ip.v6.ip6_src;
+		npc->npc_info |= NPC_IP6;
+		npc->npc_hlen = hlen;
+		npc->npc_next_proto = proto;
+
+		gpr[NPC_GPR_PROTO_OFF_v6] = proto;
+		memcpy(gpr + NPC_GPR_SADDR_OFF_v6, &npc->npc_ip.v6.ip6_src,
+		       NPC_GPR_SADDR_LEN_v6 + NPC_GPR_DADDR_LEN_v6);
+
+		if (proto == IPPROTO_ICMPV6) {
+			const struct icmp6_hdr *ic6 = &npc->npc_l4.icmp6;
+
+			npf_decode_icmp6(npc);
+			npc->npc_info |= NPC_ICMP;
+			gpr[NPC_GPR_ICMPTYPE_OFF_v6] = ic6->icmp6_type;
+			gpr[NPC_GPR_ICMPCODE_OFF_v6] = ic6->icmp6_code;
+		} else {
+			npc->npc_info |= NPC_L4PORTS;
+			memcpy(gpr + NPC_GPR_SPORT_OFF_v6, &npc->npc_l4.ports,
+			       NPC_GPR_SPORT_LEN_v6 + NPC_GPR_DPORT_LEN_v6);
+		}
+	} else
+		return false;
+
+	npc->npc_info |= NPC_GROUPER;
+	return true;
+}
+
 /*
  * npf_cache_all: general routine to cache all relevant IP (v4 or v6)
  * and TCP, UDP or ICMP headers. Only called once at top level
@@ -777,7 +915,12 @@ static inline bool npf_fetch_icmp(npf_cache_t *npc, struct rte_mbuf *nbuf,
  */
 bool npf_cache_all(npf_cache_t *npc, struct rte_mbuf *nbuf, uint16_t eth_proto)
 {
-	return npf_cache_all_at(npc, nbuf, npf_iphdr(nbuf), eth_proto, false);
+	void *n_ptr = npf_iphdr(nbuf);
+
+	if (likely(npf_cache_all_fast(npc, nbuf, n_ptr, eth_proto)))
+		return true;
+
+	return npf_cache_all_at(npc, nbuf, n_ptr, eth_proto, false);
 }
 
 bool npf_cache_all_at(npf_cache_t *npc, struct rte_mbuf *nbuf, void *n_ptr,
@@ -1542,10 +1685,11 @@ in_port_t npf_port_from_str(const char *p)
 }
 
 RTE_DEFINE_PER_LCORE(npf_cache_t, npf_cache);
+RTE_DEFINE_PER_LCORE(npf_cache_t *, npf_cache_sel);
 
 npf_cache_t *npf_cache(void)
 {
-	return &RTE_PER_LCORE(npf_cache);
+	return npf_cache_cur();
 }
 
 /*
@@ -1554,7 +1698,7 @@ npf_cache_t *npf_cache(void)
  */
 uint16_t npf_cache_mtu(void)
 {
-	npf_cache_t *npc = &RTE_PER_LCORE(npf_cache);
+	npf_cache_t *npc = npf_cache_cur();
 
 	return npc->gleaned_mtu;
 }
@@ -1562,7 +1706,7 @@ uint16_t npf_cache_mtu(void)
 /* Cached IPv6 fragmentation header ID */
 uint32_t npf_cache_frag_ident(void)
 {
-	npf_cache_t *npc = &RTE_PER_LCORE(npf_cache);
+	npf_cache_t *npc = npf_cache_cur();
 
 	return npc->fh_id;
 }
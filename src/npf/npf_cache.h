@@ -341,11 +341,33 @@ static inline void npf_cache_reset(npf_cache_t *npc)
 }
 
 RTE_DECLARE_PER_LCORE(npf_cache_t, npf_cache);
+RTE_DECLARE_PER_LCORE(npf_cache_t *, npf_cache_sel);
+
+/*
+ * The cache used for the packet being processed.  This is the per-lcore
+ * cache, unless the caller has selected one that belongs to the packet.
+ */
+static ALWAYS_INLINE npf_cache_t *npf_cache_cur(void)
+{
+	npf_cache_t *n = RTE_PER_LCORE(npf_cache_sel);
+
+	return likely(!n) ? &RTE_PER_LCORE(npf_cache) : n;
+}
+
+/*
+ * Select the cache for the packet about to be processed, or NULL to go
+ * back to the per-lcore cache.  Used by the pipeline in vector mode,
+ * where each packet of the vector keeps its own parse from node to node.
+ */
+static ALWAYS_INLINE void npf_cache_select(npf_cache_t *npc)
+{
+	RTE_PER_LCORE(npf_cache_sel) = npc;
+}
 
 static inline npf_cache_t *
 npf_get_cache(uint16_t *npf_flag, struct rte_mbuf *m, uint16_t eth_type)
 {
-	npf_cache_t *n = &RTE_PER_LCORE(npf_cache);
+	npf_cache_t *n = npf_cache_cur();
 
 	/* Cache cheater, only compute once when processing mbuf */
 	if (*npf_flag & NPF_FLAG_CACHE_EMPTY) {
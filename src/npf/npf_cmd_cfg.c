@@ -36,11 +36,14 @@
 #include "npf/npf_addrgrp.h"
 #include "npf/npf_cache.h"
 #include "npf/npf_cmd.h"
+#include "npf/npf_dtree.h"
+#include "npf/npf_jit.h"
 #include "npf/npf_rule_gen.h"
 #include "npf/npf_session.h"
 #include "npf/npf_state.h"
 #include "npf/npf_timeouts.h"
 #include "npf/rproc/npf_ext_session_limit.h"
+#include "npf/rproc/npf_rproc.h"
 #include "util.h"
 #include "vplane_log.h"
 
@@ -325,6 +328,80 @@ cmd_npf_global_icmp_strict_disable(FILE *f __unused,
 	return 0;
 }
 
+/*
+ * Rules are compiled when they are created, so mark every ruleset dirty
+ * in order that they are rebuilt at the next commit.
+ */
+static void
+npf_global_jit_set(bool enable)
+{
+	struct ruleset_select sel = {
+		.attach_type = NPF_ATTACH_TYPE_ALL,
+		.rulesets = ~0ul,
+	};
+
+	if (npf_jit_enabled() == enable)
+		return;
+
+	npf_jit_enable(enable);
+	npf_dirty_selected_rulesets(&sel);
+}
+
+static int
+cmd_npf_global_jit_enable(FILE *f, int argc __unused, char **argv __unused)
+{
+	if (!npf_jit_supported()) {
+		npf_cmd_err(f, "n-code JIT not supported");
+		return -1;
+	}
+	npf_global_jit_set(true);
+	return 0;
+}
+
+static int
+cmd_npf_global_jit_disable(FILE *f __unused, int argc __unused,
+			   char **argv __unused)
+{
+	npf_global_jit_set(false);
+	return 0;
+}
+
+/*
+ * fw global policer-grant <percent>
+ *
+ * Policers draw tokens per lcore in grants of this percentage of their
+ * rate.  0 selects the exact, locked, policer.  As for the JIT, policers
+ * are created with their rules, so rebuild every ruleset.
+ */
+static int
+cmd_npf_global_policer_grant(FILE *f, int argc, char **argv)
+{
+	struct ruleset_select sel = {
+		.attach_type = NPF_ATTACH_TYPE_ALL,
+		.rulesets = ~0ul,
+	};
+	unsigned long pct;
+	char *endp;
+
+	if (argc < 1) {
+		npf_cmd_err(f, "%s", npf_cmd_str_missing);
+		return -EINVAL;
+	}
+
+	pct = strtoul(argv[0], &endp, 10);
+	if (*endp != '\0' || pct > 100) {
+		npf_cmd_err(f, "invalid policer grant: %s", argv[0]);
+		return -EINVAL;
+	}
+
+	if (npf_policer_get_grant() == pct)
+		return 0;
+
+	npf_policer_set_grant(pct);
+	npf_dirty_selected_rulesets(&sel);
+	return 0;
+}
+
 static int
 cmd_npf_global_tcp_strict_enable(FILE *f __unused, int argc __unused,
 				 char **argv __unused)
@@ -644,6 +721,62 @@ cmd_detach_group(FILE *f, int argc, char **argv)
 	return 0;
 }
 
+/*
+ * fw classifier <attach-point> {dtree | grouper}
+ *
+ * Select the classifier used by the rulesets at an attach point.  Takes
+ * effect when the rulesets are next built, i.e. at the next commit.
+ */
+static int
+cmd_npf_fw_classifier(FILE *f, int argc, char **argv)
+{
+	enum npf_attach_type attach_type;
+	const char *attach_point;
+	enum npf_ruleset_type ruleset_type;
+	bool enable;
+	int ret;
+
+	if (argc < 2) {
+		npf_cmd_err(f, "%s", npf_cmd_str_missing);
+		return -1;
+	}
+
+	ret = npf_str2ap_type_and_point(argv[0], &attach_type, &attach_point);
+	if (ret < 0) {
+		npf_cmd_err(f, "invalid attach point: %s (%d)", argv[0], ret);
+		return -1;
+	}
+
+	if (!strcmp(argv[1], "dtree"))
+		enable = true;
+	else if (!strcmp(argv[1], "grouper"))
+		enable = false;
+	else {
+		npf_cmd_err(f, "invalid classifier: %s", argv[1]);
+		return -1;
+	}
+
+	ret = npf_dtree_attpt_set(attach_type, attach_point, enable);
+	if (ret < 0) {
+		npf_cmd_err(f, "failed setting classifier (%d)", ret);
+		return -1;
+	}
+
+	struct ruleset_select sel = {
+		.attach_type = attach_type,
+		.attach_point = attach_point,
+		.rulesets = 0
+	};
+
+	for (ruleset_type = 0; ruleset_type < NPF_RS_TYPE_COUNT;
+	     ruleset_type++)
+		sel.rulesets |= BIT(ruleset_type);
+
+	npf_dirty_selected_rulesets(&sel);
+
+	return 0;
+}
+
 static int
 cmd_commit(FILE *f, int argc, char **argv __unused)
 {
@@ -672,6 +805,10 @@ enum {
 	FW_GLOBAL_TCPSTRICT_ENABLE,
 	FW_GLOBAL_TCPSTRICT_DISABLE,
 	FW_GLOBAL_TIMEOUT,
+	FW_GLOBAL_JIT_ENABLE,
+	FW_GLOBAL_JIT_DISABLE,
+	FW_GLOBAL_POLICER_GRANT,
+	FW_CLASSIFIER,
 	ADD_RULE,
 	DELETE_RULE,
 	ATTACH_GROUP,
@@ -749,6 +886,22 @@ static const struct npf_command npf_cmd_cfg[] = {
 		.tokens = "fw global timeout",
 		.handler = cmd_npf_global_timeout,
 	},
+	[FW_GLOBAL_JIT_ENABLE] = {
+		.tokens = "fw global jit enable",
+		.handler = cmd_npf_global_jit_enable,
+	},
+	[FW_GLOBAL_JIT_DISABLE] = {
+		.tokens = "fw global jit disable",
+		.handler = cmd_npf_global_jit_disable,
+	},
+	[FW_GLOBAL_POLICER_GRANT] = {
+		.tokens = "fw global policer-grant",
+		.handler = cmd_npf_global_policer_grant,
+	},
+	[FW_CLASSIFIER] = {
+		.tokens = "fw classifier",
+		.handler = cmd_npf_fw_classifier,
+	},
 	[ADD_RULE] = {
 		.tokens = "add",
 		.handler = cmd_add_rule,
@@ -56,6 +56,7 @@
 #include "npf/npf.h"
 #include "npf/npf_addrgrp.h"
 #include "npf/npf_disassemble.h"
+#include "npf/npf_jit.h"
 #include "npf/npf_ncode.h"
 #include "npf/npf_rule_gen.h"
 #include "util.h"
@@ -529,3 +530,50 @@ npf_json_ncode(const void *nc, size_t len, json_writer_t *json)
 	}
 	jsonw_end_array(json);
 }
+
+static void
+npf_json_jit_insn(void *arg, int nc_off, size_t off, const uint8_t *code,
+		  size_t len, const char *text)
+{
+	json_writer_t *json = arg;
+	size_t used_buf_len = 0;
+	char buf[128];
+	size_t i;
+
+	if (nc_off < 0)
+		buf_app_printf(buf, &used_buf_len, sizeof(buf), "  : ");
+	else
+		buf_app_printf(buf, &used_buf_len, sizeof(buf), "%02d: ",
+			       nc_off);
+
+	buf_app_printf(buf, &used_buf_len, sizeof(buf), "%04zx: ", off);
+
+	/* Longest instruction generated is 10 bytes */
+	for (i = 0; i < 10; i++) {
+		if (i < len)
+			buf_app_printf(buf, &used_buf_len, sizeof(buf),
+				       "%02x ", code[i]);
+		else
+			buf_app_printf(buf, &used_buf_len, sizeof(buf),
+				       "   ");
+	}
+	buf_app_printf(buf, &used_buf_len, sizeof(buf), " %s", text);
+	jsonw_string(json, buf);
+}
+
+/*
+ * Show the native code the JIT generates for some n-code.  Each line is
+ * prefixed with the n-code instruction it was generated from.
+ */
+void
+npf_json_ncode_jit(const void *nc, size_t len, json_writer_t *json)
+{
+	if (!nc)
+		return;
+
+	jsonw_name(json, "ncode_jit");
+	jsonw_start_array(json);
+	if (npf_jit_listing(nc, len, npf_json_jit_insn, json) < 0)
+		jsonw_string(json, "ERROR: n-code not compiled");
+	jsonw_end_array(json);
+}
@@ -0,0 +1,694 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Decision tree (HiCuts) packet classifier for npf rule groups.
+ *
+ * Each rule is converted to a range in each of five dimensions taken from
+ * the grouper key: protocol, source address, destination address, source
+ * port and destination port (or icmp type/code).  For IPv6 only the most
+ * significant 32 bits of each address are used.  A rule range is a
+ * superset of what the rule matches (e.g. a non-contiguous mask becomes the
+ * covering prefix), so every candidate in a leaf is verified by the match
+ * callback, exactly as the grouper does.
+ *
+ * Wildcard-heavy rules replicate badly when cut, so (as in EffiCuts) the
+ * rules are first partitioned by which dimensions they cover more than half
+ * of, and a separate tree is built for each partition.  A tree is only cut
+ * along the dimensions its rules are small in.  A packet is looked up in
+ * each tree, and the match with the lowest rule index wins.
+ *
+ * Starting with the whole key space, a node is cut into 2^n equal sized
+ * regions along the dimension with the most distinct rule ranges.  The
+ * number of cuts is doubled while the rule replication stays within
+ * DT_SPFAC times the number of rules in the node.  Nodes with DT_BINTH
+ * rules or fewer become leaves.  Adjacent children with identical rule
+ * lists share a node.
+ *
+ * The trees are built at commit time and are read-only thereafter.  They
+ * are held in three flat arrays: nodes, child node indices, and leaf rule
+ * indices.
+ */
+
+#include <errno.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <urcu/list.h>
+
+#include "util.h"
+#include "vplane_log.h"
+#include "npf/npf_cache.h"
+#include "npf/npf_dtree.h"
+
+enum dt_dim {
+	DT_PROTO,
+	DT_SADDR,
+	DT_DADDR,
+	DT_SPORT,
+	DT_DPORT,
+	DT_NDIMS
+};
+
+#define DT_LEAF			0xFF
+#define DT_ALL_DIMS		((1u << DT_NDIMS) - 1)
+
+/* One tree per combination of large dimensions */
+#define DT_MAX_TREES		(1u << DT_NDIMS)
+
+/* Max rules in a leaf */
+#define DT_BINTH		8
+
+/* Max rule replication factor when a node is cut */
+#define DT_SPFAC		4
+
+#define DT_MAX_CUTS		256
+#define DT_MAX_DEPTH		24
+#define DT_MAX_NODES		(1u << 20)
+
+/* Max total leaf rule references, per rule.  Else use the grouper */
+#define DT_MAX_REPLICATION	32
+
+/* Location of a dimension in the grouper key.  len is in bytes, max 4 */
+struct dt_field {
+	uint8_t	df_off;
+	uint8_t	df_len;
+};
+
+static const struct dt_field dt_fields_v4[DT_NDIMS] = {
+	[DT_PROTO] = { NPC_GPR_PROTO_OFF_v4, NPC_GPR_PROTO_LEN_v4 },
+	[DT_SADDR] = { NPC_GPR_SADDR_OFF_v4, NPC_GPR_SADDR_LEN_v4 },
+	[DT_DADDR] = { NPC_GPR_DADDR_OFF_v4, NPC_GPR_DADDR_LEN_v4 },
+	[DT_SPORT] = { NPC_GPR_SPORT_OFF_v4, NPC_GPR_SPORT_LEN_v4 },
+	[DT_DPORT] = { NPC_GPR_DPORT_OFF_v4, NPC_GPR_DPORT_LEN_v4 },
+};
+
+static const struct dt_field dt_fields_v6[DT_NDIMS] = {
+	[DT_PROTO] = { NPC_GPR_PROTO_OFF_v6, NPC_GPR_PROTO_LEN_v6 },
+	[DT_SADDR] = { NPC_GPR_SADDR_OFF_v6, 4 },
+	[DT_DADDR] = { NPC_GPR_DADDR_OFF_v6, 4 },
+	[DT_SPORT] = { NPC_GPR_SPORT_OFF_v6, NPC_GPR_SPORT_LEN_v6 },
+	[DT_DPORT] = { NPC_GPR_DPORT_OFF_v6, NPC_GPR_DPORT_LEN_v6 },
+};
+
+struct npf_dtree_node {
+	uint8_t		dn_dim;		/* dimension cut, or DT_LEAF */
+	uint8_t		dn_shift;	/* log2 of child region size */
+	uint16_t	dn_pad;
+	uint32_t	dn_lo;		/* start of region in dn_dim */
+	uint32_t	dn_index;	/* first child, or first leaf rule */
+	uint32_t	dn_count;	/* leaf rule count */
+};
+
+/* Trees are ordered by their first rule */
+struct dt_tree {
+	uint32_t	t_root;
+	uint32_t	t_first;	/* lowest rule index in tree */
+};
+
+struct npf_dtree {
+	struct npf_dtree_node	*dt_nodes;
+	uint32_t		*dt_children;
+	uint32_t		*dt_leaf_rules;	/* indices into dt_rules */
+	void			**dt_rules;
+	const struct dt_field	*dt_fields;
+	struct dt_tree		dt_trees[DT_MAX_TREES];
+	uint32_t		dt_ntrees;
+
+	uint32_t		dt_nnodes;
+	uint32_t		dt_nchildren;
+	uint32_t		dt_nleaf_rules;
+
+	/* Allocated array sizes, during build */
+	uint32_t		dt_nodes_sz;
+	uint32_t		dt_children_sz;
+	uint32_t		dt_leaf_rules_sz;
+
+	/* Stats */
+	uint32_t		dt_nrules;
+	uint32_t		dt_nleaves;
+	uint32_t		dt_depth;
+	uint64_t		dt_build_us;
+};
+
+/* Build context */
+struct dt_build {
+	struct npf_dtree	*b_dt;
+	uint32_t		b_dims;		/* dimensions to cut */
+	uint32_t		(*b_lo)[DT_NDIMS];
+	uint32_t		(*b_hi)[DT_NDIMS];
+	uint64_t		*b_sort;	/* scratch */
+};
+
+/* Attach points using the decision tree */
+struct dt_attpt {
+	struct cds_list_head	da_list;
+	enum npf_attach_type	da_type;
+	char			da_point[];
+};
+
+static CDS_LIST_HEAD(dt_attpt_list);
+
+static inline uint32_t
+dt_key_field(const uint8_t *key, const struct dt_field *f)
+{
+	const uint8_t *p = key + f->df_off;
+
+	switch (f->df_len) {
+	case 1:
+		return p[0];
+	case 2:
+		return (p[0] << 8) | p[1];
+	default:
+		return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) |
+			p[3];
+	}
+}
+
+static inline uint64_t dt_field_size(const struct dt_field *f)
+{
+	return 1ull << (f->df_len * 8);
+}
+
+/*
+ * Convert a rules match/mask for one dimension into a range.  Only the
+ * leading fixed bits of the mask are used.
+ */
+static void
+dt_rule_range(const struct dt_field *f, const uint8_t *match,
+	      const uint8_t *mask, uint32_t *lo, uint32_t *hi)
+{
+	uint32_t fmax = dt_field_size(f) - 1;
+	uint32_t m = dt_key_field(match, f);
+	uint32_t k = dt_key_field(mask, f);
+	uint32_t pfx = 0;
+	uint b;
+
+	for (b = f->df_len * 8; b > 0; b--) {
+		uint32_t bit = 1u << (b - 1);
+
+		if (k & bit)
+			break;
+		pfx |= bit;
+	}
+
+	*lo = m & pfx;
+	*hi = (m & pfx) | (~pfx & fmax);
+}
+
+static int dt_node_alloc(struct npf_dtree *dt)
+{
+	if (dt->dt_nnodes >= DT_MAX_NODES)
+		return -ENOSPC;
+
+	if (dt->dt_nnodes == dt->dt_nodes_sz) {
+		uint32_t sz = dt->dt_nodes_sz ? dt->dt_nodes_sz * 2 : 64;
+		struct npf_dtree_node *nodes;
+
+		nodes = realloc(dt->dt_nodes, sz * sizeof(*nodes));
+		if (!nodes)
+			return -ENOMEM;
+		dt->dt_nodes = nodes;
+		dt->dt_nodes_sz = sz;
+	}
+	memset(&dt->dt_nodes[dt->dt_nnodes], 0, sizeof(*dt->dt_nodes));
+
+	return dt->dt_nnodes++;
+}
+
+static int dt_children_alloc(struct npf_dtree *dt, uint32_t n)
+{
+	uint32_t base = dt->dt_nchildren;
+
+	if (base + n > dt->dt_children_sz) {
+		uint32_t sz = dt->dt_children_sz ? dt->dt_children_sz : 256;
+		uint32_t *children;
+
+		while (sz < base + n)
+			sz *= 2;
+
+		children = realloc(dt->dt_children, sz * sizeof(*children));
+		if (!children)
+			return -ENOMEM;
+		dt->dt_children = children;
+		dt->dt_children_sz = sz;
+	}
+	dt->dt_nchildren += n;
+
+	return base;
+}
+
+static int
+dt_make_leaf(struct dt_build *b, uint32_t node, const uint32_t *idx, uint n)
+{
+	struct npf_dtree *dt = b->b_dt;
+	uint32_t base = dt->dt_nleaf_rules;
+	uint i;
+
+	if (base + n > DT_MAX_REPLICATION * dt->dt_nrules + DT_BINTH)
+		return -ENOSPC;
+
+	if (base + n > dt->dt_leaf_rules_sz) {
+		uint32_t sz = dt->dt_leaf_rules_sz ?
+			dt->dt_leaf_rules_sz : 256;
+		uint32_t *rules;
+
+		while (sz < base + n)
+			sz *= 2;
+
+		rules = realloc(dt->dt_leaf_rules, sz * sizeof(*rules));
+		if (!rules)
+			return -ENOMEM;
+		dt->dt_leaf_rules = rules;
+		dt->dt_leaf_rules_sz = sz;
+	}
+
+	for (i = 0; i < n; i++)
+		dt->dt_leaf_rules[base + i] = idx[i];
+
+	dt->dt_nleaf_rules += n;
+	dt->dt_nodes[node].dn_dim = DT_LEAF;
+	dt->dt_nodes[node].dn_index = base;
+	dt->dt_nodes[node].dn_count = n;
+	dt->dt_nleaves++;
+
+	return 0;
+}
+
+static int dt_u64_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Number of distinct rule ranges in dimension d, clipped to the region
+ */
+static uint
+dt_distinct(struct dt_build *b, uint d, uint32_t lo, uint64_t size,
+	    const uint32_t *idx, uint n)
+{
+	uint32_t hi = lo + size - 1;
+	uint i, count;
+
+	for (i = 0; i < n; i++) {
+		uint32_t rlo = RTE_MAX(b->b_lo[idx[i]][d], lo);
+		uint32_t rhi = RTE_MIN(b->b_hi[idx[i]][d], hi);
+
+		b->b_sort[i] = ((uint64_t)rlo << 32) | rhi;
+	}
+	qsort(b->b_sort, n, sizeof(uint64_t), dt_u64_cmp);
+
+	for (i = 1, count = 1; i < n; i++)
+		if (b->b_sort[i] != b->b_sort[i - 1])
+			count++;
+
+	return count;
+}
+
+/*
+ * Sum of the number of children each rule falls into, if the region is cut
+ * into ncuts along dimension d.
+ */
+static uint64_t
+dt_replication(struct dt_build *b, uint d, uint32_t lo, uint64_t size,
+	       const uint32_t *idx, uint n, uint ncuts)
+{
+	uint shift = __builtin_ctzll(size / ncuts);
+	uint32_t hi = lo + size - 1;
+	uint64_t sum = 0;
+	uint i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t rlo = RTE_MAX(b->b_lo[idx[i]][d], lo);
+		uint32_t rhi = RTE_MIN(b->b_hi[idx[i]][d], hi);
+
+		sum += ((rhi - lo) >> shift) - ((rlo - lo) >> shift) + 1;
+	}
+	return sum;
+}
+
+static int
+dt_build_node(struct dt_build *b, uint32_t node, const uint32_t *lo,
+	      const uint64_t *size, const uint32_t *idx, uint n, uint depth)
+{
+	struct npf_dtree *dt = b->b_dt;
+	uint32_t *prev = NULL, *cur = NULL;
+	uint d, best_d = DT_NDIMS, best = 1;
+	uint prev_n = 0, ncuts, c, i;
+	uint32_t clo[DT_NDIMS];
+	uint64_t csize[DT_NDIMS];
+	uint64_t cs;
+	int base, child = -1, rc = 0;
+	uint shift;
+
+	if (depth > dt->dt_depth)
+		dt->dt_depth = depth;
+
+	if (n <= DT_BINTH || depth >= DT_MAX_DEPTH)
+		return dt_make_leaf(b, node, idx, n);
+
+	/* Cut the dimension with the most distinct rule ranges */
+	for (d = 0; d < DT_NDIMS; d++) {
+		uint distinct;
+
+		if (size[d] < 2 || !(b->b_dims & (1u << d)))
+			continue;
+
+		distinct = dt_distinct(b, d, lo[d], size[d], idx, n);
+		if (distinct > best) {
+			best = distinct;
+			best_d = d;
+		}
+	}
+
+	/* Rules cannot be separated any further */
+	if (best_d == DT_NDIMS)
+		return dt_make_leaf(b, node, idx, n);
+
+	d = best_d;
+
+	for (ncuts = 2; ncuts * 2 <= DT_MAX_CUTS && ncuts * 2 <= size[d];
+	     ncuts *= 2) {
+		if (dt_replication(b, d, lo[d], size[d], idx, n, ncuts * 2) +
+		    ncuts * 2 > (uint64_t)DT_SPFAC * n)
+			break;
+	}
+
+	cs = size[d] / ncuts;
+	shift = __builtin_ctzll(cs);
+
+	/* No point cutting if every child would hold every rule */
+	if (dt_replication(b, d, lo[d], size[d], idx, n, ncuts) ==
+	    (uint64_t)ncuts * n)
+		return dt_make_leaf(b, node, idx, n);
+
+	base = dt_children_alloc(dt, ncuts);
+	if (base < 0)
+		return base;
+
+	dt->dt_nodes[node].dn_dim = d;
+	dt->dt_nodes[node].dn_shift = shift;
+	dt->dt_nodes[node].dn_lo = lo[d];
+	dt->dt_nodes[node].dn_index = base;
+
+	memcpy(clo, lo, sizeof(clo));
+	memcpy(csize, size, sizeof(csize));
+	csize[d] = cs;
+
+	for (c = 0; c < ncuts; c++) {
+		uint32_t chi;
+		uint cn = 0;
+
+		clo[d] = lo[d] + c * cs;
+		chi = clo[d] + cs - 1;
+
+		cur = malloc(n * sizeof(*cur));
+		if (!cur) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+			if (b->b_lo[idx[i]][d] <= chi &&
+			    b->b_hi[idx[i]][d] >= clo[d])
+				cur[cn++] = idx[i];
+
+		/* Share the previous child if it has the same rules */
+		if (prev && cn == prev_n &&
+		    memcmp(cur, prev, cn * sizeof(*cur)) == 0) {
+			dt->dt_children[base + c] = child;
+			free(cur);
+			cur = NULL;
+			continue;
+		}
+
+		child = dt_node_alloc(dt);
+		if (child < 0) {
+			rc = child;
+			break;
+		}
+
+		rc = dt_build_node(b, child, clo, csize, cur, cn, depth + 1);
+		if (rc < 0)
+			break;
+
+		dt->dt_children[base + c] = child;
+
+		free(prev);
+		prev = cur;
+		prev_n = cn;
+		cur = NULL;
+	}
+
+	free(cur);
+	free(prev);
+	return rc;
+}
+
+void npf_dtree_destroy(struct npf_dtree *dt)
+{
+	if (!dt)
+		return;
+
+	free(dt->dt_nodes);
+	free(dt->dt_children);
+	free(dt->dt_leaf_rules);
+	free(dt->dt_rules);
+	free(dt);
+}
+
+/*
+ * Dimensions in which a rule covers more than half of the field
+ */
+static uint32_t dt_rule_large_dims(struct dt_build *b, uint32_t rule)
+{
+	const struct dt_field *fields = b->b_dt->dt_fields;
+	uint32_t dims = 0;
+	uint d;
+
+	for (d = 0; d < DT_NDIMS; d++) {
+		uint64_t range = (uint64_t)b->b_hi[rule][d] -
+			b->b_lo[rule][d] + 1;
+
+		if (range > dt_field_size(&fields[d]) / 2)
+			dims |= 1u << d;
+	}
+	return dims;
+}
+
+struct npf_dtree *
+npf_dtree_create(sa_family_t af, uint nrules, void *const rules[],
+		 const uint8_t *const match[], const uint8_t *const mask[])
+{
+	struct dt_build b = { 0 };
+	uint32_t lo[DT_NDIMS] = { 0 };
+	uint64_t size[DT_NDIMS];
+	uint8_t *large = NULL;
+	uint32_t *idx = NULL;
+	struct npf_dtree *dt;
+	uint32_t cat;
+	uint64_t start;
+	uint i, d, n;
+	int rc = -ENOMEM;
+
+	start = rte_get_timer_cycles();
+
+	dt = zmalloc_aligned(sizeof(*dt));
+	if (!dt)
+		return NULL;
+
+	dt->dt_fields = (af == AF_INET6) ? dt_fields_v6 : dt_fields_v4;
+	dt->dt_nrules = nrules;
+	b.b_dt = dt;
+
+	dt->dt_rules = malloc(nrules * sizeof(*dt->dt_rules));
+	b.b_lo = malloc(nrules * sizeof(*b.b_lo));
+	b.b_hi = malloc(nrules * sizeof(*b.b_hi));
+	b.b_sort = malloc(nrules * sizeof(*b.b_sort));
+	large = malloc(nrules);
+	idx = malloc(nrules * sizeof(*idx));
+	if (!dt->dt_rules || !b.b_lo || !b.b_hi || !b.b_sort || !large ||
+	    !idx)
+		goto end;
+
+	for (i = 0; i < nrules; i++) {
+		dt->dt_rules[i] = rules[i];
+		for (d = 0; d < DT_NDIMS; d++)
+			dt_rule_range(&dt->dt_fields[d], match[i], mask[i],
+				      &b.b_lo[i][d], &b.b_hi[i][d]);
+		large[i] = dt_rule_large_dims(&b, i);
+	}
+
+	for (d = 0; d < DT_NDIMS; d++)
+		size[d] = dt_field_size(&dt->dt_fields[d]);
+
+	/*
+	 * Build a tree for each partition, in order of the partitions first
+	 * rule.
+	 */
+	rc = 0;
+	for (i = 0; i < nrules && rc >= 0; i++) {
+		int root;
+
+		cat = large[i];
+		if (cat > DT_ALL_DIMS)
+			continue;	/* partition already built */
+
+		for (n = 0, d = i; d < nrules; d++) {
+			if (large[d] == cat) {
+				idx[n++] = d;
+				large[d] = 0xFF;
+			}
+		}
+
+		root = dt_node_alloc(dt);
+		if (root < 0) {
+			rc = root;
+			break;
+		}
+
+		dt->dt_trees[dt->dt_ntrees].t_root = root;
+		dt->dt_trees[dt->dt_ntrees].t_first = i;
+		dt->dt_ntrees++;
+
+		b.b_dims = ~cat & DT_ALL_DIMS;
+		rc = dt_build_node(&b, root, lo, size, idx, n, 0);
+	}
+
+end:
+	free(b.b_lo);
+	free(b.b_hi);
+	free(b.b_sort);
+	free(large);
+	free(idx);
+
+	if (rc < 0) {
+		RTE_LOG(ERR, FIREWALL,
+			"Failed to build decision tree for %u rules (%d)\n",
+			nrules, rc);
+		npf_dtree_destroy(dt);
+		return NULL;
+	}
+
+	dt->dt_build_us = (rte_get_timer_cycles() - start) * USEC_PER_SEC /
+		rte_get_timer_hz();
+
+	return dt;
+}
+
+/*
+ * Look up the packet in each tree.  Candidates in a leaf are in rule order,
+ * so within a tree we stop at the first match, or once we reach a rule
+ * after the best match so far.  Trees are ordered by their first rule, so
+ * we stop once a tree cannot contain an earlier rule.
+ */
+void *
+npf_dtree_eval(const struct npf_dtree *dt, const uint8_t *key,
+	       const void *data, npf_dtree_match_cb cb)
+{
+	const struct npf_dtree_node *dn;
+	uint32_t best = UINT32_MAX;
+	const uint32_t *leaf;
+	uint32_t v, i, t;
+
+	for (t = 0; t < dt->dt_ntrees; t++) {
+		if (dt->dt_trees[t].t_first >= best)
+			break;
+
+		dn = &dt->dt_nodes[dt->dt_trees[t].t_root];
+
+		while (dn->dn_dim != DT_LEAF) {
+			v = dt_key_field(key, &dt->dt_fields[dn->dn_dim]);
+			dn = &dt->dt_nodes[dt->dt_children[dn->dn_index +
+							   ((v - dn->dn_lo) >>
+							    dn->dn_shift)]];
+		}
+
+		leaf = &dt->dt_leaf_rules[dn->dn_index];
+		for (i = 0; i < dn->dn_count && leaf[i] < best; i++) {
+			if (cb(data, dt->dt_rules[leaf[i]])) {
+				best = leaf[i];
+				break;
+			}
+		}
+	}
+
+	return best == UINT32_MAX ? NULL : dt->dt_rules[best];
+}
+
+void npf_dtree_jsonw(json_writer_t *json, const char *name,
+		     const struct npf_dtree *dt)
+{
+	size_t bytes = sizeof(*dt) +
+		dt->dt_nrules * sizeof(*dt->dt_rules) +
+		dt->dt_nnodes * sizeof(*dt->dt_nodes) +
+		dt->dt_nchildren * sizeof(*dt->dt_children) +
+		dt->dt_nleaf_rules * sizeof(*dt->dt_leaf_rules);
+
+	jsonw_name(json, name);
+	jsonw_start_object(json);
+	jsonw_string_field(json, "type", "dtree");
+	jsonw_uint_field(json, "rules", dt->dt_nrules);
+	jsonw_uint_field(json, "trees", dt->dt_ntrees);
+	jsonw_uint_field(json, "nodes", dt->dt_nnodes);
+	jsonw_uint_field(json, "leaves", dt->dt_nleaves);
+	jsonw_uint_field(json, "leaf_rules", dt->dt_nleaf_rules);
+	jsonw_uint_field(json, "depth", dt->dt_depth);
+	jsonw_uint_field(json, "memory", bytes);
+	jsonw_uint_field(json, "build_us", dt->dt_build_us);
+	jsonw_end_object(json);
+}
+
+static struct dt_attpt *
+dt_attpt_find(enum npf_attach_type attach_type, const char *attach_point)
+{
+	struct dt_attpt *da;
+
+	cds_list_for_each_entry(da, &dt_attpt_list, da_list) {
+		if (da->da_type == attach_type &&
+		    strcmp(da->da_point, attach_point) == 0)
+			return da;
+	}
+	return NULL;
+}
+
+int npf_dtree_attpt_set(enum npf_attach_type attach_type,
+			const char *attach_point, bool enable)
+{
+	struct dt_attpt *da = dt_attpt_find(attach_type, attach_point);
+
+	if (!enable) {
+		if (da) {
+			cds_list_del(&da->da_list);
+			free(da);
+		}
+		return 0;
+	}
+
+	if (da)
+		return 0;
+
+	da = malloc(sizeof(*da) + strlen(attach_point) + 1);
+	if (!da)
+		return -ENOMEM;
+
+	da->da_type = attach_type;
+	strcpy(da->da_point, attach_point);
+	cds_list_add_tail(&da->da_list, &dt_attpt_list);
+
+	return 0;
+}
+
+bool npf_dtree_attpt_enabled(enum npf_attach_type attach_type,
+			     const char *attach_point)
+{
+	return dt_attpt_find(attach_type, attach_point) != NULL;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef NPF_DTREE_H
+#define NPF_DTREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "json_writer.h"
+#include "npf/config/npf_attach_point.h"
+
+/*
+ * Decision tree classifier (HiCuts) for a rule group.
+ *
+ * The tree is built at commit time over the 5-tuple fields of the grouper
+ * key that npf_cache extracts from each packet (protocol, source and
+ * destination address, and source and destination port or icmp
+ * type/code).  Each leaf holds a short list of candidate rules, in rule
+ * order, which are verified with the match callback.
+ */
+struct npf_dtree;
+
+/* Verify a candidate rule.  Same form as the grouper callback */
+typedef bool (*npf_dtree_match_cb)(const void *data, const void *rule);
+
+/*
+ * Create a tree for nrules rules.  match and mask are the grouper key
+ * match/mask arrays for each rule (mask bit set means "dont care"), and
+ * rules[i] is returned when rule i matches.  Returns NULL if the tree could
+ * not be built, in which case the grouper should be used.
+ */
+struct npf_dtree *npf_dtree_create(sa_family_t af, uint nrules,
+				   void *const rules[],
+				   const uint8_t *const match[],
+				   const uint8_t *const mask[]);
+void npf_dtree_destroy(struct npf_dtree *dt);
+
+/*
+ * Find the first rule matched by a packet.  key is the packets grouper key.
+ */
+void *npf_dtree_eval(const struct npf_dtree *dt, const uint8_t *key,
+		     const void *data, npf_dtree_match_cb cb);
+
+void npf_dtree_jsonw(json_writer_t *json, const char *name,
+		     const struct npf_dtree *dt);
+
+/*
+ * Per attach point selection of the decision tree classifier.  Config
+ * thread only.
+ */
+int npf_dtree_attpt_set(enum npf_attach_type attach_type,
+			const char *attach_point, bool enable);
+bool npf_dtree_attpt_enabled(enum npf_attach_type attach_type,
+			     const char *attach_point);
+
+#endif /* NPF_DTREE_H */
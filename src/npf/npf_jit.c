@@ -0,0 +1,981 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * N-code JIT for x86-64.
+ *
+ * The generated function keeps its arguments in callee-saved registers for
+ * the duration of the call:
+ *
+ *	rbx = npc, r12 = rl, r13 = ifp, r14d = dir, r15 = se, rbp = nbuf
+ *
+ * and keeps the interpreters 'cmpval' in eax.  Every n-code instruction
+ * either calls a match helper, leaving its result in eax, or tests eax and
+ * jumps, so eax always holds the result of the last match.
+ *
+ * Operands that are passed by reference (IPv6 addresses and MAC addresses)
+ * are copied to a constant pool placed after the code.
+ *
+ * Functions are allocated from a shared arena of chunks, each a memfd
+ * mapped read-execute for the forwarding threads to call.  The compiler
+ * writes a function through a read-write mapping of just the pages it is
+ * in, which is unmapped as soon as the function has been written, so no
+ * writable alias of the code is left behind.  Thousands of rules share a
+ * few mappings rather than each taking a page and a TLB entry.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <rte_common.h>
+#include <rte_log.h>
+#include <rte_memory.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "npf/npf_addr.h"
+#include "npf/npf_disassemble.h"
+#include "npf/npf_instr.h"
+#include "npf/npf_jit.h"
+#include "npf/npf_ncode.h"
+#include "vplane_log.h"
+
+struct jit_chunk;
+
+struct npf_jit {
+	npf_jit_fn_t		nj_fn;
+	size_t			nj_code_size;
+	struct jit_chunk	*nj_chunk;
+	size_t			nj_off;		/* offset in the chunk */
+	size_t			nj_len;		/* length allocated */
+};
+
+static bool npf_jit_on;
+
+#ifdef RTE_ARCH_X86_64
+
+/* Fixed instructions used by the translator */
+enum jit_op {
+	JIT_PUSH_RBX,
+	JIT_PUSH_RBP,
+	JIT_PUSH_R12,
+	JIT_PUSH_R13,
+	JIT_PUSH_R14,
+	JIT_PUSH_R15,
+	JIT_SUB_RSP_8,
+	JIT_ADD_RSP_8,
+	JIT_POP_R15,
+	JIT_POP_R14,
+	JIT_POP_R13,
+	JIT_POP_R12,
+	JIT_POP_RBP,
+	JIT_POP_RBX,
+	JIT_RET,
+	JIT_MOV_RBX_RDI,
+	JIT_MOV_R12_RSI,
+	JIT_MOV_R13_RDX,
+	JIT_MOV_R14D_ECX,
+	JIT_MOV_R15_R8,
+	JIT_MOV_RBP_R9,
+	JIT_MOV_RDI_RBX,
+	JIT_MOV_RDI_RBP,
+	JIT_MOV_RSI_RBP,
+	JIT_MOV_RDX_R12,
+	JIT_MOV_RCX_R13,
+	JIT_MOV_R8D_R14D,
+	JIT_MOV_R9_R15,
+	JIT_XOR_EAX_EAX,
+	JIT_TEST_EAX_EAX,
+	JIT_CALL_RAX,
+};
+
+static const struct jit_insn {
+	uint8_t		len;
+	uint8_t		code[4];
+	const char	*text;
+} jit_insns[] = {
+	[JIT_PUSH_RBX]     = { 1, { 0x53 }, "push rbx" },
+	[JIT_PUSH_RBP]     = { 1, { 0x55 }, "push rbp" },
+	[JIT_PUSH_R12]     = { 2, { 0x41, 0x54 }, "push r12" },
+	[JIT_PUSH_R13]     = { 2, { 0x41, 0x55 }, "push r13" },
+	[JIT_PUSH_R14]     = { 2, { 0x41, 0x56 }, "push r14" },
+	[JIT_PUSH_R15]     = { 2, { 0x41, 0x57 }, "push r15" },
+	[JIT_SUB_RSP_8]    = { 4, { 0x48, 0x83, 0xec, 0x08 }, "sub rsp, 8" },
+	[JIT_ADD_RSP_8]    = { 4, { 0x48, 0x83, 0xc4, 0x08 }, "add rsp, 8" },
+	[JIT_POP_R15]      = { 2, { 0x41, 0x5f }, "pop r15" },
+	[JIT_POP_R14]      = { 2, { 0x41, 0x5e }, "pop r14" },
+	[JIT_POP_R13]      = { 2, { 0x41, 0x5d }, "pop r13" },
+	[JIT_POP_R12]      = { 2, { 0x41, 0x5c }, "pop r12" },
+	[JIT_POP_RBP]      = { 1, { 0x5d }, "pop rbp" },
+	[JIT_POP_RBX]      = { 1, { 0x5b }, "pop rbx" },
+	[JIT_RET]          = { 1, { 0xc3 }, "ret" },
+	[JIT_MOV_RBX_RDI]  = { 3, { 0x48, 0x89, 0xfb }, "mov rbx, rdi" },
+	[JIT_MOV_R12_RSI]  = { 3, { 0x49, 0x89, 0xf4 }, "mov r12, rsi" },
+	[JIT_MOV_R13_RDX]  = { 3, { 0x49, 0x89, 0xd5 }, "mov r13, rdx" },
+	[JIT_MOV_R14D_ECX] = { 3, { 0x41, 0x89, 0xce }, "mov r14d, ecx" },
+	[JIT_MOV_R15_R8]   = { 3, { 0x4d, 0x89, 0xc7 }, "mov r15, r8" },
+	[JIT_MOV_RBP_R9]   = { 3, { 0x4c, 0x89, 0xcd }, "mov rbp, r9" },
+	[JIT_MOV_RDI_RBX]  = { 3, { 0x48, 0x89, 0xdf }, "mov rdi, rbx" },
+	[JIT_MOV_RDI_RBP]  = { 3, { 0x48, 0x89, 0xef }, "mov rdi, rbp" },
+	[JIT_MOV_RSI_RBP]  = { 3, { 0x48, 0x89, 0xee }, "mov rsi, rbp" },
+	[JIT_MOV_RDX_R12]  = { 3, { 0x4c, 0x89, 0xe2 }, "mov rdx, r12" },
+	[JIT_MOV_RCX_R13]  = { 3, { 0x4c, 0x89, 0xe9 }, "mov rcx, r13" },
+	[JIT_MOV_R8D_R14D] = { 3, { 0x45, 0x89, 0xf0 }, "mov r8d, r14d" },
+	[JIT_MOV_R9_R15]   = { 3, { 0x4d, 0x89, 0xf9 }, "mov r9, r15" },
+	[JIT_XOR_EAX_EAX]  = { 2, { 0x31, 0xc0 }, "xor eax, eax" },
+	[JIT_TEST_EAX_EAX] = { 2, { 0x85, 0xc0 }, "test eax, eax" },
+	[JIT_CALL_RAX]     = { 2, { 0xff, 0xd0 }, "call rax" },
+};
+
+/* Registers that may be loaded with an immediate */
+enum jit_reg {
+	JIT_EAX = 0,
+	JIT_ECX = 1,
+	JIT_EDX = 2,
+	JIT_ESI = 6,
+};
+
+static const char *const jit_reg32[] = {
+	[JIT_EAX] = "eax", [JIT_ECX] = "ecx", [JIT_EDX] = "edx",
+	[JIT_ESI] = "esi",
+};
+
+static const char *const jit_reg64[] = {
+	[JIT_EAX] = "rax", [JIT_ECX] = "rcx", [JIT_EDX] = "rdx",
+	[JIT_ESI] = "rsi",
+};
+
+/* A rel32 or imm64 that is patched once its value is known */
+struct jit_fixup {
+	uint32_t	f_pos;		/* offset of the field in the code */
+	uint32_t	f_val;		/* n-code index, or pool offset */
+};
+
+/* Instruction recorded for a listing */
+struct jit_line {
+	int		l_nc_off;
+	uint32_t	l_off;
+	uint32_t	l_len;
+	char		l_text[48];
+};
+
+struct jit_ctx {
+	uint8_t			*c_code;
+	size_t			c_len;
+	size_t			c_cap;
+	uint8_t			*c_pool;
+	size_t			c_pool_len;
+	size_t			c_pool_cap;
+	uint32_t		*c_nc_map;	/* n-code index -> offset */
+	struct jit_fixup	*c_jmp;
+	uint			c_njmp;
+	struct jit_fixup	*c_ptr;
+	uint			c_nptr;
+	int			c_nc_off;	/* current n-code instruction */
+	bool			c_nomem;
+	bool			c_listing;
+	struct jit_line		*c_lines;
+	uint			c_nlines;
+};
+
+static bool
+jit_grow(uint8_t **buf, size_t *cap, size_t need)
+{
+	size_t new_cap;
+	uint8_t *new;
+
+	if (need <= *cap)
+		return true;
+
+	new_cap = *cap ? *cap : 256;
+	while (new_cap < need)
+		new_cap *= 2;
+
+	new = realloc(*buf, new_cap);
+	if (!new)
+		return false;
+
+	*buf = new;
+	*cap = new_cap;
+	return true;
+}
+
+static void
+jit_put(struct jit_ctx *ctx, const void *p, size_t len)
+{
+	if (ctx->c_nomem ||
+	    !jit_grow(&ctx->c_code, &ctx->c_cap, ctx->c_len + len)) {
+		ctx->c_nomem = true;
+		return;
+	}
+	memcpy(ctx->c_code + ctx->c_len, p, len);
+	ctx->c_len += len;
+}
+
+static void
+jit_put8(struct jit_ctx *ctx, uint8_t v)
+{
+	jit_put(ctx, &v, sizeof(v));
+}
+
+/* x86 is little-endian, so immediates are copied as-is */
+static void
+jit_put32(struct jit_ctx *ctx, uint32_t v)
+{
+	jit_put(ctx, &v, sizeof(v));
+}
+
+static void
+jit_put64(struct jit_ctx *ctx, uint64_t v)
+{
+	jit_put(ctx, &v, sizeof(v));
+}
+
+/*
+ * Record the instruction from 'start' to the current offset.  Only done
+ * when a listing is wanted, and reported once branches are resolved.
+ */
+static void __attribute__((format(printf, 3, 4)))
+jit_listing(struct jit_ctx *ctx, size_t start, const char *fmt, ...)
+{
+	struct jit_line *line;
+	va_list ap;
+
+	if (!ctx->c_listing || ctx->c_nomem)
+		return;
+
+	line = realloc(ctx->c_lines, (ctx->c_nlines + 1) * sizeof(*line));
+	if (!line) {
+		ctx->c_nomem = true;
+		return;
+	}
+	ctx->c_lines = line;
+	line += ctx->c_nlines++;
+
+	line->l_nc_off = ctx->c_nc_off;
+	line->l_off = start;
+	line->l_len = ctx->c_len - start;
+
+	va_start(ap, fmt);
+	vsnprintf(line->l_text, sizeof(line->l_text), fmt, ap);
+	va_end(ap);
+}
+
+static void
+jit_op(struct jit_ctx *ctx, enum jit_op op)
+{
+	const struct jit_insn *insn = &jit_insns[op];
+	size_t start = ctx->c_len;
+
+	jit_put(ctx, insn->code, insn->len);
+	jit_listing(ctx, start, "%s", insn->text);
+}
+
+static void
+jit_mov_imm32(struct jit_ctx *ctx, enum jit_reg reg, uint32_t imm)
+{
+	size_t start = ctx->c_len;
+
+	jit_put8(ctx, 0xb8 + reg);
+	jit_put32(ctx, imm);
+	jit_listing(ctx, start, "mov %s, 0x%x", jit_reg32[reg], imm);
+}
+
+static void
+jit_mov_imm64(struct jit_ctx *ctx, enum jit_reg reg, uint64_t imm)
+{
+	size_t start = ctx->c_len;
+
+	jit_put8(ctx, 0x48);
+	jit_put8(ctx, 0xb8 + reg);
+	jit_put64(ctx, imm);
+	jit_listing(ctx, start, "movabs %s, 0x%" PRIx64, jit_reg64[reg],
+		    imm);
+}
+
+static bool
+jit_add_fixup(struct jit_ctx *ctx, struct jit_fixup **fix, uint *nfix,
+	      uint32_t pos, uint32_t val)
+{
+	struct jit_fixup *new;
+
+	new = realloc(*fix, (*nfix + 1) * sizeof(*new));
+	if (!new) {
+		ctx->c_nomem = true;
+		return false;
+	}
+	new[*nfix].f_pos = pos;
+	new[*nfix].f_val = val;
+	*fix = new;
+	(*nfix)++;
+	return true;
+}
+
+/*
+ * Load a pointer to a copy of an operand.  The immediate holds the pool
+ * offset until the code is installed.
+ */
+static void
+jit_mov_pool(struct jit_ctx *ctx, enum jit_reg reg, const void *data,
+	     size_t len)
+{
+	size_t off = RTE_ALIGN(ctx->c_pool_len, sizeof(uint64_t));
+	size_t start = ctx->c_len;
+
+	if (ctx->c_nomem ||
+	    !jit_grow(&ctx->c_pool, &ctx->c_pool_cap, off + len)) {
+		ctx->c_nomem = true;
+		return;
+	}
+	memset(ctx->c_pool + ctx->c_pool_len, 0, off - ctx->c_pool_len);
+	memcpy(ctx->c_pool + off, data, len);
+	ctx->c_pool_len = off + len;
+
+	jit_put8(ctx, 0x48);
+	jit_put8(ctx, 0xb8 + reg);
+	if (!jit_add_fixup(ctx, &ctx->c_ptr, &ctx->c_nptr, ctx->c_len, off))
+		return;
+	jit_put64(ctx, off);
+	jit_listing(ctx, start, "movabs %s, pool+0x%zx", jit_reg64[reg], off);
+}
+
+#define jit_call(ctx, fn) jit_call_fn(ctx, (uintptr_t)(fn), #fn)
+
+static void
+jit_call_fn(struct jit_ctx *ctx, uintptr_t fn, const char *name)
+{
+	size_t start = ctx->c_len;
+
+	jit_put8(ctx, 0x48);
+	jit_put8(ctx, 0xb8 + JIT_EAX);
+	jit_put64(ctx, fn);
+	jit_listing(ctx, start, "movabs rax, %s", name);
+	jit_op(ctx, JIT_CALL_RAX);
+}
+
+/* BEQ/BNE to n-code index 'target' */
+static void
+jit_branch(struct jit_ctx *ctx, bool eq, uint32_t target)
+{
+	size_t start;
+
+	jit_op(ctx, JIT_TEST_EAX_EAX);
+
+	start = ctx->c_len;
+	jit_put8(ctx, 0x0f);
+	jit_put8(ctx, eq ? 0x84 : 0x85);
+	if (!jit_add_fixup(ctx, &ctx->c_jmp, &ctx->c_njmp, ctx->c_len,
+			   target))
+		return;
+	jit_put32(ctx, 0);
+	jit_listing(ctx, start, "%s nc:%02u", eq ? "je" : "jne", target);
+}
+
+static void
+jit_prologue(struct jit_ctx *ctx)
+{
+	/* Six pushes and the return address; realign rsp for calls */
+	jit_op(ctx, JIT_PUSH_RBX);
+	jit_op(ctx, JIT_PUSH_RBP);
+	jit_op(ctx, JIT_PUSH_R12);
+	jit_op(ctx, JIT_PUSH_R13);
+	jit_op(ctx, JIT_PUSH_R14);
+	jit_op(ctx, JIT_PUSH_R15);
+	jit_op(ctx, JIT_SUB_RSP_8);
+
+	jit_op(ctx, JIT_MOV_RBX_RDI);
+	jit_op(ctx, JIT_MOV_R12_RSI);
+	jit_op(ctx, JIT_MOV_R13_RDX);
+	jit_op(ctx, JIT_MOV_R14D_ECX);
+	jit_op(ctx, JIT_MOV_R15_R8);
+	jit_op(ctx, JIT_MOV_RBP_R9);
+
+	/* cmpval = 0 */
+	jit_op(ctx, JIT_XOR_EAX_EAX);
+}
+
+static void
+jit_return(struct jit_ctx *ctx, uint32_t val)
+{
+	jit_mov_imm32(ctx, JIT_EAX, val);
+	jit_op(ctx, JIT_ADD_RSP_8);
+	jit_op(ctx, JIT_POP_R15);
+	jit_op(ctx, JIT_POP_R14);
+	jit_op(ctx, JIT_POP_R13);
+	jit_op(ctx, JIT_POP_R12);
+	jit_op(ctx, JIT_POP_RBP);
+	jit_op(ctx, JIT_POP_RBX);
+	jit_op(ctx, JIT_RET);
+}
+
+/*
+ * Translate n-code.  Mirrors npf_ncode_process() instruction for
+ * instruction.
+ */
+static int
+jit_translate(struct jit_ctx *ctx, const uint32_t *nc, size_t sz)
+{
+	uint32_t nwords = sz / sizeof(uint32_t);
+	uint32_t pc = 0;
+	uint nbranch = 0;
+	int errat;
+	uint i;
+
+	/*
+	 * Same verification as for the interpreter.  Also require forward
+	 * branches only, and no more branches than the interpreters loop
+	 * limit, so that the interpreter could never have failed the
+	 * n-code due to the limit.
+	 */
+	if (npf_ncode_validate(nc, sz, &errat) != 0)
+		return -EINVAL;
+
+	ctx->c_nc_map = malloc((nwords + 1) * sizeof(uint32_t));
+	if (!ctx->c_nc_map)
+		return -ENOMEM;
+	for (i = 0; i <= nwords; i++)
+		ctx->c_nc_map[i] = UINT32_MAX;
+
+	ctx->c_nc_off = -1;
+	jit_prologue(ctx);
+
+	while (pc < nwords) {
+		enum npf_opcode_type_enum opcode = nc[pc];
+		const uint32_t *op = &nc[pc + 1];
+
+		ctx->c_nc_map[pc] = ctx->c_len;
+		ctx->c_nc_off = pc;
+
+		switch (opcode) {
+		case NPF_OPCODE_BEQ:
+		case NPF_OPCODE_BNE:
+			if (op[0] == 0 || op[0] > nwords - pc ||
+			    ++nbranch > NPF_LOOP_LIMIT)
+				return -ERANGE;
+			jit_branch(ctx, opcode == NPF_OPCODE_BEQ, pc + op[0]);
+			break;
+		case NPF_OPCODE_RET:
+			jit_return(ctx, op[0]);
+			break;
+		case NPF_OPCODE_IP4MASK:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_mov_imm32(ctx, JIT_EDX, op[1]);
+			jit_mov_imm32(ctx, JIT_ECX, (npf_netmask_t)op[2]);
+			jit_call(ctx, npf_match_ip4mask);
+			break;
+		case NPF_OPCODE_IP6MASK:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_mov_pool(ctx, JIT_EDX, &op[1], sizeof(npf_addr_t));
+			jit_mov_imm32(ctx, JIT_ECX, (npf_netmask_t)op[5]);
+			jit_call(ctx, npf_match_ip6mask);
+			break;
+		case NPF_OPCODE_TABLE:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_mov_imm32(ctx, JIT_EDX, op[1]);
+			jit_call(ctx, npf_match_table);
+			break;
+		case NPF_OPCODE_PORTS:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_mov_imm32(ctx, JIT_EDX, op[1]);
+			jit_call(ctx, npf_match_ports);
+			break;
+		case NPF_OPCODE_TTL:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_ttl);
+			break;
+		case NPF_OPCODE_TCP_FLAGS:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_tcpfl);
+			break;
+		case NPF_OPCODE_ICMP4:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_icmp4);
+			break;
+		case NPF_OPCODE_ICMP6:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_icmp6);
+			break;
+		case NPF_OPCODE_IP6_RT:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_ip6_rt);
+			break;
+		case NPF_OPCODE_PROTO:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_proto);
+			break;
+		case NPF_OPCODE_ETHERPCP:
+			jit_op(ctx, JIT_MOV_RDI_RBP);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_pcp);
+			break;
+		case NPF_OPCODE_ETHERADDR:
+			jit_op(ctx, JIT_MOV_RDI_RBP);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_mov_pool(ctx, JIT_EDX, &op[1],
+				     2 * sizeof(uint32_t));
+			jit_call(ctx, npf_match_mac);
+			break;
+		case NPF_OPCODE_ADDRFAM:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_ip_fam);
+			break;
+		case NPF_OPCODE_FRAGMENT:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_call(ctx, npf_match_ip_frag);
+			break;
+		case NPF_OPCODE_MATCHDSCP:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_mov_imm64(ctx, JIT_ESI,
+				      ((uint64_t)op[1]) << 32 | op[0]);
+			jit_call(ctx, npf_match_dscp);
+			break;
+		case NPF_OPCODE_ETHERTYPE:
+			jit_op(ctx, JIT_MOV_RDI_RBP);
+			jit_mov_imm32(ctx, JIT_ESI, op[0]);
+			jit_call(ctx, npf_match_etype);
+			break;
+		case NPF_OPCODE_RPROC:
+			jit_op(ctx, JIT_MOV_RDI_RBX);
+			jit_op(ctx, JIT_MOV_RSI_RBP);
+			jit_op(ctx, JIT_MOV_RDX_R12);
+			jit_op(ctx, JIT_MOV_RCX_R13);
+			jit_op(ctx, JIT_MOV_R8D_R14D);
+			jit_op(ctx, JIT_MOV_R9_R15);
+			jit_call(ctx, npf_match_rproc);
+			break;
+		case _NPF_OPCODE_LAST:
+		default:
+			return -EINVAL;
+		}
+
+		if (ctx->c_nomem)
+			return -ENOMEM;
+
+		pc += 1 + npf_ncode_opcode_noperands(opcode);
+	}
+
+	/* Resolve branches; the validator ensured they hit instructions */
+	for (i = 0; i < ctx->c_njmp; i++) {
+		struct jit_fixup *f = &ctx->c_jmp[i];
+		uint32_t dst = ctx->c_nc_map[f->f_val];
+		int32_t rel;
+
+		if (dst == UINT32_MAX)
+			return -ERANGE;
+
+		rel = (int32_t)dst - (int32_t)(f->f_pos + sizeof(int32_t));
+		memcpy(ctx->c_code + f->f_pos, &rel, sizeof(rel));
+	}
+
+	return 0;
+}
+
+static void
+jit_ctx_free(struct jit_ctx *ctx)
+{
+	free(ctx->c_code);
+	free(ctx->c_pool);
+	free(ctx->c_nc_map);
+	free(ctx->c_jmp);
+	free(ctx->c_ptr);
+	free(ctx->c_lines);
+}
+
+/* Arena chunk size, and alignment of each function in a chunk */
+#define JIT_CHUNK_SIZE		(256 * 1024)
+#define JIT_ALIGN		RTE_CACHE_LINE_SIZE
+
+/* A free extent of a chunk, kept in offset order */
+struct jit_extent {
+	struct jit_extent	*e_next;
+	size_t			e_off;
+	size_t			e_len;
+};
+
+struct jit_chunk {
+	struct jit_chunk	*ch_next;
+	int			ch_fd;		/* memfd backing the chunk */
+	uint8_t			*ch_rx;		/* view executed */
+	size_t			ch_size;
+	struct jit_extent	*ch_free;
+};
+
+/*
+ * Rules are compiled by the master thread, but may be freed by whichever
+ * thread drops the last reference.
+ */
+static pthread_mutex_t jit_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct jit_chunk *jit_chunks;
+
+static struct jit_chunk *
+jit_chunk_create(size_t size)
+{
+	struct jit_chunk *ch;
+	int fd, rc;
+
+	ch = calloc(1, sizeof(*ch));
+	if (!ch)
+		return NULL;
+
+	ch->ch_free = malloc(sizeof(*ch->ch_free));
+	if (!ch->ch_free)
+		goto free_ch;
+	ch->ch_free->e_next = NULL;
+	ch->ch_free->e_off = 0;
+	ch->ch_free->e_len = size;
+	ch->ch_size = size;
+
+	fd = memfd_create("npf-jit", MFD_CLOEXEC);
+	if (fd < 0)
+		goto free_ext;
+
+	if (ftruncate(fd, size) < 0)
+		goto close_fd;
+
+	ch->ch_rx = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED,
+			 fd, 0);
+	if (ch->ch_rx == MAP_FAILED)
+		goto close_fd;
+
+	ch->ch_fd = fd;
+	return ch;
+
+close_fd:
+	rc = errno;
+	close(fd);
+	errno = rc;
+free_ext:
+	free(ch->ch_free);
+free_ch:
+	rc = errno;
+	free(ch);
+	errno = rc;
+	return NULL;
+}
+
+static void
+jit_chunk_destroy(struct jit_chunk *ch)
+{
+	munmap(ch->ch_rx, ch->ch_size);
+	close(ch->ch_fd);
+	free(ch->ch_free);
+	free(ch);
+}
+
+/*
+ * Map the pages of a chunk holding [off, off + len) read-write, to write
+ * a function there.  Returns the address of off in the mapping, and the
+ * mapping to unmap once the function is written.
+ */
+static uint8_t *
+jit_chunk_map_rw(struct jit_chunk *ch, size_t off, size_t len,
+		 void **map, size_t *map_len)
+{
+	size_t pgsz = sysconf(_SC_PAGESIZE);
+	size_t start = RTE_ALIGN_FLOOR(off, pgsz);
+
+	*map_len = RTE_ALIGN_CEIL(off + len, pgsz) - start;
+	*map = mmap(NULL, *map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    ch->ch_fd, start);
+	if (*map == MAP_FAILED)
+		return NULL;
+	return (uint8_t *)*map + (off - start);
+}
+
+/* First fit from the free extents of a chunk */
+static bool
+jit_chunk_alloc(struct jit_chunk *ch, size_t len, size_t *off)
+{
+	struct jit_extent **pe, *e;
+
+	for (pe = &ch->ch_free; (e = *pe) != NULL; pe = &e->e_next) {
+		if (e->e_len < len)
+			continue;
+
+		*off = e->e_off;
+		e->e_off += len;
+		e->e_len -= len;
+		if (!e->e_len) {
+			*pe = e->e_next;
+			free(e);
+		}
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Return an extent to a chunk, merging it with its neighbours.  Returns
+ * false if there is no memory to track it, in which case it is leaked
+ * until the rest of the chunk is freed.
+ */
+static bool
+jit_chunk_release(struct jit_chunk *ch, size_t off, size_t len)
+{
+	struct jit_extent **pe, *e, *prev = NULL;
+
+	for (pe = &ch->ch_free; (e = *pe) != NULL; pe = &e->e_next) {
+		if (e->e_off > off)
+			break;
+		prev = e;
+	}
+
+	if (prev && prev->e_off + prev->e_len == off) {
+		prev->e_len += len;
+		if (e && off + len == e->e_off) {
+			prev->e_len += e->e_len;
+			prev->e_next = e->e_next;
+			free(e);
+		}
+		return true;
+	}
+
+	if (e && off + len == e->e_off) {
+		e->e_off = off;
+		e->e_len += len;
+		return true;
+	}
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return false;
+	e->e_off = off;
+	e->e_len = len;
+	e->e_next = *pe;
+	*pe = e;
+	return true;
+}
+
+static bool
+jit_chunk_empty(const struct jit_chunk *ch)
+{
+	return ch->ch_free && ch->ch_free->e_len == ch->ch_size;
+}
+
+/* Allocate space for a function, adding a chunk if none has room */
+static int
+jit_arena_alloc(struct npf_jit *jit, size_t len)
+{
+	struct jit_chunk *ch;
+	size_t size;
+
+	len = RTE_ALIGN(len, JIT_ALIGN);
+
+	pthread_mutex_lock(&jit_arena_lock);
+	for (ch = jit_chunks; ch; ch = ch->ch_next)
+		if (jit_chunk_alloc(ch, len, &jit->nj_off))
+			break;
+
+	if (!ch) {
+		size = RTE_MAX((size_t)JIT_CHUNK_SIZE,
+			       RTE_ALIGN(len, (size_t)sysconf(_SC_PAGESIZE)));
+		ch = jit_chunk_create(size);
+		if (!ch) {
+			pthread_mutex_unlock(&jit_arena_lock);
+			return -errno;
+		}
+		jit_chunk_alloc(ch, len, &jit->nj_off);
+		ch->ch_next = jit_chunks;
+		jit_chunks = ch;
+	}
+	pthread_mutex_unlock(&jit_arena_lock);
+
+	jit->nj_chunk = ch;
+	jit->nj_len = len;
+	return 0;
+}
+
+/* Free a function, and its chunk once that is empty */
+static void
+jit_arena_free(struct npf_jit *jit)
+{
+	struct jit_chunk *ch = jit->nj_chunk;
+	struct jit_chunk **pch;
+
+	pthread_mutex_lock(&jit_arena_lock);
+	if (jit_chunk_release(ch, jit->nj_off, jit->nj_len) &&
+	    jit_chunk_empty(ch)) {
+		for (pch = &jit_chunks; *pch != ch; pch = &(*pch)->ch_next)
+			;
+		*pch = ch->ch_next;
+		jit_chunk_destroy(ch);
+	}
+	pthread_mutex_unlock(&jit_arena_lock);
+}
+
+bool
+npf_jit_supported(void)
+{
+	return true;
+}
+
+struct npf_jit *
+npf_jit_compile(const void *nc, size_t sz)
+{
+	struct jit_ctx ctx = { 0 };
+	struct npf_jit *jit = NULL;
+	size_t pool_off, map_len;
+	uint8_t *rw, *rx;
+	void *map;
+	uint i;
+	int rc;
+
+	if (!nc || !sz)
+		return NULL;
+
+	rc = jit_translate(&ctx, nc, sz);
+	if (rc < 0)
+		goto out;
+
+	jit = malloc(sizeof(*jit));
+	if (!jit) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* Code, then the constant pool */
+	pool_off = RTE_ALIGN(ctx.c_len, sizeof(uint64_t));
+	rc = jit_arena_alloc(jit, pool_off + ctx.c_pool_len);
+	if (rc < 0) {
+		free(jit);
+		jit = NULL;
+		goto out;
+	}
+
+	rw = jit_chunk_map_rw(jit->nj_chunk, jit->nj_off, jit->nj_len,
+			      &map, &map_len);
+	if (!rw) {
+		rc = -errno;
+		jit_arena_free(jit);
+		free(jit);
+		jit = NULL;
+		goto out;
+	}
+	rx = jit->nj_chunk->ch_rx + jit->nj_off;
+
+	memcpy(rw, ctx.c_code, ctx.c_len);
+	if (ctx.c_pool_len)
+		memcpy(rw + pool_off, ctx.c_pool, ctx.c_pool_len);
+
+	/* Pool addresses are those the code sees, in the executable view */
+	for (i = 0; i < ctx.c_nptr; i++) {
+		uint64_t addr = (uintptr_t)rx + pool_off + ctx.c_ptr[i].f_val;
+
+		memcpy(rw + ctx.c_ptr[i].f_pos, &addr, sizeof(addr));
+	}
+	munmap(map, map_len);
+
+	jit->nj_fn = (npf_jit_fn_t)(uintptr_t)rx;
+	jit->nj_code_size = ctx.c_len;
+
+out:
+	if (rc < 0 && rc != -EINVAL && rc != -ERANGE)
+		RTE_LOG(ERR, FIREWALL, "NPF: n-code JIT failed: %s\n",
+			strerror(-rc));
+
+	jit_ctx_free(&ctx);
+	return jit;
+}
+
+void
+npf_jit_free(struct npf_jit *jit)
+{
+	if (jit) {
+		jit_arena_free(jit);
+		free(jit);
+	}
+}
+
+int
+npf_jit_listing(const void *nc, size_t sz, npf_jit_insn_cb cb, void *arg)
+{
+	struct jit_ctx ctx = { .c_listing = true };
+	uint i;
+	int rc;
+
+	rc = jit_translate(&ctx, nc, sz);
+	if (rc == 0) {
+		for (i = 0; i < ctx.c_nlines; i++) {
+			const struct jit_line *line = &ctx.c_lines[i];
+
+			cb(arg, line->l_nc_off, line->l_off,
+			   ctx.c_code + line->l_off, line->l_len,
+			   line->l_text);
+		}
+	}
+	jit_ctx_free(&ctx);
+	return rc;
+}
+
+#else /* RTE_ARCH_X86_64 */
+
+bool
+npf_jit_supported(void)
+{
+	return false;
+}
+
+struct npf_jit *
+npf_jit_compile(const void *nc __unused, size_t sz __unused)
+{
+	return NULL;
+}
+
+void
+npf_jit_free(struct npf_jit *jit __unused)
+{
+}
+
+int
+npf_jit_listing(const void *nc __unused, size_t sz __unused,
+		npf_jit_insn_cb cb __unused, void *arg __unused)
+{
+	return -ENOTSUP;
+}
+
+#endif /* RTE_ARCH_X86_64 */
+
+npf_jit_fn_t
+npf_jit_func(const struct npf_jit *jit)
+{
+	return jit->nj_fn;
+}
+
+size_t
+npf_jit_code_size(const struct npf_jit *jit)
+{
+	return jit->nj_code_size;
+}
+
+bool
+npf_jit_enabled(void)
+{
+	return npf_jit_on;
+}
+
+void
+npf_jit_enable(bool enable)
+{
+	npf_jit_on = enable && npf_jit_supported();
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef NPF_JIT_H
+#define NPF_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * N-code JIT.
+ *
+ * Translates the n-code of a rule into a native function with the same
+ * signature and result as npf_ncode_process().  Each n-code instruction
+ * becomes a direct call to its npf_match_* helper, and branches become
+ * native jumps, so the fetch/dispatch loop of the interpreter is removed.
+ *
+ * Only n-code that passes npf_ncode_validate(), and whose branches are all
+ * forward, is compiled.  Anything else is left to the interpreter.
+ */
+
+struct rte_mbuf;
+struct ifnet;
+typedef struct npf_cache npf_cache_t;
+typedef struct npf_rule npf_rule_t;
+typedef struct npf_session npf_session_t;
+
+typedef int (*npf_jit_fn_t)(npf_cache_t *npc, const npf_rule_t *rl,
+			    const struct ifnet *ifp, int dir,
+			    npf_session_t *se, struct rte_mbuf *nbuf);
+
+struct npf_jit;
+
+/* Is the JIT supported on this architecture, and is it enabled? */
+bool npf_jit_supported(void);
+bool npf_jit_enabled(void);
+void npf_jit_enable(bool enable);
+
+/*
+ * Compile n-code.  Returns NULL if the JIT is not supported, or the n-code
+ * could not be compiled.
+ */
+struct npf_jit *npf_jit_compile(const void *nc, size_t sz);
+void npf_jit_free(struct npf_jit *jit);
+npf_jit_fn_t npf_jit_func(const struct npf_jit *jit);
+size_t npf_jit_code_size(const struct npf_jit *jit);
+
+/*
+ * Listing of the native code for some n-code.  The callback is called once
+ * per native instruction, with the index of the n-code instruction it was
+ * generated from (-1 for the prologue), its offset and bytes, and a
+ * mnemonic.
+ */
+typedef void (*npf_jit_insn_cb)(void *arg, int nc_off, size_t off,
+				const uint8_t *code, size_t len,
+				const char *text);
+
+int npf_jit_listing(const void *nc, size_t sz, npf_jit_insn_cb cb, void *arg);
+
+#endif /* NPF_JIT_H */
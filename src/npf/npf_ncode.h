@@ -59,6 +59,12 @@ int npf_ncode_process(npf_cache_t *npc, const npf_rule_t *rl,
 		      npf_session_t *se, struct rte_mbuf *nbuf);
 int npf_ncode_validate(const void *nc, size_t sz, int *errat);
 
+/*
+ * Process n-code that is not part of a rule, so has no rule procedures.
+ * Only used by the unit tests.
+ */
+int npf_ncode_run(const void *nc, npf_cache_t *npc, struct rte_mbuf *nbuf);
+
 /* Error codes. */
 #define	NPF_ERR_OPCODE		-1	/* Invalid instruction. */
 #define	NPF_ERR_JUMP		-2	/* Invalid jump (e.g. out of range). */
@@ -66,6 +66,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include "compiler.h"
 #include "npf/npf.h"
 #include "npf/npf_addrgrp.h"
 #include "npf/npf_cache.h"
@@ -119,7 +120,7 @@ nc_jump(const void *iptr, int n, u_int *lcount)
 }
 
 /*
- * npf_ncode_process: process n-code using data of the specified packet.
+ * nc_process: process n-code using data of the specified packet.
  *
  * => Argument nbuf (network buffer) is opaque to this function.
  * => Chain of nbufs (and their data) should be protected from any change.
@@ -127,14 +128,11 @@ nc_jump(const void *iptr, int n, u_int *lcount)
  * => N-code should be protected from any change.
  * => Routine prevents from infinite loop.
  */
-int
-npf_ncode_process(npf_cache_t *npc, const npf_rule_t *rl,
-		  const struct ifnet *ifp, int dir,
-		  npf_session_t *se, struct rte_mbuf *nbuf)
+static ALWAYS_INLINE int
+nc_process(const void *i_ptr, npf_cache_t *npc, const npf_rule_t *rl,
+	   const struct ifnet *ifp, int dir,
+	   npf_session_t *se, struct rte_mbuf *nbuf)
 {
-	/* N-code instruction pointer. */
-	const void *i_ptr = npf_get_ncode(rl);
-
 	/* Local, state variables. */
 	uint32_t d, i, n;
 	int cmpval = 0;
@@ -274,6 +272,20 @@ fail:
 	return -1;
 }
 
+int
+npf_ncode_process(npf_cache_t *npc, const npf_rule_t *rl,
+		  const struct ifnet *ifp, int dir,
+		  npf_session_t *se, struct rte_mbuf *nbuf)
+{
+	return nc_process(npf_get_ncode(rl), npc, rl, ifp, dir, se, nbuf);
+}
+
+int
+npf_ncode_run(const void *nc, npf_cache_t *npc, struct rte_mbuf *nbuf)
+{
+	return nc_process(nc, npc, NULL, NULL, 0, NULL, nbuf);
+}
+
 /*
  * nc_ptr_check: validate that instruction pointer is not out of range.
  * If not - advance by number of arguments and fetch specified argument.
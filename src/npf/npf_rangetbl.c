@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#include <endian.h>
+#include <netinet/in.h>
+#include <rte_common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "compiler.h"
+#include "npf_ptree.h"
+#include "npf_rangetbl.h"
+#include "urcu.h"
+#include "util.h"
+
+/*
+ * Range table
+ *
+ * The ptree is walked and each prefix converted to a range of addresses in
+ * host byte order.  The ranges are sorted, and overlapping or adjacent
+ * ranges merged, so that no two ranges in the table touch.  An address is
+ * then in the table if the last range starting at or before it also ends at
+ * or after it.
+ *
+ * The start and end addresses are held in separate arrays so that the
+ * binary search only touches the start array.  The search has no data
+ * dependent branches.
+ *
+ * IPv4 tables with RT_INDEX_MIN ranges or more also have an index of 64K
+ * entries.  rt_index[b] is the first range that ends in or after the /16
+ * block b.  The ranges that may contain an address in block b are then
+ * rt_index[b] to rt_index[b + 1] inclusive, so the search is normally over
+ * a handful of ranges.
+ *
+ *   rt_index[]       rt_start[]         rt_end[]
+ *   +--------+       +------------+     +------------+
+ *   | 0      |------>| 1.0.0.0    |     | 1.0.0.255  |
+ *   +--------+       +------------+     +------------+
+ *   | 0      |       | 1.2.0.0    |     | 1.2.127.255|
+ *   +--------+       +------------+     +------------+
+ *   | 1      |
+ *   +--------+
+ *   | ...    |
+ */
+
+#define RT_INDEX_BITS	16
+#define RT_INDEX_SIZE	(1u << RT_INDEX_BITS)
+#define RT_INDEX_SHIFT	(32 - RT_INDEX_BITS)
+#define RT_INDEX_MIN	1024
+
+/* IPv6 address, or IPv4 address in 'lo', in host byte order */
+struct rt_addr {
+	uint64_t	hi;
+	uint64_t	lo;
+};
+
+struct rt_range {
+	struct rt_addr	start;
+	struct rt_addr	end;
+};
+
+struct rangetbl {
+	struct rcu_head	rt_rcu;
+	uint32_t	rt_count;
+	uint8_t		rt_alen;
+	uint32_t	*rt_index;
+	union {
+		struct {
+			uint32_t	*rt_start4;
+			uint32_t	*rt_end4;
+		};
+		struct {
+			struct rt_addr	*rt_start6;
+			struct rt_addr	*rt_end6;
+		};
+	};
+};
+
+static inline int
+rt_addr_cmp(const struct rt_addr *a, const struct rt_addr *b)
+{
+	if (a->hi != b->hi)
+		return a->hi < b->hi ? -1 : 1;
+	if (a->lo != b->lo)
+		return a->lo < b->lo ? -1 : 1;
+	return 0;
+}
+
+static int rt_range_cmp(const void *a, const void *b)
+{
+	const struct rt_range *r1 = a;
+	const struct rt_range *r2 = b;
+
+	return rt_addr_cmp(&r1->start, &r2->start);
+}
+
+/* Is b adjacent to, or overlapping, the range ending at a? */
+static bool rt_addr_touches(const struct rt_addr *a, const struct rt_addr *b)
+{
+	struct rt_addr next = *a;
+
+	/* Nothing can follow the last address */
+	if (++next.lo == 0 && ++next.hi == 0)
+		return true;
+
+	return rt_addr_cmp(b, &next) <= 0;
+}
+
+/*
+ * Convert a prefix in network byte order to a range.  IPv4 prefixes are
+ * first extended to 128 bits so that both families can be handled alike.
+ */
+static void
+rt_prefix_to_range(const uint8_t *key, uint8_t alen, uint8_t mask,
+		   struct rt_range *r)
+{
+	uint64_t w[2] = { 0, 0 };
+	uint64_t hmask, lmask;
+	uint32_t a4;
+	uint8_t bits;
+
+	if (alen == 4) {
+		memcpy(&a4, key, sizeof(a4));
+		w[1] = ntohl(a4);
+		bits = 96 + MIN(mask, 32);
+	} else {
+		memcpy(w, key, sizeof(w));
+		w[0] = be64toh(w[0]);
+		w[1] = be64toh(w[1]);
+		bits = MIN(mask, 128);
+	}
+
+	/* Host bits of each 64-bit word */
+	hmask = (bits >= 64) ? 0 : UINT64_MAX >> bits;
+	if (bits >= 128)
+		lmask = 0;
+	else
+		lmask = (bits <= 64) ? UINT64_MAX : UINT64_MAX >> (bits - 64);
+
+	r->start.hi = w[0] & ~hmask;
+	r->start.lo = w[1] & ~lmask;
+	r->end.hi = w[0] | hmask;
+	r->end.lo = w[1] | lmask;
+}
+
+struct rt_build_ctx {
+	struct rt_range	*ranges;
+	uint32_t	count;
+	uint32_t	max;
+	uint8_t		alen;
+};
+
+static int rt_build_cb(struct ptree_node *n, void *data)
+{
+	struct rt_build_ctx *ctx = data;
+
+	if (ctx->count >= ctx->max)
+		return -1;
+
+	rt_prefix_to_range(ptree_get_key(n), ctx->alen, ptree_get_mask(n),
+			   &ctx->ranges[ctx->count++]);
+	return 0;
+}
+
+/*
+ * Sort and merge ranges in place.  Returns the new number of ranges.
+ */
+static uint32_t rt_merge(struct rt_range *ranges, uint32_t count)
+{
+	uint32_t i, n;
+
+	if (count == 0)
+		return 0;
+
+	qsort(ranges, count, sizeof(*ranges), rt_range_cmp);
+
+	for (i = 1, n = 0; i < count; i++) {
+		if (rt_addr_touches(&ranges[n].end, &ranges[i].start)) {
+			if (rt_addr_cmp(&ranges[i].end, &ranges[n].end) > 0)
+				ranges[n].end = ranges[i].end;
+		} else
+			ranges[++n] = ranges[i];
+	}
+	return n + 1;
+}
+
+static void rt_build_index(struct rangetbl *rt)
+{
+	uint32_t b, i = 0;
+
+	for (b = 0; b < RT_INDEX_SIZE; b++) {
+		while (i < rt->rt_count &&
+		       rt->rt_end4[i] < (b << RT_INDEX_SHIFT))
+			i++;
+		rt->rt_index[b] = i;
+	}
+	rt->rt_index[RT_INDEX_SIZE] = rt->rt_count;
+}
+
+struct rangetbl *rangetbl_build(struct ptree_table *pt)
+{
+	struct rt_build_ctx ctx;
+	struct rangetbl *rt;
+	size_t asz, sz;
+	uint32_t i;
+	bool index;
+
+	ctx.alen = ptree_get_table_keylen(pt);
+	ctx.max = ptree_get_table_leaf_count(pt);
+	ctx.count = 0;
+	ctx.ranges = malloc(sizeof(*ctx.ranges) * RTE_MAX(ctx.max, 1u));
+	if (!ctx.ranges)
+		return NULL;
+
+	ptree_walk(pt, PT_UP, rt_build_cb, &ctx);
+	ctx.count = rt_merge(ctx.ranges, ctx.count);
+
+	asz = (ctx.alen == 4) ? sizeof(uint32_t) : sizeof(struct rt_addr);
+	index = (ctx.alen == 4 && ctx.count >= RT_INDEX_MIN);
+
+	sz = sizeof(*rt) + 2 * asz * ctx.count;
+	if (index)
+		sz += sizeof(uint32_t) * (RT_INDEX_SIZE + 1);
+
+	rt = zmalloc_aligned(sz);
+	if (!rt) {
+		free(ctx.ranges);
+		return NULL;
+	}
+
+	rt->rt_count = ctx.count;
+	rt->rt_alen = ctx.alen;
+
+	if (ctx.alen == 4) {
+		rt->rt_start4 = (uint32_t *)&rt[1];
+		rt->rt_end4 = rt->rt_start4 + ctx.count;
+		for (i = 0; i < ctx.count; i++) {
+			rt->rt_start4[i] = ctx.ranges[i].start.lo;
+			rt->rt_end4[i] = ctx.ranges[i].end.lo;
+		}
+		if (index) {
+			rt->rt_index = rt->rt_end4 + ctx.count;
+			rt_build_index(rt);
+		}
+	} else {
+		rt->rt_start6 = (struct rt_addr *)&rt[1];
+		rt->rt_end6 = rt->rt_start6 + ctx.count;
+		for (i = 0; i < ctx.count; i++) {
+			rt->rt_start6[i] = ctx.ranges[i].start;
+			rt->rt_end6[i] = ctx.ranges[i].end;
+		}
+	}
+
+	free(ctx.ranges);
+	return rt;
+}
+
+void rangetbl_free(struct rangetbl *rt)
+{
+	free(rt);
+}
+
+static void rangetbl_free_rcu_cb(struct rcu_head *head)
+{
+	rangetbl_free(caa_container_of(head, struct rangetbl, rt_rcu));
+}
+
+void rangetbl_free_rcu(struct rangetbl *rt)
+{
+	if (rt)
+		call_rcu(&rt->rt_rcu, rangetbl_free_rcu_cb);
+}
+
+/*
+ * Find the last of n entries from base that is less than or equal to key,
+ * or base if there are none.
+ */
+static ALWAYS_INLINE const uint32_t *
+rt_search4(const uint32_t *base, uint32_t n, uint32_t key)
+{
+	uint32_t half;
+
+	while (n > 1) {
+		half = n / 2;
+		base = (base[half] <= key) ? base + half : base;
+		n -= half;
+	}
+	return base;
+}
+
+static ALWAYS_INLINE const struct rt_addr *
+rt_search6(const struct rt_addr *base, uint32_t n, const struct rt_addr *key)
+{
+	uint32_t half;
+
+	while (n > 1) {
+		half = n / 2;
+		if (rt_addr_cmp(&base[half], key) <= 0)
+			base += half;
+		n -= half;
+	}
+	return base;
+}
+
+bool rangetbl_lookup_v4(const struct rangetbl *rt, uint32_t addr)
+{
+	uint32_t key = ntohl(addr);
+	const uint32_t *p;
+	uint32_t lo, n;
+
+	if (rt->rt_index) {
+		uint32_t b = key >> RT_INDEX_SHIFT;
+
+		lo = rt->rt_index[b];
+		n = RTE_MIN(rt->rt_index[b + 1] + 1, rt->rt_count) - lo;
+	} else {
+		lo = 0;
+		n = rt->rt_count;
+	}
+
+	if (n == 0)
+		return false;
+
+	p = rt_search4(&rt->rt_start4[lo], n, key);
+	return *p <= key && rt->rt_end4[p - rt->rt_start4] >= key;
+}
+
+bool rangetbl_lookup_v6(const struct rangetbl *rt, const uint8_t *addr)
+{
+	const struct rt_addr *p;
+	struct rt_addr key;
+
+	if (rt->rt_count == 0)
+		return false;
+
+	memcpy(&key.hi, addr, sizeof(key.hi));
+	memcpy(&key.lo, addr + sizeof(key.hi), sizeof(key.lo));
+	key.hi = be64toh(key.hi);
+	key.lo = be64toh(key.lo);
+
+	p = rt_search6(rt->rt_start6, rt->rt_count, &key);
+	return rt_addr_cmp(p, &key) <= 0 &&
+		rt_addr_cmp(&rt->rt_end6[p - rt->rt_start6], &key) >= 0;
+}
+
+bool rangetbl_lookup(const struct rangetbl *rt, const uint8_t *addr)
+{
+	uint32_t a4;
+
+	if (rt->rt_alen == 4) {
+		memcpy(&a4, addr, sizeof(a4));
+		return rangetbl_lookup_v4(rt, a4);
+	}
+	return rangetbl_lookup_v6(rt, addr);
+}
+
+uint32_t rangetbl_count(const struct rangetbl *rt)
+{
+	return rt->rt_count;
+}
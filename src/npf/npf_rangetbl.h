@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef NPF_RANGETBL_H
+#define NPF_RANGETBL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct ptree_table;
+
+/*
+ * Range table
+ *
+ * A read-only, compiled, copy of the set of addresses in a ptree.  The
+ * prefixes are flattened to a sorted array of disjoint address ranges, and
+ * a lookup is a binary search of that array.  Larger IPv4 tables also have
+ * an index on the top 16 bits of the address to narrow the search.
+ *
+ * Range tables are never changed once built.  A new one is built to replace
+ * it when the ptree changes.
+ */
+struct rangetbl;
+
+/*
+ * Build a range table from a ptree with a key length of 4 or 16.
+ * Returns NULL if out of memory.
+ */
+struct rangetbl *rangetbl_build(struct ptree_table *pt);
+
+/* Free now, or after an rcu grace period */
+void rangetbl_free(struct rangetbl *rt);
+void rangetbl_free_rcu(struct rangetbl *rt);
+
+/* Is the address in the table?  Addresses are in network byte order */
+bool rangetbl_lookup_v4(const struct rangetbl *rt, uint32_t addr);
+bool rangetbl_lookup_v6(const struct rangetbl *rt, const uint8_t *addr);
+bool rangetbl_lookup(const struct rangetbl *rt, const uint8_t *addr);
+
+/* Number of ranges in the table */
+uint32_t rangetbl_count(const struct rangetbl *rt);
+
+#endif /* NPF_RANGETBL_H */
@@ -69,6 +69,8 @@
 #include "npf/config/npf_config.h"
 #include "npf/grouper2.h"
 #include "npf/npf_disassemble.h"
+#include "npf/npf_dtree.h"
+#include "npf/npf_jit.h"
 #include "npf/npf_nat.h"
 #include "npf/npf_ncode.h"
 #include "npf/npf_rule_gen.h"
@@ -128,6 +130,10 @@ struct npf_rule_group {
 	g2_config_t *rg_grouper;
 	g2_config_t *rg_grouper6;
 
+	/* Decision tree classifiers.  Used in preference to the grouper */
+	struct npf_dtree *rg_dtree;
+	struct npf_dtree *rg_dtree6;
+
 	struct cds_list_head rg_rules;	/* rules in this group */
 
 
@@ -157,9 +163,11 @@ struct npf_rule_state {
 struct npf_rule {
 	struct cds_list_head		r_entry;
 	void				*r_ncode;	/* pointer to ncode */
+	npf_jit_fn_t			r_jit_fn;	/* compiled ncode */
 	npf_natpolicy_t			*r_natp;	/* nat policy */
 	struct npf_rule_stats		*r_stats;	/* rule stats */
 	struct npf_rule_state		*r_state;	/* generation state */
+	struct npf_jit			*r_jit;
 	uint32_t			r_nc_size;	/* ncode size */
 	rte_atomic32_t			r_refcnt;	/* Reference counter */
 	uint8_t				r_pass:1;	/* rule bits */
@@ -258,6 +266,7 @@ static void rule_free(npf_rule_t *rl)
 	free(rl->r_state->rs_rproc);
 	free(rl->r_state);
 	free(rl->r_stats);
+	npf_jit_free(rl->r_jit);
 	free(rl->r_ncode);
 	free(rl);
 }
@@ -300,6 +309,8 @@ npf_free_group(npf_rule_group_t *rg)
 	/* Release groupers */
 	g2_destroy(&rg->rg_grouper);
 	g2_destroy(&rg->rg_grouper6);
+	npf_dtree_destroy(rg->rg_dtree);
+	npf_dtree_destroy(rg->rg_dtree6);
 
 	free(rg->rg_name);
 	free(rg);
@@ -1007,6 +1018,10 @@ npf_json_rule(npf_rule_t *rl, bool is_nat, json_writer_t *json)
 		strcpy(buf + sizeof(buf) - 4, "...");
 	jsonw_string_field(json, "operation", buf);
 
+	/* The n-code is run as native code */
+	if (rl->r_jit)
+		jsonw_bool_field(json, "jit", true);
+
 	/* Invoke any json callbacks. */
 	npf_json_rule_rprocs(json, rl);
 
@@ -1042,12 +1057,23 @@ npf_json_rule(npf_rule_t *rl, bool is_nat, json_writer_t *json)
 
 	if (DP_DEBUG_ENABLED(NPF)) {
 		npf_json_ncode(rl->r_ncode, rl->r_nc_size, json);
+		if (rl->r_jit)
+			npf_json_ncode_jit(rl->r_ncode, rl->r_nc_size, json);
 		npf_json_grouper_info(&rl->r_state->rs_grouper_info, json);
 	}
 
 	jsonw_end_object(json);
 }
 
+static void
+npf_json_grouper(json_writer_t *json, const char *name)
+{
+	jsonw_name(json, name);
+	jsonw_start_object(json);
+	jsonw_string_field(json, "type", "grouper");
+	jsonw_end_object(json);
+}
+
 static void
 npf_json_ruleset_group_info(npf_rule_group_t *rg, json_writer_t *json)
 {
@@ -1068,6 +1094,16 @@ npf_json_ruleset_group_info(npf_rule_group_t *rg, json_writer_t *json)
 	else
 		jsonw_string_field(json, "direction",
 				   (rg->rg_dir & PFIL_IN) ? "in" : "out");
+
+	/* Without a decision tree, the grouper classifies the packets */
+	if (rg->rg_dtree)
+		npf_dtree_jsonw(json, "classifier", rg->rg_dtree);
+	else if (rg->rg_grouper)
+		npf_json_grouper(json, "classifier");
+	if (rg->rg_dtree6)
+		npf_dtree_jsonw(json, "classifier6", rg->rg_dtree6);
+	else if (rg->rg_grouper6)
+		npf_json_grouper(json, "classifier6");
 }
 
 /*
@@ -1392,6 +1428,13 @@ npf_process_rule_config(npf_rule_t *rl)
 	if (ret)
 		return ret;
 
+	/* The interpreter is used if the n-code can not be compiled */
+	if (rl->r_ncode && npf_jit_enabled()) {
+		rl->r_jit = npf_jit_compile(rl->r_ncode, rl->r_nc_size);
+		if (rl->r_jit)
+			rl->r_jit_fn = npf_jit_func(rl->r_jit);
+	}
+
 #ifdef NPF_RULE_DEBUG
 	printf("Attach Type: %s, Attach Name: %s, Group: %s, Rule Number: %u\n",
 		npf_get_attach_type_name(
@@ -1586,6 +1629,61 @@ npf_grouper_optimize(npf_rule_group_t *rg)
 	g2_optimize(&rg->rg_grouper6);
 }
 
+static struct npf_dtree *
+npf_dtree_build_af(npf_rule_group_t *rg, sa_family_t af)
+{
+	struct npf_rule_grouper_info *info;
+	const uint8_t **match, **mask;
+	struct npf_dtree *dt = NULL;
+	npf_rule_t *rl;
+	void **rules;
+	uint n = 0;
+
+	cds_list_for_each_entry(rl, &rg->rg_rules, r_entry)
+		n++;
+
+	rules = malloc(n * sizeof(*rules));
+	match = malloc(n * sizeof(*match));
+	mask = malloc(n * sizeof(*mask));
+	if (!rules || !match || !mask)
+		goto end;
+
+	/* Same rules as are added to the grouper for this family */
+	n = 0;
+	cds_list_for_each_entry(rl, &rg->rg_rules, r_entry) {
+		info = &rl->r_state->rs_grouper_info;
+
+		if (af == AF_INET && info->g_family != AF_INET6) {
+			match[n] = info->g_v4_match;
+			mask[n] = info->g_v4_mask;
+		} else if (af == AF_INET6 && info->g_family != AF_INET) {
+			match[n] = info->g_v6_match;
+			mask[n] = info->g_v6_mask;
+		} else
+			continue;
+		rules[n++] = rl;
+	}
+
+	if (n > 0)
+		dt = npf_dtree_create(af, n, rules, match, mask);
+end:
+	free(rules);
+	free(match);
+	free(mask);
+	return dt;
+}
+
+/*
+ * Build the decision tree classifiers for a rule group.  The groupers are
+ * kept, and are used if a tree cannot be built.
+ */
+void
+npf_grouper_build_dtree(npf_rule_group_t *rg)
+{
+	rg->rg_dtree = npf_dtree_build_af(rg, AF_INET);
+	rg->rg_dtree6 = npf_dtree_build_af(rg, AF_INET6);
+}
+
 static ALWAYS_INLINE
 bool npf_rule_match(npf_cache_t *npc, struct rte_mbuf *nbuf,
 		    const struct ifnet *ifp, int dir,
@@ -1595,6 +1693,9 @@ bool npf_rule_match(npf_cache_t *npc, struct rte_mbuf *nbuf,
 	 * Process the n-code, if any
 	 * NB: 'match all' generates no ncode
 	 */
+	if (rl->r_jit_fn)
+		return rl->r_jit_fn(npc, rl, ifp, dir, se, nbuf) == 0;
+
 	if (rl->r_ncode && npf_ncode_process(npc, rl, ifp, dir, se, nbuf))
 		return false;
 
@@ -1642,6 +1743,14 @@ npf_ruleset_inspect(npf_cache_t *npc, struct rte_mbuf *nbuf,
 			uint8_t *pkt = (uint8_t *)npc->npc_grouper;
 
 			if (likely(npf_iscached(npc, NPC_IP4))) {
+				if (rg->rg_dtree) {
+					rl = npf_dtree_eval(rg->rg_dtree, pkt,
+							    &pd,
+							    npf_rule_proc);
+					if (rl)
+						return rl;
+					continue;
+				}
 				if (rg->rg_grouper) {
 					rl = g2_eval4(rg->rg_grouper, pkt, &pd);
 					if (rl)
@@ -1649,6 +1758,14 @@ npf_ruleset_inspect(npf_cache_t *npc, struct rte_mbuf *nbuf,
 					continue;
 				}
 			} else if (npf_iscached(npc, NPC_IP6)) {
+				if (rg->rg_dtree6) {
+					rl = npf_dtree_eval(rg->rg_dtree6, pkt,
+							    &pd,
+							    npf_rule_proc);
+					if (rl)
+						return rl;
+					continue;
+				}
 				if (rg->rg_grouper6) {
 					rl = g2_eval6(rg->rg_grouper6, pkt,
 						      &pd);
@@ -152,6 +152,7 @@ bool npf_rproc_match(npf_cache_t *npc, struct rte_mbuf *m, const npf_rule_t *rl,
 		     const struct ifnet *ifp, int dir, npf_session_t *se);
 void npf_grouper_init(npf_rule_group_t *rg);
 void npf_grouper_optimize(npf_rule_group_t *rg);
+void npf_grouper_build_dtree(npf_rule_group_t *rg);
 bool npf_rule_proc(const void *d, const void *r);
 npf_rule_t *npf_ruleset_inspect(npf_cache_t *npc, struct rte_mbuf *nbuf,
 				const npf_ruleset_t *ruleset,
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <urcu/uatomic.h>
 
 #include "compiler.h"
 #include "npf/npf.h"
@@ -31,10 +32,16 @@
 
 struct ifnet;
 
+/*
+ * Per-lcore state.  In scalable mode each lcore draws grants of tokens from
+ * the shared bucket and spends them locally.
+ */
 struct policer_cntrs {
 	uint64_t excess;
 	uint64_t bytes_excess;
-	uint64_t pad[6];
+	int32_t tokens;		/* Unspent tokens granted to this lcore */
+	uint32_t pad32;
+	uint64_t pad[5];
 };
 
 struct npf_policer {
@@ -59,6 +66,7 @@ struct npf_policer {
 		POLICE_BYTES,
 		POLICE_PACKETS
 	} type;
+	uint32_t grant;		/* Tokens per lcore draw, 0 is exact mode */
 };
 
 #define	ONE_SECOND		1000
@@ -66,6 +74,24 @@ struct npf_policer {
 #define	POLICE_ENABLE_INNER	0x80
 #define	POLICE_PCP_MASK		0x07
 
+/*
+ * Size of the grant each lcore takes from the shared bucket, as a percentage
+ * of the rate.  0 keeps the exact (locked) policer.  Larger grants mean less
+ * contention on the shared bucket, but up to one grant per lcore may be
+ * spent outside the interval it was drawn in.
+ */
+static uint8_t npf_policer_grant_pct;
+
+void npf_policer_set_grant(uint8_t pct)
+{
+	npf_policer_grant_pct = RTE_MIN(pct, 100);
+}
+
+uint8_t npf_policer_get_grant(void)
+{
+	return npf_policer_grant_pct;
+}
+
 /* Expect "pps,rate,burst,action" */
 static int
 npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
@@ -217,6 +243,12 @@ npf_policer_create(npf_rule_t *rl, const char *params, void **handle)
 		return -EINVAL;
 	}
 
+	if (npf_policer_grant_pct) {
+		po->grant = ((uint64_t)po->rate * npf_policer_grant_pct) / 100;
+		if (!po->grant)
+			po->grant = 1;
+	}
+
 	RTE_LOG(DEBUG, QOS,
 		"Policer create (%d%s, %u, %d, %d, %d, %u) %p\n",
 		po->rate, (po->type == POLICE_BYTES ? "bytes/tc" : "pkts/tc"),
@@ -245,6 +277,86 @@ update_tokens(int32_t credit, struct npf_policer *po, const uint64_t ticks)
 	rte_atomic32_set(&po->credit, credit);
 }
 
+/*
+ * Lock free refill of the shared bucket, used in scalable mode.  Whoever
+ * advances the time of the last update adds the tokens for the intervals
+ * that have passed.
+ */
+static void
+npf_policer_refill(struct npf_policer *po)
+{
+	uint64_t then = CMM_ACCESS_ONCE(po->time);
+	uint64_t now = soft_ticks;
+	int32_t old, credit, max;
+	uint64_t next;
+	uint32_t intervals;
+
+	if (now < then + po->tc)
+		return;
+
+	if (po->type == POLICE_PACKETS) {
+		/* As below, if more than 2 Tcs have lapsed then restart */
+		next = (now >= then + 2 * po->tc) ? now : then + po->tc;
+		if (rte_atomic64_cmpset(&po->time, then, next))
+			rte_atomic32_set(&po->credit, po->rate);
+		return;
+	}
+
+	intervals = (now - then) / po->tc;
+	if (!rte_atomic64_cmpset(&po->time, then,
+				 then + (uint64_t)po->tc * intervals))
+		return;
+
+	max = po->rate + po->burst;
+	do {
+		old = rte_atomic32_read(&po->credit);
+		if ((uint64_t)intervals * po->rate >= (uint64_t)(max - old))
+			credit = max;
+		else
+			credit = old + intervals * po->rate;
+	} while (!rte_atomic32_cmpset((volatile uint32_t *)&po->credit.cnt,
+				      old, credit));
+}
+
+/*
+ * Take up to 'want' tokens from the shared bucket.
+ */
+static int32_t
+npf_policer_draw(struct npf_policer *po, int32_t want)
+{
+	int32_t credit;
+
+	do {
+		credit = rte_atomic32_read(&po->credit);
+		if (credit <= 0)
+			return 0;
+		if (want > credit)
+			want = credit;
+	} while (!rte_atomic32_cmpset((volatile uint32_t *)&po->credit.cnt,
+				      credit, credit - want));
+	return want;
+}
+
+/*
+ * Scalable mode.  Spend tokens from this lcore's grant, and only touch the
+ * shared bucket when the grant runs out.
+ */
+static bool
+npf_policer_take(struct npf_policer *po, int32_t need)
+{
+	struct policer_cntrs *pc = &po->cntrs[dp_lcore_id()];
+
+	if (pc->tokens < need) {
+		npf_policer_refill(po);
+		pc->tokens += npf_policer_draw(po, RTE_MAX((int32_t)po->grant,
+							   need - pc->tokens));
+		if (pc->tokens < need)
+			return false;
+	}
+	pc->tokens -= need;
+	return true;
+}
+
 static bool
 npf_policer(npf_cache_t *npc, struct rte_mbuf **nbuf, void *arg,
 	    npf_session_t *se __unused, npf_rproc_result_t *result)
@@ -264,7 +376,17 @@ npf_policer(npf_cache_t *npc, struct rte_mbuf **nbuf, void *arg,
 		return true;
 	}
 
-	if (po->type == POLICE_BYTES) {
+	if (po->grant) {
+		tokens = rte_pktmbuf_pkt_len(*nbuf) - pktmbuf_l2_len(*nbuf);
+		if (po->type == POLICE_BYTES) {
+			tok_with_oh = tokens + po->overhead;
+			if (tok_with_oh < 0)
+				tok_with_oh = 1;
+		} else
+			tok_with_oh = 1;
+		if (npf_policer_take(po, tok_with_oh))
+			return true;
+	} else if (po->type == POLICE_BYTES) {
 		uint64_t	lapsed;
 		int		intervals;
 
@@ -420,6 +542,8 @@ npf_policer_json(json_writer_t *json,
 
 	jsonw_uint_field(json, "exceed-packets", excess);
 	jsonw_uint_field(json, "exceed-bytes", excess_bytes);
+	if (po->grant)
+		jsonw_uint_field(json, "grant", po->grant);
 }
 
 const npf_rproc_ops_t npf_policer_ops = {
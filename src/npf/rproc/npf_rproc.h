@@ -139,6 +139,9 @@ void police_enable_inner_marking(void *handle);
 
 void police_disable_inner_marking(void *handle);
 
+void npf_policer_set_grant(uint8_t pct);
+uint8_t npf_policer_get_grant(void);
+
 void
 npf_policer_json(json_writer_t *json, npf_rule_t *rl,
 		 const char *params, void *handle);
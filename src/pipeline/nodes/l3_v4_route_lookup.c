@@ -56,6 +56,7 @@ _ipv4_route_lookup_process_common(struct pl_packet *pkt, enum pl_mode mode,
 				  enum ipv4_route_lookup_mode lkup_mode)
 {
 	struct ifnet *ifp = pkt->in_ifp;
+	struct next_hop *nxt;
 	struct vrf *vrf;
 	struct iphdr *ip = pkt->l3_hdr;
 
@@ -78,10 +79,13 @@ _ipv4_route_lookup_process_common(struct pl_packet *pkt, enum pl_mode mode,
 	}
 
 	vrf = vrf_get_rcu_fast(pktmbuf_get_vrf(pkt->mbuf));
-	struct next_hop *nxt = rt_lookup_fast(vrf, ip->daddr,
-					      pkt->tblid, pkt->mbuf);
-
-	pkt->nxt.v4 = nxt;
+	if (pkt->val_flags & NXT_RESOLVED) {
+		pkt->val_flags &= ~NXT_RESOLVED;
+		nxt = pkt->nxt.v4;
+	} else {
+		nxt = rt_lookup_fast(vrf, ip->daddr, pkt->tblid, pkt->mbuf);
+		pkt->nxt.v4 = nxt;
+	}
 
 	/*
 	 * if nxt == NULL, postpone sending icmp err
@@ -167,6 +171,70 @@ ipv4_route_lookup_host_process(struct pl_packet *pkt)
 						 IPV4_LKUP_MODE_HOST);
 }
 
+_Static_assert(PL_VECTOR_MAX <= RT_LOOKUP_BULK_MAX,
+	       "pipeline vector too big for bulk route lookup");
+
+static void
+ipv4_route_lookup_bulk(struct vrf *vrf, uint32_t tblid,
+		       struct pl_packet **pkts, const in_addr_t *dst,
+		       unsigned int count)
+{
+	struct rte_mbuf *mbufs[PL_VECTOR_MAX];
+	struct next_hop *nxt[PL_VECTOR_MAX];
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		mbufs[i] = pkts[i]->mbuf;
+
+	rt_lookup_fast_bulk(vrf, dst, tblid, mbufs, nxt, count);
+
+	for (i = 0; i < count; i++) {
+		pkts[i]->nxt.v4 = nxt[i];
+		pkts[i]->val_flags |= NXT_RESOLVED;
+	}
+}
+
+/*
+ * Vector mode: do the route lookups for all the unicast packets in
+ * the vector up front, so that the LPM memory accesses overlap.
+ * Consecutive packets in the same VRF and table are looked up
+ * together, which in practice is usually the whole vector.
+ */
+void
+ipv4_route_lookup_vec_prepare(struct pl_packet **pkts, unsigned int count)
+{
+	struct pl_packet *lkup_pkts[PL_VECTOR_MAX];
+	in_addr_t dst[PL_VECTOR_MAX];
+	struct vrf *vrf = NULL;
+	uint32_t tblid = 0;
+	unsigned int n = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		struct pl_packet *pkt = pkts[i];
+		struct iphdr *ip = pkt->l3_hdr;
+		struct vrf *pkt_vrf;
+
+		if (unlikely(pkt->l2_pkt_type == L2_PKT_BROADCAST) ||
+		    unlikely(IN_MULTICAST(ntohl(ip->daddr))))
+			continue;
+
+		pkt_vrf = vrf_get_rcu_fast(pktmbuf_get_vrf(pkt->mbuf));
+		if (n && (pkt_vrf != vrf || pkt->tblid != tblid)) {
+			ipv4_route_lookup_bulk(vrf, tblid, lkup_pkts, dst, n);
+			n = 0;
+		}
+
+		vrf = pkt_vrf;
+		tblid = pkt->tblid;
+		lkup_pkts[n] = pkt;
+		dst[n++] = ip->daddr;
+	}
+
+	if (n)
+		ipv4_route_lookup_bulk(vrf, tblid, lkup_pkts, dst, n);
+}
+
 static int
 ipv4_route_lookup_feat_change(struct pl_node *node,
 				   struct pl_feature_registration *feat,
@@ -193,6 +261,7 @@ PL_REGISTER_NODE(ipv4_route_lookup_node) = {
 	.name = "vyatta:ipv4-route-lookup",
 	.type = PL_PROC,
 	.handler = ipv4_route_lookup_process,
+	.vec_prepare = ipv4_route_lookup_vec_prepare,
 	.feat_change = ipv4_route_lookup_feat_change,
 	.feat_iterate = ipv4_route_lookup_feat_iterate,
 	.num_next = IPV4_ROUTE_LOOKUP_NUM,
@@ -13,6 +13,7 @@
 #include <string.h>
 
 #include "commands.h"
+#include "ether.h"
 #include "pl_commands.h"
 #include "pl_common.h"
 #include "pl_internal.h"
@@ -137,6 +138,8 @@ cmd_pipeline_show_nodes(struct pl_command *cmd)
 	jsonw_name(json, "pl-framework");
 	jsonw_start_object(json);
 
+	jsonw_string_field(json, "mode",
+			   packet_burst_input_func ? "vector" : "fused");
 	pl_dump_nodes(json);
 
 	jsonw_end_object(json);
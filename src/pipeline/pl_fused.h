@@ -11,6 +11,12 @@
 #ifndef PL_FUSED_H
 #define PL_FUSED_H
 
+#include <rte_per_lcore.h>
+
+#include "compiler.h"
+#include "npf/npf.h"
+#include "npf/npf_cache.h"
+#include "pl_common.h"
 #include "pl_fused_gen.h"
 
 /*
@@ -94,4 +100,23 @@ enum pl_l3_v6_route_lookup_fused_feat {
 	PL_L3_V6_ROUTE_LOOKUP_FUSED_FEAT_IPSEC = 1,
 };
 
+/*
+ * In vector mode a node runs over every packet of the vector before the
+ * next node runs.  Each packet has its own npf cache, so that it is only
+ * parsed once however many nodes use it.  Select the packet's cache
+ * before running a node's handler on it.
+ */
+static ALWAYS_INLINE void
+pl_vector_npf_switch(struct pl_packet *pkt)
+{
+	npf_cache_select(pkt->npc);
+}
+
+/* Go back to the per-lcore npf cache at the end of the vector */
+static ALWAYS_INLINE void
+pl_vector_npf_reset(void)
+{
+	npf_cache_select(NULL);
+}
+
 #endif /* PL_FUSED_H */
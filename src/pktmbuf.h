@@ -105,6 +105,7 @@ enum pkt_mdata_type {
 	PKT_MDATA_CGNAT_OUT		= (1 << 11),
 	PKT_MDATA_CGNAT_IN		= (1 << 12),
 	PKT_MDATA_CGNAT_SESSION		= (1 << 13),
+	PKT_MDATA_QOS_CLASSIFIED	= (1 << 14), /* QoS sched set */
 };
 
 struct npf_session;
@@ -142,6 +143,9 @@ struct pktmbuf_mdata {
 
 	/* PKT_MDATA_L2_RCV_TYPE */
 	enum l2_packet_type md_l2_rcv_type;
+
+	/* PKT_MDATA_QOS_CLASSIFIED, generation of the scheduler */
+	uint32_t md_qos_gen;
 } __rte_aligned(RTE_CACHE_LINE_SIZE * 2);
 
 static inline struct pktmbuf_mdata *
@@ -887,6 +887,8 @@ static void show_one_session(struct portmonitor_session *s, json_writer_t *wr)
 		jsonw_int_field(wr, "erspanhdr", ERSPAN_TYPE_II);
 	else if (s->erspan_hdr_type == ERSPAN_TYPE_III)
 		jsonw_int_field(wr, "erspanhdr", ERSPAN_TYPE_III);
+	if (s->truncate)
+		jsonw_uint_field(wr, "truncate", s->truncate);
 	jsonw_name(wr, "source_interfaces");
 	jsonw_start_array(wr);
 	cds_list_for_each_entry_rcu(pmsrcif, &pmsrcif_list, srcif_list) {
@@ -984,6 +986,7 @@ int cmd_portmonitor(FILE *f, int argc, char **argv)
 	uint32_t direction;
 	uint32_t erspan_id;
 	uint32_t erspan_hdr_type;
+	uint32_t truncate_len;
 	struct portmonitor_session *pmsess;
 	int rc;
 
@@ -1079,6 +1082,8 @@ int cmd_portmonitor(FILE *f, int argc, char **argv)
 						argv[5]);
 					return -1;
 				}
+			} else if (strcmp(argv[4], "truncate") == 0) {
+				pmsess->truncate = 0;
 			}
 		}
 		return 0;
@@ -1230,6 +1235,16 @@ int cmd_portmonitor(FILE *f, int argc, char **argv)
 			}
 			portmonitor_session_set_erspan_hdr_type(pmsess,
 								erspan_hdr_type);
+		} else if (strcmp(argv[4], "truncate") == 0) {
+			if (!get_value(argv[5], &truncate_len) ||
+			    (truncate_len &&
+			     (truncate_len < PORTMONITOR_TRUNCATE_MIN ||
+			      truncate_len > UINT16_MAX))) {
+				fprintf(f, "Invalid truncate length %s\n",
+						argv[5]);
+				return -1;
+			}
+			pmsess->truncate = truncate_len;
 		} else if (strcmp(argv[4], "disable") == 0) {
 			pmsess->disabled = true;
 			struct fal_attribute_t attr[] = {
@@ -34,6 +34,12 @@
 #include "portmonitor/portmonitor_hw.h"
 #include "urcu.h"
 
+/*
+ * Headers that forwarding may rewrite in place, without first checking
+ * whether the packet is shared, are copied into the mirror.
+ */
+#define PM_HDR_COPY_LEN		128
+
 /* Forward packet to SPAN port.
  * Returns 1 if packet was consumed.
  *         0 if span not enabled on port.
@@ -126,7 +132,8 @@ drop:
 
 static int portmonitor_encap_erspan_hdr(struct ifnet *ifp,
 					struct portmonitor_session *pmsess,
-					struct rte_mbuf *m, uint8_t direction)
+					struct rte_mbuf *m, uint8_t direction,
+					bool truncated)
 {
 	struct erspan_v2_hdr *v2_hdr;
 	struct erspan_v3_hdr *v3_hdr;
@@ -162,6 +169,8 @@ static int portmonitor_encap_erspan_hdr(struct ifnet *ifp,
 		}
 		v2_hdr->cos_en_t_id = htons((pktmbuf_get_vlan_pcp(m) << 13) |
 					    (en << 11) | pmsess->erspan_id);
+		if (truncated)
+			v2_hdr->cos_en_t_id |= htons(ERSPAN_TRUNCATED);
 		v2_hdr->index = htonl((ifp->if_port << 4) | direction);
 	} else if (pmsess->erspan_hdr_type == ERSPAN_TYPE_III) {
 		if (clock_gettime(CLOCK_REALTIME, &ts))
@@ -199,6 +208,8 @@ static int portmonitor_encap_erspan_hdr(struct ifnet *ifp,
 				htons((pktmbuf_get_vlan_pcp(m) << 13) |
 				      pmsess->erspan_id);
 		}
+		if (truncated)
+			v3_hdr->cos_bso_t_id |= htons(ERSPAN_TRUNCATED);
 		v3_hdr->p_ft_hwid_d_gra_o = htons((1 << 15) |
 						(ERSPAN_HARDWARE_ID << 4) |
 						(direction << 3) |
@@ -211,28 +222,98 @@ static int portmonitor_encap_erspan_hdr(struct ifnet *ifp,
 	return 1;
 }
 
-static void portmonitor_source_output(struct ifnet *ifp,
-					const struct portmonitor_info *pminfo,
-					struct rte_mbuf **m, uint8_t direction)
+/* Trim a packet to len bytes, freeing any segments beyond that */
+static void portmonitor_trim(struct rte_mbuf *m, uint32_t len)
+{
+	struct rte_mbuf *seg = m;
+	uint32_t left = len;
+	uint16_t nb_segs = 1;
+
+	if (rte_pktmbuf_pkt_len(m) <= len)
+		return;
+
+	while (left > seg->data_len) {
+		left -= seg->data_len;
+		seg = seg->next;
+		nb_segs++;
+	}
+	seg->data_len = left;
+	if (seg->next) {
+		rte_pktmbuf_free(seg->next);
+		seg->next = NULL;
+	}
+	m->nb_segs = nb_segs;
+	m->pkt_len = len;
+}
+
+/*
+ * Make a mirror of the first len bytes of a packet.  The mirror is a
+ * direct mbuf holding a copy of the headers, with headroom for the mirror
+ * encapsulation, chained to an indirect mbuf sharing the rest of the
+ * packet.  Anything changing the shared data of the original first makes
+ * its own copy, see pktmbuf_prepare_for_header_change().
+ */
+static struct rte_mbuf *portmonitor_mirror_pkt(struct rte_mbuf *m,
+					       uint32_t len)
+{
+	struct rte_mbuf *mh, *mi;
+	uint32_t hlen;
+
+	len = RTE_MIN(len, rte_pktmbuf_pkt_len(m));
+	hlen = RTE_MIN(len, PM_HDR_COPY_LEN);
+
+	/* Headers split over segments, so just copy */
+	if (unlikely(hlen < len && rte_pktmbuf_data_len(m) <= hlen)) {
+		mh = pktmbuf_copy(m, m->pool);
+		if (mh)
+			portmonitor_trim(mh, len);
+		return mh;
+	}
+
+	mh = pktmbuf_alloc(m->pool, pktmbuf_get_vrf(m));
+	if (!mh)
+		return NULL;
+
+	pktmbuf_copy_meta(mh, m);
+	memcpy_from_mbuf(rte_pktmbuf_append(mh, hlen), m, 0, hlen);
+	if (hlen == len)
+		return mh;
+
+	mi = pktmbuf_clone(m, m->pool);
+	if (!mi)
+		goto fail;
+
+	rte_pktmbuf_adj(mi, hlen);
+	portmonitor_trim(mi, len - hlen);
+	if (rte_pktmbuf_chain(mh, mi) < 0) {
+		rte_pktmbuf_free(mi);
+		goto fail;
+	}
+	return mh;
+
+fail:
+	rte_pktmbuf_free(mh);
+	return NULL;
+}
+
+/*
+ * Filter a packet and make its mirror.  Returns NULL if it is not to be
+ * mirrored, otherwise sets the interface the mirror is from and whether
+ * it was truncated.
+ */
+static struct rte_mbuf *
+portmonitor_source_mirror(struct ifnet *ifp,
+			  const struct portmonitor_session *pmsess,
+			  struct rte_mbuf **m, uint8_t direction,
+			  struct ifnet **in_ifp, bool *truncated)
 {
 	enum npf_ruleset_type ruleset_type;
 	bool filter_active = false;
 	int filter_dir;
 	npf_result_t result;
 	struct rte_mbuf *mirror_pkt;
-	struct ifnet *dest_ifp;
-	struct portmonitor_session *pmsess;
-
-	if (!pminfo || pminfo->hw_mirroring)
-		return;
-
-	pmsess = pminfo->pm_session;
-	if (!pmsess || pmsess->disabled)
-		return;
-
-	dest_ifp = rcu_dereference(pmsess->dest_ifp);
-	if (!dest_ifp)
-		return;
+	uint32_t len = pmsess->truncate ? : UINT32_MAX;
+	bool rx_vlan;
 
 	pktmbuf_l2_len(*m) = ETHER_HDR_LEN;
 
@@ -252,44 +333,90 @@ static void portmonitor_source_output(struct ifnet *ifp,
 				npf_get_ruleset(npf_config, ruleset_type),
 				m, ifp, filter_dir, 0, htons(ETHER_TYPE_IPv4));
 		if (result.decision != NPF_DECISION_PASS)
-			return;
+			return NULL;
 	}
 
-	mirror_pkt = pktmbuf_copy(*m, (*m)->pool);
+	*truncated = rte_pktmbuf_pkt_len(*m) > len;
+	mirror_pkt = portmonitor_mirror_pkt(*m, len);
 	if (!mirror_pkt)
-		return;
+		return NULL;
 
-	if (((*m)->ol_flags & PKT_RX_VLAN) && ifp->qinq_inner) {
+	rx_vlan = (*m)->ol_flags & PKT_RX_VLAN;
+	if (rx_vlan && ifp->qinq_inner) {
 		if (unlikely(vid_encap(ifp->if_vlan, &mirror_pkt,
 				ETHER_TYPE_VLAN) == NULL)) {
 			rte_pktmbuf_free(mirror_pkt);
-			return;
+			return NULL;
 		}
 		ifp = ifp->if_parent;
 	}
 
-	switch (pmsess->session_type) {
-	case PORTMONITOR_SPAN:
-		if ((*m)->ol_flags & PKT_RX_VLAN)
-			pktmbuf_convert_rx_to_tx_vlan(mirror_pkt);
-		/* fall through */
-	case PORTMONITOR_RSPAN_SOURCE:
-		if_output(dest_ifp, mirror_pkt, ifp, ETH_P_TEB);
-		break;
-	case PORTMONITOR_ERSPAN_SOURCE:
-		/* capture mirrored packet on erspan tunnel */
-		if (unlikely(dest_ifp->capturing))
-			capture_burst(dest_ifp, &mirror_pkt, 1);
-		if (!portmonitor_encap_erspan_hdr(ifp, pmsess, mirror_pkt,
-							direction)) {
-			rte_pktmbuf_free(mirror_pkt);
-			return;
+	if (pmsess->session_type == PORTMONITOR_SPAN && rx_vlan)
+		pktmbuf_convert_rx_to_tx_vlan(mirror_pkt);
+
+	*in_ifp = ifp;
+	return mirror_pkt;
+}
+
+/*
+ * Mirror a burst of packets.  The mirrors are all made, and captured on
+ * an erspan tunnel, before any are sent.
+ */
+static void portmonitor_source_output(struct ifnet *ifp,
+				      const struct portmonitor_info *pminfo,
+				      struct rte_mbuf *mbi[], unsigned int n,
+				      uint8_t direction)
+{
+	struct rte_mbuf *mirror[n];
+	struct ifnet *in_ifp[n];
+	bool truncated[n];
+	struct ifnet *dest_ifp;
+	struct portmonitor_session *pmsess;
+	unsigned int i, nm = 0;
+
+	if (!pminfo || pminfo->hw_mirroring)
+		return;
+
+	pmsess = pminfo->pm_session;
+	if (!pmsess || pmsess->disabled)
+		return;
+
+	if (pmsess->session_type != PORTMONITOR_SPAN &&
+	    pmsess->session_type != PORTMONITOR_RSPAN_SOURCE &&
+	    pmsess->session_type != PORTMONITOR_ERSPAN_SOURCE)
+		return;
+
+	dest_ifp = rcu_dereference(pmsess->dest_ifp);
+	if (!dest_ifp)
+		return;
+
+	for (i = 0; i < n; i++) {
+		mirror[nm] = portmonitor_source_mirror(ifp, pmsess, &mbi[i],
+						       direction, &in_ifp[nm],
+						       &truncated[nm]);
+		if (mirror[nm])
+			nm++;
+	}
+	if (nm == 0)
+		return;
+
+	if (pmsess->session_type != PORTMONITOR_ERSPAN_SOURCE) {
+		for (i = 0; i < nm; i++)
+			if_output(dest_ifp, mirror[i], in_ifp[i], ETH_P_TEB);
+		return;
+	}
+
+	/* capture mirrored packets on erspan tunnel */
+	if (unlikely(dest_ifp->capturing))
+		capture_burst(dest_ifp, mirror, nm);
+
+	for (i = 0; i < nm; i++) {
+		if (!portmonitor_encap_erspan_hdr(in_ifp[i], pmsess, mirror[i],
+						  direction, truncated[i])) {
+			rte_pktmbuf_free(mirror[i]);
+			continue;
 		}
-		if_output(dest_ifp, mirror_pkt, ifp, pmsess->gre_proto);
-		break;
-	default:
-		rte_pktmbuf_free(mirror_pkt);
-		break;
+		if_output(dest_ifp, mirror[i], in_ifp[i], pmsess->gre_proto);
 	}
 }
 
@@ -308,7 +435,7 @@ void portmonitor_src_vif_rx_output(struct ifnet *ifp, struct rte_mbuf **m)
 		pminfo->pm_iftype != PM_SRC_SESSION_SRC_IF)
 		return;
 
-	portmonitor_source_output(ifp, pminfo, m, PORTMONITOR_DIRECTION_RX);
+	portmonitor_source_output(ifp, pminfo, m, 1, PORTMONITOR_DIRECTION_RX);
 }
 
 void portmonitor_src_vif_tx_output(struct ifnet *ifp, struct rte_mbuf **m)
@@ -326,14 +453,13 @@ void portmonitor_src_vif_tx_output(struct ifnet *ifp, struct rte_mbuf **m)
 		pminfo->pm_iftype != PM_SRC_SESSION_SRC_IF)
 		return;
 
-	portmonitor_source_output(ifp, pminfo, m, PORTMONITOR_DIRECTION_TX);
+	portmonitor_source_output(ifp, pminfo, m, 1, PORTMONITOR_DIRECTION_TX);
 }
 
 void portmonitor_src_phy_rx_output(struct ifnet *ifp, struct rte_mbuf *mbi[],
 					unsigned int n)
 {
 	struct portmonitor_info *pminfo;
-	unsigned int i;
 
 	pminfo = rcu_dereference(ifp->pminfo);
 	if (!pminfo)
@@ -343,16 +469,14 @@ void portmonitor_src_phy_rx_output(struct ifnet *ifp, struct rte_mbuf *mbi[],
 		pminfo->pm_iftype != PM_SRC_SESSION_SRC_IF)
 		return;
 
-	for (i = 0; i < n; i++)
-		portmonitor_source_output(ifp, pminfo, &(mbi[i]),
-						PORTMONITOR_DIRECTION_RX);
+	portmonitor_source_output(ifp, pminfo, mbi, n,
+				  PORTMONITOR_DIRECTION_RX);
 }
 
 void portmonitor_src_phy_tx_output(struct ifnet *ifp, struct rte_mbuf *mbi[],
 					unsigned int n)
 {
 	struct portmonitor_info *pminfo;
-	unsigned int i;
 
 	if (ifp->if_type == IFT_L2VLAN)
 		return;
@@ -365,9 +489,8 @@ void portmonitor_src_phy_tx_output(struct ifnet *ifp, struct rte_mbuf *mbi[],
 		pminfo->pm_iftype != PM_SRC_SESSION_SRC_IF)
 		return;
 
-	for (i = 0; i < n; i++)
-		portmonitor_source_output(ifp, pminfo, &(mbi[i]),
-						PORTMONITOR_DIRECTION_TX);
+	portmonitor_source_output(ifp, pminfo, mbi, n,
+				  PORTMONITOR_DIRECTION_TX);
 }
 
 /* Forward packet to SPAN port.
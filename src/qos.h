@@ -11,11 +11,13 @@
 
 
 #include <rte_sched.h>
+#include <rte_spinlock.h>
 
 #include "if_var.h"
 #include "npf/npf_ruleset.h"
 #include "fal_plugin.h"
 #include "json_writer.h"
+#include "pktmbuf.h"
 
 struct rte_sched_port;
 
@@ -33,6 +35,9 @@ struct rte_sched_port;
 
 #define QOS_MAX_DROP_PRECEDENCE 2
 
+/* Most software schedulers, each on its own transmit thread, for a port */
+#define QOS_MAX_SHARDS	4
+
 struct npf_act_grp;
 
 struct red_params {
@@ -139,12 +144,39 @@ struct queue_stats {
 	uint64_t n_pkts_red_dscp_dropped_lc[RTE_NUM_DSCP_MAPS];
 };
 
+/*
+ * Software scheduler for a port, split into shards.  Each shard is a DPDK
+ * scheduler with the whole configuration, run by the transmit thread of
+ * the packet ring with the same index.  A subport is only scheduled by one
+ * shard, so subport and pipe shaping are unchanged.  The shards share the
+ * port rate through a token bucket, from which each takes credit a chunk
+ * at a time.
+ */
+struct qos_shard_credit {
+	int64_t credit;			/* Bytes the shard may still send */
+} __rte_cache_aligned;
+
+struct qos_shards {
+	unsigned int n_shards;
+	struct rte_sched_port *port[QOS_MAX_SHARDS];	/* DPDK objects */
+	struct qos_shard_credit shard[QOS_MAX_SHARDS];
+
+	/* Port token bucket, only used with more than one shard */
+	rte_spinlock_t lock;
+	uint64_t tokens;		/* Bytes */
+	uint64_t tb_size;		/* Bytes */
+	uint64_t rate;			/* Bytes per second */
+	uint64_t chunk;			/* Bytes taken at a time */
+	uint64_t tsc;			/* Time of last refill */
+	int32_t overhead;		/* Bytes added to each frame */
+};
+
 /* Qos Scheduler handles (one per physical port) */
 struct sched_info {
 	int dev_id;			/* Device ID - DPDK or FAL */
 	union _dev_info {
 		struct _dpdk {
-			struct rte_sched_port *port;	/* DPDK object */
+			struct qos_shards *shards;	/* DPDK objects */
 		} dpdk;
 		struct _fal {
 			fal_object_t hw_port_sched_group; /* FAL object */
@@ -157,6 +189,8 @@ struct sched_info {
 	struct qos_tc_rate_info *profile_tc_rates;
 	struct qos_rate_info port_rate;
 	bool    enabled;
+	bool    classify_fwd;		/* Classify on forwarding cores */
+	uint32_t gen;			/* Stamped on classified packets */
 	struct rcu_head rcu;
 
 	/* subports and pipes as configured, actual size is in port_params */
@@ -235,7 +269,7 @@ extern struct qos_dev qos_devices[];
 #define QOS_DSCP_RESGRP_JSON(qinfo) \
 			qos_devices[qinfo->dev_id].qos_dscp_resgrp_json
 #define QOS_CONFIGURED(qinfo) \
-	(qinfo->dev_info.dpdk.port || qinfo->dev_info.fal.hw_port_id)
+	(qinfo->dev_info.dpdk.shards || qinfo->dev_info.fal.hw_port_id)
 
 /*
  * Given an interface walk back to the parent device (if a vlan)
@@ -249,6 +283,34 @@ static inline struct sched_info *qos_handle(const struct ifnet *ifp)
 	return rcu_dereference(ifp->if_qos);
 }
 
+/* Number of software scheduler shards running on the port */
+static inline unsigned int qos_sched_shards(const struct sched_info *qinfo)
+{
+	const struct qos_shards *shards =
+		rcu_dereference(qinfo->dev_info.dpdk.shards);
+
+	return shards ? shards->n_shards : 1;
+}
+
+/* Does the shard schedule the subport? */
+static inline bool
+qos_shard_owns_subport(unsigned int n_shards, unsigned int shard,
+		       unsigned int subport)
+{
+	return subport % n_shards == shard;
+}
+
+/* The shard that schedules the subport of the packet */
+static inline unsigned int
+qos_sched_shard(const struct sched_info *qinfo, unsigned int n_shards,
+		const struct rte_mbuf *m)
+{
+	if (n_shards == 1)
+		return 0;
+
+	return qinfo->vlan_map[pktmbuf_get_txvlanid(m)] % n_shards;
+}
+
 /*
  * The bottom RTE_SCHED_TC_BITS bits is the TC.
  * The next RTE_SCHED_WRR_BITS is the q index.
@@ -346,7 +408,9 @@ uint32_t qos_sched_calc_qindex(struct sched_info *qinfo, unsigned int subport,
 			       unsigned int pipe, unsigned int tc,
 			       unsigned int q);
 struct sched_info;
-int qos_sched(struct ifnet *ifp, struct sched_info *info,
+bool qos_classify_fwd(struct ifnet *ifp, struct sched_info *qinfo,
+		      struct rte_mbuf **m);
+int qos_sched(struct ifnet *ifp, struct sched_info *info, unsigned int shard,
 	      struct rte_mbuf **in, uint32_t n_in,
 	      struct rte_mbuf **out, uint32_t n_out);
 struct subport_info *qos_get_subport(const char *name, struct ifnet **ifp);
@@ -402,6 +466,14 @@ int qos_dpdk_enable(struct ifnet *ifp,
 int qos_dpdk_stop(__unused struct ifnet *ifp, struct sched_info *qinfo);
 int qos_dpdk_start(struct ifnet *ifp, struct sched_info *qinfo,
 		   uint64_t bps, uint16_t max_pkt_len);
+int qos_dpdk_start_shards(struct ifnet *ifp, struct sched_info *qinfo,
+			  uint64_t bps, uint16_t max_pkt_len,
+			  unsigned int n_shards);
+bool qos_shard_credit_get(struct qos_shards *shards,
+			  struct qos_shard_credit *sc);
+void qos_shard_credit_use(struct qos_shards *shards,
+			  struct qos_shard_credit *sc,
+			  struct rte_mbuf *pkts[], unsigned int n);
 
 /* The HW forwarding plugin functions */
 fal_object_t
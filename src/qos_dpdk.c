@@ -5,13 +5,16 @@
  * SPDX-License-Identifier: LGPL-2.1-only
  */
 
+#include <rte_cycles.h>
 #include <rte_ethdev.h>
 #include <rte_ether.h>
 #include <rte_lcore.h>
 #include <rte_log.h>
+#include <rte_malloc.h>
 #include <rte_mbuf.h>
 #include <rte_red.h>
 #include <rte_sched.h>
+#include "main.h"
 #include "qos.h"
 #include "json_writer.h"
 #include "netinet6/ip6_funcs.h"
@@ -31,8 +34,11 @@ static char *qos_get_dscp_grp(struct sched_info *qinfo, uint32_t qid, int i)
 	struct rte_red_pipe_params *wred_params;
 	int profile;
 
-	profile = rte_sched_get_profile_for_pipe(qinfo->dev_info.dpdk.port,
-						 qid);
+	if (qinfo->dev_info.dpdk.shards == NULL)
+		return NULL;
+
+	profile = rte_sched_get_profile_for_pipe(
+		qinfo->dev_info.dpdk.shards->port[0], qid);
 	if (profile < 0)
 		return NULL;
 
@@ -53,7 +59,11 @@ void qos_dpdk_dscp_resgrp_json(struct sched_info *qinfo, uint32_t subport,
 
 	qid = qos_sched_calc_qindex(qinfo, subport, pipe, tc, q);
 
-	num_maps = rte_red_queue_num_maps(qinfo->dev_info.dpdk.port, qid);
+	if (qinfo->dev_info.dpdk.shards == NULL)
+		return;
+
+	num_maps = rte_red_queue_num_maps(qinfo->dev_info.dpdk.shards->port[0],
+					  qid);
 	if (num_maps) {
 		char *grp_name;
 
@@ -78,13 +88,22 @@ int qos_dpdk_subport_read_stats(struct sched_info *qinfo,
 				struct rte_sched_subport_stats64 *queue_stats)
 {
 	uint32_t over[RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE];
-	struct rte_sched_port *port = qinfo->dev_info.dpdk.port;
+	struct qos_shards *shards = qinfo->dev_info.dpdk.shards;
 	struct rte_sched_subport_stats64 stats;
-	int ret, i;
+	unsigned int s;
+	int ret = 0, i;
 
+	if (shards == NULL)
+		return -EINVAL;
+
+	/* The counts are the sum over all shards */
 	rte_spinlock_lock(&qinfo->stats_lock);
-	ret = rte_sched_subport_read_stats64(port, subport, &stats, over);
-	if (ret == 0) {
+	for (s = 0; s < shards->n_shards; s++) {
+		ret = rte_sched_subport_read_stats64(shards->port[s], subport,
+						     &stats, over);
+		if (ret != 0)
+			break;
+
 		for (i = 0; i < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; i++) {
 			queue_stats->n_pkts_tc[i] += stats.n_pkts_tc[i];
 			queue_stats->n_bytes_tc[i] += stats.n_bytes_tc[i];
@@ -143,18 +162,28 @@ int qos_dpdk_queue_read_stats(struct sched_info *qinfo,
 			      uint64_t *qlen, bool *qlen_in_pkts)
 {
 	struct rte_sched_queue_stats64 stats;
-	struct rte_sched_port *port = qinfo->dev_info.dpdk.port;
+	struct qos_shards *shards = qinfo->dev_info.dpdk.shards;
 	uint32_t qid = qos_sched_calc_qindex(qinfo, subport, pipe, tc, q);
 	uint16_t qlen_16;
-	int ret, i;
+	unsigned int s;
+	int ret = 0, i;
+
+	if (shards == NULL)
+		return -EINVAL;
 
 	/*
 	 * The DPDK always measures queue length in the number of packets.
+	 * The counts and length are the sum over all shards.
 	 */
 	*qlen_in_pkts = true;
+	*qlen = 0;
 	rte_spinlock_lock(&qinfo->stats_lock);
-	ret = rte_sched_queue_read_stats64(port, qid, &stats, &qlen_16);
-	if (ret == 0) {
+	for (s = 0; s < shards->n_shards; s++) {
+		ret = rte_sched_queue_read_stats64(shards->port[s], qid,
+						   &stats, &qlen_16);
+		if (ret != 0)
+			break;
+
 		queue_stats->n_pkts += stats.n_pkts;
 		queue_stats->n_bytes += stats.n_bytes;
 		queue_stats->n_pkts_dropped += stats.n_pkts_dropped;
@@ -162,7 +191,7 @@ int qos_dpdk_queue_read_stats(struct sched_info *qinfo,
 		for (i = 0; i < RTE_NUM_DSCP_MAPS; i++)
 			queue_stats->n_pkts_red_dscp_dropped[i] +=
 				stats.n_pkts_red_dscp_dropped[i];
-		*qlen = qlen_16;
+		*qlen += qlen_16;
 	}
 	rte_spinlock_unlock(&qinfo->stats_lock);
 
@@ -201,10 +230,22 @@ int qos_dpdk_queue_clear_stats(struct sched_info *qinfo,
 	return rv;
 }
 
+static void qos_dpdk_shards_free(struct qos_shards *shards)
+{
+	unsigned int s;
+
+	if (shards == NULL)
+		return;
+
+	for (s = 0; s < shards->n_shards; s++)
+		if (shards->port[s])
+			rte_sched_port_free(shards->port[s]);
+	rte_free(shards);
+}
+
 void qos_dpdk_free(struct sched_info *qinfo)
 {
-	if (qinfo->dev_info.dpdk.port)
-		rte_sched_port_free(qinfo->dev_info.dpdk.port);
+	qos_dpdk_shards_free(qinfo->dev_info.dpdk.shards);
 }
 
 int qos_dpdk_port(struct ifnet *ifp,
@@ -285,18 +326,23 @@ int qos_dpdk_enable(struct ifnet *ifp,
 	/* If link is already up, then start now */
 	struct if_link_status link;
 
+	/*
+	 * The transmit threads are set up first, as the number of
+	 * scheduler shards depends on the number of packet rings.
+	 */
+	if (enable_transmit_thread(ifp->if_port) < 0) {
+		DP_DEBUG(QOS_DP, ERR, DATAPLANE,
+			 "Transmit thread setup failed\n");
+		qinfo->enabled = false;
+		return -ENODEV;
+	}
+
 	if_get_link_status(ifp, &link);
 
 	if (link.link_status &&
 	    qos_sched_start(ifp, link.link_speed) < 0) {
 		DP_DEBUG(QOS_DP, ERR, DATAPLANE, "Qos start failed\n");
-		qinfo->enabled = false;
-		return -ENODEV;
-	}
-
-	if (enable_transmit_thread(ifp->if_port) < 0) {
-		DP_DEBUG(QOS_DP, ERR, DATAPLANE,
-			 "Transmit thread setup failed\n");
+		disable_transmit_thread(ifp->if_port);
 		qinfo->enabled = false;
 		return -ENODEV;
 	}
@@ -309,7 +355,7 @@ int qos_dpdk_enable(struct ifnet *ifp,
 /* Callback after all forwarding threads have cleared. */
 static void qos_dpdk_port_free_rcu(void *arg)
 {
-	rte_sched_port_free(arg);
+	qos_dpdk_shards_free(arg);
 }
 
 /* Return the total queue-array length for the subport.
@@ -333,54 +379,60 @@ static uint32_t qos_sched_subport_qsize(struct rte_sched_port_params *pp,
 		pp->n_pipes_per_subport * sizeof(struct rte_mbuf *));
 }
 
-/* Allocate and initialize a handle to QoS scheduler.
- * Only called by master thread.
+/*
+ * Packets for a subport only reach the shard that owns it, so the other
+ * shards only need the smallest queues for the subport.
  */
-int qos_dpdk_start(struct ifnet *ifp, struct sched_info *qinfo,
-		   uint64_t bps, uint16_t max_pkt_len)
+#define QOS_SHARD_IDLE_QSIZE	1
+
+/*
+ * Configure the DPDK scheduler for one shard.  All subports and pipes are
+ * configured, so that the classification is the same on every shard, but
+ * only the subports owned by the shard get their full queue sizes.
+ */
+static struct rte_sched_port *
+qos_dpdk_port_config(struct sched_info *qinfo, unsigned int shard,
+		     unsigned int n_shards)
 {
-	struct rte_sched_port *port, *old_port = NULL;
+	uint32_t idle_qsize[RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE];
+	struct rte_sched_port *port;
 	unsigned int subport, pipe;
-	int ret;
-	uint32_t q_array_size;
+	uint32_t q_array_size = 0;
+	uint32_t *sp_qsize;
+	int ret, i;
+
+	for (i = 0; i < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; i++)
+		idle_qsize[i] = QOS_SHARD_IDLE_QSIZE;
 
-	/*
-	 * Allow subports to inherit their queue sizes from the port, and
-	 * calculate the total size of queue array this port will need.
-	 */
-	q_array_size = 0;
 	for (subport = 0; subport < qinfo->n_subports; subport++) {
-		struct subport_info *sinfo = &qinfo->subport[subport];
+		if (qos_shard_owns_subport(n_shards, shard, subport))
+			sp_qsize = qinfo->subport[subport].qsize;
+		else
+			sp_qsize = idle_qsize;
 
 		q_array_size += qos_sched_subport_qsize(&qinfo->port_params,
-							sinfo->qsize);
-
-		/*
-		 * Establish subport rates before checking pipes so that the
-		 * pipes can be checked against their actual subport rates.
-		 */
-		qos_sched_subport_params_check(
-			&sinfo->params, &sinfo->subport_rate,
-			sinfo->sp_tc_rates.tc_rate, max_pkt_len, bps);
+							sp_qsize);
 	}
 
-	qos_sched_pipe_check(qinfo, max_pkt_len, bps);
-
 	port = rte_sched_port_config_v2(&qinfo->port_params, q_array_size);
 	if (port == NULL) {
 		DP_DEBUG(QOS_DP, ERR, DATAPLANE,
 			 "QoS config port failed\n");
-		return -1;
+		return NULL;
 	}
 
 	for (subport = 0; subport < qinfo->n_subports; subport++) {
 		struct subport_info *sinfo = &qinfo->subport[subport];
 		struct rte_sched_subport_params *params = &sinfo->params;
 		uint16_t qsize[RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE];
-		int i;
+
+		if (qos_shard_owns_subport(n_shards, shard, subport))
+			sp_qsize = sinfo->qsize;
+		else
+			sp_qsize = idle_qsize;
 
 		for (i = 0; i < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; i++)
-			qsize[i] = (uint16_t)sinfo->qsize[i];
+			qsize[i] = (uint16_t)sp_qsize[i];
 
 		ret = rte_sched_subport_config_v2(port, subport, params,
 						  &qsize[0], sinfo->red_params);
@@ -405,35 +457,118 @@ int qos_dpdk_start(struct ifnet *ifp, struct sched_info *qinfo,
 				goto out_free_sched;
 			}
 		}
+	}
+	return port;
+
+ out_free_sched:
+	rte_sched_port_free(port);
+	return NULL;
+}
+
+/* Allocate and initialize a handle to QoS scheduler with n_shards
+ * shards.  Only called by master thread.
+ */
+int qos_dpdk_start_shards(struct ifnet *ifp, struct sched_info *qinfo,
+			  uint64_t bps, uint16_t max_pkt_len,
+			  unsigned int n_shards)
+{
+	struct qos_shards *shards, *old_shards = NULL;
+	unsigned int subport, s;
+
+	if (n_shards == 0 || n_shards > QOS_MAX_SHARDS)
+		return -1;
+
+	/*
+	 * Allow subports to inherit their queue sizes from the port.
+	 */
+	for (subport = 0; subport < qinfo->n_subports; subport++) {
+		struct subport_info *sinfo = &qinfo->subport[subport];
+
+		qos_sched_subport_qsize(&qinfo->port_params, sinfo->qsize);
+
+		/*
+		 * Establish subport rates before checking pipes so that the
+		 * pipes can be checked against their actual subport rates.
+		 */
+		qos_sched_subport_params_check(
+			&sinfo->params, &sinfo->subport_rate,
+			sinfo->sp_tc_rates.tc_rate, max_pkt_len, bps);
+	}
+
+	qos_sched_pipe_check(qinfo, max_pkt_len, bps);
+
+	shards = rte_zmalloc_socket("qos_shards", sizeof(*shards),
+				    RTE_CACHE_LINE_SIZE,
+				    qinfo->port_params.socket);
+	if (shards == NULL) {
+		DP_DEBUG(QOS_DP, ERR, DATAPLANE,
+			 "out of memory for qos shards\n");
+		return -1;
+	}
 
-		/* Update NPF rules */
-		npf_cfg_commit_all();
+	for (s = 0; s < n_shards; s++) {
+		shards->port[s] = qos_dpdk_port_config(qinfo, s, n_shards);
+		if (shards->port[s] == NULL)
+			goto out_free_shards;
+		shards->n_shards = s + 1;
 	}
 
+	rte_spinlock_init(&shards->lock);
+	shards->rate = bps;
+	shards->overhead = qinfo->port_params.frame_overhead;
+	shards->chunk = 8 * max_pkt_len;
+	shards->tb_size = RTE_MAX(bps / 1000, 2 * shards->chunk);
+	shards->tokens = shards->tb_size;
+	shards->tsc = rte_rdtsc();
+
+	/* Update NPF rules */
+	npf_cfg_commit_all();
+
 	/* Use RCU to set the pointer because changed by master thread
 	 * but referenced by Tx thread
 	 */
-	DP_DEBUG(QOS_DP, DEBUG, DATAPLANE,  "QoS on port %s enabled\n",
-		 ifp->if_name);
-	old_port = qinfo->dev_info.dpdk.port;
-	rcu_assign_pointer(qinfo->dev_info.dpdk.port, port);
-	defer_rcu(qos_dpdk_port_free_rcu, old_port);
+	DP_DEBUG(QOS_DP, DEBUG, DATAPLANE,
+		 "QoS on port %s enabled with %u shards\n",
+		 ifp->if_name, n_shards);
+	old_shards = qinfo->dev_info.dpdk.shards;
+	rcu_assign_pointer(qinfo->dev_info.dpdk.shards, shards);
+	defer_rcu(qos_dpdk_port_free_rcu, old_shards);
 	return 0;
 
- out_free_sched:
-	rte_sched_port_free(port);
+ out_free_shards:
+	qos_dpdk_shards_free(shards);
 	return -1;
 }
 
+/* Allocate and initialize a handle to QoS scheduler.
+ * Only called by master thread.
+ */
+int qos_dpdk_start(struct ifnet *ifp, struct sched_info *qinfo,
+		   uint64_t bps, uint16_t max_pkt_len)
+{
+	unsigned int n_shards;
+
+	/*
+	 * One shard per packet ring, but no more than there are subports
+	 * to spread over them.
+	 */
+	n_shards = RTE_MIN(port_transmit_rings(ifp->if_port),
+			   RTE_MIN(qinfo->n_subports, QOS_MAX_SHARDS));
+	if (n_shards == 0)
+		n_shards = 1;
+
+	return qos_dpdk_start_shards(ifp, qinfo, bps, max_pkt_len, n_shards);
+}
+
 int qos_dpdk_stop(__unused struct ifnet *ifp, struct sched_info *qinfo)
 {
-	struct rte_sched_port *port = qinfo->dev_info.dpdk.port;
+	struct qos_shards *shards = qinfo->dev_info.dpdk.shards;
 
-	if (port == NULL)
+	if (shards == NULL)
 		return 0; /* qos not started */
 
-	rcu_assign_pointer(qinfo->dev_info.dpdk.port, NULL);
-	defer_rcu(qos_dpdk_port_free_rcu, port);
+	rcu_assign_pointer(qinfo->dev_info.dpdk.shards, NULL);
+	defer_rcu(qos_dpdk_port_free_rcu, shards);
 
 	return 0;
 }
@@ -537,18 +672,28 @@ static int qos_classify(struct ifnet *ifp, struct sched_info *qinfo,
 	 * NPF is run for classification to the pipe level
 	 * so we need to check whether a packet has been
 	 * dropped via policing and repack the array.
+	 * Packets already classified by a forwarding core
+	 * only need to be enqueued, unless that was against
+	 * an earlier configuration, whose subport and pipe
+	 * may not exist in this one.
 	 */
 	for (i = j = 0; i < n_pkts; i++) {
-		if (qos_npf_classify(ifp, qinfo,
-				     &(enq_pkts[i])) == NPF_DECISION_BLOCK) {
-			rte_pktmbuf_free(enq_pkts[i]);
-			continue;
-		}
+		if (!pktmbuf_mdata_exists(enq_pkts[i],
+					  PKT_MDATA_QOS_CLASSIFIED) ||
+		    unlikely(pktmbuf_mdata(enq_pkts[i])->md_qos_gen !=
+			     qinfo->gen)) {
+			if (qos_npf_classify(ifp, qinfo, &(enq_pkts[i])) ==
+			    NPF_DECISION_BLOCK) {
+				rte_pktmbuf_free(enq_pkts[i]);
+				continue;
+			}
 
-		/*
-		 * Ensure session is cleared from pkts.
-		 */
-		pktmbuf_mdata_clear(enq_pkts[i], PKT_MDATA_SESSION_SENTRY);
+			/*
+			 * Ensure session is cleared from pkts.
+			 */
+			pktmbuf_mdata_clear(enq_pkts[i],
+					    PKT_MDATA_SESSION_SENTRY);
+		}
 		if (i != j)
 			enq_pkts[j] = enq_pkts[i];
 		j++;
@@ -556,19 +701,82 @@ static int qos_classify(struct ifnet *ifp, struct sched_info *qinfo,
 	return j;
 }
 
+/*
+ * Classify and police a packet on the forwarding core, so that the
+ * transmit thread only has to enqueue it.  Returns false if the packet
+ * has been dropped.
+ */
+bool qos_classify_fwd(struct ifnet *ifp, struct sched_info *qinfo,
+		      struct rte_mbuf **m)
+{
+	if (qos_npf_classify(ifp, qinfo, m) == NPF_DECISION_BLOCK) {
+		rte_pktmbuf_free(*m);
+		return false;
+	}
+
+	pktmbuf_mdata_clear(*m, PKT_MDATA_SESSION_SENTRY);
+	pktmbuf_mdata_set(*m, PKT_MDATA_QOS_CLASSIFIED);
+	pktmbuf_mdata(*m)->md_qos_gen = qinfo->gen;
+	return true;
+}
+
+/*
+ * Make sure the shard has credit to send, taking a chunk from the port
+ * token bucket if not.  Returns false if the port rate has been used up.
+ */
+bool qos_shard_credit_get(struct qos_shards *shards,
+			  struct qos_shard_credit *sc)
+{
+	uint64_t now, elapsed, grab;
+
+	if (likely(sc->credit > 0))
+		return true;
+
+	rte_spinlock_lock(&shards->lock);
+	now = rte_rdtsc();
+	/* Limit so that elapsed * rate can not overflow */
+	elapsed = RTE_MIN(now - shards->tsc, rte_get_tsc_hz() / 128);
+	shards->tokens = RTE_MIN(shards->tokens +
+				 elapsed * shards->rate / rte_get_tsc_hz(),
+				 shards->tb_size);
+	shards->tsc = now;
+
+	grab = RTE_MIN(shards->tokens, shards->chunk);
+	shards->tokens -= grab;
+	sc->credit += grab;
+	rte_spinlock_unlock(&shards->lock);
+
+	return sc->credit > 0;
+}
+
+/* Charge the shard for the packets it has dequeued */
+void qos_shard_credit_use(struct qos_shards *shards,
+			  struct qos_shard_credit *sc,
+			  struct rte_mbuf *pkts[], unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sc->credit -= (int64_t)pkts[i]->pkt_len + shards->overhead;
+}
+
 /* Put/get packets currently ready to send from DPDK */
-int qos_sched(struct ifnet *ifp, struct sched_info *qinfo,
+int qos_sched(struct ifnet *ifp, struct sched_info *qinfo, unsigned int shard,
 	      struct rte_mbuf *enq_pkts[], uint32_t n_pkts,
 	      struct rte_mbuf *deq_pkts[], uint32_t space)
 {
-	struct rte_sched_port *port =
-		rcu_dereference(qinfo->dev_info.dpdk.port);
+	struct qos_shards *shards =
+		rcu_dereference(qinfo->dev_info.dpdk.shards);
+	struct rte_sched_port *port;
+	struct qos_shard_credit *sc;
+	int n;
 
-	if (unlikely(port == NULL)) {
+	if (unlikely(shards == NULL || shard >= shards->n_shards)) {
 		/* qos not started, because link down or race */
 		pktmbuf_free_bulk(enq_pkts, n_pkts);
 		return 0;
 	}
+	port = shards->port[shard];
 
 	if (n_pkts > 0) {
 		n_pkts = qos_classify(ifp, qinfo, enq_pkts, n_pkts);
@@ -580,9 +788,23 @@ int qos_sched(struct ifnet *ifp, struct sched_info *qinfo,
 			rte_sched_port_enqueue(port, enq_pkts, n_pkts);
 	}
 
+	if (space == 0)
+		return 0;
+
 	/* Get what is available to send */
-	if (space > 0)
+	if (shards->n_shards == 1)
 		return rte_sched_port_dequeue(port, deq_pkts, space);
-	else
+
+	/*
+	 * Each shard is shaped to the port rate, so the shards also have
+	 * to share it.  The credit may go negative by up to a burst, which
+	 * is paid back before the shard sends again.
+	 */
+	sc = &shards->shard[shard];
+	if (!qos_shard_credit_get(shards, sc))
 		return 0;
+
+	n = rte_sched_port_dequeue(port, deq_pkts, space);
+	qos_shard_credit_use(shards, sc, deq_pkts, n);
+	return n;
 }
@@ -303,6 +303,12 @@ void qos_sched_free_rcu(struct rcu_head *head)
 	qos_sched_free(caa_container_of(head, struct sched_info, rcu));
 }
 
+/*
+ * Each scheduler object gets a new generation, so that packets classified
+ * by the forwarding cores against an older one can be told apart.
+ */
+static uint32_t qos_sched_gen;
+
 /* Create new QoS scheduler object.
  * The object is not ready to use until all the profiles and other
  * tables are configured
@@ -328,6 +334,7 @@ struct sched_info *qos_sched_new(struct ifnet *ifp,
 	qinfo = zmalloc_aligned(sizeof(struct sched_info));
 	if (!qinfo)
 		goto nomem0;
+	qinfo->gen = ++qos_sched_gen;
 
 	qinfo->queue_map = calloc(profiles, sizeof(struct queue_map));
 	if (!qinfo->queue_map)
@@ -905,6 +912,10 @@ static void show_ifp_qos(struct ifnet *ifp, void *arg)
 	jsonw_name(wr, "shaper");
 	jsonw_start_object(wr);
 
+	if (qinfo->dev_id == QOS_DPDK_ID)
+		jsonw_string_field(wr, "classify", qinfo->classify_fwd ?
+				   "forwarding" : "transmit");
+
 	/* Show VLAN to subport mapping - skip default slots */
 	jsonw_name(wr, "vlans");
 	jsonw_start_array(wr);
@@ -1359,18 +1370,22 @@ static int cmd_qos_port(struct ifnet *ifp, int argc, char **argv)
 {
 	unsigned int subports = 0, pipes = 0, profiles = 1;
 	int32_t overhead = RTE_SCHED_FRAME_OVERHEAD_DEFAULT;
+	bool classify_fwd = false;
 	int ret;
 
 	/*
 	 * Expected command format:
 	 *
-	 * "port <a> subports <b> pipes <c> profiles <d> [overhead <e>]"
+	 * "port <a> subports <b> pipes <c> profiles <d> [overhead <e>]
+	 *  [classify <f>]"
 	 *
 	 * <a> - port-id
 	 * <b> - number of configured subports
 	 * <c> - number of configured pipes
 	 * <d> - number of configured profiles
 	 * <e> - frame-overhead
+	 * <f> - where packets are classified, "transmit" (the default)
+	 *       or "forwarding"
 	 */
 	--argc, ++argv;	/* skip "port" */
 	while (argc > 0) {
@@ -1382,7 +1397,18 @@ static int cmd_qos_port(struct ifnet *ifp, int argc, char **argv)
 			return -EINVAL;
 		}
 
-		if (strcmp(argv[0], "overhead") == 0) {
+		if (strcmp(argv[0], "classify") == 0) {
+			if (strcmp(argv[1], "forwarding") == 0)
+				classify_fwd = true;
+			else if (strcmp(argv[1], "transmit") == 0)
+				classify_fwd = false;
+			else {
+				DP_DEBUG(QOS, ERR, DATAPLANE,
+					 "unknown classify value: '%s'\n",
+					 argv[1]);
+				return -EINVAL;
+			}
+		} else if (strcmp(argv[0], "overhead") == 0) {
 			int inp_ov;
 
 			if (get_signed(argv[1], &inp_ov) < 0) {
@@ -1424,9 +1450,11 @@ static int cmd_qos_port(struct ifnet *ifp, int argc, char **argv)
 	 * ENODEV means there's no hardware support for this device
 	 */
 	ret = qos_hw_port(ifp, subports, pipes, profiles, overhead);
-	if (ret == -ENODEV)
-		return qos_dpdk_port(ifp, subports, pipes, profiles, overhead);
-
+	if (ret == -ENODEV) {
+		ret = qos_dpdk_port(ifp, subports, pipes, profiles, overhead);
+		if (ret == 0)
+			ifp->if_qos->classify_fwd = classify_fwd;
+	}
 
 	return ret;
 }
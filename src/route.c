@@ -14,6 +14,7 @@
 #include <pthread.h>
 #include <rte_branch_prediction.h>
 #include <rte_common.h>
+#include <rte_cycles.h>
 #include <rte_debug.h>
 #include <rte_ether.h>
 #include <rte_fbk_hash.h>
@@ -34,6 +35,7 @@
 
 #include "compiler.h"
 #include "compat.h"
+#include "config.h"
 #include "dp_event.h"
 #include "ecmp.h"
 #include "fal.h"
@@ -88,6 +90,7 @@ struct next_hop_u {
 	uint8_t              proto;	/* routing protocol */
 	uint32_t             index;
 	uint32_t             refcount;	/* # of LPM's referring */
+	uint16_t             *buckets;	/* resilient hash table (ECMP) */
 	struct next_hop      hop0;      /* optimization for non-ECMP */
 	struct cds_lfht_node nh_node;
 	enum pd_obj_state    pd_state;
@@ -121,6 +124,57 @@ struct nexthop_hash_key {
 
 static pthread_mutex_t route_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Set between rt_batch_begin() and rt_batch_end(), when changes to the
+ * forwarding tables are deferred so they can be applied together.
+ */
+static bool rt_batch_active;
+
+/*
+ * Nexthops whose last route was removed during the batch.  The
+ * forwarding threads can reach them until the batch is committed, so
+ * the references are only dropped after that and a grace period.
+ */
+static uint32_t *rt_batch_puts;
+static unsigned int rt_batch_nputs;
+static unsigned int rt_batch_puts_size;
+
+/*
+ * A batch changing at least this many prefixes, and at least half of
+ * the table, is applied by building a new table and swapping it in if
+ * route-shadow-swap is enabled.
+ */
+#define RT_SHADOW_MIN_PREFIXES 65536
+
+/*
+ * Drop the reference a route held on a nexthop, once the forwarding
+ * threads can no longer find it through the route.
+ */
+static void route_nexthop_put(uint32_t idx)
+{
+	unsigned int size;
+	uint32_t *puts;
+
+	if (!rt_batch_active) {
+		nexthop_put(idx);
+		return;
+	}
+
+	if (rt_batch_nputs == rt_batch_puts_size) {
+		size = rt_batch_puts_size ? 2 * rt_batch_puts_size : 512;
+		puts = realloc(rt_batch_puts, size * sizeof(*puts));
+		if (!puts) {
+			/* Safer to leak the nexthop than to free it early */
+			RTE_LOG(ERR, ROUTE,
+				"No memory to release nexthop %u\n", idx);
+			return;
+		}
+		rt_batch_puts = puts;
+		rt_batch_puts_size = size;
+	}
+	rt_batch_puts[rt_batch_nputs++] = idx;
+}
+
 static const struct reserved_route {
 	in_addr_t addr;
 	int prefix_length;
@@ -194,6 +248,9 @@ route_lpm_add(vrfid_t vrf_id, struct lpm *lpm, uint32_t ip,
 		rcu_dereference(nh_tbl.entry[next_hop]);
 	bool update_pd_state = true;
 
+	if (rt_batch_active)
+		lpm_update_begin(lpm);
+
 	rc = lpm_add(lpm, ntohl(ip), depth, next_hop, scope, &pd_state,
 			 &old_nh, &old_pd_state);
 	switch (rc) {
@@ -289,6 +346,9 @@ route_lpm_delete(vrfid_t vrf_id, struct lpm *lpm, uint32_t ip,
 	uint32_t new_nh;
 	bool promoted = false;
 
+	if (rt_batch_active)
+		lpm_update_begin(lpm);
+
 	rc = lpm_delete(lpm, ntohl(ip), depth, next_hop, scope, &pd_state,
 			    &new_nh, &new_pd_state);
 	switch (rc) {
@@ -511,7 +571,7 @@ rt_lpm_del_reserved_routes(struct lpm *lpm, struct vrf *vrf)
 				nh_idx, err_code);
 			return false;
 		}
-		nexthop_put(nh_idx);
+		route_nexthop_put(nh_idx);
 	}
 
 	return true;
@@ -571,6 +631,7 @@ static struct lpm *rt_get_lpm(struct route_head *rt_head, uint32_t id)
 }
 
 static struct next_hop *nexthop_mp_select(struct next_hop *next,
+					  const uint16_t *buckets,
 					  uint32_t size,
 					  uint32_t hash)
 {
@@ -579,7 +640,7 @@ static struct next_hop *nexthop_mp_select(struct next_hop *next,
 	if (ecmp_max_path && ecmp_max_path < size)
 		size = ecmp_max_path;
 
-	path = ecmp_lookup(size, hash);
+	path = ecmp_lookup_resilient(buckets, size, hash);
 	if (unlikely(next[path].flags & RTF_DEAD)) {
 		/* retry to find a good path */
 		for (path = 0; path < size; path++) {
@@ -614,7 +675,8 @@ inline struct next_hop *nexthop_select(uint32_t nh_idx,
 	if (likely(size == 1))
 		return next;
 
-	return nexthop_mp_select(next, size, ecmp_mbuf_hash(m, ether_type));
+	return nexthop_mp_select(next, nextu->buckets, size,
+				 ecmp_mbuf_hash(m, ether_type));
 }
 
 struct next_hop *nexthop_get(uint32_t nh_idx, uint8_t *size)
@@ -682,11 +744,67 @@ struct next_hop *rt_lookup_fast(struct vrf *vrf, in_addr_t dst,
 	return nh;
 }
 
-inline bool is_local_ipv4(vrfid_t vrf_id, in_addr_t dst)
+/*
+ * Lookup nexthops for up to RT_LOOKUP_BULK_MAX destination addresses
+ * in the same table, with the LPM lookups for all of them overlapped.
+ *
+ * Assumes both the VRF ID is valid and the VRF exists.
+ *
+ * Sets each entry of nh to an RCU protected nexthop structure or NULL.
+ */
+void rt_lookup_fast_bulk(struct vrf *vrf, const in_addr_t *dst,
+			 uint32_t tblid, struct rte_mbuf * const *m,
+			 struct next_hop **nh, unsigned int n)
+{
+	uint32_t idx[RT_LOOKUP_BULK_MAX];
+	uint32_t ips[RT_LOOKUP_BULK_MAX];
+	struct lpm *lpm;
+	unsigned int i;
+
+	assert(n <= RT_LOOKUP_BULK_MAX);
+
+	lpm = rcu_dereference(vrf->v_rt4_head.rt_table[tblid]);
+
+	for (i = 0; i < n; i++)
+		ips[i] = ntohl(dst[i]);
+
+	lpm_lookup_bulk(lpm, ips, idx, n);
+
+	for (i = 0; i < n; i++) {
+		if (unlikely(idx[i] == LPM_LOOKUP_MISS)) {
+			nh[i] = NULL;
+			continue;
+		}
+
+		nh[i] = nexthop_select(idx[i], m[i], ETHER_TYPE_IPv4);
+		if (nh[i] && unlikely(nh[i]->flags & RTF_NOROUTE))
+			nh[i] = NULL;
+	}
+}
+
+static ALWAYS_INLINE bool nexthop_idx_is_local(uint32_t idx)
 {
-	struct vrf *vrf = vrf_get_rcu(vrf_id);
 	struct next_hop_u *nextu;
 	struct next_hop *next;
+
+	nextu = rcu_dereference(nh_tbl.entry[idx]);
+	if (unlikely(!nextu))
+		return false;
+
+	next = rcu_dereference(nextu->siblings);
+	if (next->flags & RTF_LOCAL)
+		return true;
+
+	return false;
+}
+
+/*
+ * Is the address local, as seen by the forwarding threads.  Route
+ * changes in a batch that has not been committed yet are not seen.
+ */
+inline bool is_local_ipv4(vrfid_t vrf_id, in_addr_t dst)
+{
+	struct vrf *vrf = vrf_get_rcu(vrf_id);
 	struct lpm *lpm;
 	uint32_t idx;
 
@@ -698,15 +816,31 @@ inline bool is_local_ipv4(vrfid_t vrf_id, in_addr_t dst)
 	if (unlikely(lpm_lookup(lpm, ntohl(dst), &idx) != 0))
 		return false;
 
-	nextu = rcu_dereference(nh_tbl.entry[idx]);
-	if (unlikely(!nextu))
+	return nexthop_idx_is_local(idx);
+}
+
+/*
+ * Is the address local, for the control threads.  This includes route
+ * changes in a batch that has not been committed yet.
+ */
+bool is_local_ipv4_ctrl(vrfid_t vrf_id, in_addr_t dst)
+{
+	struct vrf *vrf = vrf_get_rcu(vrf_id);
+	struct lpm *lpm;
+	uint32_t idx;
+	int rc;
+
+	if (!vrf)
 		return false;
 
-	next = rcu_dereference(nextu->siblings);
-	if (next->flags & RTF_LOCAL)
-		return true;
+	pthread_mutex_lock(&route_mutex);
+	lpm = vrf->v_rt4_head.rt_table[RT_TABLE_MAIN];
+	rc = lpm_lookup_ctrl(lpm, ntohl(dst), &idx);
+	pthread_mutex_unlock(&route_mutex);
+	if (rc != 0)
+		return false;
 
-	return false;
+	return nexthop_idx_is_local(idx);
 }
 
 struct next_hop *
@@ -856,6 +990,16 @@ static struct next_hop_u *nexthop_alloc(int size)
 			free(nextu);
 			return NULL;
 		}
+		if (size <= ECMP_RESILIENT_BUCKETS) {
+			nextu->buckets = calloc(ECMP_RESILIENT_BUCKETS,
+						sizeof(*nextu->buckets));
+			if (unlikely(nextu->buckets == NULL)) {
+				free(nextu->siblings);
+				free(nextu->nh_fal_obj);
+				free(nextu);
+				return NULL;
+			}
+		}
 	}
 	nextu->nsiblings = size;
 	return nextu;
@@ -870,10 +1014,47 @@ static void __nexthop_destroy(struct next_hop_u *nextu)
 	if (nextu->siblings != &nextu->hop0)
 		free(nextu->siblings);
 
+	free(nextu->buckets);
 	free(nextu->nh_fal_obj);
 	free(nextu);
 }
 
+/*
+ * (Re)build the resilient hash table of an ECMP nexthop from the
+ * current path state.
+ */
+static void nexthop_resilient_update(struct next_hop_u *nextu)
+{
+	bool dead[ECMP_RESILIENT_BUCKETS];
+	uint32_t i, size = nextu->nsiblings;
+
+	if (!nextu->buckets)
+		return;
+
+	if (ecmp_max_path && ecmp_max_path < size)
+		size = ecmp_max_path;
+
+	for (i = 0; i < size; i++)
+		dead[i] = nextu->siblings[i].flags & RTF_DEAD;
+
+	ecmp_resilient_fill(nextu->buckets, size, dead);
+}
+
+/* ECMP max-path has changed */
+void nexthop_resilient_refresh(void)
+{
+	struct next_hop_u *nhu;
+	struct cds_lfht_iter iter;
+	struct cds_lfht_node *node;
+
+	ASSERT_MASTER();
+
+	cds_lfht_for_each(nexthop_hash, &iter, node) {
+		nhu = caa_container_of(node, struct next_hop_u, nh_node);
+		nexthop_resilient_update(nhu);
+	}
+}
+
 /*
  * Remove the old NH from the hash and add the new one. Can not
  * use a call to cds_lfht_add_replace() or any of the variants
@@ -963,6 +1144,7 @@ int nexthop_new(const struct next_hop *nh, uint16_t size, uint8_t proto,
 		nextu->hop0 = *nh;
 	} else {
 		memcpy(nextu->siblings, nh, size * sizeof(struct next_hop));
+		nexthop_resilient_update(nextu);
 	}
 	if (unlikely(nexthop_hash_insert(nextu, &key))) {
 		__nexthop_destroy(nextu);
@@ -1265,6 +1447,7 @@ route_nh_replace(struct next_hop_u *nextu, uint32_t nh_idx, struct llentry *lle,
 	new_nextu->nhg_fal_obj = nextu->nhg_fal_obj;
 	memcpy(new_nextu->nh_fal_obj, nextu->nh_fal_obj,
 	       new_nextu->nsiblings * sizeof(*new_nextu->nh_fal_obj));
+	nexthop_resilient_update(new_nextu);
 
 	assert(nh_tbl.entry[nh_idx] == nextu);
 	rcu_xchg_pointer(&nh_tbl.entry[nh_idx], new_nextu);
@@ -1349,7 +1532,7 @@ static void subtree_walk_route_cleanup_cb(struct lpm *lpm,
 			ret);
 	}
 
-	nexthop_put(idx);
+	route_nexthop_put(idx);
 }
 
 static unsigned int lle_routing_insert_arp_cb(struct lltable *llt __unused,
@@ -1710,7 +1893,7 @@ int rt_insert(vrfid_t vrf_id, in_addr_t dst, uint8_t depth, uint32_t tableid,
 		route_delete_unlink_arp(vrf, lpm, ntohl(dst), depth);
 		if (route_lpm_delete(vrf_id, lpm, dst, depth, &old,
 				     scope) >= 0)
-			nexthop_put(old);
+			route_nexthop_put(old);
 		else
 			replace = false;
 	}
@@ -1781,7 +1964,7 @@ int rt_delete(vrfid_t vrf_id, in_addr_t dst, uint8_t depth,
 	err = route_lpm_delete(vrf_id, lpm, dst, depth, &idx, scope);
 	if (err >= 0) {
 		/* Drop reference count on nexthop entry. */
-		nexthop_put(idx);
+		route_nexthop_put(idx);
 		route_delete_relink_arp(lpm, ntohl(dst), depth);
 	}
 
@@ -1808,6 +1991,105 @@ int rt_delete(vrfid_t vrf_id, in_addr_t dst, uint8_t depth,
 	return 0;
 }
 
+/*
+ * Defer the forwarding table updates for route changes until
+ * rt_batch_end(), so that a burst of changes can be applied in one go.
+ */
+void rt_batch_begin(void)
+{
+	rt_batch_active = true;
+}
+
+static void rt_lpm_free_rcu(void *arg)
+{
+	lpm_free(arg);
+}
+
+/*
+ * Point every reference to an LPM, including the aliases of it in
+ * other VRFs, at its replacement.
+ */
+static void rt_lpm_replace(struct lpm *old_lpm, struct lpm *new_lpm)
+{
+	struct vrf *vrf;
+	vrfid_t vrf_id;
+	uint32_t id;
+
+	VRF_FOREACH(vrf, vrf_id) {
+		struct route_head *rt_head = &vrf->v_rt4_head;
+
+		for (id = 0; id < rt_head->rt_rtm_max; id++)
+			if (rt_head->rt_table[id] == old_lpm)
+				rcu_assign_pointer(rt_head->rt_table[id],
+						   new_lpm);
+	}
+
+	defer_rcu(rt_lpm_free_rcu, old_lpm);
+}
+
+static void rt_lpm_commit(struct lpm *lpm)
+{
+	uint32_t pending = lpm_update_pending(lpm);
+	struct lpm *shadow;
+
+	if (config.route_shadow_swap &&
+	    pending >= RT_SHADOW_MIN_PREFIXES &&
+	    pending >= lpm_rule_count(lpm) / 2) {
+		shadow = lpm_update_commit_shadow(lpm);
+		if (shadow) {
+			rt_lpm_replace(lpm, shadow);
+			return;
+		}
+		RTE_LOG(NOTICE, ROUTE,
+			"No memory for new table %u, updating in place\n",
+			lpm_get_id(lpm));
+	}
+
+	if (lpm_update_commit(lpm) < 0)
+		RTE_LOG(ERR, ROUTE,
+			"Table %u not fully updated, out of tbl8s\n",
+			lpm_get_id(lpm));
+}
+
+/*
+ * Apply the changes deferred since rt_batch_begin(). Tables aliased
+ * into several VRFs are only committed the first time they are seen.
+ * Nexthops no longer used by any route are then released, once the
+ * forwarding threads have finished any lookups in the old tables.
+ */
+void rt_batch_end(void)
+{
+	struct vrf *vrf;
+	vrfid_t vrf_id;
+	unsigned int i;
+	uint32_t id;
+
+	if (!rt_batch_active)
+		return;
+
+	pthread_mutex_lock(&route_mutex);
+	rt_batch_active = false;
+	VRF_FOREACH(vrf, vrf_id) {
+		struct route_head *rt_head = &vrf->v_rt4_head;
+
+		for (id = 0; id < rt_head->rt_rtm_max; id++)
+			if (rt_head->rt_table[id])
+				rt_lpm_commit(rt_head->rt_table[id]);
+	}
+	pthread_mutex_unlock(&route_mutex);
+
+	if (!rt_batch_nputs)
+		return;
+
+	synchronize_rcu();
+
+	pthread_mutex_lock(&route_mutex);
+	for (i = 0; i < rt_batch_nputs; i++)
+		nexthop_put(rt_batch_puts[i]);
+	rt_batch_nputs = 0;
+	pthread_mutex_unlock(&route_mutex);
+}
+
 /* cleaner for the next hop */
 static void flush_cleanup(struct lpm *lpm __rte_unused,
 			  uint32_t ip,
@@ -1846,7 +2128,7 @@ static void flush_cleanup(struct lpm *lpm __rte_unused,
 	} else
 		route_hw_stats[pd_state.state]--;
 
-	nexthop_put(idx);
+	route_nexthop_put(idx);
 }
 
 void rt_flush(struct vrf *vrf)
@@ -2251,6 +2533,9 @@ static void rt_if_dead(struct lpm *lpm, struct vrf *vrf,
 	if (matches == 0)
 		return;
 
+	/* Move only the flows hashed to the dead paths */
+	nexthop_resilient_update(nextu);
+
 	if (matches == nextu->nsiblings || state_rx == IF_RX_LINK_DEL) {
 		/*
 		 * Delete entire route if;
@@ -2260,7 +2545,7 @@ static void rt_if_dead(struct lpm *lpm, struct vrf *vrf,
 		 */
 		route_lpm_delete(vrf->v_id, lpm, htonl(ip), depth, NULL,
 				 scope);
-		nexthop_put(idx);
+		route_nexthop_put(idx);
 	}
 }
 
@@ -2493,6 +2778,7 @@ int rt_show(struct route_head *rt_head, json_writer_t *json, uint32_t tblid,
 {
 	struct lpm *lpm = rt_get_lpm(rt_head, tblid);
 	uint32_t next_hop;
+	int rc;
 
 	if (lpm == NULL) {
 		RTE_LOG(ERR, ROUTE, "Unknown route table\n");
@@ -2502,7 +2788,10 @@ int rt_show(struct route_head *rt_head, json_writer_t *json, uint32_t tblid,
 	jsonw_start_object(json);
 	jsonw_string_field(json, "address", inet_ntoa(*addr));
 
-	if (lpm_lookup(lpm, ntohl(addr->s_addr), &next_hop) != 0)
+	pthread_mutex_lock(&route_mutex);
+	rc = lpm_lookup_ctrl(lpm, ntohl(addr->s_addr), &next_hop);
+	pthread_mutex_unlock(&route_mutex);
+	if (rc != 0)
 		jsonw_string_field(json, "state", "nomatch");
 	else
 		rt_print_nexthop(json, next_hop);
@@ -2554,6 +2843,7 @@ int rt_stats(struct route_head *rt_head, json_writer_t *json, uint32_t id)
 	uint8_t depth;
 	unsigned int total = 0;
 	uint32_t rt_used[LPM_MAX_DEPTH] = { 0 };
+	struct lpm_update_stats update_stats;
 	struct lpm *lpm = rt_get_lpm(rt_head, id);
 
 	if (lpm == NULL) {
@@ -2579,6 +2869,20 @@ int rt_stats(struct route_head *rt_head, json_writer_t *json, uint32_t id)
 	jsonw_uint_field(json, "used", lpm_tbl8_count(lpm));
 	jsonw_uint_field(json, "free", lpm_tbl8_free_count(lpm));
 
+	lpm_update_stats_get(lpm, &update_stats);
+	jsonw_name(json, "convergence");
+	jsonw_start_object(json);
+	jsonw_uint_field(json, "batches", update_stats.batches);
+	jsonw_uint_field(json, "shadow_swaps", update_stats.shadow_swaps);
+	jsonw_uint_field(json, "prefixes", update_stats.prefixes);
+	jsonw_uint_field(json, "usec", update_stats.usec);
+	jsonw_uint_field(json, "last_prefixes", update_stats.last_prefixes);
+	jsonw_uint_field(json, "last_usec", update_stats.last_usec);
+	jsonw_uint_field(json, "prefixes_per_sec", update_stats.usec ?
+			 update_stats.prefixes * US_PER_S / update_stats.usec :
+			 0);
+	jsonw_end_object(json);
+
 	jsonw_name(json, "nexthop");
 	jsonw_start_object(json);
 	jsonw_uint_field(json, "used", nh_tbl.in_use);
@@ -2606,9 +2910,13 @@ struct ifnet *nhif_dst_lookup(const struct vrf *vrf,
 	const struct next_hop_u *nextu;
 	const struct next_hop *next;
 	uint32_t nhindex;
+	int rc;
 
-	if (lpm_lookup(vrf->v_rt4_head.rt_table[RT_TABLE_MAIN],
-			   ntohl(dst), &nhindex) != 0)
+	pthread_mutex_lock(&route_mutex);
+	rc = lpm_lookup_ctrl(vrf->v_rt4_head.rt_table[RT_TABLE_MAIN],
+			     ntohl(dst), &nhindex);
+	pthread_mutex_unlock(&route_mutex);
+	if (rc != 0)
 		return NULL;
 
 	nextu = nh_tbl.entry[nhindex];
@@ -2656,7 +2964,7 @@ int nh_lookup_by_index(uint32_t nhindex, uint32_t hash, in_addr_t *nh,
 
 	size = nextu->nsiblings;
 	if (size > 1)
-		next = nexthop_mp_select(next, size, hash);
+		next = nexthop_mp_select(next, nextu->buckets, size, hash);
 
 	if (next->flags & RTF_GATEWAY)
 		*nh = next->gateway;
@@ -2683,7 +2991,7 @@ route_create_arp(struct vrf *vrf, struct lpm *lpm,
 	int sibling;
 	int size;
 
-	if (lpm_lookup(lpm, ntohl(ip->s_addr), &nh_idx) == 0) {
+	if (lpm_lookup_ctrl(lpm, ntohl(ip->s_addr), &nh_idx) == 0) {
 		nextu = rcu_dereference(nh_tbl.entry[nh_idx]);
 
 		/*
@@ -2951,7 +3259,7 @@ routing_remove_arp_safe(struct llentry *lle)
 				route_lpm_delete(vrf->v_id,
 						     lpm, ip->s_addr, 32,
 						     &nh_idx, RT_SCOPE_LINK);
-				nexthop_put(nh_idx);
+				route_nexthop_put(nh_idx);
 			} else {
 				struct arp_remove_purge_arg args = {
 					.count = nextu_nc_count(nextu),
@@ -2970,7 +3278,7 @@ routing_remove_arp_safe(struct llentry *lle)
 							     lpm, ip->s_addr,
 							     32, &nh_idx,
 							     RT_SCOPE_LINK);
-					nexthop_put(nh_idx);
+					route_nexthop_put(nh_idx);
 				}
 			}
 		} else {
@@ -3049,3 +3357,23 @@ static const struct dp_event_ops route_events = {
 
 DP_STARTUP_EVENT_REGISTER(route_events);
 
+
+/*
+ * For test only:
+ * rt-batch-ut <args>
+ * Runs a test function on the master thread, where routes are changed.
+ */
+static rt_batch_ut_handler rt_batch_ut_fn;
+
+void cmd_rt_batch_ut_set(rt_batch_ut_handler handler)
+{
+	rt_batch_ut_fn = handler;
+}
+
+int cmd_rt_batch_ut(FILE *f, int argc, char **argv)
+{
+	if (rt_batch_ut_fn)
+		return rt_batch_ut_fn(f, argc, argv);
+
+	return 0;
+}
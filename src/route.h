@@ -64,6 +64,7 @@ int nexthop_new(const struct next_hop *nh, uint16_t size, uint8_t proto,
 struct next_hop *nexthop_select(uint32_t nh_idx, const struct rte_mbuf *m,
 				uint16_t ether_type);
 struct next_hop *nexthop_get(uint32_t nh_idx, uint8_t *size);
+void nexthop_resilient_refresh(void);
 void rt_print_nexthop(json_writer_t *json, uint32_t next_hop);
 
 /*
@@ -79,11 +80,20 @@ struct next_hop *rt_lookup_fast(struct vrf *vrf, in_addr_t dst,
 				uint32_t tblid,
 				const struct rte_mbuf *m);
 
+/* Maximum number of addresses passed to rt_lookup_fast_bulk() */
+#define RT_LOOKUP_BULK_MAX 32
+
+void rt_lookup_fast_bulk(struct vrf *vrf, const in_addr_t *dst,
+			 uint32_t tblid, struct rte_mbuf * const *m,
+			 struct next_hop **nh, unsigned int n);
+
 int rt_insert(vrfid_t vrf_id, in_addr_t dst, uint8_t depth, uint32_t id,
 	      uint8_t scope, uint8_t proto, struct next_hop hops[],
 	      size_t size, bool replace);
 int rt_delete(vrfid_t vrf_id, in_addr_t dst, uint8_t depth,
 	      uint32_t id, uint8_t scope);
+void rt_batch_begin(void);
+void rt_batch_end(void);
 void rt_flush_all(enum cont_src_en cont_src);
 void rt_flush(struct vrf *vrf);
 enum rt_walk_type {
@@ -105,6 +115,7 @@ void nexthop_tbl_init(void);
 bool rt_valid_tblid(vrfid_t vrfid, uint32_t tblid);
 int rt_local_show(struct route_head *rt_head, uint32_t id, FILE *f);
 bool is_local_ipv4(vrfid_t vrf_id, in_addr_t dst);
+bool is_local_ipv4_ctrl(vrfid_t vrf_id, in_addr_t dst);
 
 static inline bool
 nexthop_is_local(const struct next_hop *nh)
@@ -126,4 +137,9 @@ uint32_t *route_hw_stats_get(void);
 
 int route_get_pd_subset_data(json_writer_t *json, enum pd_obj_state subset);
 
+/* For test only */
+typedef int (*rt_batch_ut_handler)(FILE *f, int argc, char **argv);
+int cmd_rt_batch_ut(FILE *f, int argc, char **argv);
+void cmd_rt_batch_ut_set(rt_batch_ut_handler handler);
+
 #endif
@@ -18,12 +18,20 @@
 #include "event.h"
 #include "master.h"
 #include "netlink.h"
+#include "route.h"
 #include "route_broker.h"
 #include "vplane_debug.h"
 #include "vplane_log.h"
 #include "zmq_dp.h"
 
 #define BROKER_KEEPALIVE_TIMER_SEC 10
+
+/*
+ * Maximum route messages handled per wakeup. The forwarding table
+ * changes for them are applied together at the end.
+ */
+#define ROUTE_BROKER_BATCH 1024
+
 static struct rte_timer broker_keepalive_timer[CONT_SRC_COUNT];
 
 /*
@@ -32,11 +40,11 @@ static struct rte_timer broker_keepalive_timer[CONT_SRC_COUNT];
  * dpmsg must be already allocated, and caller is responsible for destroying it.
  * Return 0 on success, -1 on error.
  */
-static int dp_rt_msg_recv(zsock_t *sock, zmq_msg_t *route_msg)
+static int dp_rt_msg_recv(zsock_t *sock, zmq_msg_t *route_msg, int flags)
 {
 	zmq_msg_init(route_msg);
 
-	if (zmq_msg_recv(route_msg, zsock_resolve(sock), 0) <= 0)
+	if (zmq_msg_recv(route_msg, zsock_resolve(sock), flags) <= 0)
 		goto error;
 
 	int more = zmq_msg_get(route_msg, ZMQ_MORE);
@@ -58,26 +66,35 @@ static int route_recv(void *arg)
 {
 	zmq_msg_t route_msg;
 	zsock_t *sock = arg;
+	unsigned int count;
+	int err = 0;
+	int rc;
 
-	errno = 0;
-	int rc = dp_rt_msg_recv(sock, &route_msg);
-	if (rc != 0) {
-		if (errno == 0)
-			return 0;
-		return -1;
+	rt_batch_begin();
+	for (count = 0; count < ROUTE_BROKER_BATCH; count++) {
+		/* Only wait for the first one, then take what is queued */
+		errno = 0;
+		rc = dp_rt_msg_recv(sock, &route_msg,
+				    count ? ZMQ_DONTWAIT : 0);
+		if (rc != 0) {
+			if (count == 0)
+				err = errno;
+			break;
+		}
+
+		rc = mnl_cb_run(zmq_msg_data(&route_msg),
+				zmq_msg_size(&route_msg),
+				0, 0, rtnl_process, (void *)CONT_SRC_MAIN);
+
+		if (rc != MNL_CB_OK)
+			DP_DEBUG(ROUTE, NOTICE, DATAPLANE,
+				 "route message not handled\n");
+
+		zmq_msg_close(&route_msg);
 	}
+	rt_batch_end();
 
-	rc = mnl_cb_run(zmq_msg_data(&route_msg),
-			zmq_msg_size(&route_msg),
-			0, 0, rtnl_process, (void *)CONT_SRC_MAIN);
-
-	if (rc != MNL_CB_OK)
-		DP_DEBUG(ROUTE, NOTICE, DATAPLANE,
-			 "route message not handled\n");
-
-	zmq_msg_close(&route_msg);
-
-	return 0;
+	return err ? -1 : 0;
 }
 
 /*
@@ -7,6 +7,7 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <netinet/icmp6.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -38,6 +39,7 @@
 #include "pktmbuf.h"
 #include "session.h"
 #include "session_feature.h"
+#include "session_private.h"
 #include "urcu.h"
 #include "vplane_log.h"
 
@@ -128,6 +130,15 @@
  * Sessions are live as their sentries are inserted and exist until they either
  * go idle and timeout, or the get marked as expired.
  *
+ * The GC does not walk the tables.  Each session sits in one slot of a
+ * timing wheel on the master thread, at the time it next needs
+ * looking at: when it would time out if still idle, its next periodic
+ * log, or a fraction of its timeout for a session with traffic.
+ * Forwarding threads hand sessions to the GC through a wait-free queue
+ * when they are created, expired, have a feature expiry request or
+ * have their timeout reduced.  Each GC run inspects at most
+ * SE_GC_BUDGET sessions.
+ *
  * All session and feature data are always freed asynchronously in a
  * call_rcu context.  At the point of feature datum free, the feature
  * is guaranteed that no inflight access can occur.
@@ -162,16 +173,54 @@ struct ports {
 #define SENTRY_HT_MIN	4096
 #define SENTRY_HT_MAX	1048576
 
-/* GC Interval (seconds) */
+/*
+ * The sentry table is split into shards selected by the top bits of
+ * the sentry hash, so that a resize only affects a fraction of the
+ * entries and table growth is spread over several hash tables.  The
+ * total bucket counts are the same as for a single table.
+ */
+#define SENTRY_HT_SHARD_BITS	4
+#define SENTRY_HT_SHARDS	(1 << SENTRY_HT_SHARD_BITS)
+
+/* GC Interval (seconds), used for parents waiting on children */
 #define SENTRY_GC_INTERVAL	5
 
+/*
+ * GC timing wheel, one slot per second of uptime.  Must be a power of
+ * 2, sessions are never scheduled further ahead than this.
+ */
+#define SE_GC_WHEEL_SLOTS	4096
+
+/* GC timer period (ms) and max sessions inspected per run */
+#define SE_GC_TICK_MS		100
+#define SE_GC_BUDGET		32768
+
+/* Sessions with traffic are checked this many times per timeout */
+#define SE_GC_CHECKS		4
+
+/* se_gc_pending states */
+enum {
+	SE_GC_IDLE,		/* not on the work queue */
+	SE_GC_QUEUED,		/* on the work queue */
+	SE_GC_DEAD,		/* reclaimed, never queue again */
+};
+
 /* Sentry and session hash tables */
-struct cds_lfht *sentry_ht;
+static struct cds_lfht *sentry_ht[SENTRY_HT_SHARDS];
 struct cds_lfht *session_ht;
 
+#define SENTRY_HT_FOREACH(ht, i) \
+	for ((i) = 0; (i) < SENTRY_HT_SHARDS && ((ht) = sentry_ht[i]); (i)++)
+
 /* GC Timer */
 struct rte_timer session_gc_timer;
 
+/* GC timing wheel and work queue, wheel is only used on master */
+static struct cds_list_head se_gc_wheel[SE_GC_WHEEL_SLOTS];
+static uint64_t se_gc_clock;	/* next wheel slot to run */
+static struct cds_wfcq_head se_gc_wq_head;
+static struct cds_wfcq_tail se_gc_wq_tail;
+
 /* For GC... */
 static inline int time_after(time_t t0, time_t t1)
 {
@@ -187,6 +236,31 @@ static rte_atomic32_t	sessions_used;
 static int32_t		sessions_max = DEFAULT_MAX_SESSIONS;
 static bool		session_gc_run = true;
 
+/*
+ * Per-lcore session slot and id caches.
+ *
+ * Forwarding threads reserve session slots from sessions_used, and
+ * take session ids from session_id, in batches so that the shared
+ * counters are written once per batch rather than once per session.
+ * Slots returned on a forwarding thread go back into its cache, and
+ * the excess is handed back to sessions_used.  Slots freed by the GC
+ * (on the master thread) are returned to sessions_used directly.
+ *
+ * Near the limit a thread takes single slots, so the limit may be
+ * reached while other threads still hold up to SESSION_SLOT_BATCH
+ * unused slots each.
+ */
+#define SESSION_SLOT_BATCH	64
+#define SESSION_ID_BATCH	64
+
+struct session_lcore_cache {
+	int32_t		lc_slots;	/* reserved, unused slots */
+	uint64_t	lc_id_next;	/* next session id to hand out */
+	uint64_t	lc_id_end;	/* end of reserved id block */
+} __rte_cache_aligned;
+
+static struct session_lcore_cache session_lcore[RTE_MAX_LCORE];
+
 /* Global session logging configuration */
 static struct session_log_cfg session_global_log_cfg;
 
@@ -285,18 +359,55 @@ static void session_log(struct session *s, enum session_log_event log_event)
 				     &log_event);
 }
 
+/* Number of slots in use, excluding those cached by lcores */
+static uint32_t slots_used(void)
+{
+	int32_t used = rte_atomic32_read(&sessions_used);
+	unsigned int i;
+
+	for (i = 0; i < RTE_MAX_LCORE; i++)
+		used -= CMM_ACCESS_ONCE(session_lcore[i].lc_slots);
+
+	return used > 0 ? used : 0;
+}
+
+/* Reserve count slots from the global limit */
+static inline int slot_reserve(int32_t count)
+{
+	if (rte_atomic32_add_return(&sessions_used, count) <= sessions_max)
+		return 0;
+
+	rte_atomic32_sub(&sessions_used, count);
+	return -ENOSPC;
+}
+
 /* Get an entry for a new session, check against max limit */
 static ALWAYS_INLINE int slot_get(void)
 {
-	if (rte_atomic32_add_return(&sessions_used, 1) <= sessions_max)
+	unsigned int lcore = rte_lcore_id();
+	struct session_lcore_cache *lc;
+
+	if (likely(lcore < RTE_MAX_LCORE)) {
+		lc = &session_lcore[lcore];
+		if (likely(lc->lc_slots > 0)) {
+			lc->lc_slots--;
+			return 0;
+		}
+
+		if (slot_reserve(SESSION_SLOT_BATCH) == 0) {
+			lc->lc_slots = SESSION_SLOT_BATCH - 1;
+			return 0;
+		}
+	}
+
+	if (slot_reserve(1) == 0)
 		return 0;
 
-	rte_atomic32_dec(&sessions_used);
 	if (net_ratelimit() && session_gc_run) {
 		session_gc_run = false;
 		RTE_LOG(ERR, DATAPLANE,
 			"Session table limit reached. Used: %u Max: %u\n",
-			rte_atomic32_read(&sessions_used), sessions_max);
+			slots_used(), sessions_max);
 	}
 	return -ENOSPC;
 }
@@ -329,11 +440,67 @@ static inline void cache_sentry(struct rte_mbuf *m, struct sentry *sen)
 /* Return entry to max limit */
 static ALWAYS_INLINE void slot_put(void)
 {
-	rte_atomic32_dec(&sessions_used);
+	unsigned int lcore = rte_lcore_id();
+	struct session_lcore_cache *lc;
+
+	if (unlikely(lcore >= RTE_MAX_LCORE) ||
+	    lcore == rte_get_master_lcore()) {
+		rte_atomic32_dec(&sessions_used);
+		return;
+	}
+
+	lc = &session_lcore[lcore];
+	if (unlikely(++lc->lc_slots > 2 * SESSION_SLOT_BATCH)) {
+		lc->lc_slots -= SESSION_SLOT_BATCH;
+		rte_atomic32_sub(&sessions_used, SESSION_SLOT_BATCH);
+	}
+}
+
+/* Get a new session id */
+static inline uint64_t session_id_get(void)
+{
+	unsigned int lcore = rte_lcore_id();
+	struct session_lcore_cache *lc;
+
+	if (unlikely(lcore >= RTE_MAX_LCORE))
+		return rte_atomic64_add_return(&session_id, 1);
+
+	lc = &session_lcore[lcore];
+	if (unlikely(lc->lc_id_next == lc->lc_id_end)) {
+		lc->lc_id_end = rte_atomic64_add_return(&session_id,
+							SESSION_ID_BATCH) + 1;
+		lc->lc_id_next = lc->lc_id_end - SESSION_ID_BATCH;
+	}
+
+	return lc->lc_id_next++;
 }
 
 static void expire_kids(struct session *s);
 
+/*
+ * Hand a session to the GC to be looked at on its next run.  Safe from
+ * any thread, a session is only queued once at a time.
+ */
+void session_gc_enqueue(struct session *s)
+{
+	if (uatomic_cmpxchg(&s->se_gc_pending, SE_GC_IDLE,
+			    SE_GC_QUEUED) == SE_GC_IDLE) {
+		cds_wfcq_node_init(&s->se_gc_node);
+		cds_wfcq_enqueue(&se_gc_wq_head, &se_gc_wq_tail,
+				 &s->se_gc_node);
+	}
+}
+
+/*
+ * Claim a session for reclaiming.  Fails if it is on the GC work
+ * queue, in which case the GC will finish it off when dequeued.
+ */
+static inline bool se_gc_claim(struct session *s)
+{
+	return uatomic_cmpxchg(&s->se_gc_pending, SE_GC_IDLE,
+			       SE_GC_DEAD) == SE_GC_IDLE;
+}
+
 /* Expire a session */
 static ALWAYS_INLINE
 void se_expire(struct session *s)
@@ -342,6 +509,7 @@ void se_expire(struct session *s)
 
 	if (rte_atomic16_cmpset(&s->se_flags, exp, (exp | SESSION_EXPIRED))) {
 		session_feature_session_expire(s);
+		session_gc_enqueue(s);
 	}
 }
 
@@ -398,11 +566,23 @@ static void session_reclaim(struct session *s)
 	}
 }
 
+/* Sentry table shard for a sentry hash */
+static ALWAYS_INLINE struct cds_lfht *sentry_ht_shard(unsigned long hash)
+{
+	return sentry_ht[(uint32_t)hash >> (32 - SENTRY_HT_SHARD_BITS)];
+}
+
 /* Unlink a sentry from the hash tables and reclaim. */
 static ALWAYS_INLINE
 void sentry_delete(struct sentry *sen)
 {
-	if (!cds_lfht_del(sentry_ht, &sen->sen_node)) {
+	struct session *s = sen->sen_session;
+
+	rte_spinlock_lock(&s->se_sen_lock);
+	cds_list_del_init(&sen->sen_link);
+	rte_spinlock_unlock(&s->se_sen_lock);
+
+	if (!cds_lfht_del(sentry_ht_shard(sen->sen_hash), &sen->sen_node)) {
 		if (sen->sen_session->se_sen == sen) {
 			/* Clear INIT sentry cache */
 			sen->sen_session->se_sen = NULL;
@@ -446,10 +626,61 @@ int reclaim_session(struct session *s, uint64_t uptime)
 	return rc;
 }
 
+/* Unlink all the sentries of a session */
+static void se_sentries_delete(struct session *s)
+{
+	struct sentry *sen;
+
+	for (;;) {
+		sen = NULL;
+		rte_spinlock_lock(&s->se_sen_lock);
+		if (!cds_list_empty(&s->se_sentries))
+			sen = cds_list_entry(s->se_sentries.next,
+					     struct sentry, sen_link);
+		rte_spinlock_unlock(&s->se_sen_lock);
+
+		if (!sen)
+			break;
+		sentry_delete(sen);
+	}
+}
+
+/* Put a session in the GC wheel slot for time 'when' */
+static void se_gc_schedule(struct session *s, uint64_t when)
+{
+	if (when < se_gc_clock)
+		when = se_gc_clock;
+
+	s->se_gc_time = when;
+	cds_list_add_tail(&s->se_gc_link,
+			  &se_gc_wheel[when & (SE_GC_WHEEL_SLOTS - 1)]);
+}
+
+/* When does an inspected, live session next need looking at */
+static uint64_t se_gc_next(struct session *s, uint64_t uptime)
+{
+	uint64_t next = uptime + RTE_MAX(se_timeout(s) / SE_GC_CHECKS, 1u);
+
+	if (s->se_idle && s->se_etime + 1 < next)
+		next = s->se_etime + 1;
+
+	if (s->se_log_periodic && s->se_ltime + 1 < next)
+		next = s->se_ltime + 1;
+
+	return RTE_MIN(next, uptime + SE_GC_WHEEL_SLOTS - 1);
+}
+
 /* GC worker routine, Reclaim expired/timedout sessions */
-static void sentry_gc_inspect(struct sentry *sen, uint64_t uptime)
+static void se_gc_inspect(struct session *s, uint64_t uptime)
 {
-	struct session *s = sen->sen_session;
+	if (s->se_gc_time) {
+		cds_list_del(&s->se_gc_link);
+		s->se_gc_time = 0;
+	}
+
+	/* Already reclaimed, seen again by a table walk */
+	if (CMM_LOAD_SHARED(s->se_gc_pending) == SE_GC_DEAD)
+		return;
 
 	if (s->se_log_creation) {
 		s->se_log_creation = 0;
@@ -471,54 +702,130 @@ static void sentry_gc_inspect(struct sentry *sen, uint64_t uptime)
 	 * If we have children then do nothing, a parent session
 	 * must exist until children are removed.
 	 */
-	if (rte_atomic16_read(&s->se_link_cnt))
+	if (rte_atomic16_read(&s->se_link_cnt)) {
+		se_gc_schedule(s, uptime + SENTRY_GC_INTERVAL);
 		return;
+	}
 
 	/*
 	 * Session reclaimed after all children are unlinked,
-	 * and all sentries reclaimed
+	 * and all sentries reclaimed.  If the session has just been
+	 * queued (e.g. by the expiry above) it is finished off when
+	 * dequeued.
 	 */
 	if (reclaim_session(s, uptime)) {
-		s->se_log_periodic = 0;
-		sentry_delete(sen);
-		session_reclaim(s);
+		if (se_gc_claim(s)) {
+			s->se_log_periodic = 0;
+			se_sentries_delete(s);
+			session_reclaim(s);
+		}
+		return;
+	}
+
+	se_gc_schedule(s, se_gc_next(s, uptime));
+}
+
+/* Inspect sessions handed over by other threads */
+static unsigned int se_gc_drain(uint64_t uptime, unsigned int budget)
+{
+	struct cds_wfcq_node *node;
+	struct session *s;
+	unsigned int count = 0;
+
+	while (count < budget) {
+		node = cds_wfcq_dequeue_blocking(&se_gc_wq_head,
+						 &se_gc_wq_tail);
+		if (!node)
+			break;
+
+		s = caa_container_of(node, struct session, se_gc_node);
+		uatomic_set(&s->se_gc_pending, SE_GC_IDLE);
+		cmm_smp_mb();
+
+		se_gc_inspect(s, uptime);
+		count++;
+	}
+
+	return count;
+}
+
+/* Inspect sessions in the wheel slots that are due */
+static unsigned int se_gc_wheel_run(uint64_t uptime, unsigned int budget)
+{
+	struct cds_list_head *slot;
+	struct session *s, *tmp;
+	unsigned int count = 0;
+	CDS_LIST_HEAD(due);
+
+	while (!time_after(se_gc_clock, uptime)) {
+		slot = &se_gc_wheel[se_gc_clock & (SE_GC_WHEEL_SLOTS - 1)];
+
+		/* Rescheduling may add back to this slot, so detach it */
+		cds_list_splice(slot, &due);
+		CDS_INIT_LIST_HEAD(slot);
+
+		cds_list_for_each_entry_safe(s, tmp, &due, se_gc_link) {
+			if (count == budget)
+				break;
+			se_gc_inspect(s, uptime);
+			count++;
+		}
+
+		/* Out of budget, leave the rest for the next run */
+		if (!cds_list_empty(&due)) {
+			cds_list_splice(&due, slot);
+			break;
+		}
+		se_gc_clock++;
 	}
+
+	return count;
 }
 
-static void sentry_gc_walk(uint64_t uptime)
+/* Inspect every session, regardless of when it is due */
+static void se_gc_walk_all(uint64_t uptime)
 {
 	struct cds_lfht_iter iter;
+	struct cds_lfht *ht;
 	struct sentry *sen;
+	unsigned int i;
 
-	/* No point */
-	if (!rte_atomic32_read(&sessions_used))
-		return;
+	SENTRY_HT_FOREACH(ht, i)
+		cds_lfht_for_each_entry(ht, &iter, sen, sen_node)
+			se_gc_inspect(sen->sen_session, uptime);
+}
+
+/* Run the GC, returns the number of sessions inspected */
+static unsigned int se_gc_run(uint64_t uptime, unsigned int budget)
+{
+	unsigned int count;
 
-	/* Clean the sentry table */
-	cds_lfht_for_each_entry(sentry_ht, &iter, sen, sen_node)
-		sentry_gc_inspect(sen, uptime);
+	count = se_gc_drain(uptime, budget);
+	count += se_gc_wheel_run(uptime, budget - count);
+
+	/* Finish off sessions expired during this run */
+	count += se_gc_drain(uptime, budget - count);
 
 	/*
 	 * Reduce msg flood on a full session table.
 	 * See if we cleared some slots.  This will only limit
 	 * the number of error msgs until the next time GC is run.
 	 */
-	if (rte_atomic32_read(&sessions_used) < sessions_max)
+	if (slots_used() < (uint32_t)sessions_max)
 		session_gc_run = true;
+
+	return count;
 }
 
 static void
 sentry_gc(struct rte_timer *timer __rte_unused, void *arg __rte_unused)
 {
-	uint64_t uptime = get_dp_uptime();
-
-	/* Walk the sentry table */
-	sentry_gc_walk(uptime);
+	se_gc_run(get_dp_uptime(), SE_GC_BUDGET);
 
 	/* Do it again, as long as we are running */
 	if (running)
 		rte_timer_reset(&session_gc_timer,
-				SENTRY_GC_INTERVAL * rte_get_timer_hz(),
+				SE_GC_TICK_MS * rte_get_timer_hz() / 1000,
 				SINGLE, rte_get_master_lcore(),
 				sentry_gc, NULL);
 }
@@ -580,7 +887,7 @@ static int sentry_table_lookup(const struct sentry_packet *sp,
 		return -ENOENT;
 
 	hash = sentry_hash(sp);
-	cds_lfht_lookup(sentry_ht, hash, sentry_match, sp, &iter);
+	cds_lfht_lookup(sentry_ht_shard(hash), hash, sentry_match, sp, &iter);
 	snode = cds_lfht_iter_get_node(&iter);
 	if (!snode)
 		return -ENOENT;
@@ -596,13 +903,18 @@ static int sentry_insert(const struct sentry_packet *sp, struct sentry *sen,
 	struct cds_lfht_node *node;
 	struct session *s = sen->sen_session;
 
-	node = cds_lfht_add_unique(sentry_ht, sentry_hash(sp), sentry_match,
-			sp, &sen->sen_node);
+	sen->sen_hash = sentry_hash(sp);
+	node = cds_lfht_add_unique(sentry_ht_shard(sen->sen_hash),
+			sen->sen_hash, sentry_match, sp, &sen->sen_node);
 	if (node != &sen->sen_node) {
 		*old = caa_container_of(node, struct sentry, sen_node);
 		return -EEXIST;
 	}
 
+	rte_spinlock_lock(&s->se_sen_lock);
+	cds_list_add(&sen->sen_link, &s->se_sentries);
+	rte_spinlock_unlock(&s->se_sen_lock);
+
 	/* session sentry count */
 	rte_atomic16_inc(&s->se_sen_cnt);
 
@@ -631,16 +943,20 @@ int session_table_walk(session_walk_t cb, void *data)
 int sentry_table_walk(sentry_walk_t cb, void *data)
 {
 	struct cds_lfht_iter iter;
+	struct cds_lfht *ht;
 	struct sentry *sen;
+	unsigned int i;
 	int rc = 0;
 
 	if (!cb)
 		return -ENOENT;
 
-	cds_lfht_for_each_entry(sentry_ht, &iter, sen, sen_node) {
-		rc = cb(sen, data);
-		if (rc)
-			break;
+	SENTRY_HT_FOREACH(ht, i) {
+		cds_lfht_for_each_entry(ht, &iter, sen, sen_node) {
+			rc = cb(sen, data);
+			if (rc)
+				return rc;
+		}
 	}
 	return rc;
 }
@@ -697,9 +1013,11 @@ void session_link_walk(struct session *s, bool do_unlink,
 int session_table_destroy_all(void)
 {
 	long dummy;
-	unsigned long count;
+	unsigned long count, total = 0;
 	struct cds_lfht_iter iter;
+	struct cds_lfht *ht;
 	struct sentry *sen;
+	unsigned int i;
 
 	/*
 	 * Forcibly delete all existing sessions by
@@ -709,10 +1027,13 @@ int session_table_destroy_all(void)
 	 * perform cleanup correctly.
 	 */
 	if (rte_atomic32_read(&sessions_used)) {
-		cds_lfht_for_each_entry(sentry_ht, &iter, sen, sen_node) {
-			se_expire(sen->sen_session);
-			sentry_gc_inspect(sen, 0);
+		SENTRY_HT_FOREACH(ht, i) {
+			cds_lfht_for_each_entry(ht, &iter, sen, sen_node)
+				se_expire(sen->sen_session);
 		}
+		se_gc_drain(0, UINT_MAX);
+		se_gc_walk_all(0);
+		se_gc_drain(0, UINT_MAX);
 
 		/*
 		 * Poll the rcu counter to ensure that all
@@ -723,17 +1044,27 @@ int session_table_destroy_all(void)
 	}
 
 	/* For UT purposes, ensure we have nothing left. */
-	cds_lfht_count_nodes(sentry_ht, &dummy, &count, &dummy);
-	return count;
+	SENTRY_HT_FOREACH(ht, i) {
+		cds_lfht_count_nodes(ht, &dummy, &count, &dummy);
+		total += count;
+	}
+	return total;
 }
 
 /* Get counts of nodes in sentry and session ht's - for UTs */
 void session_table_counts(unsigned long *sen_ht, unsigned long *sess_ht)
 
 {
+	struct cds_lfht *ht;
+	unsigned long count;
+	unsigned int i;
 	long dummy;
 
-	cds_lfht_count_nodes(sentry_ht, &dummy, sen_ht, &dummy);
+	*sen_ht = 0;
+	SENTRY_HT_FOREACH(ht, i) {
+		cds_lfht_count_nodes(ht, &dummy, &count, &dummy);
+		*sen_ht += count;
+	}
 	cds_lfht_count_nodes(session_ht, &dummy, sess_ht, &dummy);
 }
 
@@ -742,7 +1073,7 @@ void session_table_counts(unsigned long *sen_ht, unsigned long *sess_ht)
  */
 void session_counts(uint32_t *used, uint32_t *max, struct session_counts *sc)
 {
-	*used = rte_atomic32_read(&sessions_used);
+	*used = slots_used();
 	*max = sessions_max;
 
 	session_table_walk(se_counts, sc);
@@ -762,12 +1093,24 @@ void session_set_global_logging_cfg(struct session_log_cfg *scfg)
 /* Init the hash tables */
 static void init_tables(void)
 {
-	sentry_ht = cds_lfht_new(SENTRY_HT_INIT, SENTRY_HT_MIN, SENTRY_HT_MAX,
-			CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
+	unsigned int i;
+
+	for (i = 0; i < SENTRY_HT_SHARDS; i++) {
+		sentry_ht[i] = cds_lfht_new(SENTRY_HT_INIT / SENTRY_HT_SHARDS,
+				SENTRY_HT_MIN / SENTRY_HT_SHARDS,
+				SENTRY_HT_MAX / SENTRY_HT_SHARDS,
+				CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
+				NULL);
+	}
+
+	for (i = 0; i < SE_GC_WHEEL_SLOTS; i++)
+		CDS_INIT_LIST_HEAD(&se_gc_wheel[i]);
+	se_gc_clock = get_dp_uptime() + 1;
+	cds_wfcq_init(&se_gc_wq_head, &se_gc_wq_tail);
 
 	rte_timer_init(&session_gc_timer);
 	rte_timer_reset(&session_gc_timer,
-			SENTRY_GC_INTERVAL * rte_get_timer_hz(),
+			SE_GC_TICK_MS * rte_get_timer_hz() / 1000,
 			SINGLE, rte_get_master_lcore(), sentry_gc, NULL);
 
 	session_ht = cds_lfht_new(SENTRY_HT_INIT, SENTRY_HT_MIN, SENTRY_HT_MAX,
@@ -1059,6 +1402,7 @@ static struct sentry *sentry_create(struct session *s,
 		return NULL;
 
 	cds_lfht_node_init(&sen->sen_node);
+	CDS_INIT_LIST_HEAD(&sen->sen_link);
 	sen->sen_session = s;
 	sen->sen_ifindex = sp->sp_ifindex;
 	sen->sen_flags = flag | sp->sp_sentry_flags;
@@ -1193,7 +1537,9 @@ static struct session *se_alloc(void)
 	s = zmalloc_aligned(sizeof(struct session));
 	if (s) {
 		cds_lfht_node_init(&s->se_node);
-		s->se_id = rte_atomic64_add_return(&session_id, 1);
+		CDS_INIT_LIST_HEAD(&s->se_sentries);
+		rte_spinlock_init(&s->se_sen_lock);
+		s->se_id = session_id_get();
 	}
 
 	return s;
@@ -1266,8 +1612,14 @@ int session_establish(struct rte_mbuf *m, const struct ifnet *ifp,
 void session_set_protocol_state_timeout(struct session *s, uint8_t state,
 		uint32_t timeout)
 {
+	bool sooner = timeout < s->se_timeout && !s->se_custom_timeout;
+
 	s->se_timeout = timeout;
 	s->se_protocol_state = state;
+
+	/* GC may have the session scheduled for the old timeout */
+	if (sooner)
+		session_gc_enqueue(s);
 }
 
 /* Insert forw/back sentries based on packet. */
@@ -1615,13 +1967,18 @@ int session_create_from_sentry_packets(struct rte_mbuf *m,
 	rc = sentry_packet_insert_both(s, sp_forw, sp_back, SENTRY_INIT,
 				       &sen_forw, created);
 	if (rc) {
-		session_reclaim(s);
+		/* Briefly visible, so may have been handed to the GC */
+		if (se_gc_claim(s))
+			session_reclaim(s);
+		else
+			se_expire(s);
 		return rc;
 	}
 
 	/* Add the session to the session hash table.  */
 	cds_lfht_add(session_ht, s->se_id, &s->se_node);
 	s->se_flags = SESSION_INSERTED;
+	session_gc_enqueue(s);
 
 	cache_sentry(m, sen_forw);
 
@@ -1650,11 +2007,30 @@ void session_gc(void)
 {
 	uint64_t uptime = get_dp_uptime();
 
+	se_gc_drain(uptime, UINT_MAX);
+
 	/* Sets the idle flag on each session */
-	sentry_gc_walk(uptime);
+	se_gc_walk_all(uptime);
 
 	/* Simulate time into the future */
-	sentry_gc_walk(uptime + (10 * SENTRY_GC_INTERVAL));
+	uptime += 10 * SENTRY_GC_INTERVAL;
+	se_gc_walk_all(uptime);
+	se_gc_drain(uptime, UINT_MAX);
+}
+
+unsigned int session_gc_step(uint64_t uptime, unsigned int budget)
+{
+	/* The wheel belongs to the GC timer, so keep it out of the way */
+	rte_timer_stop_sync(&session_gc_timer);
+
+	return se_gc_run(uptime, budget);
+}
+
+void session_gc_resume(void)
+{
+	rte_timer_reset(&session_gc_timer,
+			SE_GC_TICK_MS * rte_get_timer_hz() / 1000,
+			SINGLE, rte_get_master_lcore(), sentry_gc, NULL);
 }
 
 /* Allocate/init a session struct (for session syncing) */
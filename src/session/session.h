@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <urcu/list.h>
+#include <urcu/wfcqueue.h>
 
 #include "if_var.h"
 #include "urcu.h"
@@ -128,6 +129,8 @@ struct sentry {
 	uint16_t		sen_flags;
 	uint8_t			sen_len;
 	uint8_t			sen_protocol;
+	uint32_t		sen_hash;	/* selects sentry table shard */
+	struct cds_list_head	sen_link;	/* on session's se_sentries */
 	uint32_t		sen_addrids[];	/* ids/addrs, must be last */
 };
 
@@ -191,6 +194,12 @@ struct session {
 	uint32_t		se_log_interval;
 	uint64_t		se_ltime;	/* time of next periodic log */
 	uint64_t		se_create_time;	/* time session was created */
+	struct cds_list_head	se_sentries;	/* Sentries of this session */
+	rte_spinlock_t		se_sen_lock;	/* Protects se_sentries */
+	uint32_t		se_gc_pending;	/* GC work queue state */
+	struct cds_wfcq_node	se_gc_node;	/* GC work queue */
+	struct cds_list_head	se_gc_link;	/* GC wheel slot */
+	uint64_t		se_gc_time;	/* GC wheel slot time, 0 if none */
 };
 
 /* For UTs, counts of various sessions */
@@ -781,6 +790,18 @@ void session_sentry_extract(struct sentry *sen, uint32_t *if_index, int *af,
  */
 void session_gc(void);
 
+/**
+ * Step the session GC.
+ *
+ * Run the GC as if the uptime were 'uptime', inspecting at most 'budget'
+ * sessions.  The GC timer is stopped until session_gc_resume() is
+ * called.  Only used by the Unit tests to drive the GC timing wheel.
+ *
+ * @return The number of sessions inspected
+ */
+unsigned int session_gc_step(uint64_t uptime, unsigned int budget);
+void session_gc_resume(void);
+
 /**
  * Session alloc
  *
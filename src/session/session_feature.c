@@ -165,6 +165,7 @@ static void sf_request_expiry(struct session_feature *sf)
 				(exp | SESS_FEAT_REQ_EXPIRY))) {
 		rte_atomic16_inc(&sf->sf_session->se_feature_exp_count);
 		sf->sf_expire_time = rte_get_timer_cycles();
+		session_gc_enqueue(sf->sf_session);
 	}
 }
 
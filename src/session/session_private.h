@@ -16,4 +16,6 @@
 
 extern const struct session_feature_ops *feature_operations[];
 
+void session_gc_enqueue(struct session *s);
+
 #endif /* SESSION_PRIVATE_H */
@@ -1861,7 +1861,7 @@ int vxlan_neigh_change(const struct nlmsghdr *nlh,
 
 		struct ifnet *ifp = ifnet_byifindex(ndm->ndm_ifindex);
 
-		if (is_local_ipv4(if_vrfid(ifp), ipaddr.s_addr)) {
+		if (is_local_ipv4_ctrl(if_vrfid(ifp), ipaddr.s_addr)) {
 			RTE_LOG(NOTICE, VXLAN,
 					"local DST(%s) in NEIGH msg; skipping\n",
 					inet_ntoa(ipaddr));
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Test the BPF compiler gives the same results as bpf_filter()
+ */
+
+#include <netinet/in.h>
+#include <pcap/bpf.h>
+#include <rte_config.h>
+#include <stdio.h>
+
+#include "dp_test_controller.h"
+#include "dp_test_lib_cmd.h"
+#include "dp_test_macros.h"
+
+#include "bpf_jit.h"
+#include "util.h"
+
+#define BPF_JIT_TEST_PKT_LEN	64
+
+/* A 64 byte frame with a 20 byte IPv4 header after the Ethernet header */
+static u_char bpf_jit_test_pkt[BPF_JIT_TEST_PKT_LEN];
+
+static void
+bpf_jit_test_pkt_init(void)
+{
+	u_int i;
+
+	for (i = 0; i < sizeof(bpf_jit_test_pkt); i++)
+		bpf_jit_test_pkt[i] = i * 37 + 11;
+	bpf_jit_test_pkt[12] = 0x08;
+	bpf_jit_test_pkt[13] = 0x00;
+	bpf_jit_test_pkt[14] = 0x45;
+	bpf_jit_test_pkt[23] = IPPROTO_UDP;
+}
+
+/*
+ * Run a program over the whole test packet, and over shorter captures of
+ * it, with both bpf_filter() and the compiled code.
+ */
+static void
+bpf_jit_test_prog(const char *name, const struct bpf_insn *insns, u_int len)
+{
+	static const u_int buflens[] = {
+		BPF_JIT_TEST_PKT_LEN, 40, 24, 15, 1, 0
+	};
+	struct bpf_jit *jit;
+	u_int i, exp, res;
+
+	jit = bpf_jit_compile(insns, len);
+#ifdef RTE_ARCH_X86_64
+	dp_test_fail_unless(jit, "%s: not compiled", name);
+#else
+	if (!jit)
+		return;
+#endif
+
+	for (i = 0; i < ARRAY_SIZE(buflens); i++) {
+		exp = bpf_filter(insns, bpf_jit_test_pkt, 1500, buflens[i]);
+		res = bpf_jit_func(jit)(bpf_jit_test_pkt, 1500, buflens[i]);
+		dp_test_fail_unless(res == exp,
+				    "%s: buflen %u returned %#x, expected %#x",
+				    name, buflens[i], res, exp);
+	}
+	bpf_jit_free(jit);
+}
+
+#define BPF_JIT_TEST(name, ...)						\
+	{ name, (const struct bpf_insn[]){ __VA_ARGS__ },		\
+	  sizeof((const struct bpf_insn[]){ __VA_ARGS__ }) /		\
+	  sizeof(struct bpf_insn) }
+
+static const struct bpf_jit_test {
+	const char *name;
+	const struct bpf_insn *insns;
+	u_int len;
+} bpf_jit_tests[] = {
+	BPF_JIT_TEST("ret k",
+		     BPF_STMT(BPF_RET | BPF_K, 0x12345678)),
+	BPF_JIT_TEST("ret a",
+		     BPF_STMT(BPF_LD | BPF_IMM, 0x87654321),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("ld len",
+		     BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("ldx len",
+		     BPF_STMT(BPF_LDX | BPF_W | BPF_LEN, 0),
+		     BPF_STMT(BPF_MISC | BPF_TXA, 0),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("tax",
+		     BPF_STMT(BPF_LD | BPF_IMM, 99),
+		     BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		     BPF_STMT(BPF_LD | BPF_IMM, 1),
+		     BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("st stx ld ldx mem",
+		     BPF_STMT(BPF_LD | BPF_IMM, 5),
+		     BPF_STMT(BPF_ST, 3),
+		     BPF_STMT(BPF_LDX | BPF_IMM, 7),
+		     BPF_STMT(BPF_STX, 15),
+		     BPF_STMT(BPF_LD | BPF_MEM, 15),
+		     BPF_STMT(BPF_LDX | BPF_MEM, 3),
+		     BPF_STMT(BPF_ALU | BPF_MUL | BPF_X, 0),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("ld mem unset",
+		     BPF_STMT(BPF_LD | BPF_IMM, 5),
+		     BPF_STMT(BPF_ST, 3),
+		     BPF_STMT(BPF_LD | BPF_MEM, 9),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("ja",
+		     BPF_STMT(BPF_JMP | BPF_JA, 1),
+		     BPF_STMT(BPF_RET | BPF_K, 1),
+		     BPF_STMT(BPF_RET | BPF_K, 2)),
+	BPF_JIT_TEST("ja 0",
+		     BPF_STMT(BPF_JMP | BPF_JA, 0),
+		     BPF_STMT(BPF_RET | BPF_K, 1)),
+	BPF_JIT_TEST("div x by 0",
+		     BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+		     BPF_STMT(BPF_LDX | BPF_IMM, 0),
+		     BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+		     BPF_STMT(BPF_RET | BPF_K, 1)),
+	BPF_JIT_TEST("mod x by 0",
+		     BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+		     BPF_STMT(BPF_LDX | BPF_IMM, 0),
+		     BPF_STMT(BPF_ALU | BPF_MOD | BPF_X, 0),
+		     BPF_STMT(BPF_RET | BPF_K, 1)),
+	BPF_JIT_TEST("div x by loaded 0",
+		     BPF_STMT(BPF_LDX | BPF_MEM, 0),
+		     BPF_STMT(BPF_LD | BPF_IMM, 100),
+		     BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("neg",
+		     BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 4),
+		     BPF_STMT(BPF_ALU | BPF_NEG, 0),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("msh",
+		     BPF_STMT(BPF_LDX | BPF_MSH | BPF_B, 14),
+		     BPF_STMT(BPF_MISC | BPF_TXA, 0),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("msh out of bounds",
+		     BPF_STMT(BPF_LDX | BPF_MSH | BPF_B, 64),
+		     BPF_STMT(BPF_RET | BPF_K, 1)),
+	BPF_JIT_TEST("msh then ind",
+		     BPF_STMT(BPF_LDX | BPF_MSH | BPF_B, 14),
+		     BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+		     BPF_STMT(BPF_RET | BPF_A, 0)),
+	BPF_JIT_TEST("udp port",
+		     BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+		     BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0800, 0, 6),
+		     BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+		     BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 4),
+		     BPF_STMT(BPF_LDX | BPF_MSH | BPF_B, 14),
+		     BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+		     BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x7a3f, 1, 0),
+		     BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		     BPF_STMT(BPF_RET | BPF_K, 0)),
+};
+
+/* Loads of each size at each offset, running off the end of the packet */
+static void
+bpf_jit_test_loads(void)
+{
+	static const uint16_t sizes[] = { BPF_W, BPF_H, BPF_B };
+	static const uint32_t xs[] = { 0, 14, 60, 0xfffffffc };
+	struct bpf_insn insns[3];
+	char name[64];
+	u_int i, j, k;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		for (k = 0; k <= BPF_JIT_TEST_PKT_LEN + 4; k++) {
+			insns[0] = (struct bpf_insn)
+				BPF_STMT(BPF_LD | sizes[i] | BPF_ABS, k);
+			insns[1] = (struct bpf_insn)
+				BPF_STMT(BPF_RET | BPF_A, 0);
+			snprintf(name, sizeof(name), "ld abs %#x %u",
+				 sizes[i], k);
+			bpf_jit_test_prog(name, insns, 2);
+
+			for (j = 0; j < ARRAY_SIZE(xs); j++) {
+				insns[0] = (struct bpf_insn)
+					BPF_STMT(BPF_LDX | BPF_IMM, xs[j]);
+				insns[1] = (struct bpf_insn)
+					BPF_STMT(BPF_LD | sizes[i] | BPF_IND,
+						 k);
+				insns[2] = (struct bpf_insn)
+					BPF_STMT(BPF_RET | BPF_A, 0);
+				snprintf(name, sizeof(name),
+					 "ld ind %#x %u x %#x",
+					 sizes[i], k, xs[j]);
+				bpf_jit_test_prog(name, insns, 3);
+			}
+		}
+	}
+}
+
+/* Each ALU operation with a K and an X operand */
+static void
+bpf_jit_test_alu(void)
+{
+	static const uint16_t ops[] = {
+		BPF_ADD, BPF_SUB, BPF_MUL, BPF_DIV, BPF_MOD,
+		BPF_AND, BPF_OR, BPF_XOR, BPF_LSH, BPF_RSH
+	};
+	static const uint32_t vals[] = { 1, 3, 31, 0x80000000, 0xffffffff };
+	struct bpf_insn insns[4];
+	char name[64];
+	u_int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		for (j = 0; j < ARRAY_SIZE(vals); j++) {
+			uint32_t v = vals[j];
+
+			/* Shifts of 32 or more are undefined */
+			if (ops[i] == BPF_LSH || ops[i] == BPF_RSH)
+				v &= 31;
+
+			insns[0] = (struct bpf_insn)
+				BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 14);
+			insns[1] = (struct bpf_insn)
+				BPF_STMT(BPF_ALU | ops[i] | BPF_K, v);
+			insns[2] = (struct bpf_insn)
+				BPF_STMT(BPF_RET | BPF_A, 0);
+			snprintf(name, sizeof(name), "alu %#x k %#x",
+				 ops[i], v);
+			bpf_jit_test_prog(name, insns, 3);
+
+			insns[1] = (struct bpf_insn)
+				BPF_STMT(BPF_LDX | BPF_IMM, v);
+			insns[2] = (struct bpf_insn)
+				BPF_STMT(BPF_ALU | ops[i] | BPF_X, 0);
+			insns[3] = (struct bpf_insn)
+				BPF_STMT(BPF_RET | BPF_A, 0);
+			snprintf(name, sizeof(name), "alu %#x x %#x",
+				 ops[i], v);
+			bpf_jit_test_prog(name, insns, 4);
+		}
+	}
+}
+
+/* Each conditional jump with a K and an X operand, both ways */
+static void
+bpf_jit_test_jmp(void)
+{
+	static const uint16_t ops[] = {
+		BPF_JGT, BPF_JGE, BPF_JEQ, BPF_JSET
+	};
+	static const uint32_t vals[] = { 0, 0x44, 0x45, 0x46, 0xffffffff };
+	struct bpf_insn insns[6];
+	char name[64];
+	u_int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		for (j = 0; j < ARRAY_SIZE(vals); j++) {
+			/* A is 0x45, from the IP version and length */
+			insns[0] = (struct bpf_insn)
+				BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 14);
+			insns[1] = (struct bpf_insn)
+				BPF_STMT(BPF_LDX | BPF_IMM, vals[j]);
+			insns[2] = (struct bpf_insn)
+				BPF_JUMP(BPF_JMP | ops[i] | BPF_K, vals[j],
+					 1, 0);
+			insns[3] = (struct bpf_insn)
+				BPF_JUMP(BPF_JMP | ops[i] | BPF_X, 0, 1, 0);
+			insns[4] = (struct bpf_insn)
+				BPF_STMT(BPF_RET | BPF_K, 1);
+			insns[5] = (struct bpf_insn)
+				BPF_STMT(BPF_RET | BPF_K, 2);
+			snprintf(name, sizeof(name), "jmp %#x %#x",
+				 ops[i], vals[j]);
+			bpf_jit_test_prog(name, insns, 6);
+
+			/* The X compare on its own */
+			insns[2] = (struct bpf_insn)
+				BPF_STMT(BPF_JMP | BPF_JA, 0);
+			snprintf(name, sizeof(name), "jmp x %#x %#x",
+				 ops[i], vals[j]);
+			bpf_jit_test_prog(name, insns, 6);
+		}
+	}
+}
+
+DP_DECL_TEST_SUITE(bpf_jit);
+
+DP_DECL_TEST_CASE(bpf_jit, bpf_jit_vs_filter, NULL, NULL);
+DP_START_TEST(bpf_jit_vs_filter, programs)
+{
+	u_int i;
+
+	bpf_jit_test_pkt_init();
+	for (i = 0; i < ARRAY_SIZE(bpf_jit_tests); i++)
+		bpf_jit_test_prog(bpf_jit_tests[i].name,
+				  bpf_jit_tests[i].insns,
+				  bpf_jit_tests[i].len);
+} DP_END_TEST;
+
+DP_START_TEST(bpf_jit_vs_filter, loads)
+{
+	bpf_jit_test_pkt_init();
+	bpf_jit_test_loads();
+} DP_END_TEST;
+
+DP_START_TEST(bpf_jit_vs_filter, alu)
+{
+	bpf_jit_test_pkt_init();
+	bpf_jit_test_alu();
+} DP_END_TEST;
+
+DP_START_TEST(bpf_jit_vs_filter, jmp)
+{
+	bpf_jit_test_pkt_init();
+	bpf_jit_test_jmp();
+} DP_END_TEST;
+
+/* Programs the compiler must reject, leaving them to bpf_filter() */
+DP_START_TEST(bpf_jit_vs_filter, rejected)
+{
+	static const struct bpf_insn div0[] = {
+		BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	static const struct bpf_insn no_ret[] = {
+		BPF_STMT(BPF_LD | BPF_IMM, 1),
+	};
+	static const struct bpf_insn bad_jmp[] = {
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 2, 0),
+		BPF_STMT(BPF_RET | BPF_K, 1),
+	};
+	static const struct bpf_insn bad_mem[] = {
+		BPF_STMT(BPF_ST, BPF_MEMWORDS),
+		BPF_STMT(BPF_RET | BPF_K, 1),
+	};
+
+	dp_test_fail_unless(!bpf_jit_compile(div0, ARRAY_SIZE(div0)),
+			    "divide by constant 0 compiled");
+	dp_test_fail_unless(!bpf_jit_compile(no_ret, ARRAY_SIZE(no_ret)),
+			    "program without a return compiled");
+	dp_test_fail_unless(!bpf_jit_compile(bad_jmp, ARRAY_SIZE(bad_jmp)),
+			    "jump past the end compiled");
+	dp_test_fail_unless(!bpf_jit_compile(bad_mem, ARRAY_SIZE(bad_mem)),
+			    "store past the scratch memory compiled");
+} DP_END_TEST;
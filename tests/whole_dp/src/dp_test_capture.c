@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Test the packet capture path, from a burst of packets on the
+ * forwarding thread to the message sent to the captures.
+ */
+
+#include <czmq.h>
+#include <pcap/pcap.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "if_var.h"
+#include "util.h"
+
+#include "dp_test.h"
+#include "dp_test_controller.h"
+#include "dp_test_lib.h"
+#include "dp_test_lib_intf.h"
+#include "dp_test_macros.h"
+#include "dp_test_pktmbuf_lib.h"
+
+#define DPT_CAP_PKTS	4
+
+static struct capture_info dpt_cap;
+static struct capture_filter dpt_cap_filter;
+
+/* Accept packets to 2.2.2.2 */
+static struct bpf_insn dpt_cap_dst_insns[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 30),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x02020202, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/*
+ * Attach capture state to an interface, as for a capture in slot 1,
+ * without the capture thread, so that the tests can read the ring.
+ */
+static struct ifnet *
+dpt_cap_start(unsigned int snaplen, unsigned int ring_sz, bool filter)
+{
+	char realname[IFNAMSIZ];
+	struct ifnet *ifp;
+
+	dp_test_intf_real("dp1T0", realname);
+	ifp = ifnet_byifname(realname);
+	dp_test_fail_unless(ifp, "no interface %s", realname);
+
+	memset(&dpt_cap, 0, sizeof(dpt_cap));
+	dpt_cap.cap_wake = eventfd(0, EFD_NONBLOCK);
+	dp_test_fail_unless(dpt_cap.cap_wake >= 0, "eventfd failed");
+	dpt_cap.cap_ring = rte_ring_create("dpt_capture", ring_sz,
+					   SOCKET_ID_ANY,
+					   RING_F_SP_ENQ | RING_F_SC_DEQ);
+	dp_test_fail_unless(dpt_cap.cap_ring, "ring create failed");
+	dpt_cap.capture_mask = 1;
+	dpt_cap.snaplen = snaplen;
+	CDS_INIT_LIST_HEAD(&dpt_cap.filters);
+
+	if (filter) {
+		memset(&dpt_cap_filter, 0, sizeof(dpt_cap_filter));
+		dpt_cap_filter.filter.bf_insns = dpt_cap_dst_insns;
+		dpt_cap_filter.filter.bf_len = ARRAY_SIZE(dpt_cap_dst_insns);
+		dpt_cap_filter.mask = 1;
+		cds_list_add_tail_rcu(&dpt_cap_filter.next, &dpt_cap.filters);
+	}
+
+	ifp->cap_info = &dpt_cap;
+	return ifp;
+}
+
+static void
+dpt_cap_stop(struct ifnet *ifp)
+{
+	struct rte_mbuf *m;
+
+	ifp->cap_info = NULL;
+	while (rte_ring_sc_dequeue(dpt_cap.cap_ring, (void **)&m) == 0)
+		rte_pktmbuf_free(m);
+	rte_ring_free(dpt_cap.cap_ring);
+	close(dpt_cap.cap_wake);
+}
+
+static struct rte_mbuf *
+dpt_cap_pak(const char *daddr, int len)
+{
+	struct rte_mbuf *m;
+
+	m = dp_test_create_ipv4_pak("1.1.1.1", daddr, 1, &len);
+	dp_test_fail_unless(m, "failed to create packet");
+	(void)dp_test_pktmbuf_eth_init(m, "aa:bb:cc:dd:ee:ff",
+				       DP_TEST_INTF_DEF_SRC_MAC,
+				       ETHER_TYPE_IPv4);
+	return m;
+}
+
+/*
+ * Take the next packet off the capture ring, and check the message sent
+ * for it: the slot mask, the PCAP header, and the data captured.
+ */
+static void
+dpt_cap_check_msg(const struct ifnet *ifp, uint32_t caplen, uint32_t len,
+		  const void *data)
+{
+	struct pcap_pkthdr pcap;
+	struct rte_mbuf *m;
+	zframe_t *frame;
+	zmsg_t *msg;
+
+	dp_test_fail_unless(rte_ring_sc_dequeue(dpt_cap.cap_ring,
+						(void **)&m) == 0,
+			    "no packet captured");
+	msg = capture_msg(ifp, m);
+	rte_pktmbuf_free(m);
+	dp_test_fail_unless(msg, "no capture message");
+	dp_test_fail_unless(zmsg_size(msg) == 3,
+			    "capture message has %zu frames", zmsg_size(msg));
+
+	frame = zmsg_first(msg);
+	dp_test_fail_unless(zframe_size(frame) == 1 &&
+			    *zframe_data(frame) == 1,
+			    "bad capture slot mask");
+
+	frame = zmsg_next(msg);
+	dp_test_fail_unless(zframe_size(frame) == sizeof(pcap),
+			    "bad pcap header size %zu", zframe_size(frame));
+	memcpy(&pcap, zframe_data(frame), sizeof(pcap));
+	dp_test_fail_unless(pcap.caplen == caplen,
+			    "caplen %u, expected %u", pcap.caplen, caplen);
+	dp_test_fail_unless(pcap.len == len,
+			    "len %u, expected %u", pcap.len, len);
+
+	frame = zmsg_next(msg);
+	dp_test_fail_unless(zframe_size(frame) == caplen,
+			    "captured %zu bytes, expected %u",
+			    zframe_size(frame), caplen);
+	dp_test_fail_unless(!memcmp(zframe_data(frame), data, caplen),
+			    "captured data does not match");
+
+	zmsg_destroy(&msg);
+}
+
+DP_DECL_TEST_SUITE(capture);
+
+DP_DECL_TEST_CASE(capture, capture_burst, NULL, NULL);
+
+/* A packet the filter rejects is not copied to the ring */
+DP_START_TEST(capture_burst, filter)
+{
+	struct rte_mbuf *pkts[2];
+	struct ifnet *ifp;
+
+	ifp = dpt_cap_start(1500, 64, true);
+
+	pkts[0] = dpt_cap_pak("3.3.3.3", 100);
+	pkts[1] = dpt_cap_pak("2.2.2.2", 100);
+	capture_burst(ifp, pkts, ARRAY_SIZE(pkts));
+
+	dp_test_fail_unless(rte_ring_count(dpt_cap.cap_ring) == 1,
+			    "%u packets captured, expected 1",
+			    rte_ring_count(dpt_cap.cap_ring));
+	dpt_cap_check_msg(ifp, rte_pktmbuf_pkt_len(pkts[1]),
+			  rte_pktmbuf_pkt_len(pkts[1]),
+			  rte_pktmbuf_mtod(pkts[1], void *));
+
+	rte_pktmbuf_free(pkts[0]);
+	rte_pktmbuf_free(pkts[1]);
+	dpt_cap_stop(ifp);
+} DP_END_TEST;
+
+/* The copy is cut at the snaplen, and len is the whole packet */
+DP_START_TEST(capture_burst, snaplen)
+{
+	struct rte_mbuf *m;
+	struct ifnet *ifp;
+	uint32_t len;
+
+	ifp = dpt_cap_start(100, 64, false);
+
+	m = dpt_cap_pak("2.2.2.2", 1000);
+	len = rte_pktmbuf_pkt_len(m);
+	capture_burst(ifp, &m, 1);
+	dpt_cap_check_msg(ifp, 100, len, rte_pktmbuf_mtod(m, void *));
+
+	/* A snaplen longer than the packet captures all of it */
+	dpt_cap.snaplen = 2000;
+	capture_burst(ifp, &m, 1);
+	dpt_cap_check_msg(ifp, len, len, rte_pktmbuf_mtod(m, void *));
+
+	rte_pktmbuf_free(m);
+	dpt_cap_stop(ifp);
+} DP_END_TEST;
+
+/*
+ * A VLAN tag in the offload flags is rebuilt in the captured data, and
+ * counts towards the snaplen.
+ */
+DP_START_TEST(capture_burst, vlan)
+{
+	struct {
+		struct ether_hdr eh;
+		struct vlan_hdr vh;
+	} __attribute__((__packed__)) vhdr;
+	uint8_t exp[64];
+	struct rte_mbuf *m;
+	struct ether_hdr *eh;
+	struct ifnet *ifp;
+	uint32_t len;
+
+	ifp = dpt_cap_start(16, 64, false);
+
+	m = dpt_cap_pak("2.2.2.2", 200);
+	m->ol_flags |= PKT_RX_VLAN;
+	m->vlan_tci = 10;
+	len = rte_pktmbuf_pkt_len(m) + sizeof(struct vlan_hdr);
+
+	eh = rte_pktmbuf_mtod(m, struct ether_hdr *);
+	memcpy(&vhdr.eh, eh, 2 * ETHER_ADDR_LEN);
+	vhdr.eh.ether_type = htons(if_tpid(ifp));
+	vhdr.vh.vlan_tci = htons(10);
+	vhdr.vh.eth_proto = eh->ether_type;
+
+	/* Cut in the middle of the VLAN header */
+	capture_burst(ifp, &m, 1);
+	dpt_cap_check_msg(ifp, 16, len, &vhdr);
+
+	/* Cut after the VLAN header, the rest follows the Ethernet header */
+	dpt_cap.snaplen = sizeof(exp);
+	memcpy(exp, &vhdr, sizeof(vhdr));
+	memcpy(exp + sizeof(vhdr),
+	       rte_pktmbuf_mtod_offset(m, void *, ETHER_HDR_LEN),
+	       sizeof(exp) - sizeof(vhdr));
+	capture_burst(ifp, &m, 1);
+	dpt_cap_check_msg(ifp, sizeof(exp), len, exp);
+
+	rte_pktmbuf_free(m);
+	dpt_cap_stop(ifp);
+} DP_END_TEST;
+
+/* A burst that does not fit in the ring is dropped, and the copies freed */
+DP_START_TEST(capture_burst, ring_full)
+{
+	struct rte_mbuf *pkts[DPT_CAP_PKTS];
+	struct rte_mempool *pool;
+	unsigned int avail, i;
+	struct ifnet *ifp;
+
+	pool = rte_mempool_lookup("capture");
+	dp_test_fail_unless(pool, "no capture pool");
+
+	/* Room for one less than the burst */
+	ifp = dpt_cap_start(1500, DPT_CAP_PKTS, false);
+
+	for (i = 0; i < DPT_CAP_PKTS; i++)
+		pkts[i] = dpt_cap_pak("2.2.2.2", 100);
+
+	avail = rte_mempool_avail_count(pool);
+	capture_burst(ifp, pkts, DPT_CAP_PKTS);
+	dp_test_fail_unless(rte_ring_count(dpt_cap.cap_ring) == 0,
+			    "%u packets captured, expected 0",
+			    rte_ring_count(dpt_cap.cap_ring));
+	dp_test_fail_unless(rte_mempool_avail_count(pool) == avail,
+			    "capture copies leaked, %u of %u available",
+			    rte_mempool_avail_count(pool), avail);
+
+	/* One less fits */
+	capture_burst(ifp, pkts, DPT_CAP_PKTS - 1);
+	dp_test_fail_unless(rte_ring_count(dpt_cap.cap_ring) ==
+			    DPT_CAP_PKTS - 1,
+			    "%u packets captured, expected %u",
+			    rte_ring_count(dpt_cap.cap_ring),
+			    DPT_CAP_PKTS - 1);
+
+	for (i = 0; i < DPT_CAP_PKTS; i++)
+		rte_pktmbuf_free(pkts[i]);
+	dpt_cap_stop(ifp);
+
+	dp_test_fail_unless(rte_mempool_avail_count(pool) == avail,
+			    "capture copies leaked, %u of %u available",
+			    rte_mempool_avail_count(pool), avail);
+} DP_END_TEST;
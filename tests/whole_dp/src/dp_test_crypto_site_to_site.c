@@ -18,6 +18,7 @@
 #include "dp_test_lib_intf.h"
 #include "dp_test_console.h"
 #include "dp_test_controller.h"
+#include "dp_test_json_utils.h"
 
 #include "main.h"
 #include "in_cksum.h"
@@ -2453,6 +2454,36 @@ static void rx_plaintext_local_pkt_notmatch_inpolicy6(vrfid_t vrfid)
 
 DP_DECL_TEST_SUITE(site_to_site_suite);
 
+static void s2s_set_inline(const char *mode)
+{
+	char cmd[64], exp[64];
+
+	snprintf(cmd, sizeof(cmd), "ipsec engine inline %s", mode);
+	dp_test_console_request_reply(cmd, false);
+	snprintf(exp, sizeof(exp), "\"mode\": \"%s\"", mode);
+	dp_test_check_state_show("ipsec engine inline", exp, false);
+}
+
+/* Number of packets processed inline by the forwarding threads */
+static int s2s_inline_packets(void)
+{
+	json_object *jresp, *jobj;
+	char *response;
+	int packets = -1;
+	bool err;
+
+	response = dp_test_console_request_w_err("ipsec engine inline",
+						 &err, false);
+	jresp = parse_json(response, NULL, 0);
+	free(response);
+	if (jresp && json_object_object_get_ex(jresp, "inline", &jobj))
+		dp_test_json_int_field_from_obj(jobj, "inline_packets",
+						&packets);
+	json_object_put(jresp);
+	dp_test_fail_unless(packets >= 0, "no inline packet count");
+	return packets;
+}
+
 DP_DECL_TEST_CASE(site_to_site_suite, encryption, NULL, NULL);
 
 /*
@@ -2500,6 +2531,18 @@ DP_START_TEST(encryption, encrypt_vrf_out_of_order)
 	encrypt_main(TEST_VRF, VRF_XFRM_OUT_OF_ORDER);
 }  DP_END_TEST;
 
+/* Encrypt on the forwarding thread rather than the crypto thread */
+DP_START_TEST(encryption, encrypt_inline)
+{
+	int before = s2s_inline_packets();
+
+	s2s_set_inline("on");
+	encrypt_main(VRF_DEFAULT_ID, VRF_XFRM_IN_ORDER);
+	s2s_set_inline("off");
+	dp_test_fail_unless(s2s_inline_packets() > before,
+			    "no packets encrypted inline");
+}  DP_END_TEST;
+
 DP_START_TEST(encryption, encrypt6)
 {
 	encrypt6_main(VRF_DEFAULT_ID);
@@ -2601,6 +2644,17 @@ DP_START_TEST(decryption, decrypt_null_invalid)
 	null_decrypt_main(VRF_DEFAULT_ID, INNER_INVALID);
 }  DP_END_TEST;
 
+DP_START_TEST(decryption, decrypt_null_inline)
+{
+	int before = s2s_inline_packets();
+
+	s2s_set_inline("on");
+	null_decrypt_main(VRF_DEFAULT_ID, INNER_VALID);
+	s2s_set_inline("off");
+	dp_test_fail_unless(s2s_inline_packets() > before,
+			    "no packets decrypted inline");
+}  DP_END_TEST;
+
 DP_DECL_TEST_CASE(site_to_site_suite, decryption_local, NULL, NULL);
 
 DP_START_TEST(decryption_local, decrypt_null_local)
@@ -10,6 +10,11 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
 #include "dp_test.h"
 #include "dp_test_lib.h"
 
@@ -21,6 +26,32 @@ struct esp_header {
 	uint32_t seq;
 };
 
+static void esp_set_seq(struct esp_header *hdr, uint32_t seq)
+{
+	hdr->seq = htonl(seq);
+}
+
+static int esp_check(struct sadb_sa *sa, uint32_t seq)
+{
+	struct esp_header hdr = { .seq = htonl(seq) };
+
+	return esp_replay_check((uint8_t *)&hdr, sa);
+}
+
+static int esp_advance(struct sadb_sa *sa, uint32_t seq)
+{
+	struct esp_header hdr = { .seq = htonl(seq) };
+
+	return esp_replay_advance((uint8_t *)&hdr, sa);
+}
+
+static void esp_replay_setup(struct sadb_sa *sa, uint32_t replay_window)
+{
+	memset(sa, 0, sizeof(*sa));
+	dp_test_fail_unless(esp_replay_init(sa, replay_window) == 0,
+			    "replay window init failed");
+}
+
 DP_DECL_TEST_SUITE(esp_replay_suite);
 
 DP_DECL_TEST_CASE(esp_replay_suite, sequence_number_check, NULL, NULL);
@@ -35,17 +66,15 @@ DP_START_TEST(sequence_number_check, sequence_number_check)
 	struct esp_header hdr;
 	unsigned int i;
 
-	sa.replay_window = 0;
-	sa.replay_bitmap = 0;
-	sa.seq = 0;
+	esp_replay_setup(&sa, 0);
 	hdr.spi = 0;
 	hdr.seq = 1;
 
 	dp_test_fail_unless((esp_replay_check((uint8_t *) &hdr, &sa) == 0),
 			    "check defaults if no replay window is set");
 
+	esp_replay_setup(&sa, 32);
 	hdr.seq = 0;
-	sa.replay_window = 32;
 
 	dp_test_fail_unless((esp_replay_check((uint8_t *) &hdr, &sa) == -1),
 			    "check should fail if sequence number is zero");
@@ -70,7 +99,6 @@ DP_START_TEST(sequence_number_check, sequence_number_check)
 			    "check should fail if sequence number "
 			    "is to the left of the window");
 
-	sa.replay_bitmap = 0;
 	sa.seq = 128;
 	hdr.seq = htonl(sa.seq - 31);
 
@@ -81,26 +109,30 @@ DP_START_TEST(sequence_number_check, sequence_number_check)
 				    "is new and within window", ntohl(hdr.seq));
 		hdr.seq = htonl(ntohl(hdr.seq) + 1);
 	}
+	esp_replay_free(&sa);
 
-	sa.replay_bitmap = 5;
-	hdr.seq = htonl(1);
-	sa.seq = 3;
+	/* Sequence numbers 1 and 3 seen */
+	esp_replay_setup(&sa, 32);
+	esp_advance(&sa, 1);
+	esp_advance(&sa, 3);
+	esp_set_seq(&hdr, 1);
 
 	dp_test_fail_unless(esp_replay_check((uint8_t *) &hdr, &sa) == -3,
 			    "check should fail if sequence number (%d) "
-			    "is _not_ new and within window", i);
+			    "is _not_ new and within window", 1);
 
-	hdr.seq = htonl(2);
+	esp_set_seq(&hdr, 2);
 
 	dp_test_fail_unless((esp_replay_check((uint8_t *) &hdr, &sa) == 0),
 			    "check should pass if sequence number (%d) "
-			    "is new and within window", i);
+			    "is new and within window", 2);
 
-	hdr.seq = htonl(3);
+	esp_set_seq(&hdr, 3);
 
 	dp_test_fail_unless((esp_replay_check((uint8_t *) &hdr, &sa) == -3),
 			    "check should fail if sequence number (%d) "
-			    "Is _not_ new and within window", i);
+			    "Is _not_ new and within window", 3);
+	esp_replay_free(&sa);
 } DP_END_TEST;
 
 DP_DECL_TEST_CASE(esp_replay_suite, sequence_number_advance, NULL, NULL);
@@ -112,46 +144,133 @@ DP_DECL_TEST_CASE(esp_replay_suite, sequence_number_advance, NULL, NULL);
 DP_START_TEST(sequence_number_advance, sequence_number_advance)
 {
 	struct sadb_sa sa;
-	struct esp_header hdr;
 
-	sa.replay_window = 3;
-	sa.replay_bitmap = 0;
-	sa.seq = 0;
-	hdr.spi = 0;
-	hdr.seq = htonl(1);
+	esp_replay_setup(&sa, 3);
 
-	esp_replay_advance((uint8_t *) &hdr, &sa);
+	dp_test_fail_unless(esp_advance(&sa, 1) == 0, "advance to 1 failed");
 	dp_test_fail_unless((sa.seq == 1),
 			    "sequence number failed to advance to 1");
-	dp_test_fail_unless((sa.replay_bitmap == 1), "bitmap should be 1");
+	dp_test_fail_unless(esp_check(&sa, 1) == -3, "1 should be seen");
 
-	hdr.seq = htonl(2);
-	esp_replay_advance((uint8_t *) &hdr, &sa);
+	dp_test_fail_unless(esp_advance(&sa, 2) == 0, "advance to 2 failed");
 	dp_test_fail_unless((sa.seq == 2),
 			    "sequence number failed to advance to 2");
-	dp_test_fail_unless((sa.replay_bitmap == 3), "bitmap should be 3");
 
-	hdr.seq = htonl(4);
-	esp_replay_advance((uint8_t *) &hdr, &sa);
+	dp_test_fail_unless(esp_advance(&sa, 4) == 0, "advance to 4 failed");
 	dp_test_fail_unless((sa.seq == 4),
 			    "sequence number failed to advance to 4");
-	dp_test_fail_unless((sa.replay_bitmap == 13), "bitmap should be 13");
+	dp_test_fail_unless(esp_check(&sa, 3) == 0, "3 should be new");
+	dp_test_fail_unless(esp_check(&sa, 2) == -3, "2 should be seen");
 
-	hdr.seq = htonl(3);
-	esp_replay_advance((uint8_t *) &hdr, &sa);
+	dp_test_fail_unless(esp_advance(&sa, 3) == 0, "advance of 3 failed");
 	dp_test_fail_unless((sa.seq == 4),
 			    "sequence number should still be 4");
-	dp_test_fail_unless((sa.replay_bitmap == 15), "bitmap should be 15");
+	dp_test_fail_unless(esp_check(&sa, 3) == -3, "3 should be seen");
 
-	hdr.seq = htonl(5);
-	esp_replay_advance((uint8_t *) &hdr, &sa);
+	dp_test_fail_unless(esp_advance(&sa, 5) == 0, "advance to 5 failed");
 	dp_test_fail_unless((sa.seq == 5),
 			    "sequence number failed to advance to 5");
-	dp_test_fail_unless((sa.replay_bitmap == 31), "bitmap should be 31");
 
-	hdr.seq = htonl(7);
-	esp_replay_advance((uint8_t *) &hdr, &sa);
+	dp_test_fail_unless(esp_advance(&sa, 7) == 0, "advance to 7 failed");
 	dp_test_fail_unless((sa.seq == 7),
 			    "sequence number failed to advance to 7");
-	dp_test_fail_unless((sa.replay_bitmap == 125), "bitmap should be 125");
+	dp_test_fail_unless(esp_check(&sa, 6) == 0, "6 should be new");
+	dp_test_fail_unless(esp_check(&sa, 5) == -3, "5 should be seen");
+	dp_test_fail_unless(esp_check(&sa, 4) == -2,
+			    "4 should be left of the window");
+
+	/*
+	 * A packet accepted by another thread between the check and
+	 * the advance, or pushed out of the window, is rejected.
+	 */
+	dp_test_fail_unless(esp_advance(&sa, 5) == -3,
+			    "second advance of 5 should fail");
+	dp_test_fail_unless(esp_advance(&sa, 4) == -2,
+			    "advance left of the window should fail");
+	esp_replay_free(&sa);
+} DP_END_TEST;
+
+DP_DECL_TEST_CASE(esp_replay_suite, large_window, NULL, NULL);
+
+/*
+ * Does a window larger than a bucket keep track of packets reordered
+ * across buckets, and forget them as it moves on?
+ */
+DP_START_TEST(large_window, large_window)
+{
+	const uint32_t window = 4096;
+	struct sadb_sa sa;
+	uint32_t seq;
+
+	esp_replay_setup(&sa, window);
+
+	/* Every other packet, then the rest in reverse */
+	for (seq = 2; seq <= 2 * window; seq += 2)
+		dp_test_fail_unless(esp_advance(&sa, seq) == 0,
+				    "advance of %u failed", seq);
+	for (seq = 2 * window - 1; seq > window; seq -= 2) {
+		dp_test_fail_unless(esp_check(&sa, seq) == 0,
+				    "%u should be new", seq);
+		dp_test_fail_unless(esp_advance(&sa, seq) == 0,
+				    "advance of %u failed", seq);
+	}
+	for (seq = window + 1; seq <= 2 * window; seq++)
+		dp_test_fail_unless(esp_check(&sa, seq) == -3,
+				    "%u should be seen", seq);
+	dp_test_fail_unless(esp_check(&sa, window) == -2,
+			    "%u should be left of the window", window);
+
+	/* Move the window on by less than its size */
+	seq = 3 * window - 100;
+	dp_test_fail_unless(esp_advance(&sa, seq) == 0,
+			    "advance to %u failed", seq);
+	dp_test_fail_unless(esp_check(&sa, seq - window + 1) == -3,
+			    "%u should still be seen", seq - window + 1);
+	dp_test_fail_unless(esp_check(&sa, seq - 1) == 0,
+			    "%u should be new", seq - 1);
+
+	/* And by more than its size, which forgets everything */
+	seq += 10 * window;
+	dp_test_fail_unless(esp_advance(&sa, seq) == 0,
+			    "advance to %u failed", seq);
+	dp_test_fail_unless(esp_check(&sa, seq) == -3,
+			    "%u should be seen", seq);
+	for (seq = seq - window + 1; seq < sa.seq; seq++)
+		dp_test_fail_unless(esp_check(&sa, seq) == 0,
+				    "%u should be new", seq);
+	esp_replay_free(&sa);
+} DP_END_TEST;
+
+DP_DECL_TEST_CASE(esp_replay_suite, burst_check, NULL, NULL);
+
+/*
+ * Does the burst check give the same results as checking the packets
+ * one at a time?
+ */
+DP_START_TEST(burst_check, burst_check)
+{
+	uint32_t seq[64];
+	struct sadb_sa sa;
+	uint64_t fail, exp;
+	unsigned int i, j;
+
+	esp_replay_setup(&sa, 1024);
+	srandom(1);
+	for (i = 0; i < 100; i++) {
+		exp = 0;
+		for (j = 0; j < ARRAY_SIZE(seq); j++) {
+			seq[j] = random() % (sa.seq + 200);
+			if (esp_check(&sa, seq[j]) < 0)
+				exp |= 1ull << j;
+		}
+		fail = esp_replay_check_burst(&sa, seq, ARRAY_SIZE(seq));
+		dp_test_fail_unless(fail == exp,
+				    "burst %u failed 0x%lx, expected 0x%lx",
+				    i, fail, exp);
+
+		for (j = 0; j < ARRAY_SIZE(seq); j++)
+			if (!(fail & (1ull << j)))
+				esp_advance(&sa, seq[j]);
+	}
+	esp_replay_free(&sa);
 } DP_END_TEST;
@@ -11,12 +11,14 @@
 #include <libmnl/libmnl.h>
 #include <linux/random.h>
 
+#include "ecmp.h"
 #include "ip_funcs.h"
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
 
 #include "dp_test.h"
+#include "dp_test_console.h"
 #include "dp_test_controller.h"
 #include "dp_test_netlink_state.h"
 #include "dp_test_lib.h"
@@ -1689,6 +1691,116 @@ DP_START_TEST(ecmp, bad_l4)
 	dp_test_nl_del_ip_addr_and_connected("dp4T3", "3.3.3.3/24");
 } DP_END_TEST;
 
+/*
+ * Resilient hash: a dead path only moves the buckets it owned, and
+ * those are spread over the remaining paths.
+ */
+DP_START_TEST(ecmp, resilient_buckets)
+{
+	uint16_t orig[ECMP_RESILIENT_BUCKETS];
+	uint16_t buckets[ECMP_RESILIENT_BUCKETS];
+	unsigned int moved[4] = { 0 };
+	bool dead[4] = { false };
+	unsigned int i;
+
+	ecmp_resilient_fill(orig, 4, dead);
+	for (i = 0; i < ECMP_RESILIENT_BUCKETS; i++)
+		dp_test_fail_unless(orig[i] == i % 4,
+				    "bucket %u path %u, expected %u",
+				    i, orig[i], i % 4);
+
+	memcpy(buckets, orig, sizeof(buckets));
+	dead[2] = true;
+	ecmp_resilient_fill(buckets, 4, dead);
+	for (i = 0; i < ECMP_RESILIENT_BUCKETS; i++) {
+		if (orig[i] != 2) {
+			dp_test_fail_unless(buckets[i] == orig[i],
+					    "bucket %u moved from live path %u",
+					    i, orig[i]);
+			continue;
+		}
+		dp_test_fail_unless(buckets[i] < 4 && buckets[i] != 2,
+				    "bucket %u not moved off dead path", i);
+		moved[buckets[i]]++;
+	}
+	for (i = 0; i < 4; i++) {
+		if (i == 2)
+			continue;
+		dp_test_fail_unless(moved[i] >= 21 && moved[i] <= 22,
+				    "path %u took %u buckets of dead path",
+				    i, moved[i]);
+	}
+
+	dead[2] = false;
+	ecmp_resilient_fill(buckets, 4, dead);
+	dp_test_fail_unless(memcmp(buckets, orig, sizeof(buckets)) == 0,
+			    "buckets not restored when path recovered");
+} DP_END_TEST;
+
+DP_START_TEST(ecmp, resilient)
+{
+	struct dp_test_expected *exp;
+	struct rte_mbuf *test_pak;
+	const char *nh_mac_str1, *nh_mac_str2;
+	const char *oif, *nh_mac;
+	uint32_t hash;
+	int len = 22;
+
+	dp_test_console_request_reply("ecmp mode resilient", false);
+
+	/* Set up the interface addresses */
+	dp_test_nl_add_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp3T2", "2.2.2.2/24");
+	dp_test_nl_add_ip_addr_and_connected("dp4T3", "3.3.3.3/24");
+
+	/* Add the route / nh arp we want the packet to follow */
+	dp_test_netlink_add_route(
+		"10.73.2.0/24 nh 2.2.2.1 int:dp3T2 nh 3.3.3.1 int:dp4T3");
+	nh_mac_str1 = "aa:bb:cc:dd:ee:ff";
+	dp_test_netlink_add_neigh("dp3T2", "2.2.2.1", nh_mac_str1);
+
+	nh_mac_str2 = "11:22:33:44:55:66";
+	dp_test_netlink_add_neigh("dp4T3", "3.3.3.1", nh_mac_str2);
+
+	test_pak = dp_test_create_udp_ipv4_pak("10.73.0.0", "10.73.2.0",
+					       1001, 1003, 1, &len);
+	(void)dp_test_pktmbuf_eth_init(test_pak,
+				       dp_test_intf_name2mac_str("dp1T1"),
+				       DP_TEST_INTF_DEF_SRC_MAC,
+				       ETHER_TYPE_IPv4);
+
+	/* With no dead paths bucket N belongs to path N % paths */
+	hash = ecmp_mbuf_hash(test_pak, ETHER_TYPE_IPv4);
+	if ((hash & (ECMP_RESILIENT_BUCKETS - 1)) % 2 == 0) {
+		oif = "dp3T2";
+		nh_mac = nh_mac_str1;
+	} else {
+		oif = "dp4T3";
+		nh_mac = nh_mac_str2;
+	}
+
+	exp = dp_test_exp_create(test_pak);
+	dp_test_exp_set_oif_name(exp, oif);
+	(void)dp_test_pktmbuf_eth_init(dp_test_exp_get_pak(exp),
+				       nh_mac,
+				       dp_test_intf_name2mac_str(oif),
+				       ETHER_TYPE_IPv4);
+	dp_test_ipv4_decrement_ttl(dp_test_exp_get_pak(exp));
+
+	dp_test_pak_receive(test_pak, "dp1T1", exp);
+
+	/* Clean Up */
+	dp_test_netlink_del_route(
+		"10.73.2.0/24 nh 2.2.2.1 int:dp3T2 nh 3.3.3.1 int:dp4T3");
+	dp_test_netlink_del_neigh("dp3T2", "2.2.2.1", nh_mac_str1);
+	dp_test_netlink_del_neigh("dp4T3", "3.3.3.1", nh_mac_str2);
+	dp_test_nl_del_ip_addr_and_connected("dp1T1", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp3T2", "2.2.2.2/24");
+	dp_test_nl_del_ip_addr_and_connected("dp4T3", "3.3.3.3/24");
+
+	dp_test_console_request_reply("ecmp mode hrw", false);
+} DP_END_TEST;
+
 /*
  * IP forward ingressing into a virtual interface (vif)
  */
@@ -10,10 +10,13 @@
  * get some meaningful performance stats (dcache and icache hits) from a
  * single test.
  */
+#include "ether.h"
+
 #include "dp_test_lib_exp.h"
 #include "dp_test_lib_intf.h"
 #include "dp_test_macros.h"
 #include "dp_test_netlink_state.h"
+#include "dp_test_npf_lib.h"
 
 DP_DECL_TEST_SUITE(ip_suite_n);
 
@@ -122,3 +125,187 @@ DP_START_TEST(ip_fwd_n, if_fwd_n)
 	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
 	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
 } DP_END_TEST;
+
+/*
+ * Forward a burst of packets through the pipeline in vector mode,
+ * with the packets split between two output interfaces so that the
+ * burst is sorted into more than one sub-vector.
+ */
+DP_DECL_TEST_CASE(ip_suite_n, ip_fwd_vector, NULL, NULL);
+DP_START_TEST(ip_fwd_vector, if_fwd_vector)
+{
+	struct dp_test_expected *exp;
+	struct rte_mbuf *rx_pak_n[DP_TEST_MAX_EXPECTED_PAKS];
+	const char *nh_mac_str[2];
+	const char *oif[2] = { "dp2T1", "dp3T2" };
+	const char *dst[2] = { "10.73.2.1", "10.73.3.1" };
+	int i, len = 22;
+
+	set_pipeline_vector_mode(true);
+
+	/* Set up the interface addresses */
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_nl_add_ip_addr_and_connected("dp3T2", "3.3.3.3/24");
+
+	/* Add the routes / nh arps we want the packets to follow */
+	dp_test_netlink_add_route("10.73.2.0/24 nh 2.2.2.1 int:dp2T1");
+	dp_test_netlink_add_route("10.73.3.0/24 nh 3.3.3.1 int:dp3T2");
+	nh_mac_str[0] = "aa:bb:cc:dd:ee:ff";
+	nh_mac_str[1] = "aa:bb:cc:dd:ee:fe";
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.1", nh_mac_str[0]);
+	dp_test_netlink_add_neigh("dp3T2", "3.3.3.1", nh_mac_str[1]);
+
+	/* Create n paks alternating between the routes added above */
+	for (i = 0; i < DP_TEST_MAX_EXPECTED_PAKS; i++) {
+		rx_pak_n[i] = dp_test_create_ipv4_pak("10.73.1.1",
+						      dst[i % 2], 1, &len);
+		dp_test_pktmbuf_eth_init(rx_pak_n[i],
+					 dp_test_intf_name2mac_str("dp1T0"),
+					 DP_TEST_INTF_DEF_SRC_MAC,
+					 ETHER_TYPE_IPv4);
+
+		/* Create paks we expect to receive on the tx ring */
+		if (i == 0)
+			exp = dp_test_exp_create_m(rx_pak_n[i], 1);
+		else
+			dp_test_exp_append_m(exp, rx_pak_n[i], 1);
+
+		dp_test_pktmbuf_eth_init(dp_test_exp_get_pak_m(exp, i),
+					 nh_mac_str[i % 2],
+					 dp_test_intf_name2mac_str(oif[i % 2]),
+					 ETHER_TYPE_IPv4);
+		dp_test_ipv4_decrement_ttl(dp_test_exp_get_pak_m(exp, i));
+		dp_test_exp_set_oif_name_m(exp, i, oif[i % 2]);
+	}
+
+	dp_test_pak_receive_n(rx_pak_n, DP_TEST_MAX_EXPECTED_PAKS, "dp1T0",
+			      exp);
+
+	/* Clean Up */
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.1", nh_mac_str[0]);
+	dp_test_netlink_del_neigh("dp3T2", "3.3.3.1", nh_mac_str[1]);
+	dp_test_netlink_del_route("10.73.2.0/24 nh 2.2.2.1 int:dp2T1");
+	dp_test_netlink_del_route("10.73.3.0/24 nh 3.3.3.1 int:dp3T2");
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_nl_del_ip_addr_and_connected("dp3T2", "3.3.3.3/24");
+
+	set_pipeline_vector_mode(false);
+} DP_END_TEST;
+
+/*
+ * Forward a burst of two interleaved UDP flows in vector mode through a
+ * stateful firewall on the input interface and a firewall on the output
+ * interface that blocks one of the flows.  Every packet is parsed by the
+ * input firewall before any reaches the output firewall, so this checks
+ * that the output firewall sees each packet's own parse.
+ */
+DP_START_TEST(ip_fwd_vector, if_fwd_vector_fw)
+{
+	struct dp_test_expected *exp;
+	struct rte_mbuf *rx_pak_n[DP_TEST_MAX_EXPECTED_PAKS];
+	const char *nh_mac_str = "aa:bb:cc:dd:ee:ff";
+	const char *src[2] = { "10.73.1.1", "10.73.1.2" };
+	uint16_t dport[2] = { 1000, 2000 };
+	int i, len = 22;
+
+	struct dp_test_npf_rule_t rules_in[] = {
+		{
+			.rule = "10",
+			.pass = PASS,
+			.stateful = STATEFUL,
+			.npf = ""
+		},
+		NULL_RULE
+	};
+	struct dp_test_npf_ruleset_t fw_in = {
+		.rstype = "fw-in",
+		.name = "FW_IN",
+		.enable = 1,
+		.attach_point = "dp1T0",
+		.fwd = FWD,
+		.dir = "in",
+		.rules = rules_in
+	};
+	struct dp_test_npf_rule_t rules_out[] = {
+		{
+			.rule = "10",
+			.pass = BLOCK,
+			.stateful = STATELESS,
+			.npf = "proto=17 dst-port=2000"
+		},
+		{
+			.rule = "20",
+			.pass = PASS,
+			.stateful = STATELESS,
+			.npf = ""
+		},
+		NULL_RULE
+	};
+	struct dp_test_npf_ruleset_t fw_out = {
+		.rstype = "fw-out",
+		.name = "FW_OUT",
+		.enable = 1,
+		.attach_point = "dp2T1",
+		.fwd = FWD,
+		.dir = "out",
+		.rules = rules_out
+	};
+
+	set_pipeline_vector_mode(true);
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_add_route("10.73.2.0/24 nh 2.2.2.1 int:dp2T1");
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.1", nh_mac_str);
+
+	dp_test_npf_fw_add(&fw_in, false);
+	dp_test_npf_fw_add(&fw_out, false);
+
+	/*
+	 * Alternate between the flows, ending with the blocked one, so
+	 * that a stale parse would block the permitted flow.
+	 */
+	for (i = 0; i < DP_TEST_MAX_EXPECTED_PAKS; i++) {
+		rx_pak_n[i] = dp_test_create_udp_ipv4_pak(src[i % 2],
+							  "10.73.2.1",
+							  41000 + i % 2,
+							  dport[i % 2],
+							  1, &len);
+		dp_test_pktmbuf_eth_init(rx_pak_n[i],
+					 dp_test_intf_name2mac_str("dp1T0"),
+					 DP_TEST_INTF_DEF_SRC_MAC,
+					 ETHER_TYPE_IPv4);
+
+		if (i == 0)
+			exp = dp_test_exp_create_m(rx_pak_n[i], 1);
+		else
+			dp_test_exp_append_m(exp, rx_pak_n[i], 1);
+
+		dp_test_pktmbuf_eth_init(dp_test_exp_get_pak_m(exp, i),
+					 nh_mac_str,
+					 dp_test_intf_name2mac_str("dp2T1"),
+					 ETHER_TYPE_IPv4);
+		dp_test_ipv4_decrement_ttl(dp_test_exp_get_pak_m(exp, i));
+		dp_test_exp_set_oif_name_m(exp, i, "dp2T1");
+		dp_test_exp_set_fwd_status_m(exp, i, i % 2 ?
+					     DP_TEST_FWD_DROPPED :
+					     DP_TEST_FWD_FORWARDED);
+	}
+
+	dp_test_pak_receive_n(rx_pak_n, DP_TEST_MAX_EXPECTED_PAKS, "dp1T0",
+			      exp);
+
+	/* Clean Up */
+	dp_test_npf_fw_del(&fw_out, false);
+	dp_test_npf_fw_del(&fw_in, false);
+	dp_test_npf_cleanup();
+
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.1", nh_mac_str);
+	dp_test_netlink_del_route("10.73.2.0/24 nh 2.2.2.1 int:dp2T1");
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	set_pipeline_vector_mode(false);
+} DP_END_TEST;
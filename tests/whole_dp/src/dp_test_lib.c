@@ -1172,7 +1172,7 @@ dp_test_intf_name2rx_ring(const char *real_name)
 	return dp_test_intf_name2ring(real_name, DP_TEST_RX_RING_BASE_NAME);
 }
 
-static struct rte_ring *
+struct rte_ring *
 dp_test_intf_name2tx_ring(const char *if_name)
 {
 	return dp_test_intf_name2ring(if_name, DP_TEST_TX_RING_BASE_NAME);
@@ -305,6 +305,9 @@ dp_test_pak_inject(struct rte_mbuf **paks_to_send, uint32_t num_paks,
 		   struct dp_test_expected *expected, const char *test_type);
 void
 dp_test_intf_wait_until_processed(struct rte_ring *ring);
+/* The ring that packets sent on a test interface end up on */
+struct rte_ring *
+dp_test_intf_name2tx_ring(const char *if_name);
 /*
  * Simulate injection of packet into the dataplane from the kernel
  */
@@ -0,0 +1,631 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * LPM lookup tests and microbenchmarks
+ *
+ * These operate directly on LPM tables outside of any VRF, so that
+ * the lookup paths can be compared against each other on the same
+ * (large) table. Timings are printed when run with debug enabled.
+ */
+#include <linux/rtnetlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+#include "lpm/lpm.h"
+#include "lpm/lpm6.h"
+#include "urcu.h"
+#include "util.h"
+
+#include "dp_test.h"
+#include "dp_test_macros.h"
+
+DP_DECL_TEST_SUITE(lpm);
+
+#define LPM_TEST_ROUTES		100000
+#define LPM_TEST_ADDRS		65536
+#define LPM_TEST_PASSES		10
+#define LPM_TEST_BULK_SIZE	32
+#define LPM6_TEST_ROUTES	50000
+
+/*
+ * Populate a table with a reproducible set of random prefixes, biased
+ * towards /24 and longer so that plenty of tbl8 groups get used. If
+ * batch is set the forwarding table is only updated once at the end.
+ */
+static struct lpm *
+lpm_test_create_table(uint32_t *prefixes, uint8_t *depths,
+		      unsigned int count, bool batch)
+{
+	struct pd_obj_state_and_flags *pd_state;
+	struct lpm *lpm;
+	unsigned int i;
+	uint8_t depth;
+	int rc;
+
+	lpm = lpm_create(0);
+	dp_test_fail_unless(lpm, "failed to create lpm");
+
+	if (batch)
+		lpm_update_begin(lpm);
+
+	srandom(1);
+	for (i = 0; i < count; i++) {
+		prefixes[i] = random();
+		depth = 8 + random() % 25;
+		if (i % 2)
+			depth = 24 + random() % 9;
+		if (depths)
+			depths[i] = depth;
+		rc = lpm_add(lpm, prefixes[i], depth, i % 4096 + 1,
+			     RT_SCOPE_UNIVERSE, &pd_state, NULL, NULL);
+		dp_test_fail_unless(rc >= 0, "failed to add %x/%u: %d",
+				    prefixes[i], depth, rc);
+	}
+
+	if (batch) {
+		rc = lpm_update_commit(lpm);
+		dp_test_fail_unless(rc == 0, "failed to commit lpm: %d", rc);
+	}
+
+	return lpm;
+}
+
+static void
+lpm_test_fill_addrs(uint32_t *addrs, unsigned int count,
+		    const uint32_t *prefixes, unsigned int num_prefixes)
+{
+	unsigned int i;
+
+	/* Mostly addresses covered by a route, plus some misses */
+	for (i = 0; i < count; i++) {
+		if (i % 8)
+			addrs[i] = prefixes[random() % num_prefixes] ^
+				(random() & 0xff);
+		else
+			addrs[i] = random();
+	}
+}
+
+DP_DECL_TEST_CASE(lpm, lpm_bulk, NULL, NULL);
+DP_START_TEST(lpm_bulk, lookup_bulk)
+{
+	uint32_t *prefixes, *addrs, *nh_scalar, *nh_bulk;
+	uint64_t start, scalar_cycles = 0, bulk_cycles = 0;
+	unsigned int i, j, pass;
+	struct lpm *lpm;
+
+	prefixes = calloc(LPM_TEST_ROUTES, sizeof(*prefixes));
+	addrs = calloc(LPM_TEST_ADDRS, sizeof(*addrs));
+	nh_scalar = calloc(LPM_TEST_ADDRS, sizeof(*nh_scalar));
+	nh_bulk = calloc(LPM_TEST_ADDRS, sizeof(*nh_bulk));
+	dp_test_fail_unless(prefixes && addrs && nh_scalar && nh_bulk,
+			    "failed to allocate test arrays");
+
+	/* Growing tbl8 defers the free of the old table */
+	rcu_register_thread();
+	rcu_defer_register_thread();
+
+	lpm = lpm_test_create_table(prefixes, NULL, LPM_TEST_ROUTES, false);
+	lpm_test_fill_addrs(addrs, LPM_TEST_ADDRS, prefixes,
+			    LPM_TEST_ROUTES);
+
+	for (pass = 0; pass < LPM_TEST_PASSES; pass++) {
+		start = rte_rdtsc();
+		for (i = 0; i < LPM_TEST_ADDRS; i++)
+			if (lpm_lookup(lpm, addrs[i], &nh_scalar[i]) != 0)
+				nh_scalar[i] = LPM_LOOKUP_MISS;
+		scalar_cycles += rte_rdtsc() - start;
+
+		start = rte_rdtsc();
+		for (i = 0; i < LPM_TEST_ADDRS; i += LPM_TEST_BULK_SIZE)
+			lpm_lookup_bulk(lpm, &addrs[i], &nh_bulk[i],
+					LPM_TEST_BULK_SIZE);
+		bulk_cycles += rte_rdtsc() - start;
+	}
+
+	for (i = 0; i < LPM_TEST_ADDRS; i++)
+		dp_test_fail_unless(nh_scalar[i] == nh_bulk[i],
+				    "%x: scalar nh %u, bulk nh %u",
+				    addrs[i], nh_scalar[i], nh_bulk[i]);
+
+	/* Odd sized bulk lookups must give the same answers */
+	memset(nh_bulk, 0, LPM_TEST_ADDRS * sizeof(*nh_bulk));
+	for (i = 0, j = 1; i < LPM_TEST_ADDRS; i += j, j = j % 37 + 1)
+		lpm_lookup_bulk(lpm, &addrs[i], &nh_bulk[i],
+				RTE_MIN(j, LPM_TEST_ADDRS - i));
+	for (i = 0; i < LPM_TEST_ADDRS; i++)
+		dp_test_fail_unless(nh_scalar[i] == nh_bulk[i],
+				    "%x: scalar nh %u, bulk nh %u",
+				    addrs[i], nh_scalar[i], nh_bulk[i]);
+
+	if (dp_test_debug_get())
+		printf("lpm lookup %u routes: scalar %.1f cycles/lookup, "
+		       "bulk(%u) %.1f cycles/lookup\n", LPM_TEST_ROUTES,
+		       (double)scalar_cycles /
+		       (LPM_TEST_ADDRS * LPM_TEST_PASSES),
+		       LPM_TEST_BULK_SIZE, (double)bulk_cycles /
+		       (LPM_TEST_ADDRS * LPM_TEST_PASSES));
+
+	lpm_delete_all(lpm, NULL, NULL);
+	lpm_free(lpm);
+	rcu_defer_unregister_thread();
+	rcu_unregister_thread();
+
+	free(prefixes);
+	free(addrs);
+	free(nh_scalar);
+	free(nh_bulk);
+} DP_END_TEST;
+
+static void
+lpm_test_check_same(const struct lpm *lpm1, const struct lpm *lpm2,
+		    const uint32_t *addrs, unsigned int count)
+{
+	uint32_t nh1, nh2;
+	unsigned int i;
+	int rc1, rc2;
+
+	for (i = 0; i < count; i++) {
+		nh1 = nh2 = LPM_LOOKUP_MISS;
+		rc1 = lpm_lookup(lpm1, addrs[i], &nh1);
+		rc2 = lpm_lookup(lpm2, addrs[i], &nh2);
+		dp_test_fail_unless(rc1 == rc2 && nh1 == nh2,
+				    "%x: nh %u (%d) vs nh %u (%d)",
+				    addrs[i], nh1, rc1, nh2, rc2);
+	}
+}
+
+static void
+lpm_test_withdraw(struct lpm *lpm, const uint32_t *prefixes,
+		  const uint8_t *depths, unsigned int count)
+{
+	struct pd_obj_state_and_flags pd_state;
+	unsigned int i;
+
+	/* Duplicates will already have gone, so ignore failures */
+	for (i = 0; i < count; i += 2)
+		lpm_delete(lpm, prefixes[i], depths[i], NULL,
+			   RT_SCOPE_UNIVERSE, &pd_state, NULL, NULL);
+}
+
+/*
+ * Compare a table built one route at a time with one built by
+ * deferring and then committing the updates, both in place and by
+ * building a shadow table.
+ */
+DP_DECL_TEST_CASE(lpm, lpm_batch, NULL, NULL);
+DP_START_TEST(lpm_batch, update_commit)
+{
+	struct lpm *lpm_inc, *lpm_batch, *shadow;
+	struct lpm_update_stats stats;
+	uint64_t start, inc_cycles, batch_cycles;
+	uint32_t *prefixes, *addrs;
+	uint8_t *depths;
+
+	prefixes = calloc(LPM_TEST_ROUTES, sizeof(*prefixes));
+	depths = calloc(LPM_TEST_ROUTES, sizeof(*depths));
+	addrs = calloc(LPM_TEST_ADDRS, sizeof(*addrs));
+	dp_test_fail_unless(prefixes && depths && addrs,
+			    "failed to allocate test arrays");
+
+	rcu_register_thread();
+	rcu_defer_register_thread();
+
+	start = rte_rdtsc();
+	lpm_inc = lpm_test_create_table(prefixes, depths, LPM_TEST_ROUTES,
+					false);
+	inc_cycles = rte_rdtsc() - start;
+
+	start = rte_rdtsc();
+	lpm_batch = lpm_test_create_table(prefixes, depths, LPM_TEST_ROUTES,
+					  true);
+	batch_cycles = rte_rdtsc() - start;
+
+	lpm_test_fill_addrs(addrs, LPM_TEST_ADDRS, prefixes,
+			    LPM_TEST_ROUTES);
+	lpm_test_check_same(lpm_inc, lpm_batch, addrs, LPM_TEST_ADDRS);
+	dp_test_fail_unless(lpm_tbl8_count(lpm_inc) ==
+			    lpm_tbl8_count(lpm_batch),
+			    "tbl8 count %u, batched %u",
+			    lpm_tbl8_count(lpm_inc),
+			    lpm_tbl8_count(lpm_batch));
+
+	/* Withdraw half the routes */
+	lpm_test_withdraw(lpm_inc, prefixes, depths, LPM_TEST_ROUTES);
+	lpm_update_begin(lpm_batch);
+	lpm_test_withdraw(lpm_batch, prefixes, depths, LPM_TEST_ROUTES);
+	dp_test_fail_unless(lpm_update_pending(lpm_batch) != 0,
+			    "no pending updates");
+	lpm_update_commit(lpm_batch);
+	lpm_test_check_same(lpm_inc, lpm_batch, addrs, LPM_TEST_ADDRS);
+
+	/* And withdraw the rest, swapping in a new table */
+	lpm_test_withdraw(lpm_inc, prefixes + 1, depths + 1,
+			  LPM_TEST_ROUTES - 1);
+	lpm_update_begin(lpm_batch);
+	lpm_test_withdraw(lpm_batch, prefixes + 1, depths + 1,
+			  LPM_TEST_ROUTES - 1);
+	shadow = lpm_update_commit_shadow(lpm_batch);
+	dp_test_fail_unless(shadow, "failed to build shadow lpm");
+	dp_test_fail_unless(lpm_is_empty(lpm_batch),
+			    "rules left in old lpm");
+	lpm_free(lpm_batch);
+	lpm_batch = shadow;
+	lpm_test_check_same(lpm_inc, lpm_batch, addrs, LPM_TEST_ADDRS);
+	dp_test_fail_unless(lpm_is_empty(lpm_batch), "rules left in lpm");
+
+	lpm_update_stats_get(lpm_batch, &stats);
+	dp_test_fail_unless(stats.batches == 3 && stats.shadow_swaps == 1,
+			    "%lu batches %lu shadow swaps", stats.batches,
+			    stats.shadow_swaps);
+
+	if (dp_test_debug_get())
+		printf("lpm add %u routes: %.0f/sec, batched %.0f/sec\n",
+		       LPM_TEST_ROUTES,
+		       (double)LPM_TEST_ROUTES * rte_get_tsc_hz() / inc_cycles,
+		       (double)LPM_TEST_ROUTES * rte_get_tsc_hz() /
+		       batch_cycles);
+
+	lpm_free(lpm_inc);
+	lpm_free(lpm_batch);
+	rcu_defer_unregister_thread();
+	rcu_unregister_thread();
+
+	free(prefixes);
+	free(depths);
+	free(addrs);
+} DP_END_TEST;
+
+struct lpm6_test_route {
+	uint8_t ip[LPM6_IPV6_ADDR_SIZE];
+	uint8_t depth;
+	uint32_t next_hop;
+};
+
+/*
+ * Loosely follow the shape of the global IPv6 table: all in 2000::/3,
+ * mostly /32 to /48, with some /64s and host routes. The next hop is
+ * derived from the prefix so that duplicates agree.
+ */
+static void
+lpm6_test_gen_routes(struct lpm6_test_route *routes, unsigned int count)
+{
+	unsigned int i, j, k;
+
+	srandom(1);
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < LPM6_IPV6_ADDR_SIZE; j++)
+			routes[i].ip[j] = random();
+		routes[i].ip[0] = 0x20 | (routes[i].ip[0] & 0x1f);
+
+		k = random() % 20;
+		if (k < 2)
+			routes[i].depth = 19 + random() % 14;
+		else if (k < 5)
+			routes[i].depth = 32;
+		else if (k < 10)
+			routes[i].depth = 33 + random() % 15;
+		else if (k < 14)
+			routes[i].depth = 48;
+		else if (k < 18)
+			routes[i].depth = 49 + random() % 16;
+		else
+			routes[i].depth = 128;
+
+		routes[i].next_hop = routes[i].depth;
+		for (j = 0; j < LPM6_IPV6_ADDR_SIZE; j++) {
+			if (j * 8 >= routes[i].depth)
+				routes[i].ip[j] = 0;
+			else if (j * 8 + 8 > routes[i].depth)
+				routes[i].ip[j] &=
+					0xff << (j * 8 + 8 - routes[i].depth);
+			routes[i].next_hop = routes[i].next_hop * 31 +
+				routes[i].ip[j];
+		}
+		routes[i].next_hop %= 1 << 20;
+	}
+}
+
+static void
+lpm6_test_algo(enum lpm6_algo algo, const struct lpm6_test_route *routes,
+	       unsigned int num_routes, const uint8_t (*addrs)[16],
+	       unsigned int num_addrs, uint32_t *nh)
+{
+	struct pd_obj_state_and_flags *pd_state;
+	uint64_t start, add_cycles, lookup_cycles = 0, del_cycles;
+	unsigned int i, pass;
+	struct lpm6 *lpm;
+	size_t mem;
+	int rc;
+
+	lpm6_set_default_algo(algo);
+	lpm = lpm6_create(0);
+	lpm6_set_default_algo(LPM6_ALGO_DIR24_8);
+	dp_test_fail_unless(lpm, "failed to create %s lpm6",
+			    lpm6_algo_name(algo));
+	dp_test_fail_unless(lpm6_get_algo(lpm) == algo,
+			    "lpm6 created with wrong algorithm");
+
+	start = rte_rdtsc();
+	for (i = 0; i < num_routes; i++) {
+		rc = lpm6_add(lpm, routes[i].ip, routes[i].depth,
+			      routes[i].next_hop, RT_SCOPE_UNIVERSE,
+			      &pd_state, NULL, NULL);
+		dp_test_fail_unless(rc >= 0, "%s: failed to add route %u: %d",
+				    lpm6_algo_name(algo), i, rc);
+	}
+	add_cycles = rte_rdtsc() - start;
+	mem = lpm6_memory_usage(lpm);
+
+	for (pass = 0; pass < LPM_TEST_PASSES; pass++) {
+		start = rte_rdtsc();
+		for (i = 0; i < num_addrs; i++)
+			if (lpm6_lookup(lpm, addrs[i], &nh[i]) != 0)
+				nh[i] = LPM_LOOKUP_MISS;
+		lookup_cycles += rte_rdtsc() - start;
+	}
+
+	start = rte_rdtsc();
+	for (i = 0; i < num_routes; i++)
+		lpm6_delete(lpm, routes[i].ip, routes[i].depth, NULL,
+			    RT_SCOPE_UNIVERSE, NULL, NULL, NULL);
+	del_cycles = rte_rdtsc() - start;
+
+	dp_test_fail_unless(lpm6_is_empty(lpm), "%s: rules left after delete",
+			    lpm6_algo_name(algo));
+
+	if (dp_test_debug_get())
+		printf("lpm6 %s %u routes: %zu bytes, add %.0f/sec, "
+		       "delete %.0f/sec, lookup %.1f cycles\n",
+		       lpm6_algo_name(algo), num_routes, mem,
+		       (double)num_routes * rte_get_tsc_hz() / add_cycles,
+		       (double)num_routes * rte_get_tsc_hz() / del_cycles,
+		       (double)lookup_cycles / (num_addrs * LPM_TEST_PASSES));
+
+	lpm6_free(lpm);
+}
+
+DP_DECL_TEST_CASE(lpm, lpm6_algo, NULL, NULL);
+DP_START_TEST(lpm6_algo, compare)
+{
+	struct lpm6_test_route *routes;
+	uint32_t *nh_dir, *nh_pt;
+	uint8_t (*addrs)[16];
+	unsigned int i, j;
+
+	routes = calloc(LPM6_TEST_ROUTES, sizeof(*routes));
+	addrs = calloc(LPM_TEST_ADDRS, sizeof(*addrs));
+	nh_dir = calloc(LPM_TEST_ADDRS, sizeof(*nh_dir));
+	nh_pt = calloc(LPM_TEST_ADDRS, sizeof(*nh_pt));
+	dp_test_fail_unless(routes && addrs && nh_dir && nh_pt,
+			    "failed to allocate test arrays");
+
+	lpm6_test_gen_routes(routes, LPM6_TEST_ROUTES);
+
+	/* Addresses within or near a route, so both hits and misses */
+	for (i = 0; i < LPM_TEST_ADDRS; i++) {
+		memcpy(addrs[i], routes[random() % LPM6_TEST_ROUTES].ip,
+		       sizeof(addrs[i]));
+		for (j = 8; j < LPM6_IPV6_ADDR_SIZE; j++)
+			addrs[i][j] |= random();
+		j = random() % LPM6_IPV6_ADDR_SIZE;
+		addrs[i][j] ^= 1 << (random() % 8);
+	}
+
+	rcu_register_thread();
+	rcu_defer_register_thread();
+
+	lpm6_test_algo(LPM6_ALGO_DIR24_8, routes, LPM6_TEST_ROUTES,
+		       (const uint8_t (*)[16])addrs, LPM_TEST_ADDRS, nh_dir);
+	lpm6_test_algo(LPM6_ALGO_POPTRIE, routes, LPM6_TEST_ROUTES,
+		       (const uint8_t (*)[16])addrs, LPM_TEST_ADDRS, nh_pt);
+
+	rcu_defer_unregister_thread();
+	rcu_unregister_thread();
+
+	for (i = 0; i < LPM_TEST_ADDRS; i++)
+		dp_test_fail_unless(nh_dir[i] == nh_pt[i],
+				    "lookup %u: dir24-8 nh %u, poptrie nh %u",
+				    i, nh_dir[i], nh_pt[i]);
+
+	free(routes);
+	free(addrs);
+	free(nh_dir);
+	free(nh_pt);
+} DP_END_TEST;
+
+/*
+ * A covering /16 outside 2000::/3, so that none of the generated routes
+ * fall under it, with more specifics at and either side of the stride
+ * boundaries.
+ */
+static const struct lpm6_test_route lpm6_test_cover[] = {
+	{ { 0xfd, 0x00 }, 16, 1001 },
+	{ { 0xfd, 0x00, 0x20 }, 20, 1002 },
+	{ { 0xfd, 0x00, 0x10 }, 24, 1003 },
+	{ { 0xfd, 0x00, 0xff }, 24, 1004 },
+	{ { 0xfd, 0x00, 0x10, 0x00 }, 32, 1005 },
+	{ { 0xfd, 0x00, 0x10, 0x00, 0x01 }, 40, 1006 },
+	{ { 0xfd, 0x00, 0x10, 0x00, 0x01, 0x00 }, 48, 1007 },
+	{ { 0xfd, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x01 }, 64, 1008 },
+	{ { 0xfd, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x01,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 128, 1009 },
+};
+
+/* In the /16 but under none of the more specifics */
+static const uint8_t lpm6_test_cover_only[LPM6_IPV6_ADDR_SIZE] = {
+	0xfd, 0x00, 0x80, 0x00, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01
+};
+
+#define LPM6_TEST_COVER_ADDRS	4096
+
+static void
+lpm6_test_change(struct lpm6 *lpm, const struct lpm6_test_route *route,
+		 bool add)
+{
+	struct pd_obj_state_and_flags *pd_state;
+	int rc;
+
+	if (!add) {
+		lpm6_delete(lpm, route->ip, route->depth, NULL,
+			    RT_SCOPE_UNIVERSE, NULL, NULL, NULL);
+		return;
+	}
+
+	rc = lpm6_add(lpm, route->ip, route->depth, route->next_hop,
+		      RT_SCOPE_UNIVERSE, &pd_state, NULL, NULL);
+	dp_test_fail_unless(rc >= 0, "%s: failed to add /%u route: %d",
+			    lpm6_algo_name(lpm6_get_algo(lpm)),
+			    route->depth, rc);
+}
+
+/* Do both tables give the same next hop for every address? */
+static void
+lpm6_test_compare(struct lpm6 *dir, struct lpm6 *pt,
+		  const uint8_t (*addrs)[16], unsigned int num_addrs,
+		  const char *round)
+{
+	uint32_t nh_dir, nh_pt;
+	unsigned int i;
+
+	for (i = 0; i < num_addrs; i++) {
+		if (lpm6_lookup(dir, addrs[i], &nh_dir) != 0)
+			nh_dir = LPM_LOOKUP_MISS;
+		if (lpm6_lookup(pt, addrs[i], &nh_pt) != 0)
+			nh_pt = LPM_LOOKUP_MISS;
+		dp_test_fail_unless(nh_dir == nh_pt,
+				    "%s: addr %u: dir24-8 nh %u, poptrie nh %u",
+				    round, i, nh_dir, nh_pt);
+	}
+}
+
+/*
+ * Delete routes from both tables a subset at a time, including the
+ * covering /16 with its more specifics still present and then the
+ * more specifics, and compare all the lookups after each round.
+ */
+DP_START_TEST(lpm6_algo, delete)
+{
+	const unsigned int num_addrs = LPM_TEST_ADDRS + LPM6_TEST_COVER_ADDRS;
+	const unsigned int num_cover = ARRAY_SIZE(lpm6_test_cover);
+	struct lpm6_test_route *routes;
+	struct lpm6 *lpm[2], *dir, *pt;
+	uint8_t (*addrs)[16];
+	unsigned int i, j, k;
+	uint32_t nh;
+
+	routes = calloc(LPM6_TEST_ROUTES, sizeof(*routes));
+	addrs = calloc(num_addrs, sizeof(*addrs));
+	dp_test_fail_unless(routes && addrs, "failed to allocate test arrays");
+
+	lpm6_test_gen_routes(routes, LPM6_TEST_ROUTES);
+
+	for (i = 0; i < LPM_TEST_ADDRS; i++) {
+		memcpy(addrs[i], routes[random() % LPM6_TEST_ROUTES].ip,
+		       sizeof(addrs[i]));
+		for (j = 8; j < LPM6_IPV6_ADDR_SIZE; j++)
+			addrs[i][j] |= random();
+	}
+
+	/* Within and around each of the routes under the /16 */
+	for (; i < num_addrs; i++) {
+		k = random() % num_cover;
+		memcpy(addrs[i], lpm6_test_cover[k].ip, sizeof(addrs[i]));
+		for (j = 2; j < LPM6_IPV6_ADDR_SIZE; j++)
+			if (j * 8 >= lpm6_test_cover[k].depth)
+				addrs[i][j] = random();
+		j = 2 + random() % (LPM6_IPV6_ADDR_SIZE - 2);
+		addrs[i][j] ^= 1 << (random() % 8);
+	}
+
+	rcu_register_thread();
+	rcu_defer_register_thread();
+
+	lpm6_set_default_algo(LPM6_ALGO_DIR24_8);
+	dir = lpm6_create(0);
+	lpm6_set_default_algo(LPM6_ALGO_POPTRIE);
+	pt = lpm6_create(0);
+	lpm6_set_default_algo(LPM6_ALGO_DIR24_8);
+	dp_test_fail_unless(dir && pt, "failed to create lpm6 tables");
+	lpm[0] = dir;
+	lpm[1] = pt;
+
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < LPM6_TEST_ROUTES; i++)
+			lpm6_test_change(lpm[k], &routes[i], true);
+		for (i = 0; i < num_cover; i++)
+			lpm6_test_change(lpm[k], &lpm6_test_cover[i], true);
+	}
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "all routes");
+
+	/* A third of the generated routes */
+	for (k = 0; k < 2; k++)
+		for (i = 0; i < LPM6_TEST_ROUTES; i += 3)
+			lpm6_test_change(lpm[k], &routes[i], false);
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "generated subset deleted");
+
+	/* The covering /16, leaving the more specifics under it */
+	for (k = 0; k < 2; k++)
+		lpm6_test_change(lpm[k], &lpm6_test_cover[0], false);
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "covering /16 deleted");
+	dp_test_fail_unless(lpm6_lookup(pt, lpm6_test_cover_only, &nh) != 0,
+			    "poptrie still covered by deleted /16, nh %u", nh);
+
+	/* Every other more specific */
+	for (k = 0; k < 2; k++)
+		for (i = 1; i < num_cover; i += 2)
+			lpm6_test_change(lpm[k], &lpm6_test_cover[i], false);
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "more specifics subset deleted");
+
+	/* The /16 back, over what is left under it */
+	for (k = 0; k < 2; k++)
+		lpm6_test_change(lpm[k], &lpm6_test_cover[0], true);
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "covering /16 added back");
+
+	/* The rest of the more specifics, then the /16 again */
+	for (k = 0; k < 2; k++) {
+		for (i = 2; i < num_cover; i += 2)
+			lpm6_test_change(lpm[k], &lpm6_test_cover[i], false);
+	}
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "more specifics deleted");
+	for (k = 0; k < 2; k++)
+		lpm6_test_change(lpm[k], &lpm6_test_cover[0], false);
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "covering /16 deleted again");
+
+	/* Another third of the generated routes, then the rest */
+	for (k = 0; k < 2; k++)
+		for (i = 1; i < LPM6_TEST_ROUTES; i += 3)
+			lpm6_test_change(lpm[k], &routes[i], false);
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "second generated subset deleted");
+
+	for (k = 0; k < 2; k++)
+		for (i = 2; i < LPM6_TEST_ROUTES; i += 3)
+			lpm6_test_change(lpm[k], &routes[i], false);
+	lpm6_test_compare(dir, pt, (const uint8_t (*)[16])addrs, num_addrs,
+			  "all deleted");
+
+	for (k = 0; k < 2; k++) {
+		dp_test_fail_unless(lpm6_is_empty(lpm[k]),
+				    "%s: rules left after delete",
+				    lpm6_algo_name(lpm6_get_algo(lpm[k])));
+		lpm6_free(lpm[k]);
+	}
+
+	rcu_defer_unregister_thread();
+	rcu_unregister_thread();
+
+	free(routes);
+	free(addrs);
+} DP_END_TEST;
@@ -1670,3 +1670,170 @@ DP_START_TEST(npf_addrgrp9, test1)
 			    "ADDRGRP9 not empty");
 	dp_test_addrgrp_destroy("ADDRGRP9");
 } DP_END_TEST;
+
+
+/*
+ * Tests the address-group range tables.
+ *
+ * Random IPv4 prefixes and ranges, and IPv6 prefixes, are added to an
+ * address-group.  Random addresses, and addresses either side of each entry,
+ * are then looked up before and after the range tables are built, and after
+ * an entry is removed, and checked against a linear search of the entries.
+ */
+struct ag10_entry {
+	uint8_t start[16];
+	uint8_t end[16];
+	uint8_t alen;
+	uint8_t mask;	/* 0 for ranges */
+};
+
+static bool
+ag10_match(struct ag10_entry *entries, uint n, const uint8_t *addr,
+	   uint8_t alen)
+{
+	uint i;
+
+	for (i = 0; i < n; i++)
+		if (entries[i].alen == alen &&
+		    memcmp(addr, entries[i].start, alen) >= 0 &&
+		    memcmp(addr, entries[i].end, alen) <= 0)
+			return true;
+	return false;
+}
+
+/* Add 'delta' (-1, 0 or 1) to a network byte order address */
+static void ag10_addr_add(uint8_t *addr, uint8_t alen, int delta)
+{
+	int i;
+
+	for (i = alen - 1; delta && i >= 0; i--) {
+		addr[i] += delta;
+		if ((delta > 0 && addr[i] != 0) ||
+		    (delta < 0 && addr[i] != 0xff))
+			break;
+	}
+}
+
+static void
+ag10_verify(struct npf_addrgrp *ag, struct ag10_entry *entries, uint n,
+	    const char *desc)
+{
+	npf_addr_t addr;
+	uint8_t alen;
+	bool exp, rv;
+	uint i, j;
+	int delta;
+
+	for (i = 0; i < 20000; i++) {
+		alen = (i & 1) ? 16 : 4;
+		memset(&addr, 0, sizeof(addr));
+
+		if (i & 2) {
+			/* Either side of, or at the edge of, an entry */
+			j = random() % n;
+			alen = entries[j].alen;
+			memcpy(addr.s6_addr, (i & 4) ? entries[j].end :
+			       entries[j].start, alen);
+			delta = (int)(random() % 3) - 1;
+			ag10_addr_add(addr.s6_addr, alen, delta);
+		} else {
+			for (j = 0; j < alen; j++)
+				addr.s6_addr[j] = random();
+			/* Keep random addresses near the entries */
+			addr.s6_addr[0] = (alen == 4) ? 10 : 0x20;
+			addr.s6_addr[1] &= (alen == 4) ? 0x0f : 0x01;
+		}
+
+		exp = ag10_match(entries, n, addr.s6_addr, alen);
+		rv = npf_addrgrp_lookup((alen == 4) ? AG_IPv4 : AG_IPv6,
+					ag, &addr) == 0;
+		dp_test_fail_unless(rv == exp,
+				    "%s: lookup %u expected %s", desc, i,
+				    exp ? "match" : "no match");
+	}
+}
+
+DP_DECL_TEST_CASE(npf_addrgrp, npf_addrgrp10, NULL, NULL);
+DP_START_TEST(npf_addrgrp10, test1)
+{
+	struct ag10_entry *entries, *e;
+	uint nentries = 3000;
+	struct npf_addrgrp *ag;
+	npf_addr_t start, end;
+	uint i, n, bit;
+	uint8_t mask;
+	int rc;
+
+	srandom(10);
+
+	entries = calloc(nentries, sizeof(*entries));
+	dp_test_fail_unless(entries, "calloc");
+
+	dp_test_addrgrp_create("ADDRGRP10");
+	ag = npf_addrgrp_lookup_name("ADDRGRP10");
+	dp_test_fail_unless(ag, "npf_addrgrp_lookup_name");
+
+	for (i = 0, n = 0; i < nentries; i++) {
+		e = &entries[n];
+		e->alen = (i % 4 == 3) ? 16 : 4;
+
+		memset(&start, 0, sizeof(start));
+		for (bit = 0; bit < e->alen; bit++)
+			start.s6_addr[bit] = random();
+		start.s6_addr[0] = (e->alen == 4) ? 10 : 0x20;
+		start.s6_addr[1] &= (e->alen == 4) ? 0x0f : 0x01;
+
+		if (e->alen == 4 && i % 4 == 2) {
+			/* IPv4 range of up to 1000 addresses */
+			end = start;
+			for (bit = random() % 1000; bit; bit--)
+				ag10_addr_add(end.s6_addr, 4, 1);
+			rc = npf_addrgrp_range_insert("ADDRGRP10", &start,
+						      &end, 4);
+			mask = 0;
+		} else {
+			mask = (e->alen == 4) ? 12 + random() % 21 :
+				16 + random() % 113;
+			for (bit = mask; bit < e->alen * 8u; bit++)
+				start.s6_addr[bit / 8] &= ~(0x80 >> (bit % 8));
+			end = start;
+			for (bit = mask; bit < e->alen * 8u; bit++)
+				end.s6_addr[bit / 8] |= 0x80 >> (bit % 8);
+			rc = npf_addrgrp_prefix_insert("ADDRGRP10", &start,
+						       e->alen, mask);
+		}
+
+		/* Overlapping entries are rejected */
+		if (rc < 0)
+			continue;
+
+		memcpy(e->start, start.s6_addr, e->alen);
+		memcpy(e->end, end.s6_addr, e->alen);
+		e->mask = mask;
+		n++;
+	}
+
+	/* Lookups before and after the range tables are built */
+	ag10_verify(ag, entries, n, "ptree");
+	npf_addrgrp_rtbl_build(ag);
+	ag10_verify(ag, entries, n, "range table");
+
+	/* Removing a prefix must take effect without a rebuild */
+	for (i = 0; i < n && entries[i].mask == 0; i++)
+		;
+	dp_test_fail_unless(i < n, "no prefix entries");
+	e = &entries[i];
+	memset(&start, 0, sizeof(start));
+	memcpy(start.s6_addr, e->start, e->alen);
+	rc = npf_addrgrp_prefix_remove("ADDRGRP10", &start, e->alen, e->mask);
+	dp_test_fail_unless(rc == 0, "npf_addrgrp_prefix_remove %d", rc);
+	*e = entries[--n];
+
+	ag10_verify(ag, entries, n, "remove");
+	npf_addrgrp_rtbl_build(ag);
+	ag10_verify(ag, entries, n, "range table after remove");
+
+	dp_test_addrgrp_destroy("ADDRGRP10");
+	free(entries);
+
+} DP_END_TEST;
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property. All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Whole dataplane tests of the npf packet cache.  npf_cache_all() takes
+ * a single pass fast path for common packets, and the result must be the
+ * same as that of the general parse.
+ */
+#include <netinet/icmp6.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+
+#include "ip_funcs.h"
+#include "ip6_funcs.h"
+#include "util.h"
+#include "npf/npf.h"
+#include "npf/npf_cache.h"
+
+#include "dp_test.h"
+#include "dp_test_lib.h"
+#include "dp_test_pktmbuf_lib.h"
+
+/*
+ * Cache a packet with npf_cache_all() and with the general parse, and
+ * check that the two caches, the result and the l3_len stored in the
+ * mbuf all match.
+ */
+static void
+npf_cache_check(struct rte_mbuf *m, uint16_t ether_type, const char *desc)
+{
+	npf_cache_t npc_all, npc_gen;
+	uint16_t l3_all, l3_gen;
+	bool ok_all, ok_gen;
+
+	memset(&npc_all, 0, sizeof(npc_all));
+	memset(&npc_gen, 0, sizeof(npc_gen));
+	npf_cache_init(&npc_all);
+	npf_cache_init(&npc_gen);
+
+	pktmbuf_l3_len(m) = 0;
+	ok_all = npf_cache_all(&npc_all, m, htons(ether_type));
+	l3_all = pktmbuf_l3_len(m);
+
+	pktmbuf_l3_len(m) = 0;
+	ok_gen = npf_cache_all_at(&npc_gen, m, npf_iphdr(m),
+				  htons(ether_type), false);
+	l3_gen = pktmbuf_l3_len(m);
+
+	dp_test_fail_unless(ok_all == ok_gen, "%s: result %u, expected %u",
+			    desc, ok_all, ok_gen);
+	dp_test_fail_unless(l3_all == l3_gen, "%s: l3_len %u, expected %u",
+			    desc, l3_all, l3_gen);
+	dp_test_fail_unless(npc_all.npc_info == npc_gen.npc_info,
+			    "%s: info 0x%x, expected 0x%x", desc,
+			    npc_all.npc_info, npc_gen.npc_info);
+
+	/* The address pointers are into each cache */
+	dp_test_fail_unless((char *)npc_all.npc_srcdst - (char *)&npc_all ==
+			    (char *)npc_gen.npc_srcdst - (char *)&npc_gen,
+			    "%s: addresses cached at different offsets", desc);
+	npc_all.npc_srcdst = NULL;
+	npc_gen.npc_srcdst = NULL;
+
+	dp_test_fail_unless(!memcmp(npc_all.npc_grouper, npc_gen.npc_grouper,
+				    sizeof(npc_all.npc_grouper)),
+			    "%s: grouper does not match", desc);
+	dp_test_fail_unless(!memcmp(&npc_all, &npc_gen, sizeof(npc_all)),
+			    "%s: cache does not match", desc);
+}
+
+/*
+ * Check a packet, then split it in two and check each fragment.  The
+ * IPv4 library puts the first fragment last.
+ */
+static void
+npf_cache_check_frags(struct rte_mbuf *m, uint16_t ether_type,
+		      const char *desc)
+{
+	struct rte_mbuf *frags[2];
+	uint16_t sizes[2], plen, first;
+	char fdesc[64];
+	int i, n;
+
+	npf_cache_check(m, ether_type, desc);
+
+	if (ether_type == ETHER_TYPE_IPv4)
+		pktmbuf_l3_len(m) = iphdr(m)->ihl << 2;
+	else
+		pktmbuf_l3_len(m) = sizeof(struct ip6_hdr);
+
+	plen = rte_pktmbuf_pkt_len(m) - m->l2_len - pktmbuf_l3_len(m);
+	first = RTE_ALIGN_FLOOR(plen / 2, 8);
+
+	if (ether_type == ETHER_TYPE_IPv4) {
+		sizes[0] = plen - first;
+		sizes[1] = first;
+		n = dp_test_ipv4_fragment_packet(m, frags, ARRAY_SIZE(frags),
+						 sizes, 0);
+	} else {
+		sizes[0] = first;
+		sizes[1] = plen - first;
+		n = dp_test_ipv6_fragment_packet(m, frags, ARRAY_SIZE(frags),
+						 sizes, 0);
+	}
+	dp_test_fail_unless(n == (int)ARRAY_SIZE(frags),
+			    "%s: %d fragments, expected %zu", desc, n,
+			    ARRAY_SIZE(frags));
+
+	for (i = 0; i < n; i++) {
+		snprintf(fdesc, sizeof(fdesc), "%s fragment %d", desc, i);
+		npf_cache_check(frags[i], ether_type, fdesc);
+		rte_pktmbuf_free(frags[i]);
+	}
+	rte_pktmbuf_free(m);
+}
+
+DP_DECL_TEST_SUITE(npf_cache);
+
+DP_DECL_TEST_CASE(npf_cache, npf_cache_fast, NULL, NULL);
+
+DP_START_TEST(npf_cache_fast, ipv4)
+{
+	const uint8_t topts[] = { 2, 4, 0x05, 0xb4, 1, 3, 3, 7, 0 };
+	struct rte_mbuf *m;
+	struct iphdr *ip;
+	int len = 200;
+	char *opt;
+
+	m = dp_test_create_udp_ipv4_pak("1.1.1.1", "2.2.2.2", 1000, 53,
+					1, &len);
+	npf_cache_check_frags(m, ETHER_TYPE_IPv4, "UDP");
+
+	m = dp_test_create_tcp_ipv4_pak("1.1.1.1", "2.2.2.2", 1000, 80,
+					TH_SYN, 1, 0, 5840, topts, 1, &len);
+	npf_cache_check_frags(m, ETHER_TYPE_IPv4, "TCP");
+
+	m = dp_test_create_raw_ipv4_pak("1.1.1.1", "2.2.2.2",
+					IPPROTO_UDPLITE, 1, &len);
+	npf_cache_check(m, ETHER_TYPE_IPv4, "UDP-Lite");
+	rte_pktmbuf_free(m);
+
+	m = dp_test_create_icmp_ipv4_pak("1.1.1.1", "2.2.2.2", ICMP_ECHO, 0,
+					 DPT_ICMP_ECHO_DATA(1, 1), 1, &len,
+					 NULL, NULL, NULL);
+	npf_cache_check_frags(m, ETHER_TYPE_IPv4, "ICMP echo");
+
+	m = dp_test_create_icmp_ipv4_pak("1.1.1.1", "2.2.2.2",
+					 ICMP_DEST_UNREACH,
+					 ICMP_PORT_UNREACH, 0, 1, &len,
+					 NULL, NULL, NULL);
+	npf_cache_check(m, ETHER_TYPE_IPv4, "ICMP unreachable");
+	rte_pktmbuf_free(m);
+
+	/* Not for the fast path */
+	m = dp_test_create_raw_ipv4_pak("1.1.1.1", "2.2.2.2", IPPROTO_GRE,
+					1, &len);
+	npf_cache_check(m, ETHER_TYPE_IPv4, "GRE");
+	rte_pktmbuf_free(m);
+
+	/* IP options, a router alert */
+	m = dp_test_create_udp_ipv4_pak("1.1.1.1", "2.2.2.2", 1000, 53,
+					1, &len);
+	opt = dp_test_pktmbuf_insert(m, m->l2_len + sizeof(*ip), 4);
+	dp_test_fail_unless(opt, "no room for IP options");
+	opt[0] = IPOPT_RA;
+	opt[1] = 4;
+	opt[2] = 0;
+	opt[3] = 0;
+	ip = iphdr(m);
+	ip->ihl++;
+	ip->tot_len = htons(ntohs(ip->tot_len) + 4);
+	npf_cache_check(m, ETHER_TYPE_IPv4, "UDP with IP options");
+
+	/* Header length past the end of the segment */
+	ip->ihl = 15;
+	npf_cache_check(m, ETHER_TYPE_IPv4, "bad header length");
+	rte_pktmbuf_free(m);
+
+	/* Truncated in the L4 header */
+	m = dp_test_create_tcp_ipv4_pak("1.1.1.1", "2.2.2.2", 1000, 80,
+					TH_ACK, 1, 1, 5840, NULL, 1, &len);
+	rte_pktmbuf_trim(m, rte_pktmbuf_pkt_len(m) - m->l2_len -
+			 sizeof(*ip) - 10);
+	npf_cache_check(m, ETHER_TYPE_IPv4, "truncated TCP");
+	rte_pktmbuf_free(m);
+} DP_END_TEST;
+
+DP_START_TEST(npf_cache_fast, ipv6)
+{
+	struct icmp6_hdr *icmp6;
+	struct ip6_hdr *ip6;
+	struct rte_mbuf *m;
+	int len = 200;
+
+	m = dp_test_create_udp_ipv6_pak("2001:1::1", "2001:2::2", 1000, 53,
+					1, &len);
+	npf_cache_check_frags(m, ETHER_TYPE_IPv6, "UDP");
+
+	m = dp_test_create_tcp_ipv6_pak("2001:1::1", "2001:2::2", 1000, 80,
+					TH_SYN, 1, 0, 5840, NULL, 1, &len);
+	npf_cache_check_frags(m, ETHER_TYPE_IPv6, "TCP");
+
+	m = dp_test_create_icmp_ipv6_pak("2001:1::1", "2001:2::2",
+					 ICMP6_ECHO_REQUEST, 0,
+					 DPT_ICMP_ECHO_DATA(1, 1), 1, &len,
+					 NULL, NULL, NULL);
+	npf_cache_check_frags(m, ETHER_TYPE_IPv6, "ICMPv6 echo");
+
+	m = dp_test_create_icmp_ipv6_pak("2001:1::1", "2001:2::2",
+					 ICMP6_DST_UNREACH,
+					 ICMP6_DST_UNREACH_NOPORT, 0, 1, &len,
+					 NULL, NULL, NULL);
+	npf_cache_check(m, ETHER_TYPE_IPv6, "ICMPv6 unreachable");
+	rte_pktmbuf_free(m);
+
+	/* NDP is only flagged with a hop limit of 255 */
+	m = dp_test_create_icmp_ipv6_pak("2001:1::1", "2001:2::2",
+					 ND_NEIGHBOR_SOLICIT, 0, 0, 1, &len,
+					 NULL, &ip6, &icmp6);
+	npf_cache_check(m, ETHER_TYPE_IPv6, "NS");
+	ip6->ip6_hlim = 255;
+	npf_cache_check(m, ETHER_TYPE_IPv6, "NS hop limit 255");
+	rte_pktmbuf_free(m);
+
+	/* ICMP in IPv6 is not ICMPv6 */
+	m = dp_test_create_raw_ipv6_pak("2001:1::1", "2001:2::2",
+					IPPROTO_ICMP, 1, &len);
+	npf_cache_check(m, ETHER_TYPE_IPv6, "ICMP in IPv6");
+	rte_pktmbuf_free(m);
+
+	/* Extension headers are left to the general parse */
+	m = dp_test_create_udp_ipv6_pak("2001:1::1", "2001:2::2", 1000, 53,
+					1, &len);
+	dp_test_fail_unless(
+		dp_test_ipv6_append_non_frag_ext_hdr(m, IPPROTO_HOPOPTS, 8),
+		"failed to add hop-by-hop header");
+	npf_cache_check(m, ETHER_TYPE_IPv6, "UDP with hop-by-hop options");
+	rte_pktmbuf_free(m);
+
+	m = dp_test_create_tcp_ipv6_pak("2001:1::1", "2001:2::2", 1000, 80,
+					TH_SYN, 1, 0, 5840, NULL, 1, &len);
+	dp_test_fail_unless(
+		dp_test_ipv6_append_non_frag_ext_hdr(m, IPPROTO_DSTOPTS, 8),
+		"failed to add destination options header");
+	npf_cache_check(m, ETHER_TYPE_IPv6, "TCP with destination options");
+
+	/* Truncated in the L4 header */
+	rte_pktmbuf_trim(m, rte_pktmbuf_pkt_len(m) - m->l2_len -
+			 sizeof(*ip6) - 8 - 10);
+	npf_cache_check(m, ETHER_TYPE_IPv6, "truncated TCP");
+	rte_pktmbuf_free(m);
+
+	/* Not IPv6 */
+	m = dp_test_create_udp_ipv6_pak("2001:1::1", "2001:2::2", 1000, 53,
+					1, &len);
+	ip6 = ip6hdr(m);
+	ip6->ip6_vfc = 0x40;
+	npf_cache_check(m, ETHER_TYPE_IPv6, "bad version");
+	rte_pktmbuf_free(m);
+} DP_END_TEST;
@@ -5,18 +5,23 @@
  *
  */
 #include <errno.h>
+#include <pthread.h>
 #include <time.h>
 #include <values.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <linux/if_ether.h>
 #include <netinet/ip_icmp.h>
+#include <rte_cycles.h>
 #include <rte_ip.h>
 #include "ip_funcs.h"
 #include "ip6_funcs.h"
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "util.h"
 
 #include "dp_test.h"
 #include "dp_test_controller.h"
@@ -33,9 +38,12 @@
 #include "dp_test_npf_sess_lib.h"
 
 #include "npf/nat/nat_pool_public.h"
+#include "npf/nat/nat_proto.h"
 #include "npf/cgnat/cgn.h"
 #include "npf/apm/apm.h"
+#include "npf/cgnat/cgn_gc.h"
 #include "npf/cgnat/cgn_limits.h"
+#include "npf/cgnat/cgn_mbuf.h"
 #include "npf/cgnat/cgn_policy.h"
 #include "npf/cgnat/cgn_source.h"
 #include "npf/cgnat/cgn_session.h"
@@ -1362,6 +1370,36 @@ static void dpt_cgn_show_source_detail(void)
 	json_object_put(jresp);
 }
 
+/*
+ * Get the number of sessions reclaimed by the session gc from the summary
+ */
+static uint64_t dpt_cgn_sess_gc_reclaimed(void)
+{
+	json_object *jresp, *jsumm, *jgc, *jval;
+	uint64_t reclaimed = 0;
+	char *response;
+	bool err;
+
+	response = dp_test_console_request_w_err(
+			"cgn-op show summary", &err, false);
+	if (!response || err)
+		return 0;
+
+	jresp = parse_json(response, parse_err_str, sizeof(parse_err_str));
+	free(response);
+
+	if (!jresp)
+		return 0;
+
+	if (json_object_object_get_ex(jresp, "summary", &jsumm) &&
+	    json_object_object_get_ex(jsumm, "sess_gc", &jgc) &&
+	    json_object_object_get_ex(jgc, "reclaimed", &jval))
+		reclaimed = json_object_get_int64(jval);
+
+	json_object_put(jresp);
+	return reclaimed;
+}
+
 static void dpt_cgn_show_subscriber_count(uint start, uint count, bool detail)
 {
 	char cmd[120];
@@ -2183,6 +2221,8 @@ DP_START_TEST(cgnat21, test)
 	 * The session cleared is: 100.64.0.1:3001 which is mapped to
 	 * 1.1.1.11:1025.
 	 */
+	uint64_t reclaimed = dpt_cgn_sess_gc_reclaimed();
+
 	dp_test_npf_cmd_fmt(false,
 			    "cgn-op clear session "
 			    "subs-addr 100.64.0.1 subs-port 3001");
@@ -2190,6 +2230,10 @@ DP_START_TEST(cgnat21, test)
 	for (i = 0; i < CGN_SESS_GC_COUNT + 1; i++)
 		dp_test_npf_cmd_fmt(false, "cgn-op ut gc");
 
+	/* Cleared session is reclaimed by the gc */
+	dp_test_fail_unless(dpt_cgn_sess_gc_reclaimed() == reclaimed + 1,
+			    "Expected session gc to reclaim 1 session");
+
 	cgnat_udp("dp1T0", "aa:bb:cc:dd:1:a1", 0,
 		  pre_str, sport_pre, "1.1.1.1", 80,
 		  "1.1.1.11", 1025, "1.1.1.1", 80,
@@ -4861,6 +4905,470 @@ repeat:
 } DP_END_TEST;
 
 
+/*
+ * cgnat43 -- IPFIX event logging to a file
+ *
+ * Checks that the exporter writes well formed IPFIX messages, and that the
+ * port-block allocation is exported in a data set using the port-block
+ * template.
+ */
+DP_DECL_TEST_CASE(npf_cgnat, cgnat43, cgnat_setup, cgnat_teardown);
+DP_START_TEST(cgnat43, test)
+{
+	char path[] = "/tmp/dp_test_cgnat_ipfix_XXXXXX";
+	uint8_t buf[8192];
+	bool pb_set = false;
+	size_t len, off;
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(path);
+	dp_test_fail_unless(fd >= 0, "mkstemp failed: %s", strerror(errno));
+	close(fd);
+
+	dpt_cgn_cmd_fmt(false, true, "cgn-ut logging ipfix file %s", path);
+
+	dpt_cgn_cmd_fmt(false, true,
+			"nat-ut pool add POOL1 "
+			"type=cgnat "
+			"address-range=RANGE1/1.1.1.11-1.1.1.20 "
+			"log-pba=yes "
+			"");
+
+	cgnat_policy_add("POLICY1", 10, "100.64.0.0/12", "POOL1",
+			 "dp2T1", CGN_MAP_EIM, CGN_FLTR_EIF, CGN_3TUPLE, true);
+
+	cgnat_udp("dp1T0", "aa:bb:cc:dd:1:a1", 0,
+		  "100.64.0.1", 49152, "1.1.1.1", 80,
+		  "1.1.1.11", 1024, "1.1.1.1", 80,
+		  "aa:bb:cc:dd:2:b1", 0, "dp2T1",
+		  DP_TEST_FWD_FORWARDED);
+
+	/* Stopping the exporter flushes all records */
+	dpt_cgn_cmd_fmt(false, true, "cgn-ut logging text");
+
+	f = fopen(path, "r");
+	dp_test_fail_unless(f, "Failed to open %s", path);
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	unlink(path);
+
+	dp_test_fail_unless(len >= 16, "IPFIX file too short (%zu)", len);
+
+	/* Walk messages, and the sets within each message */
+	for (off = 0; off + 16 <= len; ) {
+		uint16_t ver = (buf[off] << 8) | buf[off + 1];
+		uint16_t mlen = (buf[off + 2] << 8) | buf[off + 3];
+		size_t soff;
+
+		dp_test_fail_unless(ver == 10, "IPFIX version %u", ver);
+		dp_test_fail_unless(mlen >= 16 && off + mlen <= len,
+				    "IPFIX message length %u", mlen);
+
+		for (soff = off + 16; soff + 4 <= off + mlen; ) {
+			uint16_t id = (buf[soff] << 8) | buf[soff + 1];
+			uint16_t slen = (buf[soff + 2] << 8) | buf[soff + 3];
+
+			dp_test_fail_unless(slen >= 4, "IPFIX set length %u",
+					    slen);
+			if (id == 257)
+				pb_set = true;
+			soff += slen;
+		}
+		off += mlen;
+	}
+
+	dp_test_fail_unless(pb_set, "No port-block data set exported");
+
+	cgnat_policy_del("POLICY1", 10, "dp2T1");
+
+	dp_test_npf_cmd_fmt(false, "nat-ut pool delete POOL1");
+
+} DP_END_TEST;
+
+/*
+ * cgnat44 -- port-block cache scale test
+ *
+ * Maps one session for each of many new subscribers, so every mapping
+ * allocates a new port-block, first with the per-lcore port-block cache
+ * disabled and then enabled.  The subscribers are shared between one or
+ * more threads, each mapping through the same path and lcore caches as a
+ * forwarding thread, so that all contend for the same public addresses.
+ */
+#define CGNAT44_THREADS	4
+
+struct cgnat44_thread {
+	struct ifnet	*ifp;
+	uint32_t	first;		/* first subscriber, host order */
+	uint		nsubs;
+	unsigned int	lcore;
+	uint		failed;
+};
+
+static void *cgnat44_map_thread(void *arg)
+{
+	struct cgnat44_thread *ct = arg;
+	struct cgn_packet cpk;
+	int error;
+	uint i;
+
+	RTE_PER_LCORE(_lcore_id) = ct->lcore;
+	RTE_PER_LCORE(_dp_lcore_id) = ct->lcore;
+	rcu_register_thread();
+
+	memset(&cpk, 0, sizeof(cpk));
+	cpk.cpk_sid = htons(1024);
+	cpk.cpk_ipproto = IPPROTO_UDP;
+	cpk.cpk_proto = nat_proto_from_ipproto(IPPROTO_UDP);
+	cpk.cpk_ifindex = ct->ifp->if_index;
+	cpk.cpk_vrfid = if_vrfid(ct->ifp);
+	cpk.cpk_l4ports = true;
+
+	for (i = 0; i < ct->nsubs; i++) {
+		cpk.cpk_saddr = htonl(ct->first + i);
+		error = 0;
+		if (!cgn_session_map(ct->ifp, &cpk, CGN_DIR_OUT, &error))
+			ct->failed++;
+		rcu_quiescent_state();
+	}
+
+	rcu_unregister_thread();
+	return NULL;
+}
+
+static uint64_t cgnat44_map_subscribers(struct ifnet *ifp, uint nsubs,
+					uint nthreads)
+{
+	struct cgnat44_thread ct[CGNAT44_THREADS];
+	pthread_t threads[CGNAT44_THREADS];
+	uint64_t ms1;
+	uint t;
+	int rc;
+
+	ms1 = time_ms();
+
+	for (t = 0; t < nthreads; t++) {
+		ct[t] = (struct cgnat44_thread) {
+			.ifp = ifp,
+			.first = 0x02000001 + t * (nsubs / nthreads),
+			.nsubs = nsubs / nthreads,
+			.lcore = t,
+		};
+		rc = pthread_create(&threads[t], NULL, cgnat44_map_thread,
+				    &ct[t]);
+		dp_test_fail_unless(rc == 0, "pthread_create %d", rc);
+	}
+
+	for (t = 0; t < nthreads; t++) {
+		pthread_join(threads[t], NULL);
+		dp_test_fail_unless(ct[t].failed == 0,
+				    "thread %u: %u mappings failed",
+				    t, ct[t].failed);
+	}
+
+	return time_ms() - ms1;
+}
+
+DP_DECL_TEST_CASE(npf_cgnat, cgnat44, cgnat_setup, cgnat_teardown);
+DP_START_TEST_DONT_RUN(cgnat44, test)
+{
+	char real_ifname[IFNAMSIZ];
+	uint nsubs = 200000;
+	uint64_t ms_off, ms_on;
+	uint nthreads, max;
+	struct ifnet *ifp;
+
+	dp_test_intf_real("dp2T1", real_ifname);
+	ifp = ifnet_byifname(real_ifname);
+	dp_test_fail_unless(ifp, "no interface %s", real_ifname);
+
+	dpt_cgn_cmd_fmt(false, true,
+			"nat-ut pool add POOL1 "
+			"type=cgnat "
+			"prefix=PFX1/1.0.0.0/8 "
+			"block-size=512 "
+			"max-blocks=8 "
+			"addr-pooling=arbitrary "
+			"log-pba=no");
+
+	cgnat_policy_add("POLICY1", 10, "2.0.0.0/8", "POOL1",
+			 "dp2T1", CGN_MAP_EIM, CGN_FLTR_EIF, CGN_3TUPLE, true);
+
+	max = RTE_MIN(CGNAT44_THREADS, get_lcore_max() + 1);
+
+	for (nthreads = 1; nthreads <= max; nthreads *= 2) {
+		dpt_cgn_cmd_fmt(false, true, "cgn-ut port-block-cache 0");
+		ms_off = cgnat44_map_subscribers(ifp, nsubs, nthreads);
+		dp_test_npf_clear_cgnat();
+
+		dpt_cgn_cmd_fmt(false, true, "cgn-ut port-block-cache 16");
+		ms_on = cgnat44_map_subscribers(ifp, nsubs, nthreads);
+		dp_test_npf_clear_cgnat();
+
+		printf("%u new subscribers, %u threads: "
+		       "cache off %lu mS, cache on %lu mS\n",
+		       nsubs, nthreads, ms_off, ms_on);
+	}
+
+	dpt_cgn_cmd_fmt(false, true, "cgn-ut port-block-cache 0");
+
+	cgnat_policy_del("POLICY1", 10, "dp2T1");
+
+	dp_test_npf_cmd_fmt(false, "nat-ut pool delete POOL1");
+
+} DP_END_TEST;
+
+/*
+ * Total number of port-blocks allocated from all public addresses.  This
+ * includes blocks held in the per-lcore port-block caches.
+ */
+static uint dpt_cgn_apm_blocks_used(void)
+{
+	json_object *jresp, *jarray, *jobj;
+	char *response;
+	uint i, total = 0;
+	int val;
+	bool err;
+
+	response = dp_test_console_request_w_err("cgn-op show apm",
+						 &err, false);
+	dp_test_fail_unless(response && !err, "cgn-op show apm failed");
+
+	jresp = parse_json(response, parse_err_str, sizeof(parse_err_str));
+	free(response);
+	dp_test_fail_unless(jresp, "Failed to parse cgn-op show apm");
+
+	if (json_object_object_get_ex(jresp, "apm", &jarray)) {
+		for (i = 0; i < json_object_array_length(jarray); i++) {
+			jobj = json_object_array_get_idx(jarray, i);
+			if (dp_test_json_int_field_from_obj(jobj, "blocks_used",
+							    &val))
+				total += val;
+		}
+	}
+
+	json_object_put(jresp);
+	return total;
+}
+
+/*
+ * cgnat45 -- port-block cache resize and disable
+ *
+ * Blocks held in the port-block cache must be returned to the public
+ * address as soon as the cache is resized or disabled, and not only when
+ * the next block is taken from the cache.
+ */
+DP_DECL_TEST_CASE(npf_cgnat, cgnat45, cgnat_setup, cgnat_teardown);
+DP_START_TEST(cgnat45, test)
+{
+	char real_ifname[IFNAMSIZ];
+	char subs_str[20];
+	uint used;
+
+	dp_test_intf_real("dp2T1", real_ifname);
+
+	dpt_cgn_cmd_fmt(false, true,
+			"nat-ut pool add POOL1 "
+			"type=cgnat "
+			"prefix=PFX1/1.1.1.0/30 "
+			"block-size=512 "
+			"max-blocks=8 "
+			"addr-pooling=arbitrary "
+			"log-pba=no");
+
+	cgnat_policy_add("POLICY1", 10, "2.0.0.0/8", "POOL1",
+			 "dp2T1", CGN_MAP_EIM, CGN_FLTR_EIF, CGN_3TUPLE, true);
+
+	/*
+	 * First subscriber takes one block from a freshly filled magazine
+	 * of four, second subscriber takes another from the same magazine.
+	 */
+	dpt_cgn_cmd_fmt(false, true, "cgn-ut port-block-cache 4");
+
+	snprintf(subs_str, sizeof(subs_str), "2.0.0.1");
+	dpt_cgn_map(false, real_ifname, 12000, 17, subs_str, 1024,
+		    NULL, NULL);
+	used = dpt_cgn_apm_blocks_used();
+	dp_test_fail_unless(used == 4, "blocks used %u, expected 4", used);
+
+	snprintf(subs_str, sizeof(subs_str), "2.0.0.2");
+	dpt_cgn_map(false, real_ifname, 12000, 17, subs_str, 1024,
+		    NULL, NULL);
+	used = dpt_cgn_apm_blocks_used();
+	dp_test_fail_unless(used == 4, "blocks used %u, expected 4", used);
+
+	/* Resize.  The two cached blocks are released */
+	dpt_cgn_cmd_fmt(false, true, "cgn-ut port-block-cache 2");
+	used = dpt_cgn_apm_blocks_used();
+	dp_test_fail_unless(used == 2, "blocks used %u after resize, "
+			    "expected 2", used);
+
+	/* Third subscriber refills a magazine of two */
+	snprintf(subs_str, sizeof(subs_str), "2.0.0.3");
+	dpt_cgn_map(false, real_ifname, 12000, 17, subs_str, 1024,
+		    NULL, NULL);
+	used = dpt_cgn_apm_blocks_used();
+	dp_test_fail_unless(used == 4, "blocks used %u, expected 4", used);
+
+	/* Disable.  Only the blocks in use by subscribers remain */
+	dpt_cgn_cmd_fmt(false, true, "cgn-ut port-block-cache 0");
+	used = dpt_cgn_apm_blocks_used();
+	dp_test_fail_unless(used == 3, "blocks used %u after disable, "
+			    "expected 3", used);
+
+	/* New subscriber with cache disabled allocates exactly one block */
+	snprintf(subs_str, sizeof(subs_str), "2.0.0.4");
+	dpt_cgn_map(false, real_ifname, 12000, 17, subs_str, 1024,
+		    NULL, NULL);
+	used = dpt_cgn_apm_blocks_used();
+	dp_test_fail_unless(used == 4, "blocks used %u, expected 4", used);
+
+	/* Releasing the mappings returns all blocks */
+	dp_test_npf_clear_cgnat();
+	used = dpt_cgn_apm_blocks_used();
+	dp_test_fail_unless(used == 0, "blocks used %u after clear, "
+			    "expected 0", used);
+
+	cgnat_policy_del("POLICY1", 10, "dp2T1");
+
+	dp_test_npf_cmd_fmt(false, "nat-ut pool delete POOL1");
+
+} DP_END_TEST;
+
+
+/*
+ * cgnat46 -- paced gc ticks
+ *
+ * The gc list is driven directly with synthetic entries.  A round starts
+ * once the interval has elapsed, each tick does at most the budgeted work
+ * and resumes where the last tick stopped, and entries added during a
+ * round are visited by that round.
+ */
+struct dpt_gc_ent {
+	struct cgn_gc_entry	ge;
+	uint			work;		/* work to report */
+	uint			visits;
+	bool			expire;		/* reclaim when visited */
+	bool			reclaimed;
+};
+
+#define DPT_GC_ENTS	10
+
+static struct dpt_gc_ent dpt_gc_ents[DPT_GC_ENTS + 1];
+
+static uint dpt_gc_inspect(struct cgn_gc_entry *ge, bool *reclaimed)
+{
+	struct dpt_gc_ent *e = caa_container_of(ge, struct dpt_gc_ent, ge);
+
+	dp_test_fail_unless(!e->reclaimed, "reclaimed entry visited");
+	e->visits++;
+	if (e->expire) {
+		e->reclaimed = true;
+		*reclaimed = true;
+	}
+	return e->work;
+}
+
+/* Check the visits to entries [first, last), and clear them */
+static void dpt_gc_visits(uint first, uint last, uint exp)
+{
+	uint i;
+
+	for (i = 0; i < ARRAY_SIZE(dpt_gc_ents); i++) {
+		uint want = (i >= first && i < last) ? exp : 0;
+
+		dp_test_fail_unless(dpt_gc_ents[i].visits == want,
+				    "entry %u visited %u times, expected %u",
+				    i, dpt_gc_ents[i].visits, want);
+		dpt_gc_ents[i].visits = 0;
+	}
+}
+
+/* Pretend the interval has elapsed since the last round started */
+static void dpt_gc_elapse(struct cgn_gc_list *gl)
+{
+	gl->gl_round_start -= gl->gl_interval * rte_get_timer_hz();
+}
+
+DP_DECL_TEST_CASE(npf_cgnat, cgnat46, NULL, NULL);
+DP_START_TEST(cgnat46, test)
+{
+	struct cgn_gc_list gl;
+	uint i;
+
+	memset(dpt_gc_ents, 0, sizeof(dpt_gc_ents));
+	cgn_gc_list_init(&gl, dpt_gc_inspect, 10, 4);
+
+	for (i = 0; i < DPT_GC_ENTS; i++) {
+		cgn_gc_entry_init(&dpt_gc_ents[i].ge);
+		dpt_gc_ents[i].work = 1;
+		cgn_gc_list_add(&gl, &dpt_gc_ents[i].ge);
+	}
+
+	/* Entry 2 has nested entries, which count against the budget */
+	dpt_gc_ents[2].work = 3;
+	dpt_gc_ents[4].expire = true;
+	dpt_gc_ents[9].expire = true;
+
+	/* Entries are taken on, but no round before the interval */
+	cgn_gc_list_tick(&gl);
+	dp_test_fail_unless(gl.gl_count == DPT_GC_ENTS,
+			    "%u entries on the list, expected %u",
+			    gl.gl_count, DPT_GC_ENTS);
+	dp_test_fail_unless(!gl.gl_cursor, "round started early");
+	dpt_gc_visits(0, 0, 0);
+
+	/* Entries 0 to 2 are 5 work, over the budget of 4 */
+	dpt_gc_elapse(&gl);
+	cgn_gc_list_tick(&gl);
+	dp_test_fail_unless(gl.gl_cursor, "round not started");
+	dpt_gc_visits(0, 3, 1);
+
+	/* An entry added during a round is visited by it */
+	cgn_gc_entry_init(&dpt_gc_ents[DPT_GC_ENTS].ge);
+	dpt_gc_ents[DPT_GC_ENTS].work = 1;
+	cgn_gc_list_add(&gl, &dpt_gc_ents[DPT_GC_ENTS].ge);
+
+	cgn_gc_list_tick(&gl);
+	dpt_gc_visits(3, 7, 1);
+
+	cgn_gc_list_tick(&gl);
+	dpt_gc_visits(7, DPT_GC_ENTS + 1, 1);
+	dp_test_fail_unless(!gl.gl_cursor && gl.gl_rounds == 1,
+			    "round not complete");
+	dp_test_fail_unless(gl.gl_reclaimed == 2 &&
+			    gl.gl_count == DPT_GC_ENTS - 1,
+			    "reclaimed %lu, %u entries, expected 2 and %u",
+			    gl.gl_reclaimed, gl.gl_count, DPT_GC_ENTS - 1);
+
+	/* The next round waits for the interval from the last start */
+	cgn_gc_list_tick(&gl);
+	dp_test_fail_unless(!gl.gl_cursor, "round restarted early");
+	dpt_gc_visits(0, 0, 0);
+
+	/* A round can finish on the tick that starts it */
+	gl.gl_budget = 100;
+	dpt_gc_elapse(&gl);
+	cgn_gc_list_tick(&gl);
+	dp_test_fail_unless(!gl.gl_cursor && gl.gl_rounds == 2,
+			    "round not complete in one tick");
+	for (i = 0; i < ARRAY_SIZE(dpt_gc_ents); i++)
+		dp_test_fail_unless(dpt_gc_ents[i].visits ==
+				    !dpt_gc_ents[i].reclaimed,
+				    "entry %u visited %u times", i,
+				    dpt_gc_ents[i].visits);
+
+	/* Reclaim everything, ignoring the interval and budget */
+	gl.gl_budget = 1;
+	for (i = 0; i < ARRAY_SIZE(dpt_gc_ents); i++)
+		dpt_gc_ents[i].expire = true;
+	cgn_gc_list_walk_all(&gl);
+	dp_test_fail_unless(cgn_gc_list_empty(&gl) && gl.gl_count == 0,
+			    "gc list not empty");
+
+} DP_END_TEST;
+
+
 /**********************************************************************
  * Support Functions
  *********************************************************************/
@@ -17,6 +17,7 @@
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "npf/npf_jit.h"
 
 #include "dp_test.h"
 #include "dp_test_str.h"
@@ -1482,6 +1483,291 @@ DP_START_TEST(fw_ipv4, large_ruleset)
 } DP_END_TEST;
 
 
+/*
+ * Check which classifier the IPv4 rules of a ruleset are matched with,
+ * from the "classifier" field of the ruleset show output.
+ */
+static void
+npf_fw_check_classifier(const char *attach_point, const char *rsname,
+			const char *exp)
+{
+	json_object *jrset, *jclass;
+	const char *type = NULL;
+
+	jrset = dp_test_npf_json_get_ruleset("fw-in", attach_point, "in",
+					     rsname);
+	dp_test_fail_unless(jrset, "ruleset %s not found", rsname);
+	dp_test_fail_unless(
+		json_object_object_get_ex(jrset, "classifier", &jclass) &&
+		dp_test_json_string_field_from_obj(jclass, "type", &type),
+		"ruleset %s has no classifier", rsname);
+	dp_test_fail_unless(!strcmp(type, exp),
+			    "ruleset %s classifier %s, expected %s",
+			    rsname, type, exp);
+	json_object_put(jrset);
+}
+
+/*
+ * Same as large_ruleset, but using the decision tree classifier.  Mixes
+ * address, port and protocol rules so that the tree has to cut on more than
+ * one dimension, and checks that rule order is preserved.
+ */
+DP_START_TEST(fw_ipv4, dtree)
+{
+	struct dp_test_pkt_desc_t *pkt;
+	struct dp_test_expected *test_exp;
+	struct rte_mbuf *test_pak;
+	char real_ifname[IFNAMSIZ];
+
+	struct dp_test_pkt_desc_t v4_pkt = {
+		.text       = "IPv4 UDP",
+		.len        = 20,
+		.ether_type = ETHER_TYPE_IPv4,
+		.l3_src     = "1.1.1.2",
+		.l2_src     = "aa:bb:cc:dd:1:65",
+		.l3_dst     = "2.2.2.1",
+		.l2_dst     = "aa:bb:cc:dd:2:b1",
+		.proto      = IPPROTO_UDP,
+		.l4         = {
+			.udp = {
+				.sport = 41000,
+				.dport = 1000,
+			}
+		},
+		.rx_intf    = "dp1T0",
+		.tx_intf    = "dp2T1"
+	};
+	pkt = &v4_pkt;
+
+	struct dp_test_npf_rule_t rules[] = {
+		{"10", BLOCK, STATELESS, "proto=17 dst-port=2000"},
+		{"20", PASS, STATELESS, "src-addr=1.1.1.1 proto=17"},
+		{"21", PASS, STATELESS, "src-addr=1.1.1.2 proto=17"},
+		{"22", PASS, STATELESS, "src-addr=1.1.1.3 proto=17"},
+		{"23", PASS, STATELESS, "src-addr=1.1.1.4 proto=17"},
+		{"24", PASS, STATELESS, "src-addr=1.1.1.5 proto=17"},
+		{"25", PASS, STATELESS, "src-addr=1.1.1.6 proto=17"},
+		{"26", PASS, STATELESS, "src-addr=1.1.1.7 proto=17"},
+		{"27", PASS, STATELESS, "src-addr=1.1.1.8 proto=17"},
+		{"28", PASS, STATELESS, "src-addr=1.1.1.9 proto=17"},
+		{"29", PASS, STATELESS, "src-addr=1.1.1.10 proto=17"},
+		{"30", BLOCK, STATELESS, "src-addr=1.1.1.0/24 proto=17"},
+		{"40", PASS, STATELESS, "proto=17 dst-port=3000"},
+		RULE_DEF_BLOCK,
+		NULL_RULE };
+
+	struct dp_test_npf_ruleset_t fw = {
+		.rstype = "fw-in",
+		.name = "FW1_IN", .enable = 1,
+		.attach_point = "dp1T0", .fwd = FWD, .dir = "in",
+		.rules = rules
+	};
+
+	/* Not on a dtree attach point, so uses the grouper */
+	struct dp_test_npf_rule_t rules2[] = {
+		{"10", PASS, STATELESS, "proto=17"},
+		RULE_DEF_BLOCK,
+		NULL_RULE };
+
+	struct dp_test_npf_ruleset_t fw2 = {
+		.rstype = "fw-in",
+		.name = "FW2_IN", .enable = 1,
+		.attach_point = "dp2T1", .fwd = FWD, .dir = "in",
+		.rules = rules2
+	};
+
+	struct {
+		const char *src;
+		uint16_t dport;
+		enum dp_test_fwd_result_e fwd_status;
+	} tests[] = {
+		{"1.1.1.1",  1000, DP_TEST_FWD_FORWARDED},	/* rule 20 */
+		{"1.1.1.10", 1000, DP_TEST_FWD_FORWARDED},	/* rule 29 */
+		{"1.1.1.5",  2000, DP_TEST_FWD_DROPPED},	/* rule 10 */
+		{"1.1.1.11", 1000, DP_TEST_FWD_DROPPED},	/* rule 30 */
+		{"1.1.1.11", 3000, DP_TEST_FWD_DROPPED},	/* rule 30 */
+		{"1.1.2.11", 3000, DP_TEST_FWD_FORWARDED},	/* rule 40 */
+		{"1.1.2.11", 1000, DP_TEST_FWD_DROPPED},	/* default */
+	};
+
+	dp_test_intf_real("dp1T0", real_ifname);
+	dp_test_npf_cmd_fmt(false, "npf-ut fw classifier interface:%s dtree",
+			    real_ifname);
+
+	dp_test_npf_fw_add(&fw, npf_fw_debug);
+	dp_test_npf_fw_add(&fw2, npf_fw_debug);
+	npf_fw_check_classifier("dp1T0", "FW1_IN", "dtree");
+	npf_fw_check_classifier("dp2T1", "FW2_IN", "grouper");
+
+	/*
+	 * Setup interfaces and neighbours
+	 */
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.0.250/16");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.1", "aa:bb:cc:dd:2:b1");
+
+	uint i;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		dp_test_netlink_add_neigh("dp1T0", tests[i].src,
+					  "aa:bb:cc:dd:1:65");
+		pkt->l3_src = tests[i].src;
+		pkt->l4.udp.dport = tests[i].dport;
+
+		test_pak = dp_test_v4_pkt_from_desc(pkt);
+		test_exp = dp_test_exp_from_desc(test_pak, pkt);
+		dp_test_exp_set_fwd_status(test_exp, tests[i].fwd_status);
+
+		spush(test_exp->description, sizeof(test_exp->description),
+		      "Packet from %s to port %u", tests[i].src,
+		      tests[i].dport);
+
+		/* Run the test */
+		dp_test_pak_receive(test_pak, pkt->rx_intf, test_exp);
+
+		dp_test_netlink_del_neigh("dp1T0", tests[i].src,
+					  "aa:bb:cc:dd:1:65");
+	}
+
+	/* Cleanup */
+	dp_test_npf_fw_del(&fw, npf_fw_debug);
+	dp_test_npf_fw_del(&fw2, npf_fw_debug);
+	dp_test_npf_cmd_fmt(false,
+			    "npf-ut fw classifier interface:%s grouper",
+			    real_ifname);
+	dp_test_npf_commit();
+	dp_test_npf_clear_sessions();
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.0.250/16");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.1", "aa:bb:cc:dd:2:b1");
+
+} DP_END_TEST;
+
+/*
+ * Rules with address, port range and protocol n-code, run with the n-code
+ * JIT enabled.
+ */
+DP_START_TEST(fw_ipv4, jit)
+{
+	struct dp_test_pkt_desc_t *pkt;
+	struct dp_test_expected *test_exp;
+	struct rte_mbuf *test_pak;
+
+	struct dp_test_pkt_desc_t v4_pkt = {
+		.text       = "IPv4 UDP",
+		.len        = 20,
+		.ether_type = ETHER_TYPE_IPv4,
+		.l3_src     = "1.1.1.2",
+		.l2_src     = "aa:bb:cc:dd:1:65",
+		.l3_dst     = "2.2.2.1",
+		.l2_dst     = "aa:bb:cc:dd:2:b1",
+		.proto      = IPPROTO_UDP,
+		.l4         = {
+			.udp = {
+				.sport = 41000,
+				.dport = 1000,
+			}
+		},
+		.rx_intf    = "dp1T0",
+		.tx_intf    = "dp2T1"
+	};
+	pkt = &v4_pkt;
+
+	struct dp_test_npf_rule_t rules[] = {
+		{"10", BLOCK, STATELESS, "proto=17 dst-port=2000"},
+		{"20", PASS, STATELESS,
+		 "src-addr=1.1.1.0/28 proto=17 dst-port=1000-1010"},
+		{"30", BLOCK, STATELESS, "src-addr=1.1.1.0/24"},
+		{"40", PASS, STATELESS, "proto=17 dst-port=3000"},
+		RULE_DEF_BLOCK,
+		NULL_RULE };
+
+	struct dp_test_npf_ruleset_t fw = {
+		.rstype = "fw-in",
+		.name = "FW1_IN", .enable = 1,
+		.attach_point = "dp1T0", .fwd = FWD, .dir = "in",
+		.rules = rules
+	};
+
+	struct {
+		const char *src;
+		uint16_t dport;
+		enum dp_test_fwd_result_e fwd_status;
+	} tests[] = {
+		{"1.1.1.1",  1000, DP_TEST_FWD_FORWARDED},	/* rule 20 */
+		{"1.1.1.15", 1010, DP_TEST_FWD_FORWARDED},	/* rule 20 */
+		{"1.1.1.1",  1011, DP_TEST_FWD_DROPPED},	/* rule 30 */
+		{"1.1.1.5",  2000, DP_TEST_FWD_DROPPED},	/* rule 10 */
+		{"1.1.1.20", 1000, DP_TEST_FWD_DROPPED},	/* rule 30 */
+		{"1.1.2.11", 3000, DP_TEST_FWD_FORWARDED},	/* rule 40 */
+		{"1.1.2.11", 1000, DP_TEST_FWD_DROPPED},	/* default */
+	};
+	const char *jit_rules[] = { "10", "20", "30", "40" };
+	uint i;
+
+	dp_test_npf_cmd_fmt(false, "npf-ut fw global jit enable");
+
+	dp_test_npf_fw_add(&fw, npf_fw_debug);
+
+	/* Each rule with n-code is run as native code */
+	for (i = 0; npf_jit_supported() && i < ARRAY_SIZE(jit_rules); i++) {
+		json_object *jrule;
+		bool jit = false;
+
+		jrule = dp_test_npf_json_get_rule("fw-in", "dp1T0", "in",
+						  "FW1_IN", jit_rules[i]);
+		dp_test_fail_unless(jrule, "rule %s not found", jit_rules[i]);
+		dp_test_fail_unless(
+			dp_test_json_boolean_field_from_obj(jrule, "jit",
+							    &jit) && jit,
+			"rule %s not compiled", jit_rules[i]);
+		json_object_put(jrule);
+	}
+
+	/*
+	 * Setup interfaces and neighbours
+	 */
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.0.250/16");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.1", "aa:bb:cc:dd:2:b1");
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		dp_test_netlink_add_neigh("dp1T0", tests[i].src,
+					  "aa:bb:cc:dd:1:65");
+		pkt->l3_src = tests[i].src;
+		pkt->l4.udp.dport = tests[i].dport;
+
+		test_pak = dp_test_v4_pkt_from_desc(pkt);
+		test_exp = dp_test_exp_from_desc(test_pak, pkt);
+		dp_test_exp_set_fwd_status(test_exp, tests[i].fwd_status);
+
+		spush(test_exp->description, sizeof(test_exp->description),
+		      "Packet from %s to port %u", tests[i].src,
+		      tests[i].dport);
+
+		/* Run the test */
+		dp_test_pak_receive(test_pak, pkt->rx_intf, test_exp);
+
+		dp_test_netlink_del_neigh("dp1T0", tests[i].src,
+					  "aa:bb:cc:dd:1:65");
+	}
+
+	/* Cleanup */
+	dp_test_npf_fw_del(&fw, npf_fw_debug);
+	dp_test_npf_cmd_fmt(false, "npf-ut fw global jit disable");
+	dp_test_npf_clear_sessions();
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.0.250/16");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.1", "aa:bb:cc:dd:2:b1");
+
+} DP_END_TEST;
+
 /*
  * Tests a port range that spans the one byte boundary.
  *
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property. All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Whole dataplane tests of the npf grouper
+ */
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "npf/npf.h"
+#include "npf/npf_cache.h"
+#include "npf/grouper2.h"
+
+#include "dp_test.h"
+#include "dp_test_lib.h"
+
+/*
+ * Synthetic rules.  Each rule matches each grouper byte either exactly or
+ * as "dont care".  The verification callback repeats the match so that the
+ * expected first match can be found with a linear search.
+ */
+struct g2t_rule {
+	uint8_t match[NPC_GPR_SIZE_v4];
+	uint8_t mask[NPC_GPR_SIZE_v4];
+};
+
+static bool g2t_rule_proc(const void *d, const void *r)
+{
+	const uint8_t *pkt = d;
+	const struct g2t_rule *rl = r;
+	uint i;
+
+	for (i = 0; i < NPC_GPR_SIZE_v4; i++)
+		if ((pkt[i] ^ rl->match[i]) & ~rl->mask[i])
+			return false;
+	return true;
+}
+
+/*
+ * Small byte value range so that packets match a few rules each
+ */
+static void g2t_rand_bytes(uint8_t *bytes, uint n)
+{
+	uint i;
+
+	for (i = 0; i < n; i++)
+		bytes[i] = random() % 4;
+}
+
+static g2_config_t *
+g2t_ruleset_create(struct g2t_rule *rules, uint nrules)
+{
+	g2_config_t *conf;
+	uint i, j;
+
+	conf = g2_init(NPC_GPR_SIZE_v4);
+	dp_test_fail_unless(conf, "g2_init");
+
+	for (i = 0; i < nrules; i++) {
+		g2t_rand_bytes(rules[i].match, NPC_GPR_SIZE_v4);
+		for (j = 0; j < NPC_GPR_SIZE_v4; j++)
+			rules[i].mask[j] = (random() % 3) ? 0xFF : 0;
+
+		dp_test_fail_unless(g2_create_rule(conf, i + 1, &rules[i]),
+				    "g2_create_rule %u", i);
+		dp_test_fail_unless(g2_add(conf, 0, NPC_GPR_SIZE_v4,
+					   rules[i].match, rules[i].mask),
+				    "g2_add %u", i);
+	}
+	g2_optimize(&conf);
+
+	return conf;
+}
+
+static void *
+g2t_linear(struct g2t_rule *rules, uint nrules, const uint8_t *pkt)
+{
+	uint i;
+
+	for (i = 0; i < nrules; i++)
+		if (g2t_rule_proc(pkt, &rules[i]))
+			return &rules[i];
+	return NULL;
+}
+
+static uint64_t time_us(void)
+{
+	struct timeval tod;
+
+	gettimeofday(&tod, NULL);
+	return (tod.tv_sec * 1000000ul) + tod.tv_usec;
+}
+
+DP_DECL_TEST_SUITE(npf_grouper);
+
+/*
+ * npf_grouper1 -- Check that every SIMD level, and the burst variant, find
+ * the same first match as a linear search of the rules.
+ */
+DP_DECL_TEST_CASE(npf_grouper, npf_grouper1, NULL, NULL);
+DP_START_TEST(npf_grouper1, test1)
+{
+	uint8_t pkts[G2_BURST_MAX][NPC_GPR_SIZE_v4];
+	const uint8_t *pktp[G2_BURST_MAX];
+	const void *data[G2_BURST_MAX];
+	void *expected[G2_BURST_MAX];
+	void *rules_out[G2_BURST_MAX];
+	uint sizes[] = { 40, 300, 1000 };
+	enum g2_simd saved, level, max;
+	struct g2t_rule *rules;
+	g2_config_t *conf;
+	uint s, k, iter;
+
+	saved = g2_simd_get();
+	max = g2_simd_set(G2_SIMD_AVX512);
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		rules = calloc(sizes[s], sizeof(*rules));
+		dp_test_fail_unless(rules, "calloc");
+		conf = g2t_ruleset_create(rules, sizes[s]);
+
+		for (iter = 0; iter < 8; iter++) {
+			for (k = 0; k < G2_BURST_MAX; k++) {
+				g2t_rand_bytes(pkts[k], NPC_GPR_SIZE_v4);
+				pktp[k] = pkts[k];
+				data[k] = pkts[k];
+				expected[k] = g2t_linear(rules, sizes[s],
+							 pkts[k]);
+			}
+
+			for (level = G2_SIMD_NONE; level <= max; level++) {
+				g2_simd_set(level);
+
+				for (k = 0; k < G2_BURST_MAX; k++)
+					dp_test_fail_unless(
+						g2_eval(conf, pkts[k], data[k],
+							g2t_rule_proc) ==
+						expected[k],
+						"%u rules, simd %u, pkt %u",
+						sizes[s], level, k);
+
+				g2_eval_burst(conf, G2_BURST_MAX, pktp, data,
+					      g2t_rule_proc, rules_out);
+
+				for (k = 0; k < G2_BURST_MAX; k++)
+					dp_test_fail_unless(
+						rules_out[k] == expected[k],
+						"%u rules, simd %u, burst pkt %u",
+						sizes[s], level, k);
+			}
+		}
+		g2_destroy(&conf);
+		free(rules);
+	}
+
+	g2_simd_set(saved);
+
+} DP_END_TEST;
+
+/*
+ * npf_grouper2 -- Benchmark of single packet and burst evaluation at each
+ * SIMD level.  The grouper is limited to 16384 rules.
+ */
+DP_DECL_TEST_CASE(npf_grouper, npf_grouper2, NULL, NULL);
+DP_START_TEST_DONT_RUN(npf_grouper2, test1)
+{
+	uint8_t pkts[G2_BURST_MAX][NPC_GPR_SIZE_v4];
+	const uint8_t *pktp[G2_BURST_MAX];
+	const void *data[G2_BURST_MAX];
+	void *rules_out[G2_BURST_MAX];
+	uint sizes[] = { 1000, 10000, 16384 };
+	uint npkts = 1000000;
+	enum g2_simd saved, level, max;
+	struct g2t_rule *rules;
+	uint64_t us1, us2;
+	g2_config_t *conf;
+	uint s, k, n;
+
+	saved = g2_simd_get();
+	max = g2_simd_set(G2_SIMD_AVX512);
+
+	for (k = 0; k < G2_BURST_MAX; k++) {
+		g2t_rand_bytes(pkts[k], NPC_GPR_SIZE_v4);
+		pktp[k] = pkts[k];
+		data[k] = pkts[k];
+	}
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		rules = calloc(sizes[s], sizeof(*rules));
+		dp_test_fail_unless(rules, "calloc");
+		conf = g2t_ruleset_create(rules, sizes[s]);
+
+		for (level = G2_SIMD_NONE; level <= max; level++) {
+			g2_simd_set(level);
+
+			us1 = time_us();
+			for (n = 0; n < npkts; n++)
+				g2_eval(conf, pkts[n % G2_BURST_MAX],
+					data[n % G2_BURST_MAX], g2t_rule_proc);
+			us2 = time_us();
+
+			printf("%5u rules, simd %u: %lu ns/pkt single",
+			       sizes[s], level, (us2 - us1) * 1000 / npkts);
+
+			us1 = time_us();
+			for (n = 0; n < npkts; n += G2_BURST_MAX)
+				g2_eval_burst(conf, G2_BURST_MAX, pktp, data,
+					      g2t_rule_proc, rules_out);
+			us2 = time_us();
+
+			printf(", %lu ns/pkt burst\n",
+			       (us2 - us1) * 1000 / npkts);
+		}
+		g2_destroy(&conf);
+		free(rules);
+	}
+
+	g2_simd_set(saved);
+
+} DP_END_TEST;
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Test the n-code JIT gives the same results as the n-code interpreter
+ */
+
+#include <netinet/icmp6.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <rte_byteorder.h>
+#include <rte_config.h>
+#include <stdio.h>
+
+#include "ip_funcs.h"
+#include "util.h"
+#include "npf/npf.h"
+#include "npf/npf_cache.h"
+#include "npf/npf_jit.h"
+#include "npf/npf_ncode.h"
+
+#include "dp_test.h"
+#include "dp_test_lib.h"
+#include "dp_test_macros.h"
+#include "dp_test_pktmbuf_lib.h"
+
+#define NPF_JIT_TEST_NPKTS	7
+
+static struct {
+	const char *desc;
+	uint16_t ether_type;
+	struct rte_mbuf *m;
+} npf_jit_test_pkts[NPF_JIT_TEST_NPKTS];
+
+static void
+npf_jit_test_pkt_add(uint i, const char *desc, uint16_t ether_type,
+		     struct rte_mbuf *m)
+{
+	dp_test_fail_unless(m, "%s: failed to create packet", desc);
+	npf_jit_test_pkts[i].desc = desc;
+	npf_jit_test_pkts[i].ether_type = ether_type;
+	npf_jit_test_pkts[i].m = m;
+}
+
+static void
+npf_jit_test_pkts_init(void)
+{
+	struct rte_mbuf *m;
+	int len = 64;
+	uint i = 0;
+
+	m = dp_test_create_udp_ipv4_pak("1.1.1.1", "2.2.2.2", 1000, 53,
+					1, &len);
+	npf_jit_test_pkt_add(i++, "IPv4 UDP", ETHER_TYPE_IPv4, m);
+
+	m = dp_test_create_tcp_ipv4_pak("1.1.1.20", "2.2.2.2", 1000, 80,
+					TH_SYN, 1, 0, 5840, NULL, 1, &len);
+	npf_jit_test_pkt_add(i++, "IPv4 TCP SYN", ETHER_TYPE_IPv4, m);
+
+	m = dp_test_create_icmp_ipv4_pak("1.1.2.1", "2.2.2.2", ICMP_ECHO, 0,
+					 DPT_ICMP_ECHO_DATA(1, 1), 1, &len,
+					 NULL, NULL, NULL);
+	npf_jit_test_pkt_add(i++, "IPv4 ICMP echo", ETHER_TYPE_IPv4, m);
+
+	/* Flagged as a fragment by the cache */
+	m = dp_test_create_udp_ipv4_pak("1.1.1.1", "2.2.2.2", 1000, 2000,
+					1, &len);
+	if (m)
+		iphdr(m)->frag_off = htons(IP_MF);
+	npf_jit_test_pkt_add(i++, "IPv4 UDP fragment", ETHER_TYPE_IPv4, m);
+
+	m = dp_test_create_udp_ipv6_pak("2001:1::1", "2001:2::2", 1000, 53,
+					1, &len);
+	npf_jit_test_pkt_add(i++, "IPv6 UDP", ETHER_TYPE_IPv6, m);
+
+	m = dp_test_create_tcp_ipv6_pak("2001:1:0:1::1", "2001:2::2", 1000,
+					80, TH_SYN | TH_ACK, 1, 1, 5840, NULL,
+					1, &len);
+	npf_jit_test_pkt_add(i++, "IPv6 TCP SYN ACK", ETHER_TYPE_IPv6, m);
+
+	m = dp_test_create_icmp_ipv6_pak("2001:1::1", "2001:2::2",
+					 ICMP6_ECHO_REQUEST, 0,
+					 DPT_ICMP_ECHO_DATA(1, 1), 1, &len,
+					 NULL, NULL, NULL);
+	npf_jit_test_pkt_add(i++, "IPv6 ICMP echo", ETHER_TYPE_IPv6, m);
+}
+
+static void
+npf_jit_test_pkts_free(void)
+{
+	uint i;
+
+	for (i = 0; i < ARRAY_SIZE(npf_jit_test_pkts); i++)
+		rte_pktmbuf_free(npf_jit_test_pkts[i].m);
+}
+
+/*
+ * Run a program over each test packet with both the interpreter and the
+ * compiled code.
+ */
+static void
+npf_jit_test_prog(const char *name, const uint32_t *nc, size_t sz)
+{
+	struct npf_jit *jit;
+	npf_cache_t npc;
+	int exp, res;
+	uint i;
+
+	jit = npf_jit_compile(nc, sz);
+#ifdef RTE_ARCH_X86_64
+	dp_test_fail_unless(jit, "%s: not compiled", name);
+#else
+	if (!jit)
+		return;
+#endif
+
+	for (i = 0; i < ARRAY_SIZE(npf_jit_test_pkts); i++) {
+		struct rte_mbuf *m = npf_jit_test_pkts[i].m;
+
+		memset(&npc, 0, sizeof(npc));
+		npf_cache_init(&npc);
+		npf_cache_all(&npc, m, htons(npf_jit_test_pkts[i].ether_type));
+
+		exp = npf_ncode_run(nc, &npc, m);
+		res = npf_jit_func(jit)(&npc, NULL, NULL, 0, NULL, m);
+		dp_test_fail_unless(res == exp,
+				    "%s: %s returned %d, expected %d", name,
+				    npf_jit_test_pkts[i].desc, res, exp);
+	}
+	npf_jit_free(jit);
+}
+
+#define NPF_JIT_TEST(name, ...)						\
+	{ name, (const uint32_t[]){ __VA_ARGS__ },			\
+	  sizeof((const uint32_t[]){ __VA_ARGS__ }) }
+
+/* Return value of the programs when the packet does not match */
+#define NC_NOMATCH	((uint32_t)-1)
+
+/* Program offsets below are in words, from the branch instruction */
+static const struct npf_jit_test {
+	const char *name;
+	const uint32_t *nc;
+	size_t sz;
+} npf_jit_tests[] = {
+	NPF_JIT_TEST("ret",
+		     NPF_OPCODE_RET, 0x1234),
+	NPF_JIT_TEST("proto",
+		     NPF_OPCODE_PROTO, IPPROTO_UDP,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("proto or",
+		     NPF_OPCODE_PROTO, IPPROTO_TCP,
+		     NPF_OPCODE_BEQ, 8,
+		     NPF_OPCODE_PROTO, IPPROTO_ICMPV6,
+		     NPF_OPCODE_BEQ, 4,
+		     NPF_OPCODE_RET, NC_NOMATCH,
+		     NPF_OPCODE_RET, 0),
+	NPF_JIT_TEST("ip4 src",
+		     NPF_OPCODE_IP4MASK, NC_MATCH_SRC,
+		     RTE_BE32(0x01010100), 28,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("ip4 dst",
+		     NPF_OPCODE_IP4MASK, 0, RTE_BE32(0x02020202), 32,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("ip4 src inverted",
+		     NPF_OPCODE_IP4MASK, NC_MATCH_SRC | NC_MATCH_INVERT,
+		     RTE_BE32(0x01010100), 24,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("ip6 src",
+		     NPF_OPCODE_IP6MASK, NC_MATCH_SRC,
+		     RTE_BE32(0x20010001), 0, 0, 0, 48,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("ip6 dst long prefix",
+		     NPF_OPCODE_IP6MASK, 0,
+		     RTE_BE32(0x20010002), 0, 0, RTE_BE32(2), 127,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("ip6 src inverted",
+		     NPF_OPCODE_IP6MASK, NC_MATCH_SRC | NC_MATCH_INVERT,
+		     RTE_BE32(0x20010001), RTE_BE32(1), 0, 0, 64,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("dst ports",
+		     NPF_OPCODE_PORTS, 0, (50 << 16) | 80,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("src port inverted",
+		     NPF_OPCODE_PORTS, NC_MATCH_SRC | NC_MATCH_INVERT,
+		     (1000 << 16) | 1000,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("ttl",
+		     NPF_OPCODE_TTL, 64,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("tcp flags",
+		     NPF_OPCODE_TCP_FLAGS, (TH_SYN << 8) | (TH_SYN | TH_ACK),
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("icmp type",
+		     NPF_OPCODE_ICMP4, (1u << 31) | (ICMP_ECHO << 8),
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("icmp type and code",
+		     NPF_OPCODE_ICMP4,
+		     (1u << 31) | (1u << 30) | (ICMP_ECHO << 8) | 1,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("icmp6 type",
+		     NPF_OPCODE_ICMP6, (1u << 31) | (ICMP6_ECHO_REQUEST << 8),
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("addrfam",
+		     NPF_OPCODE_ADDRFAM, AF_INET6,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("fragment",
+		     NPF_OPCODE_FRAGMENT,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("dscp",
+		     NPF_OPCODE_MATCHDSCP, 1, 1u << (46 - 32),
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	NPF_JIT_TEST("ethertype",
+		     NPF_OPCODE_ETHERTYPE, ETHER_TYPE_IPv6,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+	/* A rule: family, source, protocol and destination port range */
+	NPF_JIT_TEST("rule",
+		     NPF_OPCODE_ADDRFAM, AF_INET,
+		     NPF_OPCODE_BNE, 19,
+		     NPF_OPCODE_IP4MASK, NC_MATCH_SRC,
+		     RTE_BE32(0x01010100), 24,
+		     NPF_OPCODE_BNE, 13,
+		     NPF_OPCODE_PROTO, IPPROTO_UDP,
+		     NPF_OPCODE_BNE, 9,
+		     NPF_OPCODE_PORTS, 0, (53 << 16) | 2000,
+		     NPF_OPCODE_BNE, 4,
+		     NPF_OPCODE_RET, 0,
+		     NPF_OPCODE_RET, NC_NOMATCH),
+};
+
+DP_DECL_TEST_SUITE(npf_jit);
+
+DP_DECL_TEST_CASE(npf_jit, npf_jit_vs_ncode, NULL, NULL);
+
+DP_START_TEST(npf_jit_vs_ncode, match)
+{
+	uint i;
+
+	npf_jit_test_pkts_init();
+	for (i = 0; i < ARRAY_SIZE(npf_jit_tests); i++)
+		npf_jit_test_prog(npf_jit_tests[i].name, npf_jit_tests[i].nc,
+				  npf_jit_tests[i].sz);
+	npf_jit_test_pkts_free();
+} DP_END_TEST;
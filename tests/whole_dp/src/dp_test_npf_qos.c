@@ -10,12 +10,18 @@
  */
 
 #include <libmnl/libmnl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 #include "ip6_funcs.h"
 #include "ip_funcs.h"
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "soft_ticks.h"
+#include "util.h"
+#include "npf/rproc/npf_rproc.h"
 
 #include "dp_test.h"
 #include "dp_test_str.h"
@@ -144,3 +150,252 @@ DP_START_TEST(qos_ipv4, test1)
 				  "aa:bb:cc:dd:2:b1");
 
 } DP_END_TEST;
+
+/*
+ * Police npkts packets of 500 L3 bytes, received on dp1T0, with the
+ * per-lcore grant set to grant percent.  The first npass are expected to
+ * be forwarded, and the rest dropped.  The 1 second Tc means the policer
+ * is not refilled during the test.
+ */
+static void
+qos_policer_send(const char *police, uint8_t grant, uint npkts, uint npass)
+{
+	struct dp_test_pkt_desc_t v4_pkt_desc = {
+		.text       = "TCP IPv4",
+		.len        = 460,
+		.ether_type = ETHER_TYPE_IPv4,
+		.l3_src     = "1.1.1.11",
+		.l2_src     = "aa:bb:cc:dd:1:a1",
+		.l3_dst     = "2.2.2.11",
+		.l2_dst     = "aa:bb:cc:dd:2:b1",
+		.proto      = IPPROTO_TCP,
+		.l4         = {
+			.tcp = {
+				.sport = 1000,
+				.dport = 1001,
+				.flags = 0
+			}
+		},
+		.rx_intf    = "dp1T0",
+		.tx_intf    = "dp2T1"
+	};
+	struct dp_test_npf_rule_t rules[] = {
+		{
+			.rule = "10",
+			.pass = PASS,
+			.stateful = STATELESS,
+			.npf = police
+		},
+		NULL_RULE
+	};
+	struct dp_test_npf_ruleset_t fw = {
+		.rstype = "fw-in",
+		.name   = "FW1_IN",
+		.enable = 1,
+		.attach_point   = "dp1T0",
+		.fwd    = FWD,
+		.dir    = "in",
+		.rules  = rules
+	};
+	struct dp_test_expected *test_exp;
+	struct rte_mbuf *test_pak;
+	uint i;
+
+	/* Policers are made with their rules, so set the grant first */
+	dp_test_npf_cmd_fmt(false, "npf-ut fw global policer-grant %u",
+			    grant);
+	dp_test_npf_fw_add(&fw, false);
+
+	for (i = 0; i < npkts; i++) {
+		test_pak = dp_test_v4_pkt_from_desc(&v4_pkt_desc);
+		test_exp = dp_test_exp_from_desc(test_pak, &v4_pkt_desc);
+		dp_test_exp_set_fwd_status(test_exp, i < npass ?
+					   DP_TEST_FWD_FORWARDED :
+					   DP_TEST_FWD_DROPPED);
+		dp_test_pak_receive(test_pak, v4_pkt_desc.rx_intf, test_exp);
+	}
+	dp_test_npf_verify_rule_pkt_count(NULL, &fw, fw.rules[0].rule,
+					  npkts);
+
+	dp_test_npf_fw_del(&fw, false);
+	dp_test_npf_cmd("npf-ut fw global policer-grant 0", false);
+}
+
+/*
+ * Traffic past the rate passes and drops the same packets in the exact
+ * policer and with each grant size.  With one forwarding lcore no tokens
+ * are left stranded in another lcore's grant.
+ */
+DP_DECL_TEST_CASE(npf_qos, qos_policer_grant, NULL, NULL);
+DP_START_TEST(qos_policer_grant, bytes)
+{
+	/* 2000 bytes per 1 second Tc, no burst, so 4 of 500 bytes */
+	const char *police = "rproc=policer(0,2000,0,drop,,0,1000)";
+	uint8_t grants[] = { 0, 1, 25, 30, 100 };
+	uint g;
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_add_neigh("dp1T0", "1.1.1.11",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.11",
+				  "aa:bb:cc:dd:2:b1");
+
+	for (g = 0; g < ARRAY_SIZE(grants); g++)
+		qos_policer_send(police, grants[g], 10, 4);
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_del_neigh("dp1T0", "1.1.1.11",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.11",
+				  "aa:bb:cc:dd:2:b1");
+} DP_END_TEST;
+
+DP_START_TEST(qos_policer_grant, packets)
+{
+	/* 3 packets per 1 second Tc */
+	const char *police = "rproc=policer(3,0,0,drop,,0,1000)";
+	uint8_t grants[] = { 0, 1, 50, 100 };
+	uint g;
+
+	dp_test_nl_add_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_add_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_add_neigh("dp1T0", "1.1.1.11",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.11",
+				  "aa:bb:cc:dd:2:b1");
+
+	for (g = 0; g < ARRAY_SIZE(grants); g++)
+		qos_policer_send(police, grants[g], 6, 3);
+
+	dp_test_nl_del_ip_addr_and_connected("dp1T0", "1.1.1.1/24");
+	dp_test_nl_del_ip_addr_and_connected("dp2T1", "2.2.2.2/24");
+	dp_test_netlink_del_neigh("dp1T0", "1.1.1.11",
+				  "aa:bb:cc:dd:1:a1");
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.11",
+				  "aa:bb:cc:dd:2:b1");
+} DP_END_TEST;
+
+#define POLICER_BENCH_THREADS	4
+#define POLICER_BENCH_MS	2000
+
+struct policer_bench {
+	const npf_rproc_ops_t *ops;
+	void *handle;
+	struct rte_mbuf *m;
+	unsigned int lcore;
+	volatile bool *stop;
+	uint64_t pkts;
+	uint64_t bytes;
+};
+
+static uint64_t time_us(void)
+{
+	struct timeval tod;
+
+	gettimeofday(&tod, NULL);
+	return (tod.tv_sec * 1000000ul) + tod.tv_usec;
+}
+
+static void *policer_bench_thread(void *arg)
+{
+	struct policer_bench *pb = arg;
+	uint32_t len = rte_pktmbuf_pkt_len(pb->m) - pb->m->l2_len;
+	npf_rproc_result_t result;
+
+	RTE_PER_LCORE(_dp_lcore_id) = pb->lcore;
+
+	while (!*pb->stop) {
+		result.decision = NPF_DECISION_PASS;
+		pb->ops->ro_action(NULL, &pb->m, pb->handle, NULL, &result);
+		pb->pkts++;
+		if (result.decision == NPF_DECISION_PASS)
+			pb->bytes += len;
+	}
+	return NULL;
+}
+
+/*
+ * qos_policer -- Benchmark of the policer with several threads policing
+ * through the same policer, in exact mode and with increasing per-lcore
+ * grants.  Reports the bytes passed against those allowed by the rate over
+ * the elapsed soft_ticks, and the packets processed per second.
+ */
+DP_DECL_TEST_CASE(npf_qos, qos_policer, NULL, NULL);
+DP_START_TEST_DONT_RUN(qos_policer, bench)
+{
+	struct policer_bench pb[POLICER_BENCH_THREADS];
+	pthread_t threads[POLICER_BENCH_THREADS];
+	uint8_t grants[] = { 0, 1, 5, 25, 100 };
+	uint64_t rate = 100000000;	/* bytes per second */
+	const npf_rproc_ops_t *ops;
+	uint64_t us1, us2, ticks;
+	uint64_t pkts, bytes;
+	volatile bool stop;
+	uint8_t saved;
+	uint nthreads;
+	struct rte_mbuf *m;
+	char params[64];
+	void *handle;
+	uint g, t;
+	int len = 1000;
+	int rc;
+
+	ops = npf_find_rproc_by_id(NPF_RPROC_ID_POLICER);
+	dp_test_fail_unless(ops, "no policer rproc");
+
+	m = dp_test_create_ipv4_pak("1.1.1.1", "2.2.2.1", 1, &len);
+	dp_test_fail_unless(m, "failed to create packet");
+	dp_test_pktmbuf_eth_init(m, NULL, NULL, ETHER_TYPE_IPv4);
+
+	nthreads = RTE_MIN(POLICER_BENCH_THREADS, get_lcore_max() + 1);
+	snprintf(params, sizeof(params), "0,%lu,0,drop,,0,20", rate);
+	saved = npf_policer_get_grant();
+
+	for (g = 0; g < ARRAY_SIZE(grants); g++) {
+		npf_policer_set_grant(grants[g]);
+		rc = ops->ro_ctor(NULL, params, &handle);
+		dp_test_fail_unless(rc == 0, "policer create failed %d", rc);
+
+		stop = false;
+		for (t = 0; t < nthreads; t++) {
+			pb[t] = (struct policer_bench) {
+				.ops = ops,
+				.handle = handle,
+				.m = m,
+				.lcore = t,
+				.stop = &stop,
+			};
+			rc = pthread_create(&threads[t], NULL,
+					    policer_bench_thread, &pb[t]);
+			dp_test_fail_unless(rc == 0, "pthread_create %d", rc);
+		}
+
+		ticks = soft_ticks;
+		us1 = time_us();
+		usleep(POLICER_BENCH_MS * 1000);
+		stop = true;
+		us2 = time_us();
+		ticks = soft_ticks - ticks;
+
+		pkts = bytes = 0;
+		for (t = 0; t < nthreads; t++) {
+			pthread_join(threads[t], NULL);
+			pkts += pb[t].pkts;
+			bytes += pb[t].bytes;
+		}
+
+		printf("grant %3u%%, %u threads: %lu bytes passed, "
+		       "%lu allowed in %lu ms, %lu Mpps\n",
+		       grants[g], nthreads, bytes,
+		       rate * ticks / 1000, ticks,
+		       pkts / (us2 - us1));
+
+		ops->ro_dtor(handle);
+	}
+
+	npf_policer_set_grant(saved);
+	rte_pktmbuf_free(m);
+
+} DP_END_TEST;
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Test the per port transmit staging of a forwarding lcore: packets are
+ * held per output port until a burst is full or the rx burst ends, and
+ * each burst sent is counted against the port.
+ */
+
+#include <inttypes.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <unistd.h>
+
+#include "if_var.h"
+#include "main.h"
+#include "util.h"
+
+#include "dp_test.h"
+#include "dp_test_lib.h"
+#include "dp_test_lib_intf.h"
+#include "dp_test_macros.h"
+#include "dp_test_pktmbuf_lib.h"
+
+/* Must match TX_PKT_BURST in main.c */
+#define DPT_TX_BURST	32
+
+struct dpt_burst_port {
+	struct ifnet	*ifp;
+	struct rte_ring	*ring;		/* where the device sends packets */
+	uint64_t	bursts;		/* counts before the test */
+	uint64_t	packets;
+};
+
+static void
+dpt_burst_port_init(struct dpt_burst_port *bp, const char *name)
+{
+	char realname[IFNAMSIZ];
+
+	dp_test_intf_real(name, realname);
+	bp->ifp = ifnet_byifname(realname);
+	dp_test_fail_unless(bp->ifp, "no interface %s", realname);
+	bp->ring = dp_test_intf_name2tx_ring(bp->ifp->if_name);
+	dp_test_fail_unless(bp->ring, "no tx ring for %s", realname);
+	dp_test_fail_unless(rte_ring_count(bp->ring) == 0,
+			    "%s tx ring not empty", realname);
+	pkt_burst_test_stats(bp->ifp->if_port, &bp->bursts, &bp->packets);
+}
+
+/* Check the packets staged, and the bursts and packets sent so far */
+static void
+dpt_burst_check(const struct dpt_burst_port *bp, uint16_t staged,
+		uint64_t bursts, uint64_t packets)
+{
+	uint64_t b, p;
+	uint16_t n;
+
+	n = pkt_burst_test_staged(bp->ifp->if_port);
+	dp_test_fail_unless(n == staged, "%s: %u packets staged, expected %u",
+			    bp->ifp->if_name, n, staged);
+
+	pkt_burst_test_stats(bp->ifp->if_port, &b, &p);
+	dp_test_fail_unless(b - bp->bursts == bursts,
+			    "%s: %" PRIu64 " bursts, expected %" PRIu64,
+			    bp->ifp->if_name, b - bp->bursts, bursts);
+	dp_test_fail_unless(p - bp->packets == packets,
+			    "%s: %" PRIu64 " packets, expected %" PRIu64,
+			    bp->ifp->if_name, p - bp->packets, packets);
+}
+
+static struct rte_mbuf *
+dpt_burst_pak(void)
+{
+	struct rte_mbuf *m;
+	int len = 64;
+
+	m = dp_test_create_ipv4_pak("1.1.1.1", "2.2.2.2", 1, &len);
+	dp_test_fail_unless(m, "failed to create packet");
+	(void)dp_test_pktmbuf_eth_init(m, "aa:bb:cc:dd:ee:ff",
+				       DP_TEST_INTF_DEF_SRC_MAC,
+				       ETHER_TYPE_IPv4);
+	return m;
+}
+
+/*
+ * Take n packets off the device, allowing up to 1s for them to arrive
+ * through the transmit thread, and check that they are the packets
+ * sent, in order.
+ */
+static void
+dpt_burst_collect(const struct dpt_burst_port *bp, struct rte_mbuf **sent,
+		  unsigned int n)
+{
+	struct rte_mbuf *m;
+	int timeout = USEC_PER_SEC;
+	unsigned int i = 0;
+
+	while (i < n && timeout > 0) {
+		if (rte_ring_mc_dequeue(bp->ring, (void **)&m) != 0) {
+			usleep(1);
+			timeout--;
+			continue;
+		}
+		dp_test_fail_unless(m == sent[i],
+				    "%s: packet %u sent out of order",
+				    bp->ifp->if_name, i);
+		rte_pktmbuf_free(m);
+		i++;
+	}
+	dp_test_fail_unless(i == n, "%s: %u packets sent, expected %u",
+			    bp->ifp->if_name, i, n);
+}
+
+DP_DECL_TEST_SUITE(pkt_burst);
+
+DP_DECL_TEST_CASE(pkt_burst, pkt_burst_stage, NULL, NULL);
+
+/*
+ * Packets interleaved to two ports are staged per port, and each port
+ * goes out as one burst at the end of the rx burst.
+ */
+DP_START_TEST(pkt_burst_stage, interleave)
+{
+	struct rte_mbuf *sent1[5], *sent2[3];
+	struct dpt_burst_port bp1, bp2;
+	unsigned int i;
+
+	pkt_burst_test_init(0);
+	dpt_burst_port_init(&bp1, "dp1T0");
+	dpt_burst_port_init(&bp2, "dp2T1");
+
+	for (i = 0; i < ARRAY_SIZE(sent1); i++) {
+		sent1[i] = dpt_burst_pak();
+		pkt_burst_test_output(bp1.ifp, sent1[i]);
+		if (i < ARRAY_SIZE(sent2)) {
+			sent2[i] = dpt_burst_pak();
+			pkt_burst_test_output(bp2.ifp, sent2[i]);
+		}
+	}
+	dpt_burst_check(&bp1, ARRAY_SIZE(sent1), 0, 0);
+	dpt_burst_check(&bp2, ARRAY_SIZE(sent2), 0, 0);
+	dp_test_fail_unless(rte_ring_count(bp1.ring) == 0 &&
+			    rte_ring_count(bp2.ring) == 0,
+			    "staged packets sent before the flush");
+
+	pkt_burst_test_flush(false);
+	dpt_burst_check(&bp1, 0, 1, ARRAY_SIZE(sent1));
+	dpt_burst_check(&bp2, 0, 1, ARRAY_SIZE(sent2));
+	dpt_burst_collect(&bp1, sent1, ARRAY_SIZE(sent1));
+	dpt_burst_collect(&bp2, sent2, ARRAY_SIZE(sent2));
+
+	/* Nothing staged, nothing sent */
+	pkt_burst_test_flush(false);
+	dpt_burst_check(&bp1, 0, 1, ARRAY_SIZE(sent1));
+	dpt_burst_check(&bp2, 0, 1, ARRAY_SIZE(sent2));
+
+	pkt_burst_test_fini();
+} DP_END_TEST;
+
+/*
+ * A full burst goes out as soon as it fills.  The device may not take
+ * all of it; what is left stays staged, in order, until the drain at the
+ * end of the forwarding loop.
+ */
+DP_START_TEST(pkt_burst_stage, full_and_drain)
+{
+	struct rte_mbuf *sent[DPT_TX_BURST];
+	struct dpt_burst_port bp;
+	uint64_t bursts, packets;
+	uint16_t staged;
+	unsigned int i;
+
+	pkt_burst_test_init(0);
+	dpt_burst_port_init(&bp, "dp1T0");
+
+	for (i = 0; i < DPT_TX_BURST - 1; i++) {
+		sent[i] = dpt_burst_pak();
+		pkt_burst_test_output(bp.ifp, sent[i]);
+	}
+	dpt_burst_check(&bp, DPT_TX_BURST - 1, 0, 0);
+
+	sent[i] = dpt_burst_pak();
+	pkt_burst_test_output(bp.ifp, sent[i]);
+
+	staged = pkt_burst_test_staged(bp.ifp->if_port);
+	pkt_burst_test_stats(bp.ifp->if_port, &bursts, &packets);
+	packets -= bp.packets;
+	dp_test_fail_unless(bursts - bp.bursts == 1,
+			    "%" PRIu64 " bursts sent, expected 1",
+			    bursts - bp.bursts);
+	dp_test_fail_unless(packets > 0 && packets + staged == DPT_TX_BURST,
+			    "%" PRIu64 " sent and %u staged, expected %u",
+			    packets, staged, DPT_TX_BURST);
+	dpt_burst_collect(&bp, sent, packets);
+
+	/* The drain sends the rest, counted as a second burst */
+	pkt_burst_test_flush(true);
+	if (staged) {
+		dpt_burst_check(&bp, 0, 2, DPT_TX_BURST);
+		dpt_burst_collect(&bp, sent + packets, staged);
+	} else {
+		dpt_burst_check(&bp, 0, 1, DPT_TX_BURST);
+	}
+
+	/* A partial burst is sent by the drain too */
+	for (i = 0; i < 2; i++) {
+		sent[i] = dpt_burst_pak();
+		pkt_burst_test_output(bp.ifp, sent[i]);
+	}
+	pkt_burst_test_stats(bp.ifp->if_port, &bp.bursts, &bp.packets);
+	pkt_burst_test_flush(true);
+	dpt_burst_check(&bp, 0, 1, 2);
+	dpt_burst_collect(&bp, sent, 2);
+
+	pkt_burst_test_fini();
+} DP_END_TEST;
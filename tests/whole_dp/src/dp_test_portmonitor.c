@@ -18,6 +18,7 @@
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "util.h"
 #include "gre.h"
 #include "iptun_common.h"
 
@@ -29,7 +30,10 @@
 #include "dp_test_pktmbuf_lib.h"
 #include "dp_test_lib_intf.h"
 #include "dp_test_lib_exp.h"
+#include "dp_test_lib_pkt.h"
 #include "dp_test_lib_portmonitor.h"
+#include "dp_test_npf_lib.h"
+#include "dp_test_npf_nat_lib.h"
 
 static void
 dp_test_portmonitor_setup_span_rspan(uint32_t vrfid)
@@ -117,6 +121,222 @@ DP_START_TEST(mirroring, span)
 	dp_test_portmonitor_teardown_span_rspan(VRF_DEFAULT_ID);
 } DP_END_TEST;
 
+struct pm_truncate_ctx {
+	validate_cb saved_cb;
+	uint32_t len;
+};
+
+/*
+ * Check the length of the mirror, and that it has no empty segments
+ */
+static void
+dp_test_portmonitor_truncate_cb(struct rte_mbuf *pak, struct ifnet *ifp,
+				struct dp_test_expected *expected,
+				enum dp_test_fwd_result_e fwd_result)
+{
+	struct pm_truncate_ctx *ctx = dp_test_exp_get_validate_ctx(expected);
+	struct rte_mbuf *seg;
+
+	if (fwd_result == DP_TEST_FWD_FORWARDED) {
+		dp_test_fail_unless(rte_pktmbuf_pkt_len(pak) == ctx->len,
+				    "mirror is %u bytes, expected %u",
+				    rte_pktmbuf_pkt_len(pak), ctx->len);
+		for (seg = pak; seg; seg = seg->next)
+			dp_test_fail_unless(seg->data_len > 0,
+					    "mirror has an empty segment");
+	}
+	ctx->saved_cb(pak, ifp, expected, fwd_result);
+}
+
+/*
+ * Receive a packet of n segments with the given payload lengths on dp1T1,
+ * and check the whole packet is delivered locally and its mirror on dp1T2
+ * is the first 'truncate' bytes, or all of it if 'truncate' is 0.
+ */
+static void
+dp_test_portmonitor_span_len(uint32_t truncate, int n, const int *len)
+{
+	struct pm_truncate_ctx ctx;
+	struct dp_test_expected *exp;
+	struct rte_mbuf *test_pak;
+	char cmd[TEST_MAX_CMD_LEN];
+
+	dp_test_portmonitor_setup_span_rspan(VRF_DEFAULT_ID);
+
+	dp_test_portmonitor_create_span(1, "dp1T1", "dp1T2",
+						NULL, NULL);
+	if (truncate) {
+		snprintf(cmd, sizeof(cmd),
+			 "portmonitor set session 1 truncate %u 0 0",
+			 truncate);
+		dp_test_portmonitor_request(cmd, false);
+	}
+
+	test_pak = dp_test_create_ipv4_pak("1.1.1.2", "2.2.2.2",
+					   n, len);
+	(void)dp_test_pktmbuf_eth_init(test_pak,
+				       dp_test_intf_name2mac_str("dp1T1"),
+				       DP_TEST_INTF_DEF_SRC_MAC,
+				       ETHER_TYPE_IPv4);
+
+	ctx.len = rte_pktmbuf_pkt_len(test_pak);
+	if (truncate && truncate < ctx.len)
+		ctx.len = truncate;
+
+	/* The local packet is whole, the mirror has the same bytes */
+	exp = dp_test_exp_create_m(test_pak, 2);
+	dp_test_exp_set_fwd_status_m(exp, 0, DP_TEST_FWD_LOCAL);
+	dp_test_exp_set_fwd_status_m(exp, 1, DP_TEST_FWD_FORWARDED);
+	dp_test_exp_set_oif_name_m(exp, 1, "dp1T2");
+	rte_pktmbuf_trim(dp_test_exp_get_pak_m(exp, 1),
+			 rte_pktmbuf_pkt_len(test_pak) - ctx.len);
+	ctx.saved_cb = dp_test_exp_set_validate_cb(
+		exp, dp_test_portmonitor_truncate_cb);
+	dp_test_exp_set_validate_ctx(exp, &ctx, false);
+
+	dp_test_pak_receive(test_pak, "dp1T1", exp);
+
+	dp_test_portmonitor_delete_session(1);
+	dp_test_portmonitor_teardown_span_rspan(VRF_DEFAULT_ID);
+}
+
+/*
+ * Truncated to exactly the copied header length, so there is no shared
+ * part of the mirror.
+ */
+DP_START_TEST(mirroring, span_truncate)
+{
+	int len = 1000;
+
+	dp_test_portmonitor_span_len(128, 1, &len);
+} DP_END_TEST;
+
+/*
+ * Truncated to more than the copied header length.  The rest of the
+ * mirror is shared with the original.
+ */
+DP_START_TEST(mirroring, span_truncate_300)
+{
+	int len = 1000;
+
+	dp_test_portmonitor_span_len(300, 1, &len);
+} DP_END_TEST;
+
+/* Not truncated, the mirror shares all but the headers of the original */
+DP_START_TEST(mirroring, span_untruncated)
+{
+	int len = 1000;
+
+	dp_test_portmonitor_span_len(0, 1, &len);
+} DP_END_TEST;
+
+/*
+ * The first segment is exactly the copied header length, 14 + 20 + 94
+ * bytes, so the mirror must not start the shared part with an empty
+ * segment.
+ */
+DP_START_TEST(mirroring, span_hdr_seg)
+{
+	int len[] = { 94, 500 };
+
+	dp_test_portmonitor_span_len(0, ARRAY_SIZE(len), len);
+} DP_END_TEST;
+
+/* Make a UDP packet from a descriptor, with the given payload */
+static struct rte_mbuf *
+dp_test_portmonitor_udp_pak(const struct dp_test_pkt_desc_t *pdesc,
+			    const char *payload)
+{
+	struct rte_mbuf *pak = dp_test_v4_pkt_from_desc(pdesc);
+	uint32_t poff = pak->l2_len + pak->l3_len + sizeof(struct udphdr);
+
+	dp_test_fail_unless(dp_test_pktmbuf_payload_init(pak, poff, payload,
+							 pdesc->len) != 0,
+			    "failed to write the payload");
+	dp_test_pktmbuf_udp_init(pak, pdesc->l4.udp.sport,
+				 pdesc->l4.udp.dport, true);
+	return pak;
+}
+
+/*
+ * The original is forwarded through SNAT and the TFTP ALG after an rx
+ * mirror has been made.  The ALG and NAT must change their own copy of
+ * the packet, leaving the mirror as the packet was received.
+ */
+DP_START_TEST(mirroring, span_nat_alg)
+{
+	struct dp_test_npf_nat_rule_t snat = {
+		.desc		= "snat rule",
+		.rule		= "10",
+		.ifname		= "dp2T1",
+		.proto		= IPPROTO_UDP,
+		.map		= "dynamic",
+		.from_addr	= "1.1.1.0/24",
+		.from_port	= NULL,
+		.to_addr	= NULL,
+		.to_port	= NULL,
+		.trans_addr	= "2.2.2.254",
+		.trans_port	= NULL
+	};
+	struct dp_test_pkt_desc_t pre_desc = {
+		.text       = "TFTP read request",
+		.len        = 1000,
+		.ether_type = ETHER_TYPE_IPv4,
+		.l3_src     = "1.1.1.2",
+		.l2_src     = DP_TEST_INTF_DEF_SRC_MAC,
+		.l3_dst     = "10.0.0.1",
+		.l2_dst     = dp_test_intf_name2mac_str("dp1T1"),
+		.proto      = IPPROTO_UDP,
+		.l4         = {
+			.udp = {
+				.sport = 50618,
+				.dport = 69
+			}
+		},
+		.rx_intf    = "dp1T1",
+		.tx_intf    = "dp2T1"
+	};
+	struct dp_test_pkt_desc_t post_desc = pre_desc;
+	struct dp_test_expected *exp;
+	struct rte_mbuf *test_pak, *exp_pak;
+	char payload[1000];
+
+	post_desc.l3_src = "2.2.2.254";
+	post_desc.l2_dst = "aa:bb:cc:dd:2:b3";
+
+	/* Read request opcode, then a long file name */
+	memset(payload, 'f', sizeof(payload));
+	payload[0] = 0;
+	payload[1] = 1;
+	payload[sizeof(payload) - 1] = 0;
+
+	dp_test_portmonitor_setup_span_rspan(VRF_DEFAULT_ID);
+	dp_test_netlink_add_neigh("dp2T1", "2.2.2.3", "aa:bb:cc:dd:2:b3");
+	dp_test_npf_snat_add(&snat, true);
+
+	dp_test_portmonitor_create_span(1, "dp1T1", "dp1T2",
+						NULL, NULL);
+
+	test_pak = dp_test_portmonitor_udp_pak(&pre_desc, payload);
+	exp_pak = dp_test_portmonitor_udp_pak(&post_desc, payload);
+
+	/* The mirror is sent on rx, before the original is forwarded */
+	exp = dp_test_exp_create_m(test_pak, 1);
+	dp_test_exp_set_fwd_status_m(exp, 0, DP_TEST_FWD_FORWARDED);
+	dp_test_exp_set_oif_name_m(exp, 0, "dp1T2");
+	dp_test_exp_from_desc_m(exp_pak, &post_desc, exp, 1);
+	dp_test_exp_set_fwd_status_m(exp, 1, DP_TEST_FWD_FORWARDED);
+	rte_pktmbuf_free(exp_pak);
+
+	dp_test_pak_receive(test_pak, "dp1T1", exp);
+
+	dp_test_portmonitor_delete_session(1);
+	dp_test_npf_snat_del(snat.ifname, snat.rule, true);
+	dp_test_npf_cleanup();
+	dp_test_netlink_del_neigh("dp2T1", "2.2.2.3", "aa:bb:cc:dd:2:b3");
+	dp_test_portmonitor_teardown_span_rspan(VRF_DEFAULT_ID);
+} DP_END_TEST;
+
 DP_START_TEST(mirroring, span_filter)
 {
 	struct dp_test_expected *exp;
@@ -341,9 +561,11 @@ static void
 erspan_build_expected_pak(struct dp_test_expected **expected,
 			  struct rte_mbuf *tpak,
 			  uint16_t gre_prot, uint16_t erspanid,
-			  uint8_t srcidx, uint8_t dir)
+			  uint8_t srcidx, uint8_t dir, uint32_t truncate)
 {
 	int len;
+	bool truncated;
+	struct erspan_type2_hdr *erspan;
 	struct dp_test_expected *exp;
 	struct iphdr *inner_ip;
 	struct ether_hdr *payload;
@@ -359,6 +581,9 @@ erspan_build_expected_pak(struct dp_test_expected **expected,
 
 	inner_ip = iphdr(tpak);
 	len = ntohs(inner_ip->tot_len) + ETHER_HDR_LEN;
+	truncated = truncate && (uint32_t)len > truncate;
+	if (truncated)
+		len = truncate;
 	m = dp_test_create_erspan_ipv4_pak("1.1.2.1", "1.1.2.2",
 					   &len, gre_prot, erspanid, srcidx,
 					   tpak->vlan_tci, dir,
@@ -374,6 +599,15 @@ erspan_build_expected_pak(struct dp_test_expected **expected,
 	exp->check_start[1] = pktmbuf_l2_len(exp->exp_pak[1]);
 	exp->check_len[1] = rte_pktmbuf_data_len(exp->exp_pak[0]) -
 				exp->check_start[1];
+	if (truncated) {
+		exp->check_len[1] = rte_pktmbuf_data_len(m) -
+					exp->check_start[1];
+
+		/* T bit, after the GRE header and sequence number */
+		erspan = rte_pktmbuf_mtod_offset(m, struct erspan_type2_hdr *,
+						 m->l2_len + m->l3_len + 8);
+		erspan->ver_sid |= htonl(1 << 10);
+	}
 
 	/* Ignore GRE sequence number */
 	dont_care_len = m->l2_len + m->l3_len + 4;
@@ -412,7 +646,7 @@ DP_START_TEST(mirroring, erspan_source)
 	dp_test_exp_set_fwd_status_m(exp, 0, DP_TEST_FWD_LOCAL);
 
 	erspan_build_expected_pak(&exp, test_pak, ETH_P_ERSPAN_TYPEII,
-				  20, 1, 1);
+				  20, 1, 1, 0);
 
 	dp_test_pak_receive(test_pak, "dp1T1", exp);
 
@@ -423,6 +657,47 @@ DP_START_TEST(mirroring, erspan_source)
 	dp_test_portmonitor_teardown_erspan(VRF_DEFAULT_ID);
 } DP_END_TEST;
 
+/*
+ * Truncate a 1000 byte packet to 300 bytes, sharing the rest of the
+ * mirror with the original, and check the truncated bit is set.
+ */
+DP_START_TEST(mirroring, erspan_source_truncate)
+{
+	struct pm_truncate_ctx ctx;
+	struct dp_test_expected *exp;
+	struct rte_mbuf *test_pak;
+	int len = 1000;
+
+	dp_test_portmonitor_setup_erspan(VRF_DEFAULT_ID);
+
+	dp_test_portmonitor_create_erspansrc(1, "dp1T1", "erspan1",
+						20, 1, NULL, NULL);
+	dp_test_portmonitor_request(
+		"portmonitor set session 1 truncate 300 0 0", false);
+
+	test_pak = dp_test_create_ipv4_pak("1.1.1.1", "2.2.2.2",
+					   1, &len);
+	(void)dp_test_pktmbuf_eth_init(test_pak,
+				       dp_test_intf_name2mac_str("dp1T1"),
+				       DP_TEST_INTF_DEF_SRC_MAC,
+				       ETHER_TYPE_IPv4);
+
+	exp = dp_test_exp_create_m(test_pak, 2);
+	dp_test_exp_set_fwd_status_m(exp, 0, DP_TEST_FWD_LOCAL);
+
+	erspan_build_expected_pak(&exp, test_pak, ETH_P_ERSPAN_TYPEII,
+				  20, 1, 1, 300);
+	ctx.len = rte_pktmbuf_pkt_len(dp_test_exp_get_pak_m(exp, 1));
+	ctx.saved_cb = dp_test_exp_set_validate_cb(
+		exp, dp_test_portmonitor_truncate_cb);
+	dp_test_exp_set_validate_ctx(exp, &ctx, false);
+
+	dp_test_pak_receive(test_pak, "dp1T1", exp);
+
+	dp_test_portmonitor_delete_session(1);
+	dp_test_portmonitor_teardown_erspan(VRF_DEFAULT_ID);
+} DP_END_TEST;
+
 DP_START_TEST(mirroring, erspan_source_filter)
 {
 	struct dp_test_expected *exp;
@@ -510,7 +785,7 @@ DP_START_TEST(mirroring, erspan_vlan_source)
 	dp_test_exp_set_fwd_status_m(exp, 0, DP_TEST_FWD_LOCAL);
 
 	erspan_build_expected_pak(&exp, test_pak, ETH_P_ERSPAN_TYPEII,
-				  20, 1, 1);
+				  20, 1, 1, 0);
 
 	dp_test_pak_receive(test_pak, "dp1T1", exp);
 
@@ -537,7 +812,7 @@ DP_START_TEST(mirroring, erspan_vlan_source)
 	dp_test_exp_set_vlan_tci_m(exp, 0, 10);
 
 	erspan_build_expected_pak(&exp, dp_test_exp_get_pak_m(exp, 0),
-				  ETH_P_ERSPAN_TYPEII, 20, 1, 2);
+				  ETH_P_ERSPAN_TYPEII, 20, 1, 2, 0);
 	dp_test_ipv4_decrement_ttl(dp_test_exp_get_pak_m(exp, 1));
 
 	dp_test_pak_receive(test_pak, "dp2T1", exp);
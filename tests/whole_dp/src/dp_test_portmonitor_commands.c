@@ -71,6 +71,12 @@ static const struct dp_test_command_t portmonitor_cmd[] = {
 		"Invalid direction ZZZ\n",
 		false,
 		false,
+	},
+	{
+		"portmonitor set session 1 truncate 20 0 0",
+		"Invalid truncate length 20\n",
+		false,
+		false,
 	},
 	 /* portmonitor del session negative tests */
 	{
@@ -9,13 +9,16 @@
  */
 
 #include <libmnl/libmnl.h>
+#include <rte_cycles.h>
 #include <rte_sched.h>
+#include <sys/time.h>
 
 #include "ip6_funcs.h"
 #include "ip_funcs.h"
 #include "in_cksum.h"
 #include "if_var.h"
 #include "main.h"
+#include "qos.h"
 
 #include "dp_test.h"
 #include "dp_test_str.h"
@@ -1312,3 +1315,664 @@ DP_START_TEST(qos_basic_ipv4, npf_rules_check)
 	qos_lib_test_teardown();
 
 } DP_END_TEST;
+
+/*
+ * basic_pkt_classify_fwd is basic_pkt_classify with the packets classified
+ * by the forwarding cores rather than the transmit thread.
+ */
+const char *basic_pkt_classify_fwd_cmds[] = {
+	"port subports 1 pipes 2 profiles 1 overhead 24 classify forwarding",
+	"subport 0 rate 1250000000 size 5000000 period 40",
+	"subport 0 queue 0 rate 1250000000 size 5000000",
+	"subport 0 queue 1 rate 1250000000 size 5000000",
+	"subport 0 queue 2 rate 1250000000 size 5000000",
+	"subport 0 queue 3 rate 1250000000 size 5000000",
+	"vlan 0 0",
+	"profile 0 rate 1250000 size 5000 period 10",
+	"profile 0 queue 0 rate 1250000 size 5000",
+	"profile 0 queue 1 rate 1250000 size 5000",
+	"profile 0 queue 2 rate 1250000 size 5000",
+	"profile 0 queue 3 rate 1250000 size 5000",
+	"pipe 0 0 0",
+	"pipe 0 1 0",
+	"match 0 1 action=accept src-addr=1.1.1.0/24 handle=tag(1)",
+	"enable"
+};
+
+DP_START_TEST(qos_basic_ipv4, basic_pkt_classify_fwd)
+{
+	bool debug = (dp_test_debug_get() == 2 ? true : false);
+
+	qos_lib_test_setup();
+
+	dp_test_qos_debug(debug);
+
+	/* Set up QoS config on dp2T1 */
+	dp_test_qos_attach_config_to_if("dp2T1", basic_pkt_classify_fwd_cmds,
+					debug);
+
+	dp_test_qos_check_for_zero_counters("dp2T1", debug);
+
+	/* Packets matching class 1 go to pipe 1 */
+	dp_test_qos_pkt_forw_test("dp2T1", 0, "1.1.1.11", "2.2.2.11",
+				  48, 0, 1, 0, 0, debug);
+	dp_test_qos_pkt_forw_test("dp2T1", 0, "1.1.1.11", "2.2.2.11",
+				  0, 0, 1, 3, 0, debug);
+
+	dp_test_qos_clear_counters("dp2T1", debug);
+	dp_test_qos_check_for_zero_counters("dp2T1", debug);
+
+	/* Other packets go to pipe 0 */
+	dp_test_qos_pkt_forw_test("dp2T1", 0, "3.3.3.11", "2.2.2.11",
+				  48, 0, 0, 0, 0, debug);
+	dp_test_qos_pkt_forw_test("dp2T1", 0, "3.3.3.11", "2.2.2.11",
+				  0, 0, 0, 3, 0, debug);
+
+	dp_test_qos_clear_counters("dp2T1", debug);
+	dp_test_qos_check_for_zero_counters("dp2T1", debug);
+
+	/* Cleanup */
+	dp_test_qos_delete_config_from_if("dp2T1", debug);
+	dp_test_qos_debug(false);
+
+	qos_lib_test_teardown();
+
+} DP_END_TEST;
+
+#define BENCH_BURST	32
+#define BENCH_PKTS	(4 * 1000 * 1000)
+
+const char *bench_classify_cmds[] = {
+	"port subports 1 pipes 2 profiles 1 overhead 24",
+	"subport 0 rate 1250000000 size 5000000 period 40",
+	"subport 0 queue 0 rate 1250000000 size 5000000",
+	"subport 0 queue 1 rate 1250000000 size 5000000",
+	"subport 0 queue 2 rate 1250000000 size 5000000",
+	"subport 0 queue 3 rate 1250000000 size 5000000",
+	"vlan 0 0",
+	"profile 0 rate 1250000000 size 5000000 period 10",
+	"profile 0 queue 0 rate 1250000000 size 5000000",
+	"profile 0 queue 1 rate 1250000000 size 5000000",
+	"profile 0 queue 2 rate 1250000000 size 5000000",
+	"profile 0 queue 3 rate 1250000000 size 5000000",
+	"pipe 0 0 0",
+	"pipe 0 1 0",
+	"match 0 1 action=accept src-addr=1.1.1.0/24 handle=tag(1)",
+	"enable"
+};
+
+static uint64_t time_us(void)
+{
+	struct timeval tod;
+
+	gettimeofday(&tod, NULL);
+	return (tod.tv_sec * 1000000ul) + tod.tv_usec;
+}
+
+/*
+ * Run packets through a scheduler as the transmit thread does, returning
+ * the time taken in microseconds.  All the packets are back in pkts at
+ * the end.
+ */
+static uint64_t bench_sched(struct ifnet *ifp, struct sched_info *qinfo,
+			    struct rte_mbuf **pkts)
+{
+	struct rte_mbuf *out[BENCH_BURST];
+	unsigned int n_in = BENCH_BURST;
+	uint64_t done = 0, us;
+	int n;
+
+	us = time_us();
+	while (done < BENCH_PKTS) {
+		n = qos_sched(ifp, qinfo, 0, pkts, n_in, out, BENCH_BURST);
+		memcpy(pkts, out, n * sizeof(*out));
+		n_in = n;
+		done += n;
+	}
+	us = time_us() - us;
+
+	while (n_in < BENCH_BURST)
+		n_in += qos_sched(ifp, qinfo, 0, NULL, 0, &pkts[n_in],
+				  BENCH_BURST - n_in);
+	return us;
+}
+
+/*
+ * Benchmark of the QoS transmit thread, with the packets classified by
+ * the transmit thread and by the forwarding cores.  Reports the packets
+ * per second a single transmit thread can schedule for a shaped port, and
+ * the classification cost moved to the forwarding cores.
+ *
+ * The benchmark has its own copy of the scheduler, so that it does not
+ * race with the transmit thread for dp2T1.
+ */
+DP_START_TEST_DONT_RUN(qos_basic_ipv4, bench_classify)
+{
+	struct rte_mbuf *pkts[BENCH_BURST];
+	struct sched_info *qinfo;
+	uint64_t us_tx, us_fwd, us_cls, start;
+	uint16_t max_pkt_len;
+	struct ifnet *ifp;
+	int len = 64;
+	unsigned int i;
+
+	qos_lib_test_setup();
+	dp_test_qos_attach_config_to_if("dp2T1", bench_classify_cmds, false);
+
+	ifp = ifnet_byifname("dp2T1");
+	dp_test_fail_unless(ifp && ifp->if_qos, "no qos on dp2T1");
+
+	qinfo = malloc(sizeof(*qinfo));
+	dp_test_fail_unless(qinfo, "no memory for scheduler");
+	*qinfo = *ifp->if_qos;
+	qinfo->dev_info.dpdk.shards = NULL;
+
+	max_pkt_len = ifp->if_mtu_adjusted + VLAN_HDR_LEN +
+		RTE_MAX(qinfo->port_params.frame_overhead, 0);
+	dp_test_fail_unless(
+		qos_dpdk_start(ifp, qinfo, qinfo->port_params.rate,
+			       max_pkt_len) == 0,
+		"scheduler start failed");
+
+	for (i = 0; i < BENCH_BURST; i++) {
+		pkts[i] = dp_test_create_ipv4_pak("1.1.1.11", "2.2.2.11",
+						  1, &len);
+		dp_test_pktmbuf_eth_init(pkts[i], "aa:bb:cc:dd:2:b1",
+					 "aa:bb:cc:dd:1:a1",
+					 ETHER_TYPE_IPv4);
+	}
+
+	/* Classified by the transmit thread */
+	us_tx = bench_sched(ifp, qinfo, pkts);
+
+	/* Classified by the forwarding cores */
+	start = time_us();
+	for (i = 0; i < BENCH_PKTS; i++)
+		dp_test_fail_unless(
+			qos_classify_fwd(ifp, qinfo,
+					 &pkts[i % BENCH_BURST]),
+			"packet dropped by classification");
+	us_cls = time_us() - start;
+	us_fwd = bench_sched(ifp, qinfo, pkts);
+
+	printf("transmit thread: classify on transmit %6.2f Mpps, "
+	       "classify on forwarding %6.2f Mpps\n"
+	       "forwarding classification %6.1f ns/packet\n",
+	       (double)BENCH_PKTS / us_tx, (double)BENCH_PKTS / us_fwd,
+	       us_cls * 1000.0 / BENCH_PKTS);
+
+	pktmbuf_free_bulk(pkts, BENCH_BURST);
+	qos_dpdk_stop(ifp, qinfo);
+	synchronize_rcu();
+	free(qinfo);
+
+	dp_test_qos_delete_config_from_if("dp2T1", false);
+	qos_lib_test_teardown();
+} DP_END_TEST;
+
+/*
+ * Run one packet through a shard of a sharded scheduler, returning the
+ * packet dequeued, if any.
+ */
+static struct rte_mbuf *
+sharded_sched_one(struct ifnet *ifp, struct sched_info *qinfo,
+		  unsigned int shard, struct rte_mbuf *m)
+{
+	struct rte_mbuf *out = NULL;
+	int i, n;
+
+	n = qos_sched(ifp, qinfo, shard, &m, 1, &out, 1);
+	for (i = 0; n == 0 && i < 10000; i++)
+		n = qos_sched(ifp, qinfo, shard, NULL, 0, &out, 1);
+
+	return n == 1 ? out : NULL;
+}
+
+/*
+ * Read and clear the packet count of a queue on one shard
+ */
+static uint64_t
+sharded_sched_qpkts(struct sched_info *qinfo, unsigned int shard,
+		    unsigned int subport, unsigned int tc)
+{
+	struct rte_sched_queue_stats64 stats;
+	uint32_t qid = qos_sched_calc_qindex(qinfo, subport, 0, tc, 0);
+	uint16_t qlen;
+
+	memset(&stats, 0, sizeof(stats));
+	rte_sched_queue_read_stats64(qinfo->dev_info.dpdk.shards->port[shard],
+				     qid, &stats, &qlen);
+	return stats.n_pkts;
+}
+
+/*
+ * A scheduler with two shards.  Trunk packets are scheduled by subport 0
+ * on shard 0 and vlan 10 packets by subport 1 on shard 1.
+ *
+ * As in bench_classify the test has its own copy of the scheduler, since
+ * the test environment only has one packet ring per port.
+ */
+DP_START_TEST(qos_basic_ipv4, sharded_sched)
+{
+	struct rte_mbuf *m_trunk, *m_vlan, *out;
+	struct sched_info *qinfo;
+	uint16_t max_pkt_len;
+	struct ifnet *ifp;
+	int len = 64;
+
+	qos_lib_test_setup();
+
+	dp_test_intf_vif_create("dp2T1.10", "dp2T1", 10);
+	dp_test_qos_attach_config_to_if("dp2T1", basic_vlan_pkt_fwd_cmds,
+					false);
+
+	ifp = ifnet_byifname("dp2T1");
+	dp_test_fail_unless(ifp && ifp->if_qos, "no qos on dp2T1");
+
+	qinfo = malloc(sizeof(*qinfo));
+	dp_test_fail_unless(qinfo, "no memory for scheduler");
+	*qinfo = *ifp->if_qos;
+	qinfo->dev_info.dpdk.shards = NULL;
+
+	max_pkt_len = ifp->if_mtu_adjusted + VLAN_HDR_LEN +
+		RTE_MAX(qinfo->port_params.frame_overhead, 0);
+	dp_test_fail_unless(
+		qos_dpdk_start_shards(ifp, qinfo, qinfo->port_params.rate,
+				      max_pkt_len, 2) == 0,
+		"sharded scheduler start failed");
+	dp_test_fail_unless(qos_sched_shards(qinfo) == 2,
+			    "%u shards, expected 2", qos_sched_shards(qinfo));
+
+	m_trunk = dp_test_create_ipv4_pak("1.1.1.11", "2.2.2.11", 1, &len);
+	dp_test_pktmbuf_eth_init(m_trunk, "aa:bb:cc:dd:2:b1",
+				 "aa:bb:cc:dd:1:a1", ETHER_TYPE_IPv4);
+
+	m_vlan = dp_test_create_ipv4_pak("1.1.1.11", "3.3.3.11", 1, &len);
+	dp_test_pktmbuf_eth_init(m_vlan, "aa:bb:cc:dd:2:b1",
+				 "aa:bb:cc:dd:1:a1", ETHER_TYPE_IPv4);
+	m_vlan->ol_flags |= PKT_TX_VLAN_PKT;
+	m_vlan->vlan_tci = 10;
+
+	/* The forwarding cores queue each subport to its own shard */
+	dp_test_fail_unless(qos_sched_shard(qinfo, 2, m_trunk) == 0,
+			    "trunk packet not for shard 0");
+	dp_test_fail_unless(qos_sched_shard(qinfo, 2, m_vlan) == 1,
+			    "vlan packet not for shard 1");
+
+	/* Each shard only has full queues for the subports it owns */
+	dp_test_fail_unless(qos_shard_owns_subport(2, 0, 0) &&
+			    !qos_shard_owns_subport(2, 0, 1) &&
+			    qos_shard_owns_subport(2, 1, 1),
+			    "subports not split over the shards");
+
+	/* DSCP 0 goes to TC 3 */
+	out = sharded_sched_one(ifp, qinfo, 0, m_trunk);
+	dp_test_fail_unless(out == m_trunk, "trunk packet not sent by shard 0");
+	dp_test_fail_unless(sharded_sched_qpkts(qinfo, 0, 0, 3) == 1,
+			    "trunk packet not queued on shard 0");
+	rte_pktmbuf_free(out);
+
+	out = sharded_sched_one(ifp, qinfo, 1, m_vlan);
+	dp_test_fail_unless(out == m_vlan, "vlan packet not sent by shard 1");
+	dp_test_fail_unless(sharded_sched_qpkts(qinfo, 1, 1, 3) == 1,
+			    "vlan packet not queued on shard 1");
+	dp_test_fail_unless(sharded_sched_qpkts(qinfo, 0, 1, 3) == 0,
+			    "vlan packet queued on shard 0");
+	rte_pktmbuf_free(out);
+
+	qos_dpdk_stop(ifp, qinfo);
+	synchronize_rcu();
+	free(qinfo);
+
+	dp_test_qos_delete_config_from_if("dp2T1", false);
+	dp_test_intf_vif_del("dp2T1.10", 10);
+	qos_lib_test_teardown();
+} DP_END_TEST;
+
+/*
+ * Sharing the port rate between the shards.  A shard takes credit from
+ * the port token bucket a chunk at a time, goes into debt by what it
+ * dequeues, and must pay back the debt before it sends again.
+ */
+DP_START_TEST(qos_basic_ipv4, shard_credit)
+{
+	struct qos_shard_credit sc = { .credit = 0 };
+	struct qos_shards shards;
+	struct rte_mbuf *pkts[4];
+	int64_t cost, debt;
+	int len = 1000;
+	unsigned int i;
+
+	memset(&shards, 0, sizeof(shards));
+	rte_spinlock_init(&shards.lock);
+	shards.n_shards = 2;
+	shards.rate = 1000;		/* Too slow to refill during the test */
+	shards.overhead = 24;
+	shards.chunk = 2048;
+	shards.tb_size = 2 * shards.chunk;
+	shards.tokens = shards.tb_size;
+	shards.tsc = rte_rdtsc();
+
+	for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+		pkts[i] = dp_test_create_ipv4_pak("1.1.1.11", "2.2.2.11",
+						  1, &len);
+		dp_test_pktmbuf_eth_init(pkts[i], "aa:bb:cc:dd:2:b1",
+					 "aa:bb:cc:dd:1:a1",
+					 ETHER_TYPE_IPv4);
+	}
+
+	/* No credit, so a chunk is taken from the bucket */
+	dp_test_fail_unless(qos_shard_credit_get(&shards, &sc),
+			    "no credit from a full bucket");
+	dp_test_fail_unless(sc.credit == 2048, "credit %ld, expected 2048",
+			    sc.credit);
+	dp_test_fail_unless(shards.tokens == 2048,
+			    "tokens %lu, expected 2048", shards.tokens);
+
+	/* Credit left, so the bucket is not touched */
+	dp_test_fail_unless(qos_shard_credit_get(&shards, &sc),
+			    "no credit left");
+	dp_test_fail_unless(shards.tokens == 2048,
+			    "tokens %lu changed with credit left",
+			    shards.tokens);
+
+	/* Each packet costs its length plus the frame overhead */
+	cost = pkts[0]->pkt_len + shards.overhead;
+	qos_shard_credit_use(&shards, &sc, pkts, 1);
+	dp_test_fail_unless(sc.credit == 2048 - cost,
+			    "credit %ld, expected %ld", sc.credit, 2048 - cost);
+
+	/* A dequeue may take the shard into debt */
+	qos_shard_credit_use(&shards, &sc, &pkts[1], 3);
+	debt = 2048 - 4 * cost;
+	dp_test_fail_unless(sc.credit == debt && debt + 2048 <= 0,
+			    "credit %ld, expected %ld", sc.credit, debt);
+
+	/* The debt is paid back from the bucket before sending again */
+	dp_test_fail_unless(!qos_shard_credit_get(&shards, &sc),
+			    "credit while still in debt");
+	dp_test_fail_unless(sc.credit == debt + 2048 && shards.tokens == 0,
+			    "credit %ld tokens %lu, expected %ld 0",
+			    sc.credit, shards.tokens, debt + 2048);
+
+	/* Nothing left in the bucket */
+	dp_test_fail_unless(!qos_shard_credit_get(&shards, &sc),
+			    "credit from an empty bucket");
+
+	/* The bucket refills at the port rate, 1/256s is 3906 bytes */
+	sc.credit = 0;
+	shards.rate = 1000000;		/* 1 MByte/s */
+	shards.tsc = rte_rdtsc() - rte_get_tsc_hz() / 256;
+	dp_test_fail_unless(qos_shard_credit_get(&shards, &sc),
+			    "no credit after refill");
+	dp_test_fail_unless(sc.credit == 2048, "credit %ld, expected 2048",
+			    sc.credit);
+	dp_test_fail_unless(shards.tokens >= 3906 - 2048 &&
+			    shards.tokens < 3906 - 2048 + 100,
+			    "tokens %lu after refill, expected about %u",
+			    shards.tokens, 3906 - 2048);
+
+	/* The refill is limited to the bucket size */
+	shards.tsc = rte_rdtsc() - rte_get_tsc_hz() / 128;
+	sc.credit = 0;
+	shards.tokens = 0;
+	shards.tb_size = 1000;
+	dp_test_fail_unless(qos_shard_credit_get(&shards, &sc),
+			    "no credit after refill");
+	dp_test_fail_unless(sc.credit == 1000 && shards.tokens == 0,
+			    "credit %ld tokens %lu, expected 1000 0",
+			    sc.credit, shards.tokens);
+
+	pktmbuf_free_bulk(pkts, ARRAY_SIZE(pkts));
+} DP_END_TEST;
+
+/*
+ * basic_pkt_police_fwd is basic_pkt_classify_fwd with class 1 policed to
+ * 3 packets a second.
+ */
+const char *basic_pkt_police_fwd_cmds[] = {
+	"port subports 1 pipes 2 profiles 1 overhead 24 classify forwarding",
+	"subport 0 rate 1250000000 size 5000000 period 40",
+	"subport 0 queue 0 rate 1250000000 size 5000000",
+	"subport 0 queue 1 rate 1250000000 size 5000000",
+	"subport 0 queue 2 rate 1250000000 size 5000000",
+	"subport 0 queue 3 rate 1250000000 size 5000000",
+	"vlan 0 0",
+	"profile 0 rate 1250000 size 5000 period 10",
+	"profile 0 queue 0 rate 1250000 size 5000",
+	"profile 0 queue 1 rate 1250000 size 5000",
+	"profile 0 queue 2 rate 1250000 size 5000",
+	"profile 0 queue 3 rate 1250000 size 5000",
+	"pipe 0 0 0",
+	"pipe 0 1 0",
+	"match 0 1 action=accept src-addr=1.1.1.0/24 handle=tag(1) "
+		"rproc=policer(3,0,0,drop,,0,1000)",
+	"enable"
+};
+
+/*
+ * A packet dropped by a QoS policer on the forwarding core is freed
+ * there and never reaches the transmit thread.  The 1 second Tc is too
+ * long to refill during the test.
+ */
+DP_START_TEST(qos_basic_ipv4, basic_pkt_police_fwd)
+{
+	struct rte_mbuf *m;
+	struct ifnet *ifp;
+	int len = 64;
+	unsigned int i;
+
+	qos_lib_test_setup();
+	dp_test_qos_attach_config_to_if("dp2T1", basic_pkt_police_fwd_cmds,
+					false);
+
+	ifp = ifnet_byifname("dp2T1");
+	dp_test_fail_unless(ifp && ifp->if_qos && ifp->if_qos->classify_fwd,
+			    "no forwarding classification on dp2T1");
+
+	for (i = 0; i < 6; i++) {
+		m = dp_test_create_ipv4_pak("1.1.1.11", "2.2.2.11", 1, &len);
+		dp_test_pktmbuf_eth_init(m, "aa:bb:cc:dd:2:b1",
+					 "aa:bb:cc:dd:1:a1",
+					 ETHER_TYPE_IPv4);
+
+		if (i >= 3) {
+			dp_test_fail_unless(
+				!qos_classify_fwd(ifp, ifp->if_qos, &m),
+				"packet %u not dropped by the policer", i);
+			continue;
+		}
+
+		dp_test_fail_unless(qos_classify_fwd(ifp, ifp->if_qos, &m),
+				    "packet %u dropped by the policer", i);
+		dp_test_fail_unless(pktmbuf_mdata_exists(
+					    m, PKT_MDATA_QOS_CLASSIFIED),
+				    "packet %u not flagged as classified", i);
+		rte_pktmbuf_free(m);
+	}
+
+	/* Unpoliced traffic is still classified */
+	m = dp_test_create_ipv4_pak("3.3.3.11", "2.2.2.11", 1, &len);
+	dp_test_pktmbuf_eth_init(m, "aa:bb:cc:dd:2:b1", "aa:bb:cc:dd:1:a1",
+				 ETHER_TYPE_IPv4);
+	dp_test_fail_unless(qos_classify_fwd(ifp, ifp->if_qos, &m),
+			    "unpoliced packet dropped");
+	rte_pktmbuf_free(m);
+
+	dp_test_qos_delete_config_from_if("dp2T1", false);
+	qos_lib_test_teardown();
+} DP_END_TEST;
+
+/*
+ * Read and clear the packet count of a queue of a pipe on an unsharded
+ * scheduler.
+ */
+static uint64_t
+classify_fwd_qpkts(struct sched_info *qinfo, unsigned int pipe,
+		   unsigned int tc)
+{
+	struct rte_sched_queue_stats64 stats;
+	uint32_t qid = qos_sched_calc_qindex(qinfo, 0, pipe, tc, 0);
+	uint16_t qlen;
+
+	memset(&stats, 0, sizeof(stats));
+	rte_sched_queue_read_stats64(qinfo->dev_info.dpdk.shards->port[0],
+				     qid, &stats, &qlen);
+	return stats.n_pkts;
+}
+
+/*
+ * With classification on the forwarding cores, packets the forwarding
+ * cores did not flag, such as those sent by the master thread, are still
+ * classified by the transmit thread.  Flagged packets are enqueued as
+ * the forwarding core classified them.
+ *
+ * As in bench_classify the test has its own copy of the scheduler.
+ */
+DP_START_TEST(qos_basic_ipv4, classify_fwd_unflagged)
+{
+	struct sched_info *qinfo;
+	struct rte_mbuf *m, *out;
+	uint16_t max_pkt_len;
+	struct ifnet *ifp;
+	int len = 64;
+
+	qos_lib_test_setup();
+	dp_test_qos_attach_config_to_if("dp2T1", basic_pkt_classify_fwd_cmds,
+					false);
+
+	ifp = ifnet_byifname("dp2T1");
+	dp_test_fail_unless(ifp && ifp->if_qos && ifp->if_qos->classify_fwd,
+			    "no forwarding classification on dp2T1");
+
+	qinfo = malloc(sizeof(*qinfo));
+	dp_test_fail_unless(qinfo, "no memory for scheduler");
+	*qinfo = *ifp->if_qos;
+	qinfo->dev_info.dpdk.shards = NULL;
+
+	max_pkt_len = ifp->if_mtu_adjusted + VLAN_HDR_LEN +
+		RTE_MAX(qinfo->port_params.frame_overhead, 0);
+	dp_test_fail_unless(
+		qos_dpdk_start(ifp, qinfo, qinfo->port_params.rate,
+			       max_pkt_len) == 0,
+		"scheduler start failed");
+
+	/* Not flagged, so the transmit thread puts it in pipe 1 */
+	m = dp_test_create_ipv4_pak("1.1.1.11", "2.2.2.11", 1, &len);
+	dp_test_pktmbuf_eth_init(m, "aa:bb:cc:dd:2:b1", "aa:bb:cc:dd:1:a1",
+				 ETHER_TYPE_IPv4);
+	out = sharded_sched_one(ifp, qinfo, 0, m);
+	dp_test_fail_unless(out == m, "unflagged packet not sent");
+	dp_test_fail_unless(classify_fwd_qpkts(qinfo, 1, 3) == 1,
+			    "unflagged packet not classified to pipe 1");
+	dp_test_fail_unless(classify_fwd_qpkts(qinfo, 0, 3) == 0,
+			    "unflagged packet queued on pipe 0");
+	rte_pktmbuf_free(out);
+
+	/* Flagged, so the pipe the forwarding core wrote is kept */
+	m = dp_test_create_ipv4_pak("1.1.1.11", "2.2.2.11", 1, &len);
+	dp_test_pktmbuf_eth_init(m, "aa:bb:cc:dd:2:b1", "aa:bb:cc:dd:1:a1",
+				 ETHER_TYPE_IPv4);
+	rte_sched_port_pkt_write_v2(m, 0, 0, 3, 0, e_RTE_METER_GREEN, 0);
+	pktmbuf_mdata_set(m, PKT_MDATA_QOS_CLASSIFIED);
+	pktmbuf_mdata(m)->md_qos_gen = qinfo->gen;
+	out = sharded_sched_one(ifp, qinfo, 0, m);
+	dp_test_fail_unless(out == m, "flagged packet not sent");
+	dp_test_fail_unless(classify_fwd_qpkts(qinfo, 0, 3) == 1,
+			    "flagged packet reclassified");
+	dp_test_fail_unless(classify_fwd_qpkts(qinfo, 1, 3) == 0,
+			    "flagged packet queued on pipe 1");
+	rte_pktmbuf_free(out);
+
+	qos_dpdk_stop(ifp, qinfo);
+	synchronize_rcu();
+	free(qinfo);
+
+	dp_test_qos_delete_config_from_if("dp2T1", false);
+	qos_lib_test_teardown();
+} DP_END_TEST;
+
+/*
+ * classify_fwd_reconfig_cmds is basic_pkt_classify_fwd_cmds with a single
+ * pipe, so no pipe 1.
+ */
+const char *classify_fwd_reconfig_cmds[] = {
+	"port subports 1 pipes 1 profiles 1 overhead 24 classify forwarding",
+	"subport 0 rate 1250000000 size 5000000 period 40",
+	"subport 0 queue 0 rate 1250000000 size 5000000",
+	"subport 0 queue 1 rate 1250000000 size 5000000",
+	"subport 0 queue 2 rate 1250000000 size 5000000",
+	"subport 0 queue 3 rate 1250000000 size 5000000",
+	"vlan 0 0",
+	"profile 0 rate 1250000 size 5000 period 10",
+	"profile 0 queue 0 rate 1250000 size 5000",
+	"profile 0 queue 1 rate 1250000 size 5000",
+	"profile 0 queue 2 rate 1250000 size 5000",
+	"profile 0 queue 3 rate 1250000 size 5000",
+	"pipe 0 0 0",
+	"enable"
+};
+
+/*
+ * A packet classified by a forwarding core can still be on its way to
+ * the transmit thread when the port is reconfigured.  The subport and
+ * pipe it carries are then from the old configuration, so the transmit
+ * thread classifies it again rather than enqueue it to a pipe that no
+ * longer exists.
+ */
+DP_START_TEST(qos_basic_ipv4, classify_fwd_reconfig)
+{
+	struct sched_info *qinfo;
+	struct rte_mbuf *m, *out;
+	uint16_t max_pkt_len;
+	struct ifnet *ifp;
+	int len = 64;
+
+	qos_lib_test_setup();
+	dp_test_qos_attach_config_to_if("dp2T1", basic_pkt_classify_fwd_cmds,
+					false);
+
+	ifp = ifnet_byifname("dp2T1");
+	dp_test_fail_unless(ifp && ifp->if_qos && ifp->if_qos->classify_fwd,
+			    "no forwarding classification on dp2T1");
+
+	/* Classified to pipe 1 on the forwarding core */
+	m = dp_test_create_ipv4_pak("1.1.1.11", "2.2.2.11", 1, &len);
+	dp_test_pktmbuf_eth_init(m, "aa:bb:cc:dd:2:b1", "aa:bb:cc:dd:1:a1",
+				 ETHER_TYPE_IPv4);
+	dp_test_fail_unless(qos_classify_fwd(ifp, ifp->if_qos, &m),
+			    "packet dropped by classification");
+
+	/* Now only pipe 0 */
+	dp_test_qos_attach_config_to_if("dp2T1", classify_fwd_reconfig_cmds,
+					false);
+	dp_test_fail_unless(ifp->if_qos && ifp->if_qos->n_pipes == 1,
+			    "dp2T1 not reconfigured");
+
+	qinfo = malloc(sizeof(*qinfo));
+	dp_test_fail_unless(qinfo, "no memory for scheduler");
+	*qinfo = *ifp->if_qos;
+	qinfo->dev_info.dpdk.shards = NULL;
+
+	max_pkt_len = ifp->if_mtu_adjusted + VLAN_HDR_LEN +
+		RTE_MAX(qinfo->port_params.frame_overhead, 0);
+	dp_test_fail_unless(
+		qos_dpdk_start(ifp, qinfo, qinfo->port_params.rate,
+			       max_pkt_len) == 0,
+		"scheduler start failed");
+
+	out = sharded_sched_one(ifp, qinfo, 0, m);
+	dp_test_fail_unless(out == m, "reclassified packet not sent");
+	dp_test_fail_unless(classify_fwd_qpkts(qinfo, 0, 3) == 1,
+			    "packet not reclassified to pipe 0");
+	dp_test_fail_unless(classify_fwd_qpkts(qinfo, 1, 3) == 0,
+			    "packet queued on the old pipe 1");
+	rte_pktmbuf_free(out);
+
+	qos_dpdk_stop(ifp, qinfo);
+	synchronize_rcu();
+	free(qinfo);
+
+	dp_test_qos_delete_config_from_if("dp2T1", false);
+	qos_lib_test_teardown();
+} DP_END_TEST;
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2019, AT&T Intellectual Property.  All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ *
+ * Route lookups from the control threads while a batch of route changes
+ * is open.  The forwarding table is only updated at the end of the batch,
+ * but ARP, nexthop interface and local address resolution, and "route
+ * show", must see changes made earlier in the batch.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/rtnetlink.h>
+#include <rte_common.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "if_var.h"
+#include "json_writer.h"
+#include "route.h"
+#include "urcu.h"
+#include "util.h"
+#include "vrf.h"
+
+#include "dp_test.h"
+#include "dp_test_controller.h"
+#include "dp_test_lib.h"
+#include "dp_test_lib_intf.h"
+#include "dp_test_macros.h"
+
+#define DPT_BATCH_NET	"10.73.0.0"
+#define DPT_BATCH_ADDR	"10.73.1.1"
+#define DPT_BATCH_LOCAL	"10.73.255.1"
+#define DPT_BATCH_GW	"1.1.1.2"
+
+/* What the lookups saw during and after the batch */
+static struct {
+	bool	done;
+	int	rc;		/* route add or delete failed */
+	bool	fwd;		/* forwarding lookup during the batch */
+	bool	nhif;		/* nexthop interface lookup */
+	bool	local;		/* local address, control lookup */
+	bool	local_fwd;	/* local address, forwarding lookup */
+	bool	show;		/* route show */
+	bool	fwd_after;	/* forwarding lookup after the batch */
+} dpt_batch;
+
+static in_addr_t
+dpt_batch_addr(const char *str)
+{
+	struct in_addr in;
+
+	inet_pton(AF_INET, str, &in);
+	return in.s_addr;
+}
+
+/* Does the forwarding table give the gateway route for the address */
+static bool
+dpt_batch_fwd(struct vrf *vrf)
+{
+	struct next_hop *nh;
+
+	nh = rt_lookup_fast(vrf, dpt_batch_addr(DPT_BATCH_ADDR),
+			    RT_TABLE_MAIN, NULL);
+	return nh && nh->gateway == dpt_batch_addr(DPT_BATCH_GW);
+}
+
+/* Does "route show" give the gateway route for the address */
+static bool
+dpt_batch_show(struct vrf *vrf)
+{
+	struct in_addr in = { .s_addr = dpt_batch_addr(DPT_BATCH_ADDR) };
+	json_writer_t *json;
+	char *buf = NULL;
+	size_t len;
+	bool found;
+	FILE *f;
+
+	f = open_memstream(&buf, &len);
+	if (!f)
+		return false;
+	json = jsonw_new(f);
+	rt_show(&vrf->v_rt4_head, json, RT_TABLE_MAIN, &in);
+	jsonw_destroy(&json);
+	fclose(f);
+
+	found = strstr(buf, DPT_BATCH_GW) && !strstr(buf, "nomatch");
+	free(buf);
+	return found;
+}
+
+static int
+dpt_batch_change(bool add)
+{
+	in_addr_t net = dpt_batch_addr(DPT_BATCH_NET);
+	in_addr_t local = dpt_batch_addr(DPT_BATCH_LOCAL);
+	char realname[IFNAMSIZ];
+	struct next_hop *nh;
+	struct ifnet *ifp;
+	int rc;
+
+	if (!add) {
+		rc = rt_delete(VRF_DEFAULT_ID, net, 16, RT_TABLE_MAIN,
+			       RT_SCOPE_UNIVERSE);
+		if (rc < 0)
+			return rc;
+		return rt_delete(VRF_DEFAULT_ID, local, 32, RT_TABLE_MAIN,
+				 RT_SCOPE_HOST);
+	}
+
+	dp_test_intf_real("dp1T0", realname);
+	ifp = ifnet_byifname(realname);
+	if (!ifp)
+		return -ENODEV;
+
+	nh = nexthop_create(ifp, dpt_batch_addr(DPT_BATCH_GW), RTF_GATEWAY,
+			    0, NULL);
+	if (!nh)
+		return -ENOMEM;
+	rc = rt_insert(VRF_DEFAULT_ID, net, 16, RT_TABLE_MAIN,
+		       RT_SCOPE_UNIVERSE, RTPROT_STATIC, nh, 1, false);
+	free(nh);
+	if (rc < 0)
+		return rc;
+
+	nh = nexthop_create(NULL, 0, RTF_LOCAL, 0, NULL);
+	if (!nh)
+		return -ENOMEM;
+	rc = rt_insert(VRF_DEFAULT_ID, local, 32, RT_TABLE_MAIN,
+		       RT_SCOPE_HOST, RTPROT_KERNEL, nh, 1, false);
+	free(nh);
+	return rc;
+}
+
+/*
+ * rt-batch-ut <ADD|DELETE>
+ * Runs on the master thread: make the change in a batch, as the route
+ * broker does, and record what the lookups see before it ends.  The end
+ * of the batch waits for a grace period, so not in the RCU read lock.
+ */
+static int
+dpt_batch_cmd(FILE *f __rte_unused, int argc, char **argv)
+{
+	struct vrf *vrf = get_vrf(VRF_DEFAULT_ID);
+	in_addr_t addr = dpt_batch_addr(DPT_BATCH_ADDR);
+	in_addr_t local = dpt_batch_addr(DPT_BATCH_LOCAL);
+	bool connected;
+
+	if (argc < 2 || !vrf)
+		return -1;
+
+	rcu_read_unlock();
+	rt_batch_begin();
+	dpt_batch.rc = dpt_batch_change(!strcmp(argv[1], "ADD"));
+	dpt_batch.fwd = dpt_batch_fwd(vrf);
+	dpt_batch.nhif = nhif_dst_lookup(vrf, addr, &connected) != NULL;
+	dpt_batch.local = is_local_ipv4_ctrl(VRF_DEFAULT_ID, local);
+	dpt_batch.local_fwd = is_local_ipv4(VRF_DEFAULT_ID, local);
+	dpt_batch.show = dpt_batch_show(vrf);
+	rt_batch_end();
+
+	rcu_read_lock();
+
+	dpt_batch.fwd_after = dpt_batch_fwd(vrf);
+	CMM_STORE_SHARED(dpt_batch.done, true);
+	return 0;
+}
+
+static void
+dpt_batch_run(const char *op)
+{
+	int timeout = USEC_PER_SEC;
+
+	memset(&dpt_batch, 0, sizeof(dpt_batch));
+	dp_test_send_config_src(dp_test_cont_src_get(), "rt-batch-ut %s", op);
+	while (!CMM_LOAD_SHARED(dpt_batch.done) && --timeout)
+		usleep(1);
+	dp_test_fail_unless(dpt_batch.done, "rt-batch-ut %s not run", op);
+	dp_test_fail_unless(dpt_batch.rc >= 0, "rt-batch-ut %s failed: %d",
+			    op, dpt_batch.rc);
+}
+
+DP_DECL_TEST_SUITE(route_batch);
+
+DP_DECL_TEST_CASE(route_batch, route_batch_ctrl, NULL, NULL);
+
+DP_START_TEST(route_batch_ctrl, resolve)
+{
+	cmd_rt_batch_ut_set(dpt_batch_cmd);
+
+	/* Added routes resolve in the batch, and forward after it */
+	dpt_batch_run("ADD");
+	dp_test_fail_unless(!dpt_batch.fwd,
+			    "route forwarded before the batch ended");
+	dp_test_fail_unless(dpt_batch.nhif,
+			    "no nexthop interface for added route");
+	dp_test_fail_unless(dpt_batch.local,
+			    "added local address not local");
+	dp_test_fail_unless(!dpt_batch.local_fwd,
+			    "local address forwarded before the batch ended");
+	dp_test_fail_unless(dpt_batch.show, "added route not shown");
+	dp_test_fail_unless(dpt_batch.fwd_after,
+			    "route not forwarded after the batch");
+
+	/* Deleted routes are gone in the batch, but forward until it ends */
+	dpt_batch_run("DELETE");
+	dp_test_fail_unless(dpt_batch.fwd,
+			    "route removed before the batch ended");
+	dp_test_fail_unless(!dpt_batch.nhif,
+			    "nexthop interface for deleted route");
+	dp_test_fail_unless(!dpt_batch.local,
+			    "deleted local address still local");
+	dp_test_fail_unless(dpt_batch.local_fwd,
+			    "local address removed before the batch ended");
+	dp_test_fail_unless(!dpt_batch.show, "deleted route still shown");
+	dp_test_fail_unless(!dpt_batch.fwd_after,
+			    "route still forwarded after the batch");
+
+	cmd_rt_batch_ut_set(NULL);
+} DP_END_TEST;
@@ -11,6 +11,7 @@
  */
 
 #include <libmnl/libmnl.h>
+#include <limits.h>
 #include <linux/random.h>
 #include <netinet/in.h>
 #include <time.h>
@@ -1156,3 +1157,166 @@ DP_START_TEST(session_link_walk, test18)
 
 	dp_test_netlink_del_vrf(69, 0);
 } DP_END_TEST;
+
+/*
+ * Test many sessions spread over the sentry table shards, and that
+ * the per-lcore slot caches do not show up in the used count.
+ */
+DP_DECL_TEST_CASE(session_suite, session_many, NULL, NULL);
+DP_START_TEST(session_many, test19)
+{
+	struct rte_mbuf *m;
+	struct session_counts sc = { 0 };
+	struct session *s1, *s2;
+	const struct ifnet *ifp;
+	char realname[IFNAMSIZ];
+	unsigned long sen, se;
+	uint32_t used, max;
+	unsigned int i;
+	bool created;
+	bool forw;
+	int len = 22;
+	int rc;
+
+	dp_test_netlink_add_vrf(69, 1);
+
+	dp_test_nl_add_ip_addr_and_connected_vrf(IF_NAME, "1.1.1.1/24", 69);
+	dp_test_intf_real(IF_NAME, realname);
+	ifp = ifnet_byifname(realname);
+
+	for (i = 0; i < 300; i++) {
+		m = dp_test_create_udp_ipv4_pak("10.73.0.0", "10.73.2.0",
+				1000 + i, 2000, 1, &len);
+		dp_test_session_establish(m, ifp, 10, &s1, &created);
+		dp_test_fail_unless(created, "session %u not created\n", i);
+		rte_pktmbuf_free(m);
+	}
+
+	session_table_counts(&sen, &se);
+	dp_test_fail_unless(sen == 600 && se == 300,
+			"session many: bad counts: sen: %lu se: %lu\n",
+			sen, se);
+
+	session_counts(&used, &max, &sc);
+	dp_test_fail_unless(used == 300, "session many: used %u\n", used);
+
+	for (i = 0; i < 300; i++) {
+		m = dp_test_create_udp_ipv4_pak("10.73.2.0", "10.73.0.0",
+				2000, 1000 + i, 1, &len);
+		rc = dp_test_session_lookup(m, ifp->if_index, &s2, &forw);
+		dp_test_fail_unless(rc == 0 && !forw,
+				"session many: reverse lookup %u: %d\n", i, rc);
+		rte_pktmbuf_free(m);
+	}
+
+	dp_test_session_reset();
+
+	session_counts(&used, &max, &sc);
+	dp_test_fail_unless(used == 0, "session many: used %u\n", used);
+
+	dp_test_nl_del_ip_addr_and_connected_vrf(IF_NAME, "1.1.1.1/24", 69);
+
+	dp_test_netlink_del_vrf(69, 0);
+} DP_END_TEST;
+
+/*
+ * Step the GC timing wheel.  Sessions are handed to the GC when created,
+ * are looked at again a quarter of their timeout later, and expire once
+ * idle for longer than their timeout.  Sessions left over when a run is
+ * out of budget are carried over to the next run.
+ */
+DP_DECL_TEST_CASE(session_suite, session_gc_wheel, NULL, NULL);
+DP_START_TEST(session_gc_wheel, test20)
+{
+	struct rte_mbuf *m;
+	struct session *s;
+	const struct ifnet *ifp;
+	char realname[IFNAMSIZ];
+	unsigned long sen, se;
+	unsigned int i, n;
+	uint64_t uptime;
+	bool created;
+	int len = 22;
+
+	dp_test_netlink_add_vrf(69, 1);
+
+	dp_test_nl_add_ip_addr_and_connected_vrf(IF_NAME, "1.1.1.1/24", 69);
+	dp_test_intf_real(IF_NAME, realname);
+	ifp = ifnet_byifname(realname);
+
+	/* Stop the GC timer, so only the steps below run the GC */
+	session_gc_step(get_dp_uptime(), 0);
+
+	/* One session with a 10 second timeout */
+	m = dp_test_create_udp_ipv4_pak("10.73.0.0", "10.73.2.0",
+			1000, 2000, 1, &len);
+	dp_test_session_establish(m, ifp, 10, &s, &created);
+	rte_pktmbuf_free(m);
+
+	/* Picked up from the queue, and idle from now */
+	uptime = get_dp_uptime();
+	n = session_gc_step(uptime, UINT_MAX);
+	dp_test_fail_unless(n == 1, "session gc wheel: inspected %u\n", n);
+
+	/* Still there at its timeout, gone a second later */
+	session_gc_step(uptime + 10, UINT_MAX);
+	session_table_counts(&sen, &se);
+	dp_test_fail_unless(sen == 2 && se == 1,
+			"session gc wheel: bad counts: sen: %lu se: %lu\n",
+			sen, se);
+
+	session_gc_step(uptime + 11, UINT_MAX);
+	session_table_counts(&sen, &se);
+	dp_test_fail_unless(sen == 0 && se == 0,
+			"session gc wheel: not expired: sen: %lu se: %lu\n",
+			sen, se);
+
+	/* Ten sessions with an 8 second timeout */
+	for (i = 0; i < 10; i++) {
+		m = dp_test_create_udp_ipv4_pak("10.73.0.0", "10.73.2.0",
+				1000 + i, 2000, 1, &len);
+		dp_test_session_establish(m, ifp, 8, &s, &created);
+		rte_pktmbuf_free(m);
+	}
+
+	/* The queue is drained 4 at a time */
+	uptime = get_dp_uptime();
+	n = session_gc_step(uptime, 4);
+	n += session_gc_step(uptime, 4);
+	dp_test_fail_unless(n == 8, "session gc wheel: drained %u\n", n);
+	n = session_gc_step(uptime, 4);
+	dp_test_fail_unless(n == 2, "session gc wheel: drained %u\n", n);
+
+	/* All are due after 2 seconds, 3 are inspected per run */
+	for (i = 0; i < 3; i++) {
+		n = session_gc_step(uptime + 2, 3);
+		dp_test_fail_unless(n == 3,
+				"session gc wheel: run %u inspected %u\n",
+				i, n);
+	}
+	n = session_gc_step(uptime + 2, 3);
+	dp_test_fail_unless(n == 1, "session gc wheel: inspected %u\n", n);
+	n = session_gc_step(uptime + 2, 3);
+	dp_test_fail_unless(n == 0, "session gc wheel: inspected %u\n", n);
+
+	session_table_counts(&sen, &se);
+	dp_test_fail_unless(sen == 20 && se == 10,
+			"session gc wheel: bad counts: sen: %lu se: %lu\n",
+			sen, se);
+
+	/* Each is inspected once when due and once more when expired */
+	n = session_gc_step(uptime + 9, UINT_MAX);
+	dp_test_fail_unless(n == 20, "session gc wheel: inspected %u\n", n);
+
+	session_table_counts(&sen, &se);
+	dp_test_fail_unless(sen == 0 && se == 0,
+			"session gc wheel: not expired: sen: %lu se: %lu\n",
+			sen, se);
+
+	session_gc_resume();
+	dp_test_session_reset();
+
+	dp_test_nl_del_ip_addr_and_connected_vrf(IF_NAME, "1.1.1.1/24", 69);
+
+	dp_test_netlink_del_vrf(69, 0);
+} DP_END_TEST;
@@ -26,29 +26,12 @@
 #include "commands.h"
 #include "dp_test_lib.h"
 #include "dp_test_lib_intf.h"
-#include "capture.h"
 
 #include "dp_test.h"
 
 int spath_pipefd[2] = {0};
 int shadow_pipefd[DATAPLANE_MAX_PORTS] = {0};
 
-void
-capture_burst(const struct ifnet *ifp, struct rte_mbuf *pkts[], unsigned int n)
-{
-	return;
-}
-
-void capture_cancel(struct ifnet *ifp)
-{
-	return;
-}
-
-int cmd_capture(FILE *f, int argc, char **argv)
-{
-	return 0;
-}
-
 int slowpath_init(void)
 {
 	if (pipe(spath_pipefd) == -1)
@@ -58,11 +41,6 @@ int slowpath_init(void)
 	return spath_pipefd[0];
 }
 
-void capture_init(uint16_t mbuf_sz)
-{
-	return;
-}
-
 int
 rtnl_process_team(const struct nlmsghdr *nlh, void *data __unused)
 {